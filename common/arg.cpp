@@ -6,6 +6,7 @@
 #include "json-schema-to-grammar.h"
 #include "log.h"
 #include "sampling.h"
+#include "vector-index.h"
 
 // fix problem with std::min and std::max
 #if defined(_WIN32)
@@ -1573,6 +1574,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.sampling.no_perf = true;
         }
     ).set_env("LLAMA_ARG_NO_PERF"));
+    add_opt(common_arg(
+        {"--trace"}, "FNAME",
+        "record a trace of the graph execution and write it to FNAME on exit, in the Chrome trace format (default: disabled)",
+        [](common_params & params, const std::string & value) {
+            params.trace_file = value;
+        }
+    ).set_env("LLAMA_ARG_TRACE"));
     add_opt(common_arg(
         {"-f", "--file"}, "FNAME",
         "a file containing the prompt (default: none)",
@@ -2342,6 +2350,22 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.use_mlock = true;
         }
     ).set_env("LLAMA_ARG_MLOCK"));
+    add_opt(common_arg(
+        {"--prefetch"},
+        "prefetch the weights of the next layers in the background while a layer is computed, for memory-mapped models larger than the RAM",
+        [](common_params & params) {
+            params.weight_prefetch = true;
+        }
+    ).set_env("LLAMA_ARG_PREFETCH"));
+    add_opt(common_arg(
+        {"--hugepages"},
+        "allocate the CPU weights and KV cache with huge pages to reduce the TLB misses\n"
+        "uses the hugetlb pool if it has enough pages, otherwise transparent huge pages\n"
+        "the weights in the CPU buffers are copied from the model file instead of being memory-mapped",
+        [](common_params & params) {
+            params.use_hugepages = true;
+        }
+    ).set_env("LLAMA_ARG_HUGEPAGES"));
     add_opt(common_arg(
         {"--no-mmap"},
         "do not memory-map model (slower load but may reduce pageouts if not using mlock)",
@@ -2435,6 +2459,17 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             }
         }
     ).set_env("LLAMA_ARG_N_CPU_MOE"));
+    add_opt(common_arg(
+        {"--expert-cache"}, "N",
+        string_format("keep the most used Mixture of Experts (MoE) weights in host memory resident, up to N MiB\n"
+            "the experts are ranked from the routing observed at runtime (default: %d, 0 = disabled)", params.expert_cache_mib),
+        [](common_params & params, int value) {
+            if (value < 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.expert_cache_mib = value;
+        }
+    ).set_env("LLAMA_ARG_EXPERT_CACHE"));
     add_opt(common_arg(
         {"--cpu-moe-draft", "-cmoed"},
         "keep all Mixture of Experts (MoE) weights in the CPU for the draft model",
@@ -2686,6 +2721,25 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.chunk_separator = value;
         }
     ).set_examples({LLAMA_EXAMPLE_RETRIEVAL}));
+    add_opt(common_arg(
+        {"--index-type"}, "{f32,i8,binary}",
+        string_format("storage type of the embeddings in the vector index (default: %s)", params.index_type.c_str()),
+        [](common_params & params, const std::string & value) {
+            common_vector_index_type type;
+            if (!common_vector_index_type_from_name(value, type)) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.index_type = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_RETRIEVAL, LLAMA_EXAMPLE_SERVER}));
+    add_opt(common_arg(
+        {"--index-file"}, "FNAME",
+        "vector index file: an existing file is memory-mapped (read-only in llama-server),\n"
+        "otherwise the index is built and saved to it",
+        [](common_params & params, const std::string & value) {
+            params.index_file = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_RETRIEVAL, LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"--junk"}, "N",
         string_format("number of times to repeat the junk text (default: %d)", params.n_junk),
@@ -2937,6 +2991,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.n_threads_http = value;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_THREADS_HTTP"));
+    add_opt(common_arg(
+        {"--stream-flush-ms"}, "N",
+        string_format("interval in milliseconds during which the tokens of a stream are written together, 0 writes the tokens as soon as they are available (default: %d)", params.stream_flush_ms),
+        [](common_params & params, int value) {
+            params.stream_flush_ms = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_STREAM_FLUSH_MS"));
     add_opt(common_arg(
         {"--cache-reuse"}, "N",
         string_format(
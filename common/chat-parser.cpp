@@ -3,6 +3,7 @@
 #include "log.h"
 #include "regex-partial.h"
 
+#include <algorithm>
 #include <optional>
 #include <stdexcept>
 #include <string>
@@ -10,18 +11,55 @@
 
 using json = nlohmann::ordered_json;
 
-common_chat_msg_parser::common_chat_msg_parser(const std::string & input, bool is_partial, const common_chat_syntax & syntax)
-    : input_(input), is_partial_(is_partial), syntax_(syntax)
+common_chat_msg_parser::common_chat_msg_parser(const std::string & input, bool is_partial, const common_chat_syntax & syntax, common_chat_msg_parser_state * state)
+    : input_(input), is_partial_(is_partial), syntax_(syntax), state_(state)
 {
     result_.role = "assistant";
 
-    while (true) {
+    if (state_) {
+        if (input.size() < state_->input.size() || input.compare(0, state_->input.size(), state_->input) != 0) {
+            *state_ = {};
+        }
+
+        // the healing marker of the previous parses can be kept if the appended text does not contain it
+        const auto & marker = state_->healing_marker;
+        if (!marker.empty() && input.find(marker, state_->input.size() >= marker.size() ? state_->input.size() - marker.size() + 1 : 0) == std::string::npos) {
+            healing_marker_ = marker;
+        }
+
+        state_->input = input;
+    }
+
+    while (healing_marker_.empty()) {
         std::string id = std::to_string(std::rand());
         if (input.find(id) == std::string::npos) {
             healing_marker_ = id;
-            break;
         }
     }
+
+    if (state_) {
+        state_->healing_marker = healing_marker_;
+    }
+}
+
+common_regex_match common_chat_msg_parser::search(const common_regex & regex, size_t from) {
+    if (!state_) {
+        return regex.search(input_, from);
+    }
+
+    // a match starting in the text that was searched would have been found, either fully or partially at its end
+    const auto key = std::make_pair(regex.str(), from);
+
+    size_t start = from;
+    if (auto it = state_->no_match.find(key); it != state_->no_match.end()) {
+        start = std::max(start, it->second);
+    }
+
+    auto m = regex.search(input_, start);
+    if (m.type == COMMON_REGEX_MATCH_TYPE_NONE) {
+        state_->no_match[key] = input_.size();
+    }
+    return m;
 }
 
 std::string common_chat_msg_parser::str(const common_string_range & rng) const {
@@ -181,7 +219,7 @@ std::string common_chat_msg_parser::consume_rest() {
 
 // Tries to find the regex, consumes it (pos right after it) and gives the prelude (right before it) and the groups to the callback.
 std::optional<common_chat_msg_parser::find_regex_result> common_chat_msg_parser::try_find_regex(const common_regex & regex, size_t from, bool add_prelude_to_content) {
-    auto m = regex.search(input_, from == std::string::npos ? pos_ : from);
+    auto m = search(regex, from == std::string::npos ? pos_ : from);
     if (m.type == COMMON_REGEX_MATCH_TYPE_NONE) {
         return std::nullopt;
     }
@@ -208,7 +246,7 @@ common_chat_msg_parser::find_regex_result common_chat_msg_parser::consume_regex(
 }
 
 std::optional<common_chat_msg_parser::find_regex_result> common_chat_msg_parser::try_consume_regex(const common_regex & regex) {
-    auto m = regex.search(input_, pos_);
+    auto m = search(regex, pos_);
     if (m.type == COMMON_REGEX_MATCH_TYPE_NONE) {
         return std::nullopt;
     }
@@ -231,15 +269,26 @@ std::optional<common_chat_msg_parser::find_regex_result> common_chat_msg_parser:
 }
 
 std::optional<common_json> common_chat_msg_parser::try_consume_json() {
+    if (state_) {
+        if (auto cached = state_->json.find(pos_); cached != state_->json.end()) {
+            pos_ = cached->second.end;
+            return cached->second.json;
+        }
+    }
     auto it = input_.cbegin() + pos_;
     const auto end = input_.cend();
     common_json result;
     if (!common_json_parse(it, end, healing_marker_, result)) {
         return std::nullopt;
     }
+    const auto begin = pos_;
     pos_ = std::distance(input_.cbegin(), it);
     if (result.healing_marker.marker.empty()) {
         // No healing marker, just return the parsed json
+        if (state_ && pos_ < input_.size()) {
+            // followed by more text, the value is complete (e.g. a number cannot grow anymore)
+            state_->json[begin] = { pos_, result };
+        }
         return result;
     }
     if (!is_partial()) {
@@ -6,8 +6,10 @@
 
 #include <nlohmann/json.hpp>
 
+#include <map>
 #include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 class common_chat_msg_partial_exception : public std::runtime_error {
@@ -15,17 +17,46 @@ class common_chat_msg_partial_exception : public std::runtime_error {
     common_chat_msg_partial_exception(const std::string & message) : std::runtime_error(message) {}
 };
 
+/*
+    Parse state kept between the parses of a streamed output, where the input of a parse starts with the input of the
+    previous parse.
+
+    A regex search that found nothing cannot find a match starting in the text it already searched, and a complete JSON
+    value followed by more text does not depend on the text appended after it. Both are remembered, so that a parse only
+    searches and parses the appended text instead of the whole input again.
+    If the input does not start with the previous input (e.g. a stop word was removed), the state is reset.
+*/
+struct common_chat_msg_parser_state {
+    std::string input; // input of the previous parse
+    std::string healing_marker;
+
+    // (regex, from) -> size of the input that was searched without finding a match
+    std::map<std::pair<std::string, size_t>, size_t> no_match;
+
+    struct json_value {
+        size_t      end;
+        common_json json;
+    };
+
+    // begin -> complete JSON value
+    std::map<size_t, json_value> json;
+};
+
 class common_chat_msg_parser {
     std::string input_;
     bool is_partial_;
     common_chat_syntax syntax_;
     std::string healing_marker_;
+    common_chat_msg_parser_state * state_;
 
     size_t pos_ = 0;
     common_chat_msg result_;
 
+    // regex.search, skipping the text that the previous parses already searched without finding a match
+    common_regex_match search(const common_regex & regex, size_t from);
+
   public:
-    common_chat_msg_parser(const std::string & input, bool is_partial, const common_chat_syntax & syntax);
+    common_chat_msg_parser(const std::string & input, bool is_partial, const common_chat_syntax & syntax, common_chat_msg_parser_state * state = nullptr);
     const std::string & input() const { return input_; }
     size_t pos() const { return pos_; }
     const std::string & healing_marker() const { return healing_marker_; }
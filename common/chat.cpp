@@ -2309,8 +2309,8 @@ static void common_chat_parse(common_chat_msg_parser & builder) {
     builder.finish();
 }
 
-common_chat_msg common_chat_parse(const std::string & input, bool is_partial, const common_chat_syntax & syntax) {
-    common_chat_msg_parser builder(input, is_partial, syntax);
+common_chat_msg common_chat_parse(const std::string & input, bool is_partial, const common_chat_syntax & syntax, common_chat_msg_parser_state * state) {
+    common_chat_msg_parser builder(input, is_partial, syntax, state);
     try {
         common_chat_parse(builder);
     } catch (const common_chat_msg_partial_exception & ex) {
@@ -2327,3 +2327,21 @@ common_chat_msg common_chat_parse(const std::string & input, bool is_partial, co
     }
     return msg;
 }
+
+common_chat_msg_stream_parser::common_chat_msg_stream_parser(const common_chat_syntax & syntax, const std::function<std::string()> & gen_tool_call_id)
+    : syntax_(syntax), gen_tool_call_id_(gen_tool_call_id), state_(std::make_unique<common_chat_msg_parser_state>()) {}
+
+common_chat_msg_stream_parser::~common_chat_msg_stream_parser() = default;
+
+std::vector<common_chat_msg_diff> common_chat_msg_stream_parser::update(const std::string & input, bool is_partial) {
+    auto new_msg = common_chat_parse(input, is_partial, syntax_, state_.get());
+    if (new_msg.empty()) {
+        return {};
+    }
+    if (gen_tool_call_id_) {
+        new_msg.ensure_tool_call_ids_set(tool_call_ids_, gen_tool_call_id_);
+    }
+    auto diffs = common_chat_msg_diff::compute_diffs(msg_, new_msg);
+    msg_ = std::move(new_msg);
+    return diffs;
+}
@@ -10,6 +10,7 @@
 #include <map>
 
 struct common_chat_templates;
+struct common_chat_msg_parser_state;
 
 struct common_chat_tool_call {
     std::string name;
@@ -193,7 +194,27 @@ std::string common_chat_format_example(
 const char*               common_chat_format_name(common_chat_format format);
 const char*               common_reasoning_format_name(common_reasoning_format format);
 common_reasoning_format   common_reasoning_format_from_name(const std::string & format);
-common_chat_msg           common_chat_parse(const std::string & input, bool is_partial, const common_chat_syntax & syntax);
+common_chat_msg           common_chat_parse(const std::string & input, bool is_partial, const common_chat_syntax & syntax, common_chat_msg_parser_state * state = nullptr);
+
+// Parses a streamed output incrementally: the input of each update starts with the input of the previous update,
+// and only the appended text is searched and parsed (see common_chat_msg_parser_state)
+class common_chat_msg_stream_parser {
+    common_chat_syntax syntax_;
+    std::function<std::string()> gen_tool_call_id_;
+    std::vector<std::string> tool_call_ids_;
+    std::unique_ptr<common_chat_msg_parser_state> state_;
+    common_chat_msg msg_;
+
+  public:
+    // tool calls without an id get one from gen_tool_call_id (if set)
+    common_chat_msg_stream_parser(const common_chat_syntax & syntax, const std::function<std::string()> & gen_tool_call_id = nullptr);
+    ~common_chat_msg_stream_parser();
+
+    // parses the input and returns the changes of the message since the previous update
+    std::vector<common_chat_msg_diff> update(const std::string & input, bool is_partial);
+
+    const common_chat_msg & msg() const { return msg_; }
+};
 
 common_chat_tool_choice common_chat_tool_choice_parse_oaicompat(const std::string & tool_choice);
 
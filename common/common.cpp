@@ -899,6 +899,10 @@ struct common_init_result common_init_from_params(common_params & params) {
     common_init_result iparams;
     auto mparams = common_model_params_to_llama(params);
 
+    if (!params.trace_file.empty()) {
+        ggml_trace_start(params.trace_file.c_str());
+    }
+
     llama_model * model = llama_model_load_from_file(params.model.path.c_str(), mparams);
     if (model == NULL) {
         LOG_ERR("%s: failed to load model '%s'\n", __func__, params.model.path.c_str());
@@ -1110,6 +1114,7 @@ struct llama_model_params common_model_params_to_llama(common_params & params) {
     mparams.use_mlock       = params.use_mlock;
     mparams.check_tensors   = params.check_tensors;
     mparams.use_extra_bufts = !params.no_extra_bufts;
+    mparams.use_hugepages   = params.use_hugepages;
 
     if (params.kv_overrides.empty()) {
         mparams.kv_overrides = NULL;
@@ -1150,6 +1155,7 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.yarn_beta_fast    = params.yarn_beta_fast;
     cparams.yarn_beta_slow    = params.yarn_beta_slow;
     cparams.yarn_orig_ctx     = params.yarn_orig_ctx;
+    cparams.expert_cache_mib  = params.expert_cache_mib;
     cparams.pooling_type      = params.pooling_type;
     cparams.attention_type    = params.attention_type;
     cparams.cb_eval           = params.cb_eval;
@@ -1160,6 +1166,7 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.op_offload        = !params.no_op_offload;
     cparams.swa_full          = params.swa_full;
     cparams.kv_unified        = params.kv_unified;
+    cparams.weight_prefetch   = params.weight_prefetch;
 
     cparams.type_k = params.cache_type_k;
     cparams.type_v = params.cache_type_v;
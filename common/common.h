@@ -288,6 +288,7 @@ struct common_params {
     float   yarn_beta_fast        = 32.0f; // YaRN low correction dim
     float   yarn_beta_slow        =  1.0f; // YaRN high correction dim
     int32_t yarn_orig_ctx         =     0; // YaRN original context length
+    int32_t expert_cache_mib      =     0; // keep the most used MoE experts resident, up to this size in MiB (0 = disabled)
 
     // offload params
     std::vector<ggml_backend_dev_t> devices; // devices to use for offloading
@@ -328,6 +329,7 @@ struct common_params {
     std::string lookup_cache_static  = ""; // path of static ngram cache file for lookup decoding           // NOLINT
     std::string lookup_cache_dynamic = ""; // path of dynamic ngram cache file for lookup decoding          // NOLINT
     std::string logits_file          = ""; // file for saving *all* logits                                  // NOLINT
+    std::string trace_file           = ""; // file for the Chrome trace of the graph execution               // NOLINT
 
     std::vector<std::string> in_files;   // all input files
     std::vector<std::string> antiprompt; // strings upon which more user input is prompted (a.k.a. reverse prompts)
@@ -381,6 +383,8 @@ struct common_params {
     bool input_prefix_bos  = false; // prefix BOS to user inputs, preceding input_prefix
     bool use_mmap          = true;  // use mmap for faster loads
     bool use_mlock         = false; // use mlock to keep model in memory
+    bool weight_prefetch   = false; // prefetch the memory mapped weights of the next layers during the compute
+    bool use_hugepages     = false; // allocate the CPU weights and KV cache with huge pages
     bool verbose_prompt    = false; // print prompt tokens before generation
     bool display_prompt    = true;  // print prompt before generation
     bool no_kv_offload     = false; // disable KV offloading
@@ -419,6 +423,7 @@ struct common_params {
     int32_t timeout_read      = 600;          // http read timeout in seconds
     int32_t timeout_write     = timeout_read; // http write timeout in seconds
     int32_t n_threads_http    = -1;           // number of threads to process HTTP requests (TODO: support threadpool)
+    int32_t stream_flush_ms   = 0;            // interval in ms during which the streamed tokens are written together
     int32_t n_cache_reuse     = 0;            // min chunk size to reuse from the cache via KV shifting
     int32_t n_swa_checkpoints = 3;            // max number of SWA checkpoints per slot
 
@@ -465,6 +470,9 @@ struct common_params {
 
     std::string chunk_separator = "\n"; // chunk separator for context embedding
 
+    std::string index_type = "f32"; // storage of the vector index (f32, i8, binary)
+    std::string index_file = "";    // path to a saved vector index (see common_vector_index)
+
     // passkey params
     int32_t n_junk = 250; // number of times to repeat the junk text
     int32_t i_pos  = -1;  // position of the passkey in the junk text
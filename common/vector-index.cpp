@@ -0,0 +1,650 @@
+#include "vector-index.h"
+
+#include "log.h"
+#include "llama.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#if !defined(_WIN32)
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#    include <immintrin.h>
+#    if defined(__GNUC__) || defined(__clang__)
+#        define VECTOR_INDEX_X86_DISPATCH
+#    endif
+#elif defined(__ARM_NEON)
+#    include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#endif
+
+//
+// kernels
+//
+
+static float vec_dot_f32_scalar(const float * a, const float * b, int n) {
+    float sum = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        sum += a[i]*b[i];
+    }
+    return sum;
+}
+
+static int32_t vec_dot_i8_scalar(const int8_t * a, const int8_t * b, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += (int32_t) a[i]*b[i];
+    }
+    return sum;
+}
+
+static int32_t vec_popcount_u64(uint64_t x) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    return (int32_t) __popcnt64(x);
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    int32_t n = 0;
+    for (; x; x &= x - 1) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+static int32_t vec_hamming_scalar(const uint64_t * a, const uint64_t * b, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += vec_popcount_u64(a[i] ^ b[i]);
+    }
+    return sum;
+}
+
+#if defined(VECTOR_INDEX_X86_DISPATCH)
+
+__attribute__((target("avx2,fma")))
+static float vec_dot_f32_avx2(const float * a, const float * b, int n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),     _mm256_loadu_ps(b + i),     acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    acc0 = _mm256_add_ps(acc0, acc1);
+
+    const __m128 r4 = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    const __m128 r2 = _mm_add_ps(r4, _mm_movehl_ps(r4, r4));
+    const __m128 r1 = _mm_add_ss(r2, _mm_movehdup_ps(r2));
+
+    float sum = _mm_cvtss_f32(r1);
+    for (; i < n; ++i) {
+        sum += a[i]*b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static int32_t vec_dot_i8_avx2(const int8_t * a, const int8_t * b, int n) {
+    __m256i acc = _mm256_setzero_si256();
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) (a + i)));
+        const __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) (b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+
+    const __m128i r4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    const __m128i r2 = _mm_add_epi32(r4, _mm_unpackhi_epi64(r4, r4));
+    const __m128i r1 = _mm_add_epi32(r2, _mm_shuffle_epi32(r2, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    int32_t sum = _mm_cvtsi128_si32(r1);
+    for (; i < n; ++i) {
+        sum += (int32_t) a[i]*b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("popcnt")))
+static int32_t vec_hamming_popcnt(const uint64_t * a, const uint64_t * b, int n) {
+    int32_t sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += __builtin_popcountll(a[i] ^ b[i]);
+    }
+    return sum;
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+static float vec_dot_f32_neon(const float * a, const float * b, int n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i),     vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i]*b[i];
+    }
+    return sum;
+}
+
+static int32_t vec_dot_i8_neon(const int8_t * a, const int8_t * b, int n) {
+    int32x4_t acc = vdupq_n_s32(0);
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const int8x16_t va = vld1q_s8(a + i);
+        const int8x16_t vb = vld1q_s8(b + i);
+#if defined(__ARM_FEATURE_DOTPROD)
+        acc = vdotq_s32(acc, va, vb);
+#else
+        const int16x8_t lo = vmull_s8(vget_low_s8(va), vget_low_s8(vb));
+        const int16x8_t hi = vmull_high_s8(va, vb);
+        acc = vpadalq_s16(acc, lo);
+        acc = vpadalq_s16(acc, hi);
+#endif
+    }
+
+    int32_t sum = vaddvq_s32(acc);
+    for (; i < n; ++i) {
+        sum += (int32_t) a[i]*b[i];
+    }
+    return sum;
+}
+
+static int32_t vec_hamming_neon(const uint64_t * a, const uint64_t * b, int n) {
+    uint32x4_t acc = vdupq_n_u32(0);
+
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        const uint8x16_t x = veorq_u8(vreinterpretq_u8_u64(vld1q_u64(a + i)), vreinterpretq_u8_u64(vld1q_u64(b + i)));
+        acc = vpadalq_u16(acc, vpaddlq_u8(vcntq_u8(x)));
+    }
+
+    int32_t sum = (int32_t) vaddvq_u32(acc);
+    for (; i < n; ++i) {
+        sum += vec_popcount_u64(a[i] ^ b[i]);
+    }
+    return sum;
+}
+
+#endif
+
+struct vec_kernels {
+    float   (*dot_f32)(const float *,    const float *,    int);
+    int32_t (*dot_i8) (const int8_t *,   const int8_t *,   int);
+    int32_t (*hamming)(const uint64_t *, const uint64_t *, int);
+};
+
+static vec_kernels vec_kernels_init() {
+    vec_kernels res = { vec_dot_f32_scalar, vec_dot_i8_scalar, vec_hamming_scalar };
+
+#if defined(VECTOR_INDEX_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        res.dot_f32 = vec_dot_f32_avx2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        res.dot_i8 = vec_dot_i8_avx2;
+    }
+    if (__builtin_cpu_supports("popcnt")) {
+        res.hamming = vec_hamming_popcnt;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    res.dot_f32 = vec_dot_f32_neon;
+    res.dot_i8  = vec_dot_i8_neon;
+    res.hamming = vec_hamming_neon;
+#endif
+
+    return res;
+}
+
+static const vec_kernels & vec_kernels_get() {
+    static const vec_kernels kernels = vec_kernels_init();
+    return kernels;
+}
+
+//
+// quantization
+//
+
+// rows are kept 8-byte aligned, so that the binary rows can be read as uint64_t
+static size_t vector_index_row_size(int32_t n_embd, common_vector_index_type type) {
+    switch (type) {
+        case COMMON_VECTOR_INDEX_TYPE_F32:    return ((size_t) n_embd*sizeof(float) + 7) & ~(size_t) 7;
+        case COMMON_VECTOR_INDEX_TYPE_I8:     return (sizeof(float) + (size_t) n_embd + 7) & ~(size_t) 7;
+        case COMMON_VECTOR_INDEX_TYPE_BINARY: return (((size_t) n_embd + 63)/64)*sizeof(uint64_t);
+    }
+    return 0;
+}
+
+// i8 row: [float scale][int8 q[n_embd]], x ~= scale*q
+static void vector_index_quantize_row(const float * x, uint8_t * row, int32_t n_embd, common_vector_index_type type) {
+    switch (type) {
+        case COMMON_VECTOR_INDEX_TYPE_F32:
+            {
+                memcpy(row, x, n_embd*sizeof(float));
+            } break;
+        case COMMON_VECTOR_INDEX_TYPE_I8:
+            {
+                float amax = 0.0f;
+                for (int32_t i = 0; i < n_embd; ++i) {
+                    amax = std::max(amax, std::fabs(x[i]));
+                }
+
+                const float d  = amax/127.0f;
+                const float id = d > 0.0f ? 1.0f/d : 0.0f;
+
+                memcpy(row, &d, sizeof(float));
+
+                int8_t * q = (int8_t *) (row + sizeof(float));
+                for (int32_t i = 0; i < n_embd; ++i) {
+                    q[i] = (int8_t) std::lround(x[i]*id);
+                }
+            } break;
+        case COMMON_VECTOR_INDEX_TYPE_BINARY:
+            {
+                uint64_t * bits = (uint64_t *) row;
+                for (int32_t i = 0; i < (n_embd + 63)/64; ++i) {
+                    bits[i] = 0;
+                }
+                for (int32_t i = 0; i < n_embd; ++i) {
+                    if (x[i] > 0.0f) {
+                        bits[i/64] |= (uint64_t) 1 << (i%64);
+                    }
+                }
+            } break;
+    }
+}
+
+static float vector_index_score(const uint8_t * q, const uint8_t * row, int32_t n_embd, common_vector_index_type type, const vec_kernels & k) {
+    switch (type) {
+        case COMMON_VECTOR_INDEX_TYPE_F32:
+            {
+                return k.dot_f32((const float *) q, (const float *) row, n_embd);
+            }
+        case COMMON_VECTOR_INDEX_TYPE_I8:
+            {
+                float dq;
+                float dr;
+                memcpy(&dq, q,   sizeof(float));
+                memcpy(&dr, row, sizeof(float));
+
+                return dq*dr*k.dot_i8((const int8_t *) (q + sizeof(float)), (const int8_t *) (row + sizeof(float)), n_embd);
+            }
+        case COMMON_VECTOR_INDEX_TYPE_BINARY:
+            {
+                const int32_t dist = k.hamming((const uint64_t *) q, (const uint64_t *) row, (n_embd + 63)/64);
+
+                return 1.0f - 2.0f*dist/n_embd;
+            }
+    }
+    return 0.0f;
+}
+
+//
+// file format
+//
+
+static const char   VECTOR_INDEX_MAGIC[4] = { 'l', 'v', 'i', 'x' };
+static const uint32_t VECTOR_INDEX_VERSION  = 2;
+
+struct vector_index_header {
+    char     magic[4];
+    uint32_t version;
+    uint32_t type;
+    int32_t  n_embd;
+    int64_t  n_rows;
+    uint64_t hash_model;
+    uint64_t hash_text;
+};
+
+static_assert(sizeof(vector_index_header) == 40, "unexpected vector_index_header size");
+
+//
+// hashes
+//
+
+// FNV-1a
+static const uint64_t VECTOR_INDEX_HASH_INIT = 0xcbf29ce484222325ULL;
+
+static uint64_t vector_index_hash(uint64_t h, const void * data, size_t size) {
+    const uint8_t * p = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t vector_index_hash_str(uint64_t h, const std::string & str) {
+    // length-prefixed so that the concatenation is unambiguous
+    const uint64_t n = str.size();
+    h = vector_index_hash(h, &n, sizeof(n));
+    return vector_index_hash(h, str.data(), str.size());
+}
+
+uint64_t common_vector_index_model_hash(const llama_context * ctx) {
+    const llama_model * model = llama_get_model(ctx);
+
+    char desc[256];
+    llama_model_desc(model, desc, sizeof(desc));
+
+    char name[256] = "";
+    llama_model_meta_val_str(model, "general.name", name, sizeof(name));
+
+    const uint64_t size     = llama_model_size(model);
+    const uint64_t n_params = llama_model_n_params(model);
+    const int32_t  n_embd   = llama_model_n_embd(model);
+    const int32_t  pooling  = llama_pooling_type(ctx);
+
+    uint64_t h = VECTOR_INDEX_HASH_INIT;
+    h = vector_index_hash_str(h, desc);
+    h = vector_index_hash_str(h, name);
+    h = vector_index_hash(h, &size,     sizeof(size));
+    h = vector_index_hash(h, &n_params, sizeof(n_params));
+    h = vector_index_hash(h, &n_embd,   sizeof(n_embd));
+    h = vector_index_hash(h, &pooling,  sizeof(pooling));
+
+    return h;
+}
+
+uint64_t common_vector_index_text_hash(const std::vector<std::string> & texts) {
+    uint64_t h = VECTOR_INDEX_HASH_INIT;
+    for (const auto & text : texts) {
+        h = vector_index_hash_str(h, text);
+    }
+    return h;
+}
+
+//
+// common_vector_index
+//
+
+const char * common_vector_index_type_name(common_vector_index_type type) {
+    switch (type) {
+        case COMMON_VECTOR_INDEX_TYPE_F32:    return "f32";
+        case COMMON_VECTOR_INDEX_TYPE_I8:     return "i8";
+        case COMMON_VECTOR_INDEX_TYPE_BINARY: return "binary";
+    }
+    return "unknown";
+}
+
+bool common_vector_index_type_from_name(const std::string & name, common_vector_index_type & type) {
+    for (auto t : { COMMON_VECTOR_INDEX_TYPE_F32, COMMON_VECTOR_INDEX_TYPE_I8, COMMON_VECTOR_INDEX_TYPE_BINARY }) {
+        if (name == common_vector_index_type_name(t)) {
+            type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct common_vector_index::impl {
+    int32_t                  n_embd;
+    common_vector_index_type type;
+    size_t                   row_size;
+    int64_t                  n_rows = 0;
+
+    uint64_t hash_model = 0;
+    uint64_t hash_text  = 0;
+
+    // owned rows - used when building the index or when mmap is not available
+    std::vector<uint8_t> buf;
+
+    // mapped file
+    void * addr   = nullptr;
+    size_t n_addr = 0;
+
+    const uint8_t * rows() const {
+        return addr ? (const uint8_t *) addr + sizeof(vector_index_header) : buf.data();
+    }
+
+    ~impl() {
+#if !defined(_WIN32)
+        if (addr) {
+            munmap(addr, n_addr);
+        }
+#endif
+    }
+};
+
+common_vector_index::common_vector_index(int32_t n_embd, common_vector_index_type type) : pimpl(new impl) {
+    pimpl->n_embd   = n_embd;
+    pimpl->type     = type;
+    pimpl->row_size = vector_index_row_size(n_embd, type);
+}
+
+common_vector_index::common_vector_index(std::unique_ptr<impl> && pimpl) : pimpl(std::move(pimpl)) {}
+
+common_vector_index::~common_vector_index() = default;
+
+int32_t common_vector_index::n_embd() const {
+    return pimpl->n_embd;
+}
+
+common_vector_index_type common_vector_index::type() const {
+    return pimpl->type;
+}
+
+int64_t common_vector_index::size() const {
+    return pimpl->n_rows;
+}
+
+size_t common_vector_index::row_size() const {
+    return pimpl->row_size;
+}
+
+uint64_t common_vector_index::hash_model() const {
+    return pimpl->hash_model;
+}
+
+uint64_t common_vector_index::hash_text() const {
+    return pimpl->hash_text;
+}
+
+void common_vector_index::set_hash(uint64_t hash_model, uint64_t hash_text) {
+    pimpl->hash_model = hash_model;
+    pimpl->hash_text  = hash_text;
+}
+
+int64_t common_vector_index::add(const float * embd) {
+    if (pimpl->addr) {
+        LOG_ERR("%s: cannot add vectors to a memory-mapped index\n", __func__);
+        return -1;
+    }
+
+    pimpl->buf.resize((pimpl->n_rows + 1)*pimpl->row_size, 0);
+
+    vector_index_quantize_row(embd, pimpl->buf.data() + pimpl->n_rows*pimpl->row_size, pimpl->n_embd, pimpl->type);
+
+    return pimpl->n_rows++;
+}
+
+std::vector<common_vector_index_result> common_vector_index::search(const float * query, int32_t top_k, int32_t n_threads) const {
+    const int64_t n_rows = pimpl->n_rows;
+
+    top_k     = (int32_t) std::min<int64_t>(top_k, n_rows);
+    n_threads = (int32_t) std::max<int64_t>(1, std::min<int64_t>(n_threads, n_rows/1024));
+
+    if (top_k <= 0) {
+        return {};
+    }
+
+    // the query is quantized the same way as the rows
+    std::vector<uint8_t> q(pimpl->row_size, 0);
+    vector_index_quantize_row(query, q.data(), pimpl->n_embd, pimpl->type);
+
+    const auto & k = vec_kernels_get();
+
+    // min-heap on the score, so the worst of the current top-k is at the front
+    const auto cmp = [](const common_vector_index_result & a, const common_vector_index_result & b) {
+        return a.score > b.score;
+    };
+
+    std::vector<std::vector<common_vector_index_result>> heaps(n_threads);
+
+    const auto worker = [&](int ith) {
+        auto & heap = heaps[ith];
+        heap.reserve(top_k + 1);
+
+        const int64_t i0 = (n_rows*ith)/n_threads;
+        const int64_t i1 = (n_rows*(ith + 1))/n_threads;
+
+        const uint8_t * rows = pimpl->rows();
+
+        for (int64_t i = i0; i < i1; ++i) {
+            const float score = vector_index_score(q.data(), rows + i*pimpl->row_size, pimpl->n_embd, pimpl->type, k);
+
+            if ((int32_t) heap.size() < top_k) {
+                heap.push_back({ i, score });
+                std::push_heap(heap.begin(), heap.end(), cmp);
+            } else if (score > heap.front().score) {
+                std::pop_heap(heap.begin(), heap.end(), cmp);
+                heap.back() = { i, score };
+                std::push_heap(heap.begin(), heap.end(), cmp);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int ith = 1; ith < n_threads; ++ith) {
+        workers.emplace_back(worker, ith);
+    }
+    worker(0);
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    std::vector<common_vector_index_result> res;
+    for (const auto & heap : heaps) {
+        res.insert(res.end(), heap.begin(), heap.end());
+    }
+
+    // ties are broken by id to keep the results deterministic
+    std::sort(res.begin(), res.end(), [](const common_vector_index_result & a, const common_vector_index_result & b) {
+        return a.score > b.score || (a.score == b.score && a.id < b.id);
+    });
+    res.resize(top_k);
+
+    return res;
+}
+
+bool common_vector_index::save(const std::string & fname) const {
+    FILE * f = fopen(fname.c_str(), "wb");
+    if (!f) {
+        LOG_ERR("%s: failed to open '%s' for writing\n", __func__, fname.c_str());
+        return false;
+    }
+
+    vector_index_header hdr = {};
+    memcpy(hdr.magic, VECTOR_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = VECTOR_INDEX_VERSION;
+    hdr.type    = (uint32_t) pimpl->type;
+    hdr.n_embd  = pimpl->n_embd;
+    hdr.n_rows  = pimpl->n_rows;
+
+    hdr.hash_model = pimpl->hash_model;
+    hdr.hash_text  = pimpl->hash_text;
+
+    const size_t n_data = pimpl->n_rows*pimpl->row_size;
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    if (ok && n_data > 0) {
+        ok = fwrite(pimpl->rows(), n_data, 1, f) == 1;
+    }
+
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        LOG_ERR("%s: failed to write '%s'\n", __func__, fname.c_str());
+    }
+
+    return ok;
+}
+
+std::unique_ptr<common_vector_index> common_vector_index::load(const std::string & fname) {
+    FILE * f = fopen(fname.c_str(), "rb");
+    if (!f) {
+        LOG_ERR("%s: failed to open '%s'\n", __func__, fname.c_str());
+        return nullptr;
+    }
+
+    vector_index_header hdr;
+    const bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1;
+    if (!ok || memcmp(hdr.magic, VECTOR_INDEX_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != VECTOR_INDEX_VERSION ||
+        hdr.type > COMMON_VECTOR_INDEX_TYPE_BINARY || hdr.n_embd <= 0 || hdr.n_rows < 0) {
+        LOG_ERR("%s: '%s' is not a valid vector index file\n", __func__, fname.c_str());
+        fclose(f);
+        return nullptr;
+    }
+
+    std::unique_ptr<impl> pimpl(new impl);
+    pimpl->n_embd   = hdr.n_embd;
+    pimpl->type     = (common_vector_index_type) hdr.type;
+    pimpl->row_size = vector_index_row_size(hdr.n_embd, pimpl->type);
+    pimpl->n_rows   = hdr.n_rows;
+
+    pimpl->hash_model = hdr.hash_model;
+    pimpl->hash_text  = hdr.hash_text;
+
+    // n_rows comes from the file, so check the size of the data before computing it
+    if ((uint64_t) pimpl->n_rows > (SIZE_MAX - sizeof(hdr))/pimpl->row_size) {
+        LOG_ERR("%s: '%s' is not a valid vector index file\n", __func__, fname.c_str());
+        fclose(f);
+        return nullptr;
+    }
+
+    const size_t n_data = pimpl->n_rows*pimpl->row_size;
+
+#if !defined(_WIN32)
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || (uint64_t) st.st_size < sizeof(hdr) ||
+        (uint64_t) pimpl->n_rows > ((uint64_t) st.st_size - sizeof(hdr))/pimpl->row_size) {
+        LOG_ERR("%s: '%s' is truncated\n", __func__, fname.c_str());
+        fclose(f);
+        return nullptr;
+    }
+
+    if (n_data > 0) {
+        pimpl->n_addr = sizeof(hdr) + n_data;
+        pimpl->addr   = mmap(nullptr, pimpl->n_addr, PROT_READ, MAP_SHARED, fileno(f), 0);
+        if (pimpl->addr == MAP_FAILED) {
+            // fall back to reading the file
+            pimpl->addr = nullptr;
+        } else {
+            // the scan is sequential
+            posix_madvise(pimpl->addr, pimpl->n_addr, POSIX_MADV_SEQUENTIAL);
+        }
+    }
+#endif
+
+    if (!pimpl->addr && n_data > 0) {
+        pimpl->buf.resize(n_data);
+        if (fread(pimpl->buf.data(), n_data, 1, f) != 1) {
+            LOG_ERR("%s: '%s' is truncated\n", __func__, fname.c_str());
+            fclose(f);
+            return nullptr;
+        }
+    }
+
+    fclose(f);
+
+    return std::unique_ptr<common_vector_index>(new common_vector_index(std::move(pimpl)));
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Flat (brute-force) in-process vector index for embeddings
+//
+// The vectors are stored quantized and scanned with SIMD kernels:
+//   - f32:    exact dot products
+//   - i8:     one int8 per dimension + one float scale per vector, int8 dot products
+//   - binary: one sign bit per dimension, similarity derived from the hamming distance
+//
+// The vectors are expected to be L2-normalized (see common_embd_normalize), so that the dot product is the cosine similarity.
+// The index can be saved to a file and memory-mapped back without copying the data.
+// The file header records hashes of the model and of the texts the vectors were computed from (0 = unknown),
+// so that a stale index can be detected when it is loaded.
+
+struct llama_context;
+
+enum common_vector_index_type {
+    COMMON_VECTOR_INDEX_TYPE_F32    = 0,
+    COMMON_VECTOR_INDEX_TYPE_I8     = 1,
+    COMMON_VECTOR_INDEX_TYPE_BINARY = 2,
+};
+
+const char * common_vector_index_type_name(common_vector_index_type type);
+
+// returns false if the name is unknown
+bool common_vector_index_type_from_name(const std::string & name, common_vector_index_type & type);
+
+// hash of the model, its embedding size and the pooling type of ctx
+uint64_t common_vector_index_model_hash(const llama_context * ctx);
+
+// hash of the texts, in order
+uint64_t common_vector_index_text_hash(const std::vector<std::string> & texts);
+
+struct common_vector_index_result {
+    int64_t id;
+    float   score; // approximate cosine similarity
+};
+
+struct common_vector_index {
+    common_vector_index(int32_t n_embd, common_vector_index_type type);
+    ~common_vector_index();
+
+    int32_t                  n_embd() const;
+    common_vector_index_type type()   const;
+
+    // number of vectors in the index
+    int64_t size() const;
+
+    // size in bytes of one stored vector
+    size_t row_size() const;
+
+    // hashes of the source of the vectors, see common_vector_index_model_hash and common_vector_index_text_hash
+    uint64_t hash_model() const;
+    uint64_t hash_text()  const;
+
+    void set_hash(uint64_t hash_model, uint64_t hash_text);
+
+    // quantize and append a vector, returns its id (ids are assigned sequentially from 0)
+    // fails (returns -1) if the index is memory-mapped
+    int64_t add(const float * embd);
+
+    // top_k most similar vectors, sorted by decreasing score
+    // the scan is split over n_threads threads
+    std::vector<common_vector_index_result> search(const float * query, int32_t top_k, int32_t n_threads = 1) const;
+
+    // the file format is a small header followed by the rows as they are stored in memory
+    bool save(const std::string & fname) const;
+
+    // the file is memory-mapped when supported, otherwise it is read into memory
+    // returns nullptr on failure
+    static std::unique_ptr<common_vector_index> load(const std::string & fname);
+
+private:
+    struct impl;
+    std::unique_ptr<impl> pimpl;
+
+    common_vector_index(std::unique_ptr<impl> && pimpl);
+};
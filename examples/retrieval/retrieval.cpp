@@ -2,6 +2,7 @@
 #include "common.h"
 #include "log.h"
 #include "llama.h"
+#include "vector-index.h"
 
 #include <algorithm>
 #include <fstream>
@@ -22,8 +23,6 @@ struct chunk {
     std::string textdata;
     // tokenized text data
     std::vector<llama_token> tokens;
-    // embedding
-    std::vector<float> embedding;
 };
 
 // chunk file data to chunks of size >= chunk_size
@@ -133,6 +132,12 @@ int main(int argc, char ** argv) {
         return 1;
     }
 
+    common_vector_index_type index_type;
+    if (!common_vector_index_type_from_name(params.index_type, index_type)) {
+        LOG_ERR("invalid index type '%s'\n", params.index_type.c_str());
+        return 1;
+    }
+
     LOG_INF("processing files:\n");
     for (auto & context_file : params.context_files) {
         LOG_INF("%s\n", context_file.c_str());
@@ -185,74 +190,119 @@ int main(int argc, char ** argv) {
     const uint64_t n_batch = params.n_batch;
     GGML_ASSERT(params.n_batch >= params.n_ctx);
 
-    // tokenize the prompts and trim
-    for (auto & chunk : chunks) {
-        auto inp = common_tokenize(ctx, chunk.textdata, true, false);
-        if (inp.size() > n_batch) {
-            LOG_ERR("%s: chunk size (%lld) exceeds batch size (%lld), increase batch size and re-run\n",
-                    __func__, (long long int) inp.size(), (long long int) n_batch);
-            return 1;
+    const int n_chunks = chunks.size();
+    const int n_embd   = llama_model_n_embd(model);
+
+    uint64_t hash_text = 0;
+    {
+        std::vector<std::string> texts;
+        texts.reserve(chunks.size());
+        for (const auto & chunk : chunks) {
+            texts.push_back(chunk.textdata);
         }
-        // add eos if not present
-        if (llama_vocab_eos(vocab) >= 0 && (inp.empty() || inp.back() != llama_vocab_eos(vocab))) {
-            inp.push_back(llama_vocab_eos(vocab));
+        hash_text = common_vector_index_text_hash(texts);
+    }
+    const uint64_t hash_model = common_vector_index_model_hash(ctx);
+
+    // reuse the saved index if it was built from the same chunks with the same model
+    std::unique_ptr<common_vector_index> index;
+    if (!params.index_file.empty() && std::ifstream(params.index_file).good()) {
+        index = common_vector_index::load(params.index_file);
+        if (index && (index->size() != n_chunks || index->n_embd() != n_embd || index->hash_text() != hash_text)) {
+            LOG_WRN("%s: index '%s' does not match the context files, rebuilding it\n", __func__, params.index_file.c_str());
+            index.reset();
+        }
+        if (index && index->hash_model() != hash_model) {
+            LOG_WRN("%s: index '%s' was built with a different model, rebuilding it\n", __func__, params.index_file.c_str());
+            index.reset();
+        }
+        if (index && index->type() != index_type) {
+            LOG_WRN("%s: index '%s' is stored as %s, rebuilding it as %s\n", __func__, params.index_file.c_str(),
+                    common_vector_index_type_name(index->type()), common_vector_index_type_name(index_type));
+            index.reset();
+        }
+        if (index) {
+            LOG_INF("%s: loaded %s index with %lld vectors from '%s'\n", __func__,
+                    common_vector_index_type_name(index->type()), (long long int) index->size(), params.index_file.c_str());
         }
-        chunk.tokens = inp;
     }
 
-    // tokenization stats
-    if (params.verbose_prompt) {
-        for (int i = 0; i < (int) chunks.size(); i++) {
-            LOG_INF("%s: prompt %d: '%s'\n", __func__, i, chunks[i].textdata.c_str());
-            LOG_INF("%s: number of tokens in prompt = %zu\n", __func__, chunks[i].tokens.size());
-            for (int j = 0; j < (int) chunks[i].tokens.size(); j++) {
-                LOG_INF("%6d -> '%s'\n", chunks[i].tokens[j], common_token_to_piece(ctx, chunks[i].tokens[j]).c_str());
+    if (!index) {
+        // tokenize the prompts and trim
+        for (auto & chunk : chunks) {
+            auto inp = common_tokenize(ctx, chunk.textdata, true, false);
+            if (inp.size() > n_batch) {
+                LOG_ERR("%s: chunk size (%lld) exceeds batch size (%lld), increase batch size and re-run\n",
+                        __func__, (long long int) inp.size(), (long long int) n_batch);
+                return 1;
+            }
+            // add eos if not present
+            if (llama_vocab_eos(vocab) >= 0 && (inp.empty() || inp.back() != llama_vocab_eos(vocab))) {
+                inp.push_back(llama_vocab_eos(vocab));
             }
-            LOG_INF("\n\n");
+            chunk.tokens = inp;
         }
-    }
 
-    // initialize batch
-    const int n_chunks = chunks.size();
-    struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
-
-    // allocate output
-    const int n_embd = llama_model_n_embd(model);
-    std::vector<float> embeddings(n_chunks * n_embd, 0);
-    float * emb = embeddings.data();
-
-    // break into batches
-    int p = 0; // number of prompts processed already
-    int s = 0; // number of prompts in current batch
-    for (int k = 0; k < n_chunks; k++) {
-        // clamp to n_batch tokens
-        auto & inp = chunks[k].tokens;
-
-        const uint64_t n_toks = inp.size();
-
-        // encode if at capacity
-        if (batch.n_tokens + n_toks > n_batch) {
-            float * out = emb + p * n_embd;
-            batch_process(ctx, batch, out, s, n_embd);
-            common_batch_clear(batch);
-            p += s;
-            s = 0;
+        // tokenization stats
+        if (params.verbose_prompt) {
+            for (int i = 0; i < (int) chunks.size(); i++) {
+                LOG_INF("%s: prompt %d: '%s'\n", __func__, i, chunks[i].textdata.c_str());
+                LOG_INF("%s: number of tokens in prompt = %zu\n", __func__, chunks[i].tokens.size());
+                for (int j = 0; j < (int) chunks[i].tokens.size(); j++) {
+                    LOG_INF("%6d -> '%s'\n", chunks[i].tokens[j], common_token_to_piece(ctx, chunks[i].tokens[j]).c_str());
+                }
+                LOG_INF("\n\n");
+            }
         }
 
-        // add to batch
-        batch_add_seq(batch, inp, s);
-        s += 1;
-    }
+        // initialize batch
+        struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+        // allocate output
+        std::vector<float> embeddings(n_chunks * n_embd, 0);
+        float * emb = embeddings.data();
+
+        // break into batches
+        int p = 0; // number of prompts processed already
+        int s = 0; // number of prompts in current batch
+        for (int k = 0; k < n_chunks; k++) {
+            // clamp to n_batch tokens
+            auto & inp = chunks[k].tokens;
+
+            const uint64_t n_toks = inp.size();
+
+            // encode if at capacity
+            if (batch.n_tokens + n_toks > n_batch) {
+                float * out = emb + p * n_embd;
+                batch_process(ctx, batch, out, s, n_embd);
+                common_batch_clear(batch);
+                p += s;
+                s = 0;
+            }
 
-    // final batch
-    float * out = emb + p * n_embd;
-    batch_process(ctx, batch, out, s, n_embd);
+            // add to batch
+            batch_add_seq(batch, inp, s);
+            s += 1;
+        }
 
-    // save embeddings to chunks
-    for (int i = 0; i < n_chunks; i++) {
-        chunks[i].embedding = std::vector<float>(emb + i * n_embd, emb + (i + 1) * n_embd);
-        // clear tokens as they are no longer needed
-        chunks[i].tokens.clear();
+        // final batch
+        float * out = emb + p * n_embd;
+        batch_process(ctx, batch, out, s, n_embd);
+
+        // store the embeddings in the index
+        index.reset(new common_vector_index(n_embd, index_type));
+        index->set_hash(hash_model, hash_text);
+        for (int i = 0; i < n_chunks; i++) {
+            index->add(emb + i * n_embd);
+            // clear tokens as they are no longer needed
+            chunks[i].tokens.clear();
+        }
+
+        llama_batch_free(batch);
+
+        if (!params.index_file.empty() && index->save(params.index_file)) {
+            LOG_INF("%s: saved index to '%s'\n", __func__, params.index_file.c_str());
+        }
     }
 
     struct llama_batch query_batch = llama_batch_init(n_batch, 0, 1);
@@ -271,25 +321,16 @@ int main(int argc, char ** argv) {
 
         common_batch_clear(query_batch);
 
-        // compute cosine similarities
+        // find the most similar chunks
         {
-            std::vector<std::pair<int, float>> similarities;
-            for (int i = 0; i < n_chunks; i++) {
-                float sim = common_embd_similarity_cos(chunks[i].embedding.data(), query_emb.data(), n_embd);
-                similarities.push_back(std::make_pair(i, sim));
-            }
-
-            // sort similarities
-            std::sort(similarities.begin(), similarities.end(), [](const std::pair<int, float> & a, const std::pair<int, float> & b) {
-                return a.second > b.second;
-            });
+            const auto results = index->search(query_emb.data(), params.sampling.top_k, params.cpuparams.n_threads);
 
             LOG("Top %d similar chunks:\n", params.sampling.top_k);
-            for (int i = 0; i < std::min(params.sampling.top_k, (int) chunks.size()); i++) {
-                LOG("filename: %s\n", chunks[similarities[i].first].filename.c_str());
-                LOG("filepos: %lld\n", (long long int) chunks[similarities[i].first].filepos);
-                LOG("similarity: %f\n", similarities[i].second);
-                LOG("textdata:\n%s\n", chunks[similarities[i].first].textdata.c_str());
+            for (const auto & r : results) {
+                LOG("filename: %s\n", chunks[r.id].filename.c_str());
+                LOG("filepos: %lld\n", (long long int) chunks[r.id].filepos);
+                LOG("similarity: %f\n", r.score);
+                LOG("textdata:\n%s\n", chunks[r.id].textdata.c_str());
                 LOG("--------------------\n");
             }
         }
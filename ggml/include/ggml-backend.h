@@ -192,6 +192,8 @@ extern "C" {
     typedef ggml_backend_buffer_type_t * (*ggml_backend_dev_get_extra_bufts_t)(ggml_backend_dev_t device);
     // Set the abort callback for the backend
     typedef void                         (*ggml_backend_set_abort_callback_t)(ggml_backend_t backend, ggml_abort_callback abort_callback, void * abort_callback_data);
+    // Enable or disable the fusion of ops (used to test the fused kernels against the individual ops)
+    typedef void                         (*ggml_backend_set_fusion_t)(ggml_backend_t backend, bool use_fusion);
     // Get a list of feature flags supported by the backend (returns a NULL-terminated array)
     struct ggml_backend_feature {
         const char * name;
@@ -349,6 +351,11 @@ extern "C" {
     GGML_API ggml_backend_buffer_t      ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size);
     GGML_API ggml_backend_buffer_type_t ggml_backend_cpu_buffer_type(void);
 
+    // CPU buffer type backed by huge pages to reduce the TLB misses with large buffers (e.g. the weights and the KV cache)
+    // uses the hugetlb pool (1 GB pages if the buffer size is close to a multiple of 1 GB, then 2 MB pages) and falls back to transparent huge pages
+    // on Linux, on the other systems the buffers are allocated like the CPU buffer type
+    GGML_API ggml_backend_buffer_type_t ggml_backend_cpu_hugepage_buffer_type(void);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -682,6 +682,20 @@ extern "C" {
     GGML_API int64_t ggml_cycles(void);
     GGML_API int64_t ggml_cycles_per_ms(void);
 
+    // tracing in the Chrome trace event format (chrome://tracing, https://ui.perfetto.dev)
+    // events are recorded lock-free into per-thread ring buffers and written to fname by ggml_trace_stop or at exit
+    // start and stop are not synchronized with the recording threads, call them while no graph is being computed
+    // the timer must be initialized before the start, by ggml_init() or ggml_time_init()
+    GGML_API void    ggml_trace_start(const char * fname);
+    GGML_API void    ggml_trace_stop(void);
+    GGML_API bool    ggml_trace_enabled(void);
+
+    // returns the start time of an event, 0 if tracing is disabled
+    GGML_API int64_t ggml_trace_begin(void);
+    // records the event [t_start, now] on the calling thread, no-op if t_start is 0
+    // cat must be a string literal, name is copied and truncated to GGML_MAX_NAME
+    GGML_API void    ggml_trace_end(int64_t t_start, const char * cat, const char * name);
+
     // accepts a UTF-8 path, even on Windows
     GGML_API FILE *  ggml_fopen(const char * fname, const char * mode);
 
@@ -2132,6 +2146,15 @@ extern "C" {
             struct ggml_tensor * a,
             struct ggml_tensor * sinks);
 
+    // optional hint: the range of KV rows [kv_ranges[0], kv_ranges[1]) outside of which the mask of each query is -INF
+    // backends may skip the KV rows outside of the range, or ignore the hint and rely on the mask
+    //
+    // kv_ranges: [2, n_batch, 1, ne33] I32
+    //
+    GGML_API void ggml_flash_attn_ext_add_kv_ranges(
+            struct ggml_tensor * a,
+            struct ggml_tensor * kv_ranges);
+
     // TODO: needs to be adapted to ggml_flash_attn_ext
     GGML_API struct ggml_tensor * ggml_flash_attn_back(
            struct ggml_context * ctx,
@@ -11,6 +11,7 @@
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MAX_FREE_BLOCKS 256
+#define MAX_CACHED_PLANS 8
 
 //#define GGML_ALLOCATOR_DEBUG
 
@@ -106,6 +107,10 @@ struct ggml_dyn_tallocr {
     struct free_block free_blocks[MAX_FREE_BLOCKS];
     size_t max_size;
 
+    // total size of the allocated blocks, used to measure the fragmentation
+    size_t live_size;
+    size_t live_max;
+
 #ifdef GGML_ALLOCATOR_DEBUG
     struct {
         const struct ggml_tensor * tensor;
@@ -215,6 +220,9 @@ static size_t ggml_dyn_tallocr_alloc(struct ggml_dyn_tallocr * alloc, size_t siz
 
     alloc->max_size = MAX(alloc->max_size, offset + size);
 
+    alloc->live_size += size;
+    alloc->live_max   = MAX(alloc->live_max, alloc->live_size);
+
     return offset;
 
     GGML_UNUSED(tensor);
@@ -230,6 +238,8 @@ static void ggml_dyn_tallocr_free_tensor(struct ggml_dyn_tallocr * alloc, size_t
     remove_allocated_tensor(alloc, offset, tensor);
 #endif
 
+    alloc->live_size -= size;
+
     // see if we can merge with an existing block
     for (int i = 0; i < alloc->n_free_blocks; i++) {
         struct free_block * block = &alloc->free_blocks[i];
@@ -285,6 +295,8 @@ static void ggml_dyn_tallocr_reset(struct ggml_dyn_tallocr * alloc) {
     alloc->free_blocks[0].offset = 0;
     alloc->free_blocks[0].size = SIZE_MAX/2; // restrict maximum size of a measure allocator to half size_t max to avoid overflows
     alloc->max_size = 0;
+    alloc->live_size = 0;
+    alloc->live_max = 0;
 
 #ifdef GGML_ALLOCATOR_DEBUG
     for (int i = 0; i < 1024; i++) {
@@ -301,6 +313,8 @@ static struct ggml_dyn_tallocr * ggml_dyn_tallocr_new(size_t alignment) {
         /*.n_free_blocks = */ 0,
         /*.free_blocks   = */ {{0}},
         /*.max_size      = */ 0,
+        /*.live_size     = */ 0,
+        /*.live_max      = */ 0,
 #ifdef GGML_ALLOCATOR_DEBUG
         /*.allocated_tensors = */ {{0}},
 #endif
@@ -330,6 +344,17 @@ struct hash_node {
     int buffer_id;
     size_t offset; // offset within the buffer
     bool allocated;
+    int block; // 1 + index in ggml_gallocr::blocks, 0 if not allocated from a buffer
+};
+
+// a range of a buffer allocated while planning a graph
+// a tensor computed in-place shares the block of its parent, extending the lifetime of the block
+struct alloc_block {
+    struct ggml_dyn_tallocr * alloc;
+    size_t offset;
+    size_t size;
+    int t_alloc; // the block is live during the allocation events [t_alloc, t_free)
+    int t_free;
 };
 
 struct tensor_alloc {
@@ -347,6 +372,17 @@ struct node_alloc {
     struct tensor_alloc src[GGML_MAX_SRC];
 };
 
+// the tensor assignments of a graph
+struct gallocr_plan {
+    uint64_t key; // see ggml_gallocr_graph_key
+
+    struct node_alloc * node_allocs; // [n_nodes]
+    int n_nodes;
+
+    struct leaf_alloc * leaf_allocs; // [n_leafs]
+    int n_leafs;
+};
+
 struct ggml_gallocr {
     ggml_backend_buffer_type_t * bufts; // [n_buffers]
     ggml_backend_buffer_t * buffers; // [n_buffers]
@@ -355,12 +391,26 @@ struct ggml_gallocr {
 
     struct ggml_hash_set hash_set;
     struct hash_node * hash_values; // [hash_set.size]
+    int * tensor_ids; // [hash_set.size] position of the tensors in the graph, see ggml_gallocr_graph_key
 
     struct node_alloc * node_allocs; // [n_nodes]
     int n_nodes;
 
     struct leaf_alloc * leaf_allocs; // [n_leafs]
     int n_leafs;
+
+    uint64_t plan_key; // key of the current plan (node_allocs, leaf_allocs)
+
+    // the plans of the graphs allocated before the current one, most recent first
+    // when the graph alternates between a few topologies, e.g. prompt processing and generation, they are not planned again
+    struct gallocr_plan plans[MAX_CACHED_PLANS];
+    int n_plans;
+
+    // blocks allocated during the last planning
+    struct alloc_block * blocks; // [n_blocks]
+    int n_blocks;
+    int n_blocks_max;
+    int n_events;
 };
 
 ggml_gallocr_t ggml_gallocr_new_n(ggml_backend_buffer_type_t * bufts, int n_bufs) {
@@ -438,11 +488,17 @@ void ggml_gallocr_free(ggml_gallocr_t galloc) {
 
     ggml_hash_set_free(&galloc->hash_set);
     free(galloc->hash_values);
+    free(galloc->tensor_ids);
     free(galloc->bufts);
     free(galloc->buffers);
     free(galloc->buf_tallocs);
     free(galloc->node_allocs);
     free(galloc->leaf_allocs);
+    for (int i = 0; i < galloc->n_plans; i++) {
+        free(galloc->plans[i].node_allocs);
+        free(galloc->plans[i].leaf_allocs);
+    }
+    free(galloc->blocks);
     free(galloc);
 }
 
@@ -461,6 +517,23 @@ static bool ggml_gallocr_is_allocated(ggml_gallocr_t galloc, struct ggml_tensor
     return t->data != NULL || ggml_gallocr_hash_get(galloc, t)->allocated;
 }
 
+static int ggml_gallocr_add_block(ggml_gallocr_t galloc, struct ggml_dyn_tallocr * alloc, size_t offset, size_t size) {
+    if (galloc->n_blocks == galloc->n_blocks_max) {
+        galloc->n_blocks_max = MAX(256, 2*galloc->n_blocks_max);
+        galloc->blocks = realloc(galloc->blocks, galloc->n_blocks_max * sizeof(struct alloc_block));
+        GGML_ASSERT(galloc->blocks != NULL);
+    }
+
+    struct alloc_block * block = &galloc->blocks[galloc->n_blocks];
+    block->alloc   = alloc;
+    block->offset  = offset;
+    block->size    = aligned_offset(NULL, size, alloc->alignment);
+    block->t_alloc = galloc->n_events++;
+    block->t_free  = INT_MAX;
+
+    return ++galloc->n_blocks;
+}
+
 static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor * node, int buffer_id) {
     GGML_ASSERT(buffer_id >= 0);
     struct hash_node * hn = ggml_gallocr_hash_get(galloc, node);
@@ -504,6 +577,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
                             assert(view_src_hn->offset == p_hn->offset);
                             hn->buffer_id = p_hn->buffer_id;
                             hn->offset = p_hn->offset;
+                            hn->block = view_src_hn->block;
                             p_hn->allocated = false; // avoid freeing the parent
                             view_src_hn->allocated = false;
                             return;
@@ -512,6 +586,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
                         AT_PRINTF("reusing parent %s for %s\n", parent->name, node->name);
                         hn->buffer_id = p_hn->buffer_id;
                         hn->offset = p_hn->offset;
+                        hn->block = p_hn->block;
                         p_hn->allocated = false; // avoid freeing the parent
                         return;
                     }
@@ -525,6 +600,7 @@ static void ggml_gallocr_allocate_node(ggml_gallocr_t galloc, struct ggml_tensor
         size_t offset = ggml_dyn_tallocr_alloc(alloc, size, node);
         hn->buffer_id = buffer_id;
         hn->offset = offset;
+        hn->block = ggml_gallocr_add_block(galloc, alloc, offset, size);
     }
 }
 
@@ -543,6 +619,10 @@ static void ggml_gallocr_free_node(ggml_gallocr_t galloc, struct ggml_tensor * n
     size_t size = ggml_backend_buft_get_alloc_size(buft, node);
     ggml_dyn_tallocr_free_tensor(alloc, offset, size, node);
     hn->allocated = false;
+
+    if (hn->block > 0) {
+        galloc->blocks[hn->block - 1].t_free = galloc->n_events++;
+    }
 }
 
 static int get_node_buffer_id(const int * node_buffer_ids, int i) {
@@ -554,6 +634,9 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
     ggml_hash_set_reset(&galloc->hash_set);
     memset(galloc->hash_values, 0, sizeof(struct hash_node) * galloc->hash_set.size);
 
+    galloc->n_blocks = 0;
+    galloc->n_events = 0;
+
     // allocate leafs
     // these may be tensors that the application is not using in the graph, but may still want to allocate for other purposes
     for (int i = 0; i < graph->n_leafs; i++) {
@@ -656,6 +739,261 @@ static void ggml_gallocr_alloc_graph_impl(ggml_gallocr_t galloc, struct ggml_cgr
     }
 }
 
+static int alloc_block_cmp_size(const void * a, const void * b) {
+    const struct alloc_block * ba = *(const struct alloc_block * const *) a;
+    const struct alloc_block * bb = *(const struct alloc_block * const *) b;
+    if (ba->size != bb->size) {
+        return ba->size > bb->size ? -1 : 1;
+    }
+    return ba->t_alloc - bb->t_alloc;
+}
+
+static bool alloc_block_overlap(const struct alloc_block * a, const struct alloc_block * b) {
+    return a->t_alloc < b->t_free && b->t_alloc < a->t_free;
+}
+
+// the best-fit allocation is done online, in the order of the graph, and may leave gaps that are never filled
+// with the lifetimes of all the blocks known, the blocks can be placed again offline, largest first, each one in the
+// smallest gap left by the blocks already placed that are live at the same time
+// the result is used when it needs less memory than the online allocation
+static void ggml_gallocr_pack_blocks(ggml_gallocr_t galloc) {
+    if (galloc->n_blocks == 0) {
+        return;
+    }
+
+    struct alloc_block ** sorted = malloc(galloc->n_blocks * sizeof(struct alloc_block *));
+    struct alloc_block ** placed = malloc(galloc->n_blocks * sizeof(struct alloc_block *));
+    size_t * offsets = malloc(galloc->n_blocks * sizeof(size_t));
+    GGML_ASSERT(sorted != NULL && placed != NULL && offsets != NULL);
+
+    for (int i = 0; i < galloc->n_buffers; i++) {
+        struct ggml_dyn_tallocr * alloc = galloc->buf_tallocs[i];
+
+        // if the buffer type is used multiple times, the allocator is shared
+        bool shared = false;
+        for (int j = 0; j < i; j++) {
+            shared = shared || galloc->buf_tallocs[j] == alloc;
+        }
+        if (shared) {
+            continue;
+        }
+
+        int n_sorted = 0;
+        for (int j = 0; j < galloc->n_blocks; j++) {
+            if (galloc->blocks[j].alloc == alloc) {
+                sorted[n_sorted++] = &galloc->blocks[j];
+            }
+        }
+        if (n_sorted == 0) {
+            continue;
+        }
+        qsort(sorted, n_sorted, sizeof(struct alloc_block *), alloc_block_cmp_size);
+
+        // placed blocks, ordered by their new offset
+        int n_placed = 0;
+        size_t max_size = 0;
+        for (int j = 0; j < n_sorted; j++) {
+            struct alloc_block * block = sorted[j];
+
+            size_t best_offset = SIZE_MAX;
+            size_t best_gap    = SIZE_MAX;
+            size_t prev_end    = 0;
+            for (int k = 0; k < n_placed; k++) {
+                const struct alloc_block * other = placed[k];
+                if (!alloc_block_overlap(block, other)) {
+                    continue;
+                }
+                const size_t other_offset = offsets[other - galloc->blocks];
+                if (other_offset > prev_end) {
+                    const size_t gap = other_offset - prev_end;
+                    if (gap >= block->size && gap < best_gap) {
+                        best_gap    = gap;
+                        best_offset = prev_end;
+                    }
+                }
+                prev_end = MAX(prev_end, other_offset + other->size);
+            }
+            if (best_offset == SIZE_MAX) {
+                best_offset = prev_end;
+            }
+            offsets[block - galloc->blocks] = best_offset;
+            max_size = MAX(max_size, best_offset + block->size);
+
+            int pos = n_placed;
+            while (pos > 0 && offsets[placed[pos - 1] - galloc->blocks] > best_offset) {
+                placed[pos] = placed[pos - 1];
+                pos--;
+            }
+            placed[pos] = block;
+            n_placed++;
+        }
+
+        const size_t best_fit_size = alloc->max_size;
+        if (max_size < best_fit_size) {
+            for (int j = 0; j < n_sorted; j++) {
+                sorted[j]->offset = offsets[sorted[j] - galloc->blocks];
+            }
+            alloc->max_size = max_size;
+        }
+
+        GGML_LOG_DEBUG("%s: %s compute buffer: best-fit %.2f MiB, packed %.2f MiB, %.2f MiB live at peak (%.1f%% fragmentation)\n",
+            __func__, ggml_backend_buft_name(galloc->bufts[i]), best_fit_size / 1024.0 / 1024.0, max_size / 1024.0 / 1024.0,
+            alloc->live_max / 1024.0 / 1024.0, 100.0 * (1.0 - (double) alloc->live_max / MAX(alloc->max_size, 1)));
+    }
+
+    // move the tensors to the new offsets of their blocks
+    for (size_t i = 0; i < galloc->hash_set.size; i++) {
+        struct hash_node * hn = &galloc->hash_values[i];
+        if (hn->block > 0) {
+            hn->offset = galloc->blocks[hn->block - 1].offset;
+        }
+    }
+
+    free(offsets);
+    free(placed);
+    free(sorted);
+}
+
+// position of a tensor in the graph numbered by ggml_gallocr_graph_key: nodes are 1..n_nodes, leafs are -1..-n_leafs
+static int ggml_gallocr_tensor_id(ggml_gallocr_t galloc, const struct ggml_tensor * t) {
+    if (t == NULL) {
+        return 0;
+    }
+    size_t i = ggml_hash_find(&galloc->hash_set, t);
+    if (i == GGML_HASHSET_FULL || !ggml_bitset_get(galloc->hash_set.used, i)) {
+        // not part of the graph
+        return INT_MIN;
+    }
+    return galloc->tensor_ids[i];
+}
+
+// hash of the topology of the graph and of the buffer assignment, a plan can only be reused for a graph with the same key
+// the sizes are not part of the key, a plan made for larger tensors also fits smaller ones (see ggml_gallocr_needs_realloc)
+// the sources are identified by their position in the graph, so that graphs with the same ops but a different wiring
+// (and therefore different tensor lifetimes) get different keys
+static uint64_t ggml_gallocr_graph_key(ggml_gallocr_t galloc, const struct ggml_cgraph * graph, const int * node_buffer_ids, const int * leaf_buffer_ids) {
+    ggml_hash_set_reset(&galloc->hash_set);
+    for (int i = 0; i < graph->n_nodes; i++) {
+        galloc->tensor_ids[ggml_hash_find_or_insert(&galloc->hash_set, graph->nodes[i])] = i + 1;
+    }
+    for (int i = 0; i < graph->n_leafs; i++) {
+        galloc->tensor_ids[ggml_hash_find_or_insert(&galloc->hash_set, graph->leafs[i])] = -(i + 1);
+    }
+
+    uint64_t key = 0xcbf29ce484222325ULL; // FNV-1a
+#define GALLOCR_KEY_ADD(v) key = (key ^ (uint64_t) (v)) * 0x100000001b3ULL
+    GALLOCR_KEY_ADD(graph->n_nodes);
+    GALLOCR_KEY_ADD(graph->n_leafs);
+    for (int i = 0; i < graph->n_nodes; i++) {
+        const struct ggml_tensor * node = graph->nodes[i];
+        GALLOCR_KEY_ADD(node->op);
+        GALLOCR_KEY_ADD(node->type);
+        GALLOCR_KEY_ADD(node->flags);
+        GALLOCR_KEY_ADD(node->data != NULL);
+        GALLOCR_KEY_ADD((uint32_t) ggml_gallocr_tensor_id(galloc, node->view_src));
+        GALLOCR_KEY_ADD(get_node_buffer_id(node_buffer_ids, i));
+        for (int j = 0; j < GGML_MAX_SRC; j++) {
+            GALLOCR_KEY_ADD((uint32_t) ggml_gallocr_tensor_id(galloc, node->src[j]));
+        }
+    }
+    for (int i = 0; i < graph->n_leafs; i++) {
+        const struct ggml_tensor * leaf = graph->leafs[i];
+        GALLOCR_KEY_ADD(leaf->type);
+        GALLOCR_KEY_ADD(leaf->flags);
+        GALLOCR_KEY_ADD(leaf->data != NULL);
+        GALLOCR_KEY_ADD((uint32_t) ggml_gallocr_tensor_id(galloc, leaf->view_src));
+        GALLOCR_KEY_ADD(get_node_buffer_id(leaf_buffer_ids, i));
+    }
+#undef GALLOCR_KEY_ADD
+    return key;
+}
+
+static void ggml_gallocr_swap_plan(ggml_gallocr_t galloc, struct gallocr_plan * plan) {
+    struct gallocr_plan cur = {
+        /*.key         = */ galloc->plan_key,
+        /*.node_allocs = */ galloc->node_allocs,
+        /*.n_nodes     = */ galloc->n_nodes,
+        /*.leaf_allocs = */ galloc->leaf_allocs,
+        /*.n_leafs     = */ galloc->n_leafs,
+    };
+    galloc->plan_key    = plan->key;
+    galloc->node_allocs = plan->node_allocs;
+    galloc->n_nodes     = plan->n_nodes;
+    galloc->leaf_allocs = plan->leaf_allocs;
+    galloc->n_leafs     = plan->n_leafs;
+    *plan = cur;
+}
+
+static bool ggml_gallocr_needs_realloc(ggml_gallocr_t galloc, struct ggml_cgraph * graph);
+
+// make a previous plan of the graph current if the tensors of the graph still fit in it
+static bool ggml_gallocr_use_cached_plan(ggml_gallocr_t galloc, struct ggml_cgraph * graph, uint64_t key) {
+    for (int i = 0; i < galloc->n_buffers; i++) {
+        if (galloc->buffers[i] == NULL) {
+            return false;
+        }
+    }
+
+    if (galloc->n_nodes > 0 && galloc->plan_key == key && !ggml_gallocr_needs_realloc(galloc, graph)) {
+        return true;
+    }
+
+    for (int i = 0; i < galloc->n_plans; i++) {
+        if (galloc->plans[i].key != key) {
+            continue;
+        }
+        ggml_gallocr_swap_plan(galloc, &galloc->plans[i]);
+        if (!ggml_gallocr_needs_realloc(galloc, graph)) {
+            // keep the cache ordered by recency
+            struct gallocr_plan prev = galloc->plans[i];
+            memmove(&galloc->plans[1], &galloc->plans[0], i * sizeof(struct gallocr_plan));
+            galloc->plans[0] = prev;
+            return true;
+        }
+        ggml_gallocr_swap_plan(galloc, &galloc->plans[i]);
+    }
+
+    return false;
+}
+
+// move the current plan to the cache before making a new plan for a graph with the given key
+static void ggml_gallocr_push_plan(ggml_gallocr_t galloc, uint64_t key) {
+    // the plans of the same graph are replaced by the new plan, which is made for the larger tensors
+    for (int i = 0; i < galloc->n_plans; i++) {
+        if (galloc->plans[i].key == key) {
+            free(galloc->plans[i].node_allocs);
+            free(galloc->plans[i].leaf_allocs);
+            memmove(&galloc->plans[i], &galloc->plans[i + 1], (galloc->n_plans - i - 1) * sizeof(struct gallocr_plan));
+            galloc->n_plans--;
+            i--;
+        }
+    }
+
+    if (galloc->n_nodes == 0 || galloc->plan_key == key) {
+        return;
+    }
+
+    if (galloc->n_plans == MAX_CACHED_PLANS) {
+        galloc->n_plans--;
+        free(galloc->plans[galloc->n_plans].node_allocs);
+        free(galloc->plans[galloc->n_plans].leaf_allocs);
+    }
+    memmove(&galloc->plans[1], &galloc->plans[0], galloc->n_plans * sizeof(struct gallocr_plan));
+    galloc->n_plans++;
+
+    galloc->plans[0] = (struct gallocr_plan) {
+        /*.key         = */ galloc->plan_key,
+        /*.node_allocs = */ galloc->node_allocs,
+        /*.n_nodes     = */ galloc->n_nodes,
+        /*.leaf_allocs = */ galloc->leaf_allocs,
+        /*.n_leafs     = */ galloc->n_leafs,
+    };
+    galloc->node_allocs = NULL;
+    galloc->n_nodes     = 0;
+    galloc->leaf_allocs = NULL;
+    galloc->n_leafs     = 0;
+}
+
 bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, const int * node_buffer_ids, const int * leaf_buffer_ids) {
     size_t min_hash_size = graph->n_nodes + graph->n_leafs;
     // add 25% margin to avoid hash collisions
@@ -670,8 +1008,22 @@ bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, c
         free(galloc->hash_values);
         galloc->hash_values = malloc(sizeof(struct hash_node) * galloc->hash_set.size);
         GGML_ASSERT(galloc->hash_values != NULL);
+
+        free(galloc->tensor_ids);
+        galloc->tensor_ids = malloc(sizeof(int) * galloc->hash_set.size);
+        GGML_ASSERT(galloc->tensor_ids != NULL);
     }
 
+    const uint64_t key = ggml_gallocr_graph_key(galloc, graph, node_buffer_ids, leaf_buffer_ids);
+
+    // the buffers never shrink, so a previous plan of the same graph that fits needs no new allocation
+    if (ggml_gallocr_use_cached_plan(galloc, graph, key)) {
+        return true;
+    }
+
+    ggml_gallocr_push_plan(galloc, key);
+    galloc->plan_key = key;
+
     // reset allocators
     for (int i = 0; i < galloc->n_buffers; i++) {
         ggml_dyn_tallocr_reset(galloc->buf_tallocs[i]);
@@ -679,6 +1031,7 @@ bool ggml_gallocr_reserve_n(ggml_gallocr_t galloc, struct ggml_cgraph * graph, c
 
     // allocate in hash table
     ggml_gallocr_alloc_graph_impl(galloc, graph, node_buffer_ids, leaf_buffer_ids);
+    ggml_gallocr_pack_blocks(galloc);
 
     // set the node_allocs from the hash table
     if (galloc->n_nodes < graph->n_nodes) {
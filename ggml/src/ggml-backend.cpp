@@ -27,6 +27,10 @@
 #include <sys/sysctl.h>
 #endif
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
 
 // backend buffer type
 
@@ -1355,11 +1359,20 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
     std::vector<int32_t> ids;
     std::vector<ggml_bitset_t> used_ids;
 
+    const bool trace = ggml_trace_enabled();
+    char trace_name[GGML_MAX_NAME];
+
     for (int split_id = 0; split_id < sched->n_splits; split_id++) {
         struct ggml_backend_sched_split * split = &splits[split_id];
         int split_backend_id = split->backend_id;
         ggml_backend_t split_backend = sched->backends[split_backend_id];
 
+        if (trace) {
+            snprintf(trace_name, sizeof(trace_name), "split %d: %s", split_id, ggml_backend_name(split_backend));
+        }
+
+        const int64_t t_copy = trace && split->n_inputs > 0 ? ggml_trace_begin() : 0;
+
         // copy the input tensors to the split backend
         for (int input_id = 0; input_id < split->n_inputs; input_id++) {
             ggml_backend_t input_backend = ggml_backend_sched_get_tensor_backend(sched, split->inputs[input_id]);
@@ -1483,6 +1496,13 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
             }
         }
 
+        if (t_copy) {
+            ggml_trace_end(t_copy, "copy", trace_name);
+        }
+
+        // for asynchronous backends this is only the time to submit the split
+        const int64_t t_compute = trace ? ggml_trace_begin() : 0;
+
         if (!sched->callback_eval) {
             enum ggml_status ec = ggml_backend_graph_compute_async(split_backend, &split->graph);
             if (ec != GGML_STATUS_SUCCESS) {
@@ -1522,6 +1542,10 @@ static enum ggml_status ggml_backend_sched_compute_splits(ggml_backend_sched_t s
             }
         }
 
+        if (t_compute) {
+            ggml_trace_end(t_compute, "split", trace_name);
+        }
+
         // record the event of this copy
         if (split->n_inputs > 0) {
             if (sched->events[split_backend_id][sched->cur_copy] != NULL) {
@@ -2116,3 +2140,152 @@ ggml_backend_buffer_t ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size)
     GGML_ASSERT((uintptr_t)ptr % TENSOR_ALIGNMENT == 0 && "buffer pointer must be aligned");
     return ggml_backend_buffer_init(ggml_backend_cpu_buffer_from_ptr_type(), ggml_backend_cpu_buffer_from_ptr_i, ptr, size);
 }
+
+// CPU backend - huge page buffer
+
+struct ggml_backend_cpu_hugepage_buffer_context {
+    void * data;
+    size_t size;   // size of the mapping, 0 if data was allocated with ggml_aligned_malloc
+};
+
+#ifdef __linux__
+static void * ggml_backend_cpu_hugepage_map(size_t size, size_t * mapped_size) {
+    const size_t size_2m = 2ull*1024*1024;
+    const size_t size_1g = 1024ull*1024*1024;
+
+    // explicit huge pages from the hugetlb pool, the pages are reserved by mmap so a failure is reported here
+    struct { size_t page_size; int flags; } hugetlb[] = {
+#ifdef MAP_HUGE_1GB
+        { size_1g, MAP_HUGE_1GB },
+#endif
+#ifdef MAP_HUGE_2MB
+        { size_2m, MAP_HUGE_2MB },
+#else
+        { size_2m, 0 },
+#endif
+    };
+
+    for (const auto & ht : hugetlb) {
+        const size_t len = GGML_PAD(size, ht.page_size);
+
+        // do not waste more than 1/8 of the buffer to round it up to 1 GB pages
+        if (ht.page_size == size_1g && len - size > size/8) {
+            continue;
+        }
+
+        void * data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | ht.flags, -1, 0);
+        if (data != MAP_FAILED) {
+            GGML_LOG_DEBUG("%s: allocated %zu MiB with %zu MiB hugetlb pages\n", __func__, len/(1024*1024), ht.page_size/(1024*1024));
+            *mapped_size = len;
+            return data;
+        }
+    }
+
+    // transparent huge pages: over-allocate to align the mapping to 2 MB and trim the excess
+    const size_t len = GGML_PAD(size, size_2m);
+
+    uint8_t * raw = (uint8_t *) mmap(NULL, len + size_2m, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    uint8_t * data = (uint8_t *) GGML_PAD((uintptr_t) raw, size_2m);
+
+    if (data > raw) {
+        munmap(raw, data - raw);
+    }
+    if (raw + len + size_2m > data + len) {
+        munmap(data + len, (raw + len + size_2m) - (data + len));
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(data, len, MADV_HUGEPAGE) != 0) {
+        GGML_LOG_DEBUG("%s: madvise(.., MADV_HUGEPAGE) failed, using normal pages\n", __func__);
+    } else {
+        GGML_LOG_DEBUG("%s: allocated %zu MiB with transparent huge pages\n", __func__, len/(1024*1024));
+    }
+#endif
+
+    *mapped_size = len;
+    return data;
+}
+#endif
+
+static void * ggml_backend_cpu_hugepage_buffer_get_base(ggml_backend_buffer_t buffer) {
+    ggml_backend_cpu_hugepage_buffer_context * ctx = (ggml_backend_cpu_hugepage_buffer_context *) buffer->context;
+    return (void *) GGML_PAD((uintptr_t) ctx->data, TENSOR_ALIGNMENT);
+}
+
+static void ggml_backend_cpu_hugepage_buffer_free_buffer(ggml_backend_buffer_t buffer) {
+    ggml_backend_cpu_hugepage_buffer_context * ctx = (ggml_backend_cpu_hugepage_buffer_context *) buffer->context;
+#ifdef __linux__
+    if (ctx->size > 0) {
+        munmap(ctx->data, ctx->size);
+    } else
+#endif
+    {
+        ggml_aligned_free(ctx->data, buffer->size);
+    }
+    delete ctx;
+}
+
+static void ggml_backend_cpu_hugepage_buffer_clear(ggml_backend_buffer_t buffer, uint8_t value) {
+    memset(ggml_backend_cpu_hugepage_buffer_get_base(buffer), value, buffer->size);
+}
+
+static const struct ggml_backend_buffer_i ggml_backend_cpu_hugepage_buffer_i = {
+    /* .free_buffer     = */ ggml_backend_cpu_hugepage_buffer_free_buffer,
+    /* .get_base        = */ ggml_backend_cpu_hugepage_buffer_get_base,
+    /* .init_tensor     = */ NULL, // no initialization required
+    /* .memset_tensor   = */ ggml_backend_cpu_buffer_memset_tensor,
+    /* .set_tensor      = */ ggml_backend_cpu_buffer_set_tensor,
+    /* .get_tensor      = */ ggml_backend_cpu_buffer_get_tensor,
+    /* .cpy_tensor      = */ ggml_backend_cpu_buffer_cpy_tensor,
+    /* .clear           = */ ggml_backend_cpu_hugepage_buffer_clear,
+    /* .reset           = */ NULL,
+};
+
+static const char * ggml_backend_cpu_hugepage_buffer_type_get_name(ggml_backend_buffer_type_t buft) {
+    return "CPU_Hugepage";
+
+    GGML_UNUSED(buft);
+}
+
+static ggml_backend_buffer_t ggml_backend_cpu_hugepage_buffer_type_alloc_buffer(ggml_backend_buffer_type_t buft, size_t size) {
+    void * data        = NULL;
+    size_t mapped_size = 0;
+
+#ifdef __linux__
+    data = ggml_backend_cpu_hugepage_map(size, &mapped_size);
+#endif
+
+    if (data == NULL) {
+        data = ggml_aligned_malloc(size);
+    }
+
+    if (data == NULL) {
+        GGML_LOG_ERROR("%s: failed to allocate buffer of size %zu\n", __func__, size);
+        return NULL;
+    }
+
+    ggml_backend_cpu_hugepage_buffer_context * ctx = new ggml_backend_cpu_hugepage_buffer_context { data, mapped_size };
+
+    return ggml_backend_buffer_init(buft, ggml_backend_cpu_hugepage_buffer_i, ctx, size);
+}
+
+ggml_backend_buffer_type_t ggml_backend_cpu_hugepage_buffer_type(void) {
+    static struct ggml_backend_buffer_type ggml_backend_cpu_hugepage_buffer_type = {
+        /* .iface   = */ {
+            /* .get_name         = */ ggml_backend_cpu_hugepage_buffer_type_get_name,
+            /* .alloc_buffer     = */ ggml_backend_cpu_hugepage_buffer_type_alloc_buffer,
+            /* .get_alignment    = */ ggml_backend_cpu_buffer_type_get_alignment,
+            /* .get_max_size     = */ NULL, // defaults to SIZE_MAX
+            /* .get_alloc_size   = */ NULL, // defaults to ggml_nbytes
+            /* .is_host          = */ ggml_backend_cpu_buffer_type_is_host,
+        },
+        /* .device  = */ NULL, // FIXME ggml_backend_reg_dev_get(ggml_backend_cpu_reg(), 0),
+        /* .context = */ NULL,
+    };
+
+    return &ggml_backend_cpu_hugepage_buffer_type;
+}
@@ -31,6 +31,26 @@ class tensor_traits : public ggml::cpu::tensor_traits {
             ggml_backend_amx_mul_mat(params, op);
             return true;
         }
+        if (op->op == GGML_OP_MUL_MAT_ID) {
+            ggml_backend_amx_mul_mat_id(params, op);
+            return true;
+        }
+        return false;
+    }
+};
+
+// attention does not use weights, the KV cache is in a regular CPU buffer
+class attn_tensor_traits : public ggml::cpu::tensor_traits {
+    bool work_size(int n_threads, const struct ggml_tensor * op, size_t & size) override {
+        size = ggml_backend_amx_flash_attn_ext_wsize(n_threads, op);
+        return true;
+    }
+
+    bool compute_forward(struct ggml_compute_params * params, struct ggml_tensor * op) override {
+        if (op->op == GGML_OP_FLASH_ATTN_EXT) {
+            ggml_backend_amx_flash_attn_ext(params, op);
+            return true;
+        }
         return false;
     }
 };
@@ -39,6 +59,11 @@ static ggml::cpu::tensor_traits * get_tensor_traits(ggml_backend_buffer_t, struc
     static tensor_traits traits;
     return &traits;
 }
+
+static ggml::cpu::tensor_traits * get_attn_tensor_traits() {
+    static attn_tensor_traits traits;
+    return &traits;
+}
 }  // namespace ggml::cpu::amx
 
 // AMX buffer interface
@@ -160,15 +185,31 @@ class extra_buffer_type : ggml::cpu::extra_buffer_type {
                 return true;
             }
         }
+
+        // experts of a MoE layer, packed one after the other
+        if (op->op == GGML_OP_MUL_MAT_ID && ggml_is_contiguous(op->src[0]) && op->src[0]->ne[3] == 1 &&
+            op->src[0]->buffer && op->src[0]->buffer->buft == ggml_backend_amx_buffer_type() &&
+            op->src[0]->ne[1] % (TILE_N * 2) == 0 &&                      // out_features is 32x
+            qtype_has_amx_kernels(op->src[0]->type) &&
+            op->src[1]->type == GGML_TYPE_F32 && op->src[1]->nb[0] == sizeof(float) && op->src[1]->ne[3] == 1) {
+            // src1 must be host buffer
+            return !op->src[1]->buffer || ggml_backend_buft_is_host(op->src[1]->buffer->buft);
+        }
+
         return false;
     }
 
     ggml::cpu::tensor_traits * get_tensor_traits(const struct ggml_tensor * op) override {
-        if (op->op == GGML_OP_MUL_MAT && op->src[0]->buffer &&
+        if ((op->op == GGML_OP_MUL_MAT || op->op == GGML_OP_MUL_MAT_ID) && op->src[0]->buffer &&
             op->src[0]->buffer->buft == ggml_backend_amx_buffer_type()) {
             return (ggml::cpu::tensor_traits *) op->src[0]->extra;
         }
 
+        // prompt processing with a BF16 KV cache, the AMX buffer type only exists if the tiles can be used
+        if (op->op == GGML_OP_FLASH_ATTN_EXT && ggml_backend_amx_flash_attn_ext_supported(op)) {
+            return ggml::cpu::amx::get_attn_tensor_traits();
+        }
+
         return nullptr;
     }
 };
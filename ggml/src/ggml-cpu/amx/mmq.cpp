@@ -10,6 +10,7 @@
 #include "ggml-cpu-impl.h"
 #include "simd-mappings.h"
 #include "quants.h"
+#include "vec.h"
 #include "ggml-quants.h"
 #include <algorithm>
 #include <type_traits>
@@ -2079,7 +2080,7 @@ void tinygemm_kernel_amx(int M, int N, int KB, const void * RESTRICT _A, const v
         _tile_stored(TMM5, Tile5(C_pre), TILE_N * sizeof(int32_t));
 
         if (need_unpack) {
-            unpack_B<TB>(Tile1, B_blk0);
+            unpack_B<TB>(Tile1, B_blk1);
             _tile_loadd(TMM1, Tile1, TILE_N * VNNI_BLK);
         } else {
             _tile_loadd(TMM1, B_blk1, TILE_N * VNNI_BLK);
@@ -2299,6 +2300,50 @@ void tinygemm_kernel_amx(int M, int N, int KB, const void * RESTRICT _A, const v
 
 } // anonymous namespace
 
+// MUL_MAT_ID work space, each buffer is aligned to a cache line:
+//   A           {n_src1_rows, row_size_A}  src1 quantized to vec_dot_type
+//   A_gathered  {n_rows, row_size_A}       src1 rows gathered by expert
+//   first_row   {n_as + 1}                 first row of each expert in A_gathered
+//   first_block {n_as + 1}                 first {2 * TILE_M, 2 * TILE_N} block of each expert
+//   rows        {n_rows}                   (i1, i2) of the dst row of each gathered row
+struct mmid_row_mapping {
+    int32_t i1;
+    int32_t i2;
+};
+
+struct mmid_wdata {
+    char             * A;
+    char             * A_gathered;
+    int64_t          * first_row;
+    int64_t          * first_block;
+    mmid_row_mapping * rows;
+};
+
+static size_t mmid_layout(char * base, int64_t n_as, int64_t n_src1_rows, int64_t n_rows, size_t row_size_A, mmid_wdata * wd) {
+    size_t offs = 0;
+
+    auto alloc = [&](size_t size) {
+        char * ptr = base ? base + offs : nullptr;
+        offs += GGML_PAD(size, 64);
+        return ptr;
+    };
+
+    mmid_wdata tmp;
+    wd = wd ? wd : &tmp;
+
+    wd->A           = alloc(n_src1_rows * row_size_A);
+    wd->A_gathered  = alloc(n_rows * row_size_A);
+    wd->first_row   = (int64_t *)          alloc((n_as + 1) * sizeof(int64_t));
+    wd->first_block = (int64_t *)          alloc((n_as + 1) * sizeof(int64_t));
+    wd->rows        = (mmid_row_mapping *) alloc(n_rows * sizeof(mmid_row_mapping));
+
+    return offs;
+}
+
+static size_t mmid_wsize(int64_t n_as, int64_t n_src1_rows, int64_t n_rows, size_t row_size_A) {
+    return mmid_layout(nullptr, n_as, n_src1_rows, n_rows, row_size_A, nullptr);
+}
+
 // get the packed tensor size for quantized weights
 size_t ggml_backend_amx_get_alloc_size(const struct ggml_tensor * tensor) {
     const enum ggml_type TYPE = tensor->type;
@@ -2306,12 +2351,15 @@ size_t ggml_backend_amx_get_alloc_size(const struct ggml_tensor * tensor) {
     const int K = tensor->ne[0]; // ne0: in_features
     const int N = tensor->ne[1]; // ne1: out_features
 
+    // the experts of a 3d weight are packed one after the other
+    const int64_t n_mat = tensor->ne[2] * tensor->ne[3];
+
     auto get_tensor_size = [&] {
         size_t row_size_B{0};
         GGML_DISPATCH_QTYPES(TYPE, [&] {
             row_size_B = get_row_size<type, blck_size>(K);
         });
-        return N * row_size_B;
+        return n_mat * N * row_size_B;
     };
 
     if (qtype_has_amx_kernels(TYPE)) {
@@ -2331,8 +2379,11 @@ void ggml_backend_amx_convert_weight(struct ggml_tensor * tensor, const void * d
     const int K = tensor->ne[0]; // ne0: in_features
     const int N = tensor->ne[1]; // ne1: out_features
 
+    // N is a multiple of TILE_N, so the experts of a 3d weight are packed as the rows of a single 2d weight
+    const int n_mat = tensor->ne[2] * tensor->ne[3];
+
     GGML_DISPATCH_QTYPES(TYPE, [&] {
-        convert_B_packed_format<type, blck_size>((void *)((char *)tensor->data + offset), (const type *)data, N, K);
+        convert_B_packed_format<type, blck_size>((void *)((char *)tensor->data + offset), (const type *)data, N * n_mat, K);
     });
 }
 
@@ -2351,6 +2402,21 @@ size_t ggml_backend_amx_desired_wsize(const struct ggml_tensor * dst) {
 
     size_t desired_wsize = 0;
 
+    if (dst->op == GGML_OP_MUL_MAT_ID) {
+        const struct ggml_tensor * src1 = dst->src[1];
+        const struct ggml_tensor * ids  = dst->src[2];
+
+        const int64_t n_as   = src0->ne[2];
+        const int64_t n_rows = ids->ne[0] * ids->ne[1];
+
+        GGML_DISPATCH_QTYPES(TYPE, [&] {
+            const size_t row_size_A = K / blck_size * sizeof(vec_dot_type);
+            desired_wsize = mmid_wsize(n_as, src1->ne[1] * src1->ne[2], n_rows, row_size_A);
+        });
+
+        return desired_wsize;
+    }
+
     GGML_DISPATCH_QTYPES(TYPE, [&] {
         const size_t row_size_A = K / blck_size * sizeof(vec_dot_type);
         desired_wsize = M * row_size_A;
@@ -2509,4 +2575,574 @@ void ggml_backend_amx_mul_mat(const ggml_compute_params * params, struct ggml_te
     });
 }
 
+// NB: grouped gemm for MUL_MAT_ID with Advanced Matrix Extensions (Intel AMX)
+//
+// src0: weights of the experts in shape of {n_as, N, K}, quantized, packed one expert after the other
+// src1: input  in shape of {n_tokens, ne11, K}, float32, ne11 is 1 (broadcast) or n_ids
+// ids:  experts selected for each token in shape of {n_tokens, n_ids}
+// dst:  output in shape of {n_tokens, n_ids, N}, float32
+//
+// the rows of src1 are quantized once and gathered by expert, each expert then runs the same
+// {2 * TILE_M, 2 * TILE_N} blocks as MUL_MAT and the results are scattered to the rows of dst
+//
+void ggml_backend_amx_mul_mat_id(const ggml_compute_params * params, struct ggml_tensor * dst) {
+    struct ggml_tensor * src0 = dst->src[0];
+    struct ggml_tensor * src1 = dst->src[1];
+    struct ggml_tensor * ids  = dst->src[2];
+
+    const enum ggml_type TYPE = src0->type;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int N = dst->ne[0];
+    const int K = src0->ne[0];
+
+    const int64_t n_as   = src0->ne[2];
+    const int64_t n_ids  = ids->ne[0];
+    const int64_t n_rows = ids->ne[0] * ids->ne[1];
+
+    const int64_t ne11 = src1->ne[1];
+    const int64_t ne12 = src1->ne[2];
+
+    GGML_DISPATCH_QTYPES(TYPE, [&] {
+        const int KB = K / blck_size;
+        const int TILE_SIZE = get_tile_size<type>();
+        const size_t row_size_A = KB * sizeof(vec_dot_type);
+
+        // packed size of one expert
+        const size_t size_B = N * get_row_size<type, blck_size>(K);
+
+        if (params->wsize < mmid_wsize(n_as, ne11 * ne12, n_rows, row_size_A)) {
+            GGML_ABORT("insufficient work space size");
+        }
+
+        mmid_wdata wd;
+        mmid_layout((char *) params->wdata, n_as, ne11 * ne12, n_rows, row_size_A, &wd);
+
+        // quantize src1
+        for (int64_t ir = ith; ir < ne11 * ne12; ir += nth) {
+            const int64_t i11 = ir % ne11;
+            const int64_t i12 = ir / ne11;
+            from_float<vec_dot_type>((const float *)((const char *) src1->data + i11 * src1->nb[1] + i12 * src1->nb[2]),
+                    wd.A + ir * row_size_A, K);
+        }
+
+        // group the rows by expert
+        if (ith == 0) {
+            int64_t * first_row = wd.first_row;
+
+            memset(first_row, 0, (n_as + 1) * sizeof(int64_t));
+
+            auto get_id = [&](int64_t iid1, int64_t id) {
+                const int32_t i02 = *(const int32_t *) ((const char *) ids->data + iid1 * ids->nb[1] + id * ids->nb[0]);
+                GGML_ASSERT(i02 >= 0 && i02 < n_as);
+                return i02;
+            };
+
+            for (int64_t iid1 = 0; iid1 < ids->ne[1]; ++iid1) {
+                for (int64_t id = 0; id < n_ids; ++id) {
+                    first_row[get_id(iid1, id) + 1]++;
+                }
+            }
+
+            const int64_t NB = N / (2 * TILE_N);
+
+            wd.first_block[0] = 0;
+            for (int64_t e = 0; e < n_as; ++e) {
+                const int64_t n = first_row[e + 1];
+                first_row[e + 1]      = first_row[e] + n;
+                wd.first_block[e + 1] = wd.first_block[e] + div_up<int64_t>(n, 2 * TILE_M) * NB;
+            }
+
+            // first_row[e] is the next free row of expert e while filling, restored afterwards
+            for (int64_t iid1 = 0; iid1 < ids->ne[1]; ++iid1) {
+                for (int64_t id = 0; id < n_ids; ++id) {
+                    wd.rows[first_row[get_id(iid1, id)]++] = { (int32_t) id, (int32_t) iid1 };
+                }
+            }
+
+            for (int64_t e = n_as; e > 0; --e) {
+                first_row[e] = first_row[e - 1];
+            }
+            first_row[0] = 0;
+        }
+
+        ggml_barrier(params->threadpool);
+
+        // gather the quantized src1 rows of each expert
+        for (int64_t ir = ith; ir < n_rows; ir += nth) {
+            const mmid_row_mapping row = wd.rows[ir];
+            memcpy(wd.A_gathered + ir * row_size_A, wd.A + (row.i2 * ne11 + row.i1 % ne11) * row_size_A, row_size_A);
+        }
+
+        ggml_barrier(params->threadpool);
+
+        constexpr int BLOCK_M = TILE_M * 2;
+        constexpr int BLOCK_N = TILE_N * 2;
+        const int NB = N / BLOCK_N;
+
+        // per thread output block, scattered to the rows of dst
+        static thread_local float C[BLOCK_M * BLOCK_N];
+
+        parallel_for_ggml(params, wd.first_block[n_as], [&](int begin, int end) {
+            // init tile config for each thread
+            ggml_tile_config_init();
+
+            int64_t e = 0;
+            for (int i = begin; i < end; ++i) {
+                while (wd.first_block[e + 1] <= i) {
+                    e++;
+                }
+
+                const int64_t b = i - wd.first_block[e];
+                const int mb = b / NB;
+                const int nb = b % NB;
+
+                const int64_t n_rows_e = wd.first_row[e + 1] - wd.first_row[e];
+
+                const int mb_start = mb * BLOCK_M;
+                const int mb_size  = std::min<int64_t>(BLOCK_M, n_rows_e - mb_start);
+                const int nb_start = nb * BLOCK_N;
+
+                const char * A = wd.A_gathered + (wd.first_row[e] + mb_start) * row_size_A;
+                const char * B = (const char *) src0->data + e * size_B + PACKED_INDEX(nb * 2, 0, KB, TILE_SIZE);
+
+                if (mb_size == 1) {
+                    tinygemm_kernel_vnni<vec_dot_type, type, float, 1, BLOCK_N, blck_size>::apply(KB, A, B, C, BLOCK_N);
+                } else {
+                    tinygemm_kernel_amx<vec_dot_type, type, float, blck_size>(mb_size, BLOCK_N, KB, A, B, C, BLOCK_N);
+                }
+
+                for (int m = 0; m < mb_size; ++m) {
+                    const mmid_row_mapping row = wd.rows[wd.first_row[e] + mb_start + m];
+                    memcpy((char *) dst->data + row.i1 * dst->nb[1] + row.i2 * dst->nb[2] + nb_start * sizeof(float),
+                            C + m * BLOCK_N, BLOCK_N * sizeof(float));
+                }
+            }
+        });
+    });
+}
+
+// NB: flash attention with AMX-BF16 tiles for prompt processing with a BF16 KV cache
+//
+// q:    {ne3, n_head,    n_q,  DK}, float32
+// k:    {ne3, n_head_kv, n_kv, DK}, bf16
+// v:    {ne3, n_head_kv, n_kv, DV}, bf16
+// mask: {ne3, ne2,       n_q,  n_kv}, f16, optional
+// dst:  {ne3, n_q,       n_head, DV}, float32
+//
+// each work item is a block of FA_BLOCK_Q rows of q of one head, the KV cache is processed in tiles of
+// FA_BLOCK_KV rows with the same 2-2-4 tile pattern as the gemm (a K=16 step per TMUL):
+//   S^T = K * Q^T: A is loaded straight from the KV cache, B is q packed to vnni format once per block
+//   O  += P * V:   A is the bf16 softmax of the tile, B is the tile of V packed to vnni format
+// the online softmax runs on the transposed S^T with avx512, fully masked tiles are skipped
+//
+#if defined(__AMX_BF16__) && defined(__AVX512BF16__)
+
+#define FA_BLOCK_Q  (2 * TILE_M)
+#define FA_BLOCK_KV (2 * TILE_M)
+
+// per thread work space, each buffer is aligned to a cache line:
+//   QB {DK/16, 2, 8, TILE_N, 2}   bf16   q in vnni format, scaled
+//   O  {FA_BLOCK_Q, DV}           float  output accumulator
+//   M  {FA_BLOCK_Q}               float  maximum KQ value of each row
+//   S  {FA_BLOCK_Q}               float  sum of each row
+//   ST {FA_BLOCK_KV, FA_BLOCK_Q}  float  KQ values of the current tile
+//   SQ {FA_BLOCK_Q, FA_BLOCK_KV}  float  KQ values of the current tile, transposed
+//   P  {FA_BLOCK_Q, FA_BLOCK_KV}  bf16   softmax of the current tile
+//   VB {2, DV/16, 8, TILE_N, 2}   bf16   V of the current tile in vnni format
+struct fa_wdata {
+    ggml_bf16_t * QB;
+    float       * O;
+    float       * M;
+    float       * S;
+    float       * ST;
+    float       * SQ;
+    ggml_bf16_t * P;
+    ggml_bf16_t * VB;
+};
+
+static size_t fa_layout(char * base, int64_t DK, int64_t DV, fa_wdata * wd) {
+    size_t offs = 0;
+
+    auto alloc = [&](size_t size) {
+        char * ptr = base ? base + offs : nullptr;
+        offs += GGML_PAD(size, 64);
+        return ptr;
+    };
+
+    fa_wdata tmp;
+    wd = wd ? wd : &tmp;
+
+    wd->QB = (ggml_bf16_t *) alloc(DK * FA_BLOCK_Q * sizeof(ggml_bf16_t));
+    wd->O  = (float *)       alloc(FA_BLOCK_Q * DV * sizeof(float));
+    wd->M  = (float *)       alloc(FA_BLOCK_Q * sizeof(float));
+    wd->S  = (float *)       alloc(FA_BLOCK_Q * sizeof(float));
+    wd->ST = (float *)       alloc(FA_BLOCK_KV * FA_BLOCK_Q * sizeof(float));
+    wd->SQ = (float *)       alloc(FA_BLOCK_Q * FA_BLOCK_KV * sizeof(float));
+    wd->P  = (ggml_bf16_t *) alloc(FA_BLOCK_Q * FA_BLOCK_KV * sizeof(ggml_bf16_t));
+    wd->VB = (ggml_bf16_t *) alloc(FA_BLOCK_KV * DV * sizeof(ggml_bf16_t));
+
+    return offs;
+}
+
+// pack nq rows of q (scaled) to vnni format, the missing rows are zero
+static void fa_pack_q(ggml_bf16_t * RESTRICT QB, const char * RESTRICT q, size_t ldq, int nq, int DK, float scale) {
+    const __m512 vscale = _mm512_set1_ps(scale);
+
+    alignas(64) ggml_bf16_t row[FA_BLOCK_Q][TILE_K];
+
+    // 32 dims (16 vnni pairs) of 16 rows are transposed at a time
+    for (int d0 = 0; d0 < DK; d0 += TILE_K) {
+        for (int h = 0; h < 2; ++h) {
+            __m512i v[16];
+            for (int c = 0; c < TILE_N; ++c) {
+                const int iq = h * TILE_N + c;
+                if (iq < nq) {
+                    const float * x = (const float *)(q + iq * ldq) + d0;
+                    const __m512 x0 = _mm512_mul_ps(_mm512_loadu_ps(x +  0), vscale);
+                    const __m512 x1 = _mm512_mul_ps(_mm512_loadu_ps(x + 16), vscale);
+                    _mm512_store_si512((__m512i *) row[iq], (__m512i) _mm512_cvtne2ps_pbh(x1, x0));
+                } else {
+                    _mm512_store_si512((__m512i *) row[iq], _mm512_setzero_si512());
+                }
+                v[c] = _mm512_load_si512((const __m512i *) row[iq]);
+            }
+
+            transpose_16x16_32bit(v);
+
+            // v[j] holds the pair (d0 + 2j, d0 + 2j + 1) of the 16 rows, which is row j%8 of the B tile of dims d0 + 16*(j/8)
+            for (int j = 0; j < 16; ++j) {
+                const int kc = d0 / 16 + j / 8;
+                _mm512_storeu_si512((__m512i *)(QB + ((kc * 2 + h) * 8 + j % 8) * TILE_N * 2), v[j]);
+            }
+        }
+    }
+}
+
+// pack FA_BLOCK_KV rows of V to vnni format: {2, DV/16, 8, TILE_N, 2}
+static void fa_pack_v(ggml_bf16_t * RESTRICT VB, const char * RESTRICT v, size_t ldv, int DV) {
+    static const __m512i idx_lo = _mm512_set_epi16(
+        47, 15, 46, 14, 45, 13, 44, 12, 43, 11, 42, 10, 41,  9, 40,  8,
+        39,  7, 38,  6, 37,  5, 36,  4, 35,  3, 34,  2, 33,  1, 32,  0);
+    static const __m512i idx_hi = _mm512_set_epi16(
+        63, 31, 62, 30, 61, 29, 60, 28, 59, 27, 58, 26, 57, 25, 56, 24,
+        55, 23, 54, 22, 53, 21, 52, 20, 51, 19, 50, 18, 49, 17, 48, 16);
+
+    const int NC = DV / TILE_N;
+
+    for (int kk = 0; kk < 2; ++kk) {
+        for (int r = 0; r < 8; ++r) {
+            const ggml_bf16_t * v0 = (const ggml_bf16_t *)(v + (kk * TILE_M + 2 * r + 0) * ldv);
+            const ggml_bf16_t * v1 = (const ggml_bf16_t *)(v + (kk * TILE_M + 2 * r + 1) * ldv);
+
+            for (int dc = 0; dc < NC; dc += 2) {
+                const __m512i a = _mm512_loadu_si512((const __m512i *)(v0 + dc * TILE_N));
+                const __m512i b = _mm512_loadu_si512((const __m512i *)(v1 + dc * TILE_N));
+
+                _mm512_store_si512((__m512i *)(VB + ((kk * NC + dc + 0) * 8 + r) * TILE_N * 2), _mm512_permutex2var_epi16(a, idx_lo, b));
+                _mm512_store_si512((__m512i *)(VB + ((kk * NC + dc + 1) * 8 + r) * TILE_N * 2), _mm512_permutex2var_epi16(a, idx_hi, b));
+            }
+        }
+    }
+}
+
+bool ggml_backend_amx_flash_attn_ext_supported(const struct ggml_tensor * op) {
+    const struct ggml_tensor * q    = op->src[0];
+    const struct ggml_tensor * k    = op->src[1];
+    const struct ggml_tensor * v    = op->src[2];
+    const struct ggml_tensor * mask = op->src[3];
+
+    float logit_softcap = 0.0f;
+    memcpy(&logit_softcap, (const float *) op->op_params + 2, sizeof(float));
+
+    return op->op == GGML_OP_FLASH_ATTN_EXT &&
+        q->type == GGML_TYPE_F32 && k->type == GGML_TYPE_BF16 && v->type == GGML_TYPE_BF16 &&
+        (mask == nullptr || mask->type == GGML_TYPE_F16) &&
+        q->nb[0] == sizeof(float) && k->nb[0] == sizeof(ggml_bf16_t) && v->nb[0] == sizeof(ggml_bf16_t) &&
+        k->ne[0] % TILE_K == 0 && v->ne[0] % TILE_K == 0 &&
+        k->ne[1] % FA_BLOCK_KV == 0 &&
+        q->ne[1] >= TILE_M && // the tiles are not worth it for token generation
+        logit_softcap == 0.0f;
+}
+
+size_t ggml_backend_amx_flash_attn_ext_wsize(int n_threads, const struct ggml_tensor * op) {
+    return n_threads * fa_layout(nullptr, op->src[1]->ne[0], op->src[2]->ne[0], nullptr) + 64;
+}
+
+void ggml_backend_amx_flash_attn_ext(const ggml_compute_params * params, struct ggml_tensor * dst) {
+    const struct ggml_tensor * q     = dst->src[0];
+    const struct ggml_tensor * k     = dst->src[1];
+    const struct ggml_tensor * v     = dst->src[2];
+    const struct ggml_tensor * mask      = dst->src[3];
+    const struct ggml_tensor * sinks     = dst->src[4];
+    const struct ggml_tensor * kv_ranges = dst->src[5];
+
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int DK = nek0;
+    const int DV = v->ne[0];
+
+    GGML_ASSERT(ne0 == DV);
+    GGML_ASSERT(nb0 == sizeof(float));
+
+    float scale    = 1.0f;
+    float max_bias = 0.0f;
+
+    memcpy(&scale,    (const float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias, (const float *) dst->op_params + 1, sizeof(float));
+
+    const uint32_t n_head      = neq2;
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
+
+    const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
+
+    // broadcast factors
+    const int64_t rk2 = neq2 / nek2;
+    const int64_t rk3 = neq3 / nek3;
+
+    const int64_t rv2 = neq2 / v->ne[2];
+    const int64_t rv3 = neq3 / v->ne[3];
+
+    const int NQB = div_up<int>(neq1, FA_BLOCK_Q);
+    const int NC  = DV / TILE_N;
+
+    const size_t wsize = fa_layout(nullptr, DK, DV, nullptr);
+    GGML_ASSERT(params->wsize >= params->nth * wsize + 64);
+
+    fa_wdata wd;
+    fa_layout((char *) GGML_PAD((uintptr_t) params->wdata, 64) + params->ith * wsize, DK, DV, &wd);
+
+    const ggml_fp16_t neg_inf = GGML_CPU_FP32_TO_FP16(-INFINITY);
+
+    parallel_for_ggml(params, neq3 * neq2 * NQB, [&](int begin, int end) {
+        // init tile config for each thread
+        ggml_tile_config_init();
+
+        for (int i = begin; i < end; ++i) {
+            const int iq3 = i / (neq2 * NQB);
+            const int iq2 = (i / NQB) % neq2;
+            const int q0  = (i % NQB) * FA_BLOCK_Q;
+            const int nq  = std::min<int>(FA_BLOCK_Q, neq1 - q0);
+
+            const uint32_t h = iq2; // head index
+            const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+            const char * k_data = (const char *) k->data + (iq2 / rk2) * nbk2 + (iq3 / rk3) * nbk3;
+            const char * v_data = (const char *) v->data + (iq2 / rv2) * nbv2 + (iq3 / rv3) * nbv3;
+
+            const char * m_data = mask ? (const char *) mask->data + q0 * mask->nb[1] + (iq2 % mask->ne[2]) * mask->nb[2] + (iq3 % mask->ne[3]) * mask->nb[3] : nullptr;
+
+            fa_pack_q(wd.QB, (const char *) q->data + q0 * nbq1 + iq2 * nbq2 + iq3 * nbq3, nbq1, nq, DK, scale);
+
+            memset(wd.O, 0, FA_BLOCK_Q * DV * sizeof(float));
+            memset(wd.P, 0, FA_BLOCK_Q * FA_BLOCK_KV * sizeof(ggml_bf16_t));
+            for (int iq = 0; iq < FA_BLOCK_Q; ++iq) {
+                wd.M[iq] = -INFINITY;
+                wd.S[iq] = 0.0f;
+            }
+
+            // union of the KV ranges of the queries in the block, aligned to the KV tiles
+            int64_t ic_beg = 0;
+            int64_t ic_end = nek1;
+
+            if (kv_ranges) {
+                ic_beg = nek1;
+                ic_end = 0;
+
+                for (int iq = 0; iq < nq; ++iq) {
+                    const int32_t * pr = (const int32_t *) ((const char *) kv_ranges->data + (q0 + iq) * kv_ranges->nb[1] + (iq3 % kv_ranges->ne[3]) * kv_ranges->nb[3]);
+
+                    if (pr[0] < pr[1]) {
+                        ic_beg = std::min<int64_t>(ic_beg, pr[0]);
+                        ic_end = std::max<int64_t>(ic_end, pr[1]);
+                    }
+                }
+
+                ic_beg = std::max<int64_t>(ic_beg, 0) / FA_BLOCK_KV * FA_BLOCK_KV;
+                ic_end = std::min<int64_t>(div_up<int64_t>(ic_end, FA_BLOCK_KV) * FA_BLOCK_KV, nek1);
+            }
+
+            for (int64_t ic0 = ic_beg; ic0 < ic_end; ic0 += FA_BLOCK_KV) {
+                // skip the tile if all the rows are masked
+                if (m_data) {
+                    bool masked = true;
+                    for (int iq = 0; iq < nq && masked; ++iq) {
+                        const __m512i vm = _mm512_loadu_si512((const __m512i *)((const ggml_fp16_t *)(m_data + iq * mask->nb[1]) + ic0));
+                        masked = _mm512_cmpneq_epi16_mask(vm, _mm512_set1_epi16(neg_inf)) == 0;
+                    }
+                    if (masked) {
+                        continue;
+                    }
+                }
+
+                // S^T = K * Q^T
+                const char * k_tile = k_data + ic0 * nbk1;
+
+                _tile_zero(TMM4);
+                _tile_zero(TMM5);
+                _tile_zero(TMM6);
+                _tile_zero(TMM7);
+
+                for (int kc = 0; kc < DK / 16; ++kc) {
+                    _tile_loadd(TMM2, k_tile + kc * 32, nbk1);
+                    _tile_loadd(TMM3, k_tile + TILE_M * nbk1 + kc * 32, nbk1);
+                    _tile_loadd(TMM0, wd.QB + (kc * 2 + 0) * 8 * TILE_N * 2, TILE_N * 4);
+                    _tile_loadd(TMM1, wd.QB + (kc * 2 + 1) * 8 * TILE_N * 2, TILE_N * 4);
+                    _tile_dpbf16ps(TMM4, TMM2, TMM0);
+                    _tile_dpbf16ps(TMM5, TMM3, TMM0);
+                    _tile_dpbf16ps(TMM6, TMM2, TMM1);
+                    _tile_dpbf16ps(TMM7, TMM3, TMM1);
+                }
+
+                _tile_stored(TMM4, wd.ST,                                  FA_BLOCK_Q * sizeof(float));
+                _tile_stored(TMM5, wd.ST + TILE_M * FA_BLOCK_Q,            FA_BLOCK_Q * sizeof(float));
+                _tile_stored(TMM6, wd.ST + TILE_N,                         FA_BLOCK_Q * sizeof(float));
+                _tile_stored(TMM7, wd.ST + TILE_M * FA_BLOCK_Q + TILE_N,   FA_BLOCK_Q * sizeof(float));
+
+                // pack V while the tiles are busy
+                fa_pack_v(wd.VB, v_data + ic0 * nbv1, nbv1, DV);
+
+                for (int bk = 0; bk < 2; ++bk) {
+                    for (int bq = 0; bq < 2; ++bq) {
+                        __m512i vt[16];
+                        for (int r = 0; r < 16; ++r) {
+                            vt[r] = _mm512_loadu_si512((const __m512i *)(wd.ST + (bk * 16 + r) * FA_BLOCK_Q + bq * 16));
+                        }
+                        transpose_16x16_32bit(vt);
+                        for (int r = 0; r < 16; ++r) {
+                            _mm512_storeu_si512((__m512i *)(wd.SQ + (bq * 16 + r) * FA_BLOCK_KV + bk * 16), vt[r]);
+                        }
+                    }
+                }
+
+                // online softmax of each row
+                for (int iq = 0; iq < nq; ++iq) {
+                    float * sq = wd.SQ + iq * FA_BLOCK_KV;
+
+                    __m512 s0 = _mm512_loadu_ps(sq +  0);
+                    __m512 s1 = _mm512_loadu_ps(sq + 16);
+
+                    if (m_data) {
+                        const ggml_fp16_t * mp = (const ggml_fp16_t *)(m_data + iq * mask->nb[1]) + ic0;
+                        const __m512 vslope = _mm512_set1_ps(slope);
+                        s0 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(mp +  0))), vslope, s0);
+                        s1 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(mp + 16))), vslope, s1);
+                    }
+
+                    const float Mt = ::_mm512_reduce_max_ps(_mm512_max_ps(s0, s1));
+
+                    ggml_bf16_t * p = wd.P + iq * FA_BLOCK_KV;
+
+                    if (Mt == -INFINITY) {
+                        // the whole row is masked
+                        _mm512_storeu_si512((__m512i *) p, _mm512_setzero_si512());
+                        continue;
+                    }
+
+                    if (Mt > wd.M[iq]) {
+                        // new maximum, scale O and the sum with expf(Mold - M)
+                        const float ms = expf(wd.M[iq] - Mt);
+                        wd.M[iq] = Mt;
+                        wd.S[iq] *= ms;
+                        ggml_vec_scale_f32(DV, wd.O + iq * DV, ms);
+                    }
+
+                    _mm512_storeu_ps(sq +  0, s0);
+                    _mm512_storeu_ps(sq + 16, s1);
+
+                    wd.S[iq] += (float) ggml_vec_soft_max_f32(FA_BLOCK_KV, sq, sq, wd.M[iq]);
+
+                    _mm512_storeu_si512((__m512i *) p, (__m512i) _mm512_cvtne2ps_pbh(_mm512_loadu_ps(sq + 16), _mm512_loadu_ps(sq)));
+                }
+
+                // O += P * V
+                for (int dc = 0; dc < NC; dc += 2) {
+                    float * o = wd.O + dc * TILE_N;
+
+                    _tile_loadd(TMM4, o,                        DV * sizeof(float));
+                    _tile_loadd(TMM5, o + TILE_M * DV,          DV * sizeof(float));
+                    _tile_loadd(TMM6, o + TILE_N,               DV * sizeof(float));
+                    _tile_loadd(TMM7, o + TILE_M * DV + TILE_N, DV * sizeof(float));
+
+                    for (int kk = 0; kk < 2; ++kk) {
+                        _tile_loadd(TMM2, wd.P + kk * 16,                       FA_BLOCK_KV * sizeof(ggml_bf16_t));
+                        _tile_loadd(TMM3, wd.P + TILE_M * FA_BLOCK_KV + kk * 16, FA_BLOCK_KV * sizeof(ggml_bf16_t));
+                        _tile_loadd(TMM0, wd.VB + ((kk * NC + dc + 0) * 8) * TILE_N * 2, TILE_N * 4);
+                        _tile_loadd(TMM1, wd.VB + ((kk * NC + dc + 1) * 8) * TILE_N * 2, TILE_N * 4);
+                        _tile_dpbf16ps(TMM4, TMM2, TMM0);
+                        _tile_dpbf16ps(TMM5, TMM3, TMM0);
+                        _tile_dpbf16ps(TMM6, TMM2, TMM1);
+                        _tile_dpbf16ps(TMM7, TMM3, TMM1);
+                    }
+
+                    _tile_stored(TMM4, o,                        DV * sizeof(float));
+                    _tile_stored(TMM5, o + TILE_M * DV,          DV * sizeof(float));
+                    _tile_stored(TMM6, o + TILE_N,               DV * sizeof(float));
+                    _tile_stored(TMM7, o + TILE_M * DV + TILE_N, DV * sizeof(float));
+                }
+            }
+
+            for (int iq = 0; iq < nq; ++iq) {
+                float * o = wd.O + iq * DV;
+
+                float S = wd.S[iq];
+
+                // sinks
+                if (sinks) {
+                    const float s = ((const float *) sinks->data)[h];
+                    const float M = wd.M[iq];
+
+                    float ms = 1.0f;
+                    float vs = 1.0f;
+
+                    if (s > M) {
+                        ms = expf(M - s);
+                        ggml_vec_scale_f32(DV, o, ms);
+                    } else {
+                        vs = expf(s - M);
+                    }
+
+                    S = S*ms + vs;
+                }
+
+                // O /= S
+                ggml_vec_scale_f32(DV, o, 1.0f/S);
+
+                // permute(0, 2, 1, 3)
+                memcpy((char *) dst->data + (iq3*ne2*ne1 + iq2 + (q0 + iq)*ne1)*nb1, o, nb1);
+            }
+        }
+    });
+}
+
+#else
+
+bool ggml_backend_amx_flash_attn_ext_supported(const struct ggml_tensor * op) {
+    GGML_UNUSED(op);
+    return false;
+}
+
+size_t ggml_backend_amx_flash_attn_ext_wsize(int n_threads, const struct ggml_tensor * op) {
+    GGML_UNUSED(n_threads);
+    GGML_UNUSED(op);
+    return 0;
+}
+
+void ggml_backend_amx_flash_attn_ext(const ggml_compute_params * params, struct ggml_tensor * dst) {
+    GGML_UNUSED(params);
+    GGML_UNUSED(dst);
+    GGML_ABORT("AMX-BF16 is not available");
+}
+
+#endif // defined(__AMX_BF16__) && defined(__AVX512BF16__)
+
 #endif // if defined(__AMX_INT8__) && defined(__AVX512VNNI__)
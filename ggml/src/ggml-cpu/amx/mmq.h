@@ -8,3 +8,11 @@ size_t ggml_backend_amx_get_alloc_size(const struct ggml_tensor * tensor);
 void ggml_backend_amx_convert_weight(struct ggml_tensor * tensor, const void * data, size_t offset, size_t size);
 
 void ggml_backend_amx_mul_mat(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+
+void ggml_backend_amx_mul_mat_id(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+
+bool ggml_backend_amx_flash_attn_ext_supported(const struct ggml_tensor * op);
+
+size_t ggml_backend_amx_flash_attn_ext_wsize(int n_threads, const struct ggml_tensor * op);
+
+void ggml_backend_amx_flash_attn_ext(const struct ggml_compute_params * params, struct ggml_tensor * dst);
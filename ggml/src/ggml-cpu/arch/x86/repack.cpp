@@ -1373,6 +1373,448 @@ static void gemm_q4_b32_8x8_q8_0_lut_avx(int n, float * GGML_RESTRICT s, size_t
 
 #endif // defined(__AVX2__) || defined(__AVX512F__)
 
+#if defined(__AVX2__)
+// Kernels for the 8-row interleaved Q8_0, Q5_K, Q6_K and IQ4_XS layouts
+// A 32-byte load of the weights holds 8 consecutive quants of 4 rows, the activations are broadcast
+// to the 4 rows and the two halves of an 8-row block are reduced with hadd + permute
+
+#if (defined(__AVX512VNNI__) && defined(__AVX512VL__)) || defined(__AVXVNNI__)
+#define GGML_REPACK_X8_DPBUSD
+#endif
+
+// The products of one sub-block are summed in int16 with maddubs and the sub-block scales are applied with madd.
+// This is exact as long as the maddubs sums of a sub-block stay below 2^15, which holds for 4 chunks of unsigned
+// 5-bit quants or 2 chunks of 6-bit quants, and is cheaper than dpbusd followed by a 32-bit multiply.
+static inline __m256i repack_x8_dot_us8(const __m256i acc, const __m256i x, const __m256i y) {
+    return _mm256_add_epi16(acc, _mm256_maddubs_epi16(x, y));
+}
+
+// 8 int16 scales (one per row) to the madd multipliers of rows 0-3 (h = 0) or 4-7 (h = 1)
+static inline __m256i repack_x8_expand_scales(const __m128i sc16, int h) {
+    const __m256i sc = _mm256_broadcastsi128_si256(sc16);
+    return _mm256_shuffle_epi8(sc, h == 0 ?
+        _mm256_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 2, 3, 4, 5, 4, 5, 4, 5, 4, 5, 6, 7, 6, 7, 6, 7, 6, 7) :
+        _mm256_setr_epi8(8, 9, 8, 9, 8, 9, 8, 9, 10, 11, 10, 11, 10, 11, 10, 11, 12, 13, 12, 13, 12, 13, 12, 13, 14, 15, 14, 15, 14, 15, 14, 15));
+}
+
+#if defined(GGML_REPACK_X8_DPBUSD)
+// same for the int32 sums of dpbusd
+static inline __m256i repack_x8_expand_scales_i32(const __m128i sc16, int h) {
+    return _mm256_permutevar8x32_epi32(_mm256_cvtepi16_epi32(sc16),
+        h == 0 ? _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3) : _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7));
+}
+#endif
+
+// the int32 pair sums of rows 0-3 and 4-7 to one int32 per row
+static inline __m256i repack_x8_reduce(const __m256i sum_0123, const __m256i sum_4567) {
+    return _mm256_permutevar8x32_epi32(_mm256_hadd_epi32(sum_0123, sum_4567), _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+}
+
+// 8 quants of the activation row m, broadcast to the 4 rows of a weight load
+// block_q8_K / block_q8_0 are used by gemv, the 4-row interleaved blocks by gemm
+static inline __m256i repack_x8_load_a(const block_q8_K & a, int m, int c) {
+    UNUSED(m);
+    return _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *) (a.qs + c * 8)));
+}
+
+static inline __m256i repack_x8_load_a(const block_q8_Kx4 & a, int m, int c) {
+    return _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *) (a.qs + c * 32 + m * 8)));
+}
+
+static inline __m256i repack_x8_load_a(const block_q8_0 & a, int m, int c) {
+    UNUSED(m);
+    return _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *) (a.qs + c * 8)));
+}
+
+static inline __m256i repack_x8_load_a(const block_q8_0x4 & a, int m, int c) {
+    return _mm256_broadcastq_epi64(_mm_loadl_epi64((const __m128i *) (a.qs + c * 32 + m * 8)));
+}
+
+static inline float repack_x8_a_d(const block_q8_K & a, int m)   { UNUSED(m); return a.d; }
+static inline float repack_x8_a_d(const block_q8_Kx4 & a, int m) { return a.d[m]; }
+static inline float repack_x8_a_d(const block_q8_0 & a, int m)   { UNUSED(m); return GGML_CPU_FP16_TO_FP32(a.d); }
+static inline float repack_x8_a_d(const block_q8_0x4 & a, int m) { return GGML_CPU_FP16_TO_FP32(a.d[m]); }
+
+// sums of the 16-element groups 2p and 2p + 1 of the activation row m as an int16 pair
+static inline __m256i repack_x8_a_bsums(const block_q8_K & a, int m, int p) {
+    UNUSED(m);
+    int32_t v;
+    memcpy(&v, a.bsums + 2 * p, sizeof(v));
+    return _mm256_set1_epi32(v);
+}
+
+static inline __m256i repack_x8_a_bsums(const block_q8_Kx4 & a, int m, int p) {
+    int32_t v;
+    memcpy(&v, a.bsums + (p / 2) * 16 + m * 4 + (p % 2) * 2, sizeof(v));
+    return _mm256_set1_epi32(v);
+}
+
+// row-wise dot product of 8 int16 pairs (one per row) with a broadcast int16 pair
+static inline __m256i repack_x8_pairs(const __m128i v0, const __m128i v1) {
+    return _mm256_cvtepi8_epi16(_mm_unpacklo_epi8(v0, v1));
+}
+
+static inline void repack_x8_store(float * GGML_RESTRICT s, size_t bs, int row, int x, const __m256 v) {
+    _mm256_storeu_ps(s + row * bs + x * 8, v);
+}
+
+template <int nrows, typename block_ay>
+static void gemm_q8_0_8x8_q8_0_avx2(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int nb = n / QK8_0;
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_ay * a_ptr = (const block_ay *) vy + y * nb;
+        for (int x = 0; x < nc / 8; x++) {
+            const block_q8_0x8 * b_ptr = (const block_q8_0x8 *) vx + x * nb;
+
+            __m256 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm256_setzero_ps();
+            }
+
+            for (int l = 0; l < nb; l++) {
+                const __m256 d_b = GGML_F32Cx8_LOAD(b_ptr[l].d);
+
+                __m256i w[4][2];
+                for (int c = 0; c < 4; c++) {
+                    w[c][0] = _mm256_loadu_si256((const __m256i *) (b_ptr[l].qs + c * 64));
+                    w[c][1] = _mm256_loadu_si256((const __m256i *) (b_ptr[l].qs + c * 64 + 32));
+                }
+
+                for (int m = 0; m < nrows; m++) {
+                    __m256i sum_0 = _mm256_setzero_si256();
+                    __m256i sum_1 = _mm256_setzero_si256();
+                    for (int c = 0; c < 4; c++) {
+                        const __m256i a = repack_x8_load_a(a_ptr[l], m, c);
+                        sum_0 = mul_sum_i8_pairs_acc_int32x8(sum_0, w[c][0], a);
+                        sum_1 = mul_sum_i8_pairs_acc_int32x8(sum_1, w[c][1], a);
+                    }
+                    const __m256 d = _mm256_mul_ps(d_b, _mm256_set1_ps(repack_x8_a_d(a_ptr[l], m)));
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(repack_x8_reduce(sum_0, sum_1)), d, acc[m]);
+                }
+            }
+
+            for (int m = 0; m < nrows; m++) {
+                repack_x8_store(s, bs, y * nrows + m, x, acc[m]);
+            }
+        }
+    }
+}
+
+template <int nrows, typename block_ay>
+static void gemm_q5_K_8x8_q8_K_avx2(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    static const uint32_t kmask1 = 0x3f3f3f3f;
+    static const uint32_t kmask2 = 0x0f0f0f0f;
+    static const uint32_t kmask3 = 0x03030303;
+
+    const int nb = n / QK_K;
+
+    const __m256i m4  = _mm256_set1_epi8(0x0F);
+    const __m256i m1  = _mm256_set1_epi8(0x01);
+    const __m256i m1h = _mm256_set1_epi8(0x02);
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_ay * a_ptr = (const block_ay *) vy + y * nb;
+        for (int x = 0; x < nc / 8; x++) {
+            const block_q5_Kx8 * b_ptr = (const block_q5_Kx8 *) vx + x * nb;
+
+            __m256 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm256_setzero_ps();
+            }
+
+            for (int l = 0; l < nb; l++) {
+                const block_q5_Kx8 & b = b_ptr[l];
+
+                // scales and mins of sub-block sb in bytes sb * 16 + [0, 8) and sb * 16 + [8, 16), see the generic implementation
+                uint32_t utmp[32];
+                for (int sb = 0; sb < 8; sb++) {
+                    memcpy(utmp + sb * 4, b.scales + sb * 12, 12);
+                    utmp[sb * 4 + 3] = ((utmp[sb * 4 + 2] >> 4) & kmask2) | (((utmp[sb * 4 + 1] >> 6) & kmask3) << 4);
+                    const uint32_t uaux_0 = utmp[sb * 4 + 1] & kmask1;
+                    utmp[sb * 4 + 1] = (utmp[sb * 4 + 2] & kmask2) | (((utmp[sb * 4 + 0] >> 6) & kmask3) << 4);
+                    utmp[sb * 4 + 2] = uaux_0;
+                    utmp[sb * 4 + 0] &= kmask1;
+                }
+                const uint8_t * sm = (const uint8_t *) utmp;
+
+                __m256i sumi[nrows][2];
+                __m256i summ[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m][0] = sumi[m][1] = summ[m] = _mm256_setzero_si256();
+                }
+
+                for (int g = 0; g < 4; g++) {
+                    __m256i sc[2][2];
+                    for (int i = 0; i < 2; i++) {
+                        const __m128i sc16 = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (sm + (2 * g + i) * 16)));
+                        sc[i][0] = repack_x8_expand_scales(sc16, 0);
+                        sc[i][1] = repack_x8_expand_scales(sc16, 1);
+                    }
+                    const __m128i shift = _mm_cvtsi32_si128(2 * g);
+
+                    __m256i raw[nrows][2][2];
+                    for (int m = 0; m < nrows; m++) {
+                        raw[m][0][0] = raw[m][0][1] = raw[m][1][0] = raw[m][1][1] = _mm256_setzero_si256();
+                    }
+                    for (int kk = 0; kk < 4; kk++) {
+                        const int k = g * 4 + kk;
+                        __m256i w[2][2];
+                        for (int h = 0; h < 2; h++) {
+                            const __m256i ql = _mm256_loadu_si256((const __m256i *) (b.qs + k * 64 + h * 32));
+                            const __m256i qh = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (b.qh + kk * 64 + h * 32)), shift);
+                            w[0][h] = _mm256_or_si256(_mm256_and_si256(ql, m4), _mm256_slli_epi16(_mm256_and_si256(qh, m1), 4));
+                            w[1][h] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql, 4), m4), _mm256_slli_epi16(_mm256_and_si256(qh, m1h), 3));
+                        }
+                        for (int m = 0; m < nrows; m++) {
+                            const __m256i a0 = repack_x8_load_a(a_ptr[l], m, g * 8 + kk);
+                            const __m256i a1 = repack_x8_load_a(a_ptr[l], m, g * 8 + 4 + kk);
+                            for (int h = 0; h < 2; h++) {
+                                raw[m][0][h] = repack_x8_dot_us8(raw[m][0][h], w[0][h], a0);
+                                raw[m][1][h] = repack_x8_dot_us8(raw[m][1][h], w[1][h], a1);
+                            }
+                        }
+                    }
+                    for (int m = 0; m < nrows; m++) {
+                        for (int h = 0; h < 2; h++) {
+                            sumi[m][h] = _mm256_add_epi32(sumi[m][h], _mm256_madd_epi16(raw[m][0][h], sc[0][h]));
+                            sumi[m][h] = _mm256_add_epi32(sumi[m][h], _mm256_madd_epi16(raw[m][1][h], sc[1][h]));
+                        }
+                    }
+
+                    // mins of the sub-blocks 2g and 2g + 1
+                    const __m256i mins = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(
+                        _mm_loadl_epi64((const __m128i *) (sm + (2 * g + 0) * 16 + 8)),
+                        _mm_loadl_epi64((const __m128i *) (sm + (2 * g + 1) * 16 + 8))));
+                    for (int m = 0; m < nrows; m++) {
+                        // the bsums of the two 32-element sub-blocks as an int16 pair
+                        const __m256i bs_lo = repack_x8_a_bsums(a_ptr[l], m, 2 * g);
+                        const __m256i bs_hi = repack_x8_a_bsums(a_ptr[l], m, 2 * g + 1);
+                        const __m256i bsums = _mm256_blend_epi16(
+                            _mm256_add_epi16(bs_lo, _mm256_srli_epi32(bs_lo, 16)),
+                            _mm256_slli_epi32(_mm256_add_epi16(bs_hi, _mm256_srli_epi32(bs_hi, 16)), 16), 0xAA);
+                        summ[m] = _mm256_add_epi32(summ[m], _mm256_madd_epi16(mins, bsums));
+                    }
+                }
+
+                const __m256 d    = GGML_F32Cx8_LOAD(b.d);
+                const __m256 dmin = GGML_F32Cx8_LOAD(b.dmin);
+                for (int m = 0; m < nrows; m++) {
+                    const __m256 da = _mm256_set1_ps(repack_x8_a_d(a_ptr[l], m));
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(repack_x8_reduce(sumi[m][0], sumi[m][1])), _mm256_mul_ps(d, da), acc[m]);
+                    acc[m] = _mm256_fnmadd_ps(_mm256_cvtepi32_ps(summ[m]), _mm256_mul_ps(dmin, da), acc[m]);
+                }
+            }
+
+            for (int m = 0; m < nrows; m++) {
+                repack_x8_store(s, bs, y * nrows + m, x, acc[m]);
+            }
+        }
+    }
+}
+
+template <int nrows, typename block_ay>
+static void gemm_q6_K_8x8_q8_K_avx2(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int nb = n / QK_K;
+
+    const __m256i m4  = _mm256_set1_epi8(0x0F);
+    const __m256i m2  = _mm256_set1_epi8(0x03);
+    const __m256i m2h = _mm256_set1_epi8(0x0C);
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_ay * a_ptr = (const block_ay *) vy + y * nb;
+        for (int x = 0; x < nc / 8; x++) {
+            const block_q6_Kx8 * b_ptr = (const block_q6_Kx8 *) vx + x * nb;
+
+            __m256 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm256_setzero_ps();
+            }
+
+            for (int l = 0; l < nb; l++) {
+                const block_q6_Kx8 & b = b_ptr[l];
+
+                __m256i sumi[nrows][2];
+                __m256i sumo[nrows];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m][0] = sumi[m][1] = sumo[m] = _mm256_setzero_si256();
+                }
+
+                for (int g = 0; g < 4; g++) {
+                    const __m128i shift = _mm_cvtsi32_si128(4 * (g % 2));
+
+                    // the 16-element groups 4g + kp (low nibbles) and 4g + 2 + kp (high nibbles)
+                    for (int kp = 0; kp < 2; kp++) {
+                        __m256i sc[2][2];
+                        for (int i = 0; i < 2; i++) {
+                            const __m128i sc16 = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *) (b.scales + (4 * g + 2 * i + kp) * 8)));
+                            sc[i][0] = repack_x8_expand_scales(sc16, 0);
+                            sc[i][1] = repack_x8_expand_scales(sc16, 1);
+                        }
+
+                        __m256i raw[nrows][2][2];
+                        for (int m = 0; m < nrows; m++) {
+                            raw[m][0][0] = raw[m][0][1] = raw[m][1][0] = raw[m][1][1] = _mm256_setzero_si256();
+                        }
+                        for (int kk = 2 * kp; kk < 2 * kp + 2; kk++) {
+                            const int k = g * 4 + kk;
+                            __m256i w[2][2];
+                            for (int h = 0; h < 2; h++) {
+                                const __m256i ql = _mm256_loadu_si256((const __m256i *) (b.ql + k * 64 + h * 32));
+                                const __m256i qh = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i *) (b.qh + (g / 2) * 256 + kk * 64 + h * 32)), shift);
+                                w[0][h] = _mm256_or_si256(_mm256_and_si256(ql, m4), _mm256_slli_epi16(_mm256_and_si256(qh, m2), 4));
+                                w[1][h] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql, 4), m4), _mm256_slli_epi16(_mm256_and_si256(qh, m2h), 2));
+                            }
+                            for (int m = 0; m < nrows; m++) {
+                                const __m256i a0 = repack_x8_load_a(a_ptr[l], m, g * 8 + kk);
+                                const __m256i a1 = repack_x8_load_a(a_ptr[l], m, g * 8 + 4 + kk);
+                                for (int h = 0; h < 2; h++) {
+                                    raw[m][0][h] = repack_x8_dot_us8(raw[m][0][h], w[0][h], a0);
+                                    raw[m][1][h] = repack_x8_dot_us8(raw[m][1][h], w[1][h], a1);
+                                }
+                            }
+                        }
+                        for (int m = 0; m < nrows; m++) {
+                            for (int h = 0; h < 2; h++) {
+                                sumi[m][h] = _mm256_add_epi32(sumi[m][h], _mm256_madd_epi16(raw[m][0][h], sc[0][h]));
+                                sumi[m][h] = _mm256_add_epi32(sumi[m][h], _mm256_madd_epi16(raw[m][1][h], sc[1][h]));
+                            }
+                        }
+                    }
+
+                    // the quants are stored with an offset of 32: subtract 32 * scale * bsum of the groups 4g .. 4g + 3
+                    for (int p = 2 * g; p < 2 * g + 2; p++) {
+                        const __m256i sc = repack_x8_pairs(
+                            _mm_loadl_epi64((const __m128i *) (b.scales + (2 * p + 0) * 8)),
+                            _mm_loadl_epi64((const __m128i *) (b.scales + (2 * p + 1) * 8)));
+                        for (int m = 0; m < nrows; m++) {
+                            sumo[m] = _mm256_add_epi32(sumo[m], _mm256_madd_epi16(sc, repack_x8_a_bsums(a_ptr[l], m, p)));
+                        }
+                    }
+                }
+
+                const __m256 d = GGML_F32Cx8_LOAD(b.d);
+                for (int m = 0; m < nrows; m++) {
+                    const __m256i sum = _mm256_sub_epi32(repack_x8_reduce(sumi[m][0], sumi[m][1]), _mm256_slli_epi32(sumo[m], 5));
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(sum), _mm256_mul_ps(d, _mm256_set1_ps(repack_x8_a_d(a_ptr[l], m))), acc[m]);
+                }
+            }
+
+            for (int m = 0; m < nrows; m++) {
+                repack_x8_store(s, bs, y * nrows + m, x, acc[m]);
+            }
+        }
+    }
+}
+
+template <int nrows, typename block_ay>
+static void gemm_iq4_xs_8x8_q8_K_avx2(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+    const int nb = n / QK_K;
+
+    const __m256i m4     = _mm256_set1_epi8(0x0F);
+    const __m256i values = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) kvalues_iq4nl));
+
+    for (int y = 0; y < nr / nrows; y++) {
+        const block_ay * a_ptr = (const block_ay *) vy + y * nb;
+        for (int x = 0; x < nc / 8; x++) {
+            const block_iq4_xsx8 * b_ptr = (const block_iq4_xsx8 *) vx + x * nb;
+
+            __m256 acc[nrows];
+            for (int m = 0; m < nrows; m++) {
+                acc[m] = _mm256_setzero_ps();
+            }
+
+            for (int l = 0; l < nb; l++) {
+                const block_iq4_xsx8 & b = b_ptr[l];
+
+                const __m128i scales_h = _mm_loadu_si128((const __m128i *) b.scales_h);
+
+                __m256i sumi[nrows][2];
+                for (int m = 0; m < nrows; m++) {
+                    sumi[m][0] = sumi[m][1] = _mm256_setzero_si256();
+                }
+
+                for (int g = 0; g < 4; g++) {
+                    // the scales of the sub-blocks 2g and 2g + 1 as int16, one per row
+                    __m256i sc[2][2];
+                    {
+                        const __m128i sl = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (b.scales_l + g * 8)));
+                        const __m128i sh = _mm_srl_epi16(scales_h, _mm_cvtsi32_si128(4 * g));
+                        const __m128i m4_16 = _mm_set1_epi16(0x0F);
+                        const __m128i m3_16 = _mm_set1_epi16(0x03);
+                        const __m128i off   = _mm_set1_epi16(32);
+                        const __m128i sc0 = _mm_sub_epi16(_mm_or_si128(_mm_and_si128(sl, m4_16), _mm_slli_epi16(_mm_and_si128(sh, m3_16), 4)), off);
+                        const __m128i sc1 = _mm_sub_epi16(_mm_or_si128(_mm_srli_epi16(sl, 4), _mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(sh, 2), m3_16), 4)), off);
+#if defined(GGML_REPACK_X8_DPBUSD)
+                        sc[0][0] = repack_x8_expand_scales_i32(sc0, 0);
+                        sc[0][1] = repack_x8_expand_scales_i32(sc0, 1);
+                        sc[1][0] = repack_x8_expand_scales_i32(sc1, 0);
+                        sc[1][1] = repack_x8_expand_scales_i32(sc1, 1);
+#else
+                        sc[0][0] = repack_x8_expand_scales(sc0, 0);
+                        sc[0][1] = repack_x8_expand_scales(sc0, 1);
+                        sc[1][0] = repack_x8_expand_scales(sc1, 0);
+                        sc[1][1] = repack_x8_expand_scales(sc1, 1);
+#endif
+                    }
+
+#if defined(GGML_REPACK_X8_DPBUSD)
+                    // the int32 dot products of the sub-blocks, scaled once per sub-block
+                    __m256i raw[nrows][2][2];
+                    for (int m = 0; m < nrows; m++) {
+                        raw[m][0][0] = raw[m][0][1] = raw[m][1][0] = raw[m][1][1] = _mm256_setzero_si256();
+                    }
+#endif
+                    for (int kk = 0; kk < 4; kk++) {
+                        const int k = g * 4 + kk;
+                        __m256i w[2][2];
+                        for (int h = 0; h < 2; h++) {
+                            const __m256i q = _mm256_loadu_si256((const __m256i *) (b.qs + k * 64 + h * 32));
+                            w[0][h] = _mm256_shuffle_epi8(values, _mm256_and_si256(q, m4));
+                            w[1][h] = _mm256_shuffle_epi8(values, _mm256_and_si256(_mm256_srli_epi16(q, 4), m4));
+                        }
+                        for (int m = 0; m < nrows; m++) {
+                            const __m256i a0 = repack_x8_load_a(a_ptr[l], m, g * 8 + kk);
+                            const __m256i a1 = repack_x8_load_a(a_ptr[l], m, g * 8 + 4 + kk);
+                            for (int h = 0; h < 2; h++) {
+#if defined(GGML_REPACK_X8_DPBUSD)
+                                raw[m][0][h] = mul_sum_i8_pairs_acc_int32x8(raw[m][0][h], w[0][h], a0);
+                                raw[m][1][h] = mul_sum_i8_pairs_acc_int32x8(raw[m][1][h], w[1][h], a1);
+#else
+                                // the int16 sums of two chunks of signed 8-bit products may overflow, scale every chunk
+                                const __m256i p0 = _mm256_maddubs_epi16(_mm256_sign_epi8(w[0][h], w[0][h]), _mm256_sign_epi8(a0, w[0][h]));
+                                const __m256i p1 = _mm256_maddubs_epi16(_mm256_sign_epi8(w[1][h], w[1][h]), _mm256_sign_epi8(a1, w[1][h]));
+                                sumi[m][h] = _mm256_add_epi32(sumi[m][h], _mm256_madd_epi16(p0, sc[0][h]));
+                                sumi[m][h] = _mm256_add_epi32(sumi[m][h], _mm256_madd_epi16(p1, sc[1][h]));
+#endif
+                            }
+                        }
+                    }
+#if defined(GGML_REPACK_X8_DPBUSD)
+                    for (int m = 0; m < nrows; m++) {
+                        for (int h = 0; h < 2; h++) {
+                            sumi[m][h] = _mm256_add_epi32(sumi[m][h], _mm256_mullo_epi32(raw[m][0][h], sc[0][h]));
+                            sumi[m][h] = _mm256_add_epi32(sumi[m][h], _mm256_mullo_epi32(raw[m][1][h], sc[1][h]));
+                        }
+                    }
+#endif
+                }
+
+                const __m256 d = GGML_F32Cx8_LOAD(b.d);
+                for (int m = 0; m < nrows; m++) {
+                    const __m256 da = _mm256_set1_ps(repack_x8_a_d(a_ptr[l], m));
+                    acc[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(repack_x8_reduce(sumi[m][0], sumi[m][1])), _mm256_mul_ps(d, da), acc[m]);
+                }
+            }
+
+            for (int m = 0; m < nrows; m++) {
+                repack_x8_store(s, bs, y * nrows + m, x, acc[m]);
+            }
+        }
+    }
+}
+#endif // defined(__AVX2__)
+
 void ggml_gemv_q4_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
 #if defined(__AVX2__) || defined(__AVX512F__)
     {
@@ -6305,3 +6747,67 @@ void ggml_gemm_q2_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const vo
 
 #endif
 }
+
+void ggml_gemv_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    gemm_q8_0_8x8_q8_0_avx2<1, block_q8_0>(n, s, bs, vx, vy, nr, nc);
+#else
+    ggml_gemv_q8_0_8x8_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemv_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    gemm_q5_K_8x8_q8_K_avx2<1, block_q8_K>(n, s, bs, vx, vy, nr, nc);
+#else
+    ggml_gemv_q5_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemv_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    gemm_q6_K_8x8_q8_K_avx2<1, block_q8_K>(n, s, bs, vx, vy, nr, nc);
+#else
+    ggml_gemv_q6_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemv_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    gemm_iq4_xs_8x8_q8_K_avx2<1, block_q8_K>(n, s, bs, vx, vy, nr, nc);
+#else
+    ggml_gemv_iq4_xs_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemm_q8_0_8x8_q8_0(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    gemm_q8_0_8x8_q8_0_avx2<4, block_q8_0x4>(n, s, bs, vx, vy, nr, nc);
+#else
+    ggml_gemm_q8_0_8x8_q8_0_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemm_q5_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    gemm_q5_K_8x8_q8_K_avx2<4, block_q8_Kx4>(n, s, bs, vx, vy, nr, nc);
+#else
+    ggml_gemm_q5_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemm_q6_K_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    gemm_q6_K_8x8_q8_K_avx2<4, block_q8_Kx4>(n, s, bs, vx, vy, nr, nc);
+#else
+    ggml_gemm_q6_K_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
+
+void ggml_gemm_iq4_xs_8x8_q8_K(int n, float * GGML_RESTRICT s, size_t bs, const void * GGML_RESTRICT vx, const void * GGML_RESTRICT vy, int nr, int nc) {
+#if defined(__AVX2__)
+    gemm_iq4_xs_8x8_q8_K_avx2<4, block_q8_Kx4>(n, s, bs, vx, vy, nr, nc);
+#else
+    ggml_gemm_iq4_xs_8x8_q8_K_generic(n, s, bs, vx, vy, nr, nc);
+#endif
+}
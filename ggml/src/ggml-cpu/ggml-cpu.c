@@ -36,6 +36,11 @@
 #include <signal.h>
 #if defined(__gnu_linux__)
 #include <syscall.h>
+#include <linux/futex.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
 #endif
 
 #ifdef GGML_USE_OPENMP
@@ -59,6 +64,12 @@
 #define GGML_CACHE_ALIGN __attribute__((aligned(GGML_CACHE_LINE)))
 #endif
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#define GGML_THREAD_LOCAL __declspec(thread)
+#else
+#define GGML_THREAD_LOCAL _Thread_local
+#endif
+
 #if defined(__has_feature)
 #if __has_feature(thread_sanitizer)
 #define GGML_TSAN_ENABLED 1
@@ -437,6 +448,40 @@ typedef pthread_mutex_t    ggml_mutex_t;
 
 #endif
 
+// Fused ops
+enum ggml_cpu_fusion_op {
+    GGML_CPU_FUSION_NONE,
+    GGML_CPU_FUSION_SKIP,              // computed by an earlier fused node
+    GGML_CPU_FUSION_RMS_NORM_MUL,      // rms_norm -> mul
+    GGML_CPU_FUSION_ADD_RMS_NORM,      // add -> rms_norm
+    GGML_CPU_FUSION_ADD_RMS_NORM_MUL,  // add -> rms_norm -> mul
+    GGML_CPU_FUSION_ROPE_SET_ROWS,     // rope -> [reshape] -> ... -> set_rows
+};
+
+struct ggml_cpu_fusion {
+    enum ggml_cpu_fusion_op op;
+    int32_t last; // index of the last node of the group
+};
+
+// Barrier
+//
+// the threads arrive in groups of GGML_BARRIER_GROUP_SIZE consecutive threads, only the last thread of each group
+// arrives at the top level, so that the arrival counters are not contended by all the threads at once
+// the threads are placed on consecutive cores, so a group usually shares a cache (e.g. a CCX)
+//
+// the waiting threads spin for n_barrier_spin rounds and then sleep (futex on Linux, yield elsewhere)
+// n_barrier_spin adapts at runtime: it is halved when threads had to sleep, e.g. when the cores are oversubscribed,
+// and doubled back up to the limit set by the polling level otherwise
+
+#define GGML_BARRIER_GROUP_SIZE 8
+#define GGML_BARRIER_MAX_GROUPS (GGML_MAX_N_THREADS/GGML_BARRIER_GROUP_SIZE)
+#define GGML_BARRIER_SPIN_MIN   8
+#define GGML_BARRIER_SPIN_POLL  256 // spin rounds per polling level
+
+struct ggml_barrier_group {
+    atomic_int GGML_CACHE_ALIGN n_arrived;
+};
+
 // Threadpool def
 struct ggml_threadpool {
     ggml_mutex_t mutex;       // mutex for cond.var
@@ -451,6 +496,14 @@ struct ggml_threadpool {
     atomic_int GGML_CACHE_ALIGN n_barrier_passed;
     atomic_int GGML_CACHE_ALIGN current_chunk; // currently processing chunk during Mat_Mul, shared between all the threads.
 
+#ifndef GGML_USE_OPENMP
+    atomic_int GGML_CACHE_ALIGN n_barrier_sleep; // number of threads sleeping in the barrier
+    atomic_int n_barrier_spin;                   // number of spin rounds before sleeping in the barrier
+    int        n_barrier_spin_max;
+
+    struct ggml_barrier_group barrier_groups[GGML_BARRIER_MAX_GROUPS];
+#endif
+
     // these are atomic as an annotation for thread-sanitizer
     atomic_bool stop;         // Used for stopping the threadpool altogether
     atomic_bool pause;        // Used for pausing the threadpool or individual threads
@@ -463,6 +516,9 @@ struct ggml_threadpool {
     int32_t      prio;        // Scheduling priority
     uint32_t     poll;        // Polling level (0 - no polling)
 
+    struct ggml_cpu_fusion * fusion; // per node fusion plan of the current graph (see ggml_graph_plan_fusion)
+    int          fusion_size;        // number of allocated entries in fusion
+
     enum ggml_status ec;
 };
 
@@ -522,10 +578,74 @@ struct ggml_numa_nodes {
 
 struct ggml_state {
     struct ggml_numa_nodes numa;
+    bool hybrid; // cores of different performance (see ggml_cpu_detect_hybrid)
 };
 
 static struct ggml_state g_state = {0};
 
+#ifndef GGML_USE_OPENMP
+
+// index of the current thread in the threadpool, used to find its barrier group
+static GGML_THREAD_LOCAL int ggml_barrier_ith = 0;
+
+#if defined(__gnu_linux__)
+static inline void ggml_futex_wait(atomic_int * addr, int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void ggml_futex_wake_all(atomic_int * addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#else
+static inline void ggml_futex_wait(atomic_int * addr, int val) {
+    UNUSED(addr);
+    UNUSED(val);
+    sched_yield();
+}
+
+static inline void ggml_futex_wake_all(atomic_int * addr) {
+    UNUSED(addr);
+}
+#endif
+
+static void ggml_barrier_release(struct ggml_threadpool * tp) {
+    // exit barrier (full seq-cst fence)
+    atomic_fetch_add_explicit(&tp->n_barrier_passed, 1, memory_order_seq_cst);
+
+    const int n_spin = atomic_load_explicit(&tp->n_barrier_spin, memory_order_relaxed);
+
+    if (atomic_load_explicit(&tp->n_barrier_sleep, memory_order_seq_cst) > 0) {
+        ggml_futex_wake_all(&tp->n_barrier_passed);
+
+        if (n_spin > GGML_BARRIER_SPIN_MIN) {
+            atomic_store_explicit(&tp->n_barrier_spin, MAX(n_spin/2, GGML_BARRIER_SPIN_MIN), memory_order_relaxed);
+        }
+    } else if (n_spin < tp->n_barrier_spin_max) {
+        atomic_store_explicit(&tp->n_barrier_spin, MIN(n_spin*2, tp->n_barrier_spin_max), memory_order_relaxed);
+    }
+}
+
+static void ggml_barrier_wait(struct ggml_threadpool * tp, int n_passed) {
+    const int n_spin = atomic_load_explicit(&tp->n_barrier_spin, memory_order_relaxed);
+
+    for (int i = 0; i < n_spin; i++) {
+        if (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) != n_passed) {
+            return;
+        }
+        ggml_thread_cpu_relax();
+    }
+
+    // the seq-cst increment pairs with the seq-cst load in ggml_barrier_release, either the last thread sees
+    // the sleeper and wakes it up or the sleeper sees the new n_barrier_passed and does not sleep
+    atomic_fetch_add_explicit(&tp->n_barrier_sleep, 1, memory_order_seq_cst);
+    while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_seq_cst) == n_passed) {
+        ggml_futex_wait(&tp->n_barrier_passed, n_passed);
+    }
+    atomic_fetch_sub_explicit(&tp->n_barrier_sleep, 1, memory_order_relaxed);
+}
+
+#endif // GGML_USE_OPENMP
+
 void ggml_barrier(struct ggml_threadpool * tp) {
     int n_threads = atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed);
     if (n_threads == 1) {
@@ -537,22 +657,38 @@ void ggml_barrier(struct ggml_threadpool * tp) {
 #else
     int n_passed = atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed);
 
-    // enter barrier (full seq-cst fence)
-    int n_barrier = atomic_fetch_add_explicit(&tp->n_barrier, 1, memory_order_seq_cst);
+    // number of arrivals at the top level
+    int  n_arrive = n_threads;
+    bool arrive   = true;
 
-    if (n_barrier == (n_threads - 1)) {
+    const int n_groups = (n_threads + GGML_BARRIER_GROUP_SIZE - 1)/GGML_BARRIER_GROUP_SIZE;
+
+    if (n_groups > 1) {
+        const int ig      = ggml_barrier_ith/GGML_BARRIER_GROUP_SIZE;
+        const int n_group = MIN(GGML_BARRIER_GROUP_SIZE, n_threads - ig*GGML_BARRIER_GROUP_SIZE);
+
+        struct ggml_barrier_group * group = &tp->barrier_groups[ig];
+
+        // enter group (full seq-cst fence), the last thread of the group arrives at the top level
+        arrive = atomic_fetch_add_explicit(&group->n_arrived, 1, memory_order_seq_cst) == (n_group - 1);
+        if (arrive) {
+            atomic_store_explicit(&group->n_arrived, 0, memory_order_relaxed);
+        }
+
+        n_arrive = n_groups;
+    }
+
+    // enter barrier (full seq-cst fence)
+    if (arrive && atomic_fetch_add_explicit(&tp->n_barrier, 1, memory_order_seq_cst) == (n_arrive - 1)) {
         // last thread
         atomic_store_explicit(&tp->n_barrier, 0, memory_order_relaxed);
 
-        // exit barrier (fill seq-cst fence)
-        atomic_fetch_add_explicit(&tp->n_barrier_passed, 1, memory_order_seq_cst);
+        ggml_barrier_release(tp);
         return;
     }
 
     // wait for other threads
-    while (atomic_load_explicit(&tp->n_barrier_passed, memory_order_relaxed) == n_passed) {
-        ggml_thread_cpu_relax();
-    }
+    ggml_barrier_wait(tp, n_passed);
 
     // exit barrier (full seq-cst fence)
     // TSAN doesn't support standalone fence yet, we use a dummy read-modify-write instead
@@ -679,6 +815,54 @@ bool ggml_is_numa(void) {
     return g_state.numa.n_nodes > 1;
 }
 
+// cores of different performance, e.g. P-cores and E-cores or big.LITTLE
+static bool ggml_cpu_detect_hybrid(void) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    // CPUID.(EAX=07H,ECX=0):EDX[15] - hybrid part
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return (edx >> 15) & 1;
+    }
+    return false;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    int info[4];
+    __cpuidex(info, 7, 0);
+    return (info[3] >> 15) & 1;
+#elif defined(__gnu_linux__)
+    // the scheduler capacity of the cores differs
+    long first = -1;
+    for (uint32_t c = 0; c < GGML_NUMA_MAX_CPUS; ++c) {
+        char path[256];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cpu_capacity", c);
+
+        FILE * f = fopen(path, "r");
+        if (f == NULL) {
+            break;
+        }
+
+        long capacity = -1;
+        const int n = fscanf(f, "%ld", &capacity);
+        fclose(f);
+
+        if (n != 1) {
+            break;
+        }
+        if (first < 0) {
+            first = capacity;
+        } else if (capacity != first) {
+            return true;
+        }
+    }
+    return false;
+#else
+    return false;
+#endif
+}
+
+static inline bool ggml_cpu_is_hybrid(void) {
+    return g_state.hybrid;
+}
+
 #if defined(__ARM_ARCH)
 
 #if defined(__linux__) && defined(__aarch64__)
@@ -1353,9 +1537,13 @@ UseGgmlGemm2:;
     //   Also, chunking by thread was measured to have perform better on NUMA systems.  See https://github.com/ggml-org/llama.cpp/pull/6915
     //   In theory, chunking should be just as useful on NUMA and non NUMA systems, but testing disagreed with that.
     if (nchunk0 * nchunk1 < nth * 4 || ggml_is_numa()) {
+        // on hybrid CPUs one chunk per thread leaves the faster cores waiting for the slower ones,
+        // with a few chunks per thread the faster cores pick up the remaining chunks instead
+        const int64_t nchunk = ggml_cpu_is_hybrid() && !ggml_is_numa() ? MIN(nth * 4, MAX(nr0, nr1)) : nth;
+
         // distribute the thread work across the inner or outer loop based on which one is larger
-        nchunk0 = nr0 > nr1 ? nth : 1; // parallelize by src0 rows
-        nchunk1 = nr0 > nr1 ? 1 : nth; // parallelize by src1 rows
+        nchunk0 = nr0 > nr1 ? nchunk : 1; // parallelize by src0 rows
+        nchunk1 = nr0 > nr1 ? 1 : nchunk; // parallelize by src1 rows
     }
 
     // The number of elements in each chunk
@@ -1465,6 +1653,73 @@ static void ggml_compute_forward_mul_mat_id_one_chunk(
     }
 }
 
+// the work of MUL_MAT_ID is split in tiles of (expert, block of src0 rows, block of tokens) that all the threads take from
+// a single queue, so that the threads do not sweep the experts one after the other
+#define MMID_TILE_ROWS 64
+#define MMID_TILE_COLS 64
+
+// experts with at least this many tokens are computed as small GEMMs on a gathered copy of their src1 rows
+#define MMID_GEMM_MIN_COLS 4
+
+#if GGML_USE_LLAMAFILE
+// computes one tile with llamafile_sgemm into the thread scratch buffer and scatters the result to dst
+// returns false if sgemm does not support the tile, in which case the caller falls back to vec_dot
+static bool ggml_compute_forward_mul_mat_id_tile_sgemm(
+    const struct ggml_compute_params * params,
+    struct ggml_tensor * dst,
+    const struct ggml_tensor * src0,
+    const struct ggml_tensor * ids,
+    const int64_t cur_a,
+    const int64_t ir0_start,
+    const int64_t ir0_end,
+    const int64_t ir1_start,
+    const int64_t ir1_end,
+    const char * src0_cur,
+    const struct mmid_row_mapping * matrix_rows,
+    const char * src1_gathered,
+    const size_t row_size,
+    float * tmp) {
+
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    enum ggml_type const vec_dot_type = type_traits_cpu[src0->type].vec_dot_type;
+
+    const int64_t nr0 = ir0_end - ir0_start;
+    const int64_t nr1 = ir1_end - ir1_start;
+
+    // the tile is computed by the calling thread alone
+    struct ggml_compute_params tile_params = *params;
+    tile_params.ith = 0;
+    tile_params.nth = 1;
+
+    if (!llamafile_sgemm(&tile_params,
+                         nr0, nr1, ne00/ggml_blck_size(src0->type),
+                         src0_cur + ir0_start*nb01,
+                         nb01/ggml_type_size(src0->type),
+                         src1_gathered + ir1_start*row_size,
+                         row_size/ggml_type_size(vec_dot_type),
+                         tmp,
+                         nr0,
+                         src0->type,
+                         vec_dot_type,
+                         GGML_TYPE_F32)) {
+        return false;
+    }
+
+    for (int64_t ir1 = ir1_start; ir1 < ir1_end; ++ir1) {
+        struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, ir1);
+
+        float * dst_col = (float *) ((char *) dst->data + row_mapping.i1*nb1 + row_mapping.i2*nb2);
+
+        memcpy(dst_col + ir0_start, tmp + (ir1 - ir1_start)*nr0, nr0*sizeof(float));
+    }
+
+    return true;
+}
+#endif
+
 static void * incr_ptr_aligned(void ** p, size_t size, size_t align) {
 
     void * ptr = *p;
@@ -1519,8 +1774,21 @@ static void ggml_compute_forward_mul_mat_id(
     struct mmid_row_mapping * matrix_rows = // [n_as][ids->ne[0]*ids->ne[1]]
         incr_ptr_aligned(&wdata_cur, n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping), sizeof(int64_t));
 
-    char (*atomic_current_chunk)[CACHE_LINE_SIZE] = // [n_as]
-        incr_ptr_aligned(&wdata_cur, CACHE_LINE_SIZE * n_as, CACHE_LINE_SIZE);
+    int64_t * matrix_tiles = // [n_as + 1], first tile of each expert
+        incr_ptr_aligned(&wdata_cur, (n_as + 1)*sizeof(int64_t), sizeof(int64_t));
+
+    int64_t * matrix_gather = // [n_as], first row of each expert in src1_gathered, -1 if the expert is not computed as GEMM
+        incr_ptr_aligned(&wdata_cur, n_as*sizeof(int64_t), sizeof(int64_t));
+
+    const size_t row_size = ggml_row_size(vec_dot_type, ne10);
+
+#if GGML_USE_LLAMAFILE
+    char * src1_gathered = // [ids->ne[0]*ids->ne[1]][row_size]
+        incr_ptr_aligned(&wdata_cur, ids->ne[0]*ids->ne[1]*row_size, sizeof(int64_t));
+
+    float * tile_tmp = // [nth][MMID_TILE_ROWS*MMID_TILE_COLS]
+        incr_ptr_aligned(&wdata_cur, nth*MMID_TILE_ROWS*MMID_TILE_COLS*sizeof(float), CACHE_LINE_SIZE);
+#endif
 
     GGML_ASSERT(params->wsize >= (size_t)((char *) wdata_cur - (char *) params->wdata));
 
@@ -1576,79 +1844,127 @@ static void ggml_compute_forward_mul_mat_id(
                 matrix_row_counts[i02] += 1;
             }
         }
-    }
 
-    // reset current_chunk
-    for (int cur_a = ith; cur_a < n_as; cur_a += nth) {
-        atomic_int * current_chunk_ctr = (atomic_int *)(atomic_current_chunk + cur_a);
-        *current_chunk_ctr = nth;
+        // plan the tiles of each expert and the experts computed as GEMM
+        const int64_t nchunk0 = (ne01 + MMID_TILE_ROWS - 1)/MMID_TILE_ROWS;
+
+        int64_t n_tiles  = 0;
+        int64_t n_gather = 0;
+
+        for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+            const int64_t cne1 = matrix_row_counts[cur_a];
+
+            matrix_tiles[cur_a]  = n_tiles;
+            matrix_gather[cur_a] = -1;
+
+            n_tiles += nchunk0*((cne1 + MMID_TILE_COLS - 1)/MMID_TILE_COLS);
+
+#if GGML_USE_LLAMAFILE
+            if (cne1 >= MMID_GEMM_MIN_COLS) {
+                matrix_gather[cur_a] = n_gather;
+                n_gather += cne1;
+            }
+#endif
+        }
+        matrix_tiles[n_as] = n_tiles;
+
+        // Every thread starts at ith, so the first unprocessed tile is nth.
+        ggml_threadpool_chunk_set(params->threadpool, nth);
     }
 
     ggml_barrier(params->threadpool);
 
-    for (int cur_a = 0; cur_a < n_as; ++cur_a) {
-        const int64_t cne1 = matrix_row_counts[cur_a];
+    const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
 
-        if (cne1 == 0) {
+#if GGML_USE_LLAMAFILE
+    // copy the src1 rows of the GEMM experts next to each other
+    bool any_gather = false;
+
+    for (int cur_a = 0; cur_a < n_as; ++cur_a) {
+        if (matrix_gather[cur_a] < 0) {
             continue;
         }
 
-        const char * src0_cur = (const char *) src0->data + cur_a * nb02;
-        const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
-        const size_t row_size = ggml_row_size(vec_dot_type, ne10);
+        any_gather = true;
+
+        for (int64_t ir1 = ith; ir1 < matrix_row_counts[cur_a]; ir1 += nth) {
+            struct mmid_row_mapping row_mapping = MMID_MATRIX_ROW(cur_a, ir1);
 
-        const int64_t nr0 = ne01;
-        const int64_t nr1 = cne1;
+            const int64_t i11 = row_mapping.i1 % ne11;
+            const int64_t i12 = row_mapping.i2;
 
-        int chunk_size = 16;
-        if (nr0 == 1 || nr1 == 1) {
-            chunk_size = 64;
+            const char * src1_col = (const char *) wdata +
+                (src1_cont || src1->type != vec_dot_type
+                ? (i11      + i12*ne11)*row_size
+                : (i11*nb11 + i12*nb12));
+
+            memcpy(src1_gathered + (matrix_gather[cur_a] + ir1)*row_size, src1_col, row_size);
         }
+    }
+
+    if (any_gather) {
+        ggml_barrier(params->threadpool);
+    }
+#endif
 
 #if defined(__aarch64__)
-        // disable for ARM
-        const bool disable_chunking = true;
+    // disable for ARM
+    const bool disable_chunking = true;
 #else
-        // disable for NUMA
-        const bool disable_chunking = ggml_is_numa();
+    // disable for NUMA
+    const bool disable_chunking = ggml_is_numa();
 #endif // defined(__aarch64__)
 
-        int64_t nchunk0 = (nr0 + chunk_size - 1) / chunk_size;
-        int64_t nchunk1 = (nr1 + chunk_size - 1) / chunk_size;
+    const int64_t nchunk0 = (ne01 + MMID_TILE_ROWS - 1)/MMID_TILE_ROWS;
+    const int64_t n_tiles = matrix_tiles[n_as];
 
-        if (nchunk0 * nchunk1 < nth * 4 || disable_chunking) {
-            nchunk0 = nr0 > nr1 ? nth : 1;
-            nchunk1 = nr0 > nr1 ? 1 : nth;
+    // the tiles taken by a thread are increasing, so the current expert only moves forward
+    int     cur_a = 0;
+    int64_t tile  = ith;
+
+    while (tile < n_tiles) {
+        while (matrix_tiles[cur_a + 1] <= tile) {
+            cur_a++;
         }
 
-        const int64_t dr0 = (nr0 + nchunk0 - 1) / nchunk0;
-        const int64_t dr1 = (nr1 + nchunk1 - 1) / nchunk1;
+        const int64_t cne1 = matrix_row_counts[cur_a];
 
-        int current_chunk = ith;
+        const int64_t ith0 = (tile - matrix_tiles[cur_a]) % nchunk0;
+        const int64_t ith1 = (tile - matrix_tiles[cur_a]) / nchunk0;
 
-        atomic_int * current_chunk_ctr = (atomic_int *)(atomic_current_chunk + cur_a);
+        const int64_t ir0_start = ith0*MMID_TILE_ROWS;
+        const int64_t ir0_end   = MIN(ir0_start + MMID_TILE_ROWS, ne01);
 
-        while (current_chunk < nchunk0 * nchunk1) {
-            const int64_t ith0 = current_chunk % nchunk0;
-            const int64_t ith1 = current_chunk / nchunk0;
+        const int64_t ir1_start = ith1*MMID_TILE_COLS;
+        const int64_t ir1_end   = MIN(ir1_start + MMID_TILE_COLS, cne1);
 
-            const int64_t ir0_start = dr0 * ith0;
-            const int64_t ir0_end = MIN(ir0_start + dr0, nr0);
+        const char * src0_cur = (const char *) src0->data + cur_a*nb02;
 
-            const int64_t ir1_start = dr1 * ith1;
-            const int64_t ir1_end = MIN(ir1_start + dr1, nr1);
+        bool done = false;
+
+#if GGML_USE_LLAMAFILE
+        if (matrix_gather[cur_a] >= 0) {
+            done = ggml_compute_forward_mul_mat_id_tile_sgemm(
+                params, dst, src0, ids, cur_a,
+                ir0_start, ir0_end, ir1_start, ir1_end,
+                src0_cur, matrix_rows, src1_gathered + matrix_gather[cur_a]*row_size, row_size,
+                tile_tmp + ith*MMID_TILE_ROWS*MMID_TILE_COLS
+            );
+        }
+#endif
 
+        if (!done) {
             ggml_compute_forward_mul_mat_id_one_chunk(
                 dst, src0, src1, ids, cur_a,
                 ir0_start, ir0_end, ir1_start, ir1_end,
                 src0_cur, matrix_rows, row_size, src1_cont, wdata
             );
+        }
 
-            if (nth >= nchunk0 * nchunk1) {
-                break;
-            }
-
-            current_chunk = atomic_fetch_add_explicit(current_chunk_ctr, 1, memory_order_relaxed);
+        if (disable_chunking) {
+            tile += nth;
+        } else {
+            tile = ggml_threadpool_chunk_add(params->threadpool, 1);
         }
     }
 }
@@ -2612,6 +2928,7 @@ void ggml_threadpool_free(struct ggml_threadpool* threadpool) {
 
     const size_t workers_size = sizeof(struct ggml_compute_state) * n_threads;
     ggml_aligned_free(threadpool->workers, workers_size);
+    free(threadpool->fusion);
     ggml_aligned_free(threadpool, sizeof(struct ggml_threadpool));
 }
 
@@ -2737,8 +3054,14 @@ struct ggml_cplan ggml_graph_plan(
                         cur += n_as * sizeof(int64_t) + sizeof(int64_t);
                         // matrix_rows
                         cur += n_as*ids->ne[0]*ids->ne[1]*sizeof(struct mmid_row_mapping) + sizeof(int64_t);
-                        // atomic_current_chunk
-                        cur += CACHE_LINE_SIZE*n_as + CACHE_LINE_SIZE;
+                        // matrix_tiles, matrix_gather
+                        cur += (2*n_as + 1)*sizeof(int64_t) + 2*sizeof(int64_t);
+#if GGML_USE_LLAMAFILE
+                        // src1_gathered
+                        cur += ids->ne[0]*ids->ne[1]*ggml_row_size(vec_dot_type, src1->ne[0]) + sizeof(int64_t);
+                        // tile_tmp
+                        cur += n_tasks*MMID_TILE_ROWS*MMID_TILE_COLS*sizeof(float) + CACHE_LINE_SIZE;
+#endif
                     } break;
                 case GGML_OP_OUT_PROD:
                     {
@@ -2747,11 +3070,15 @@ struct ggml_cplan ggml_graph_plan(
                         }
                     } break;
                 case GGML_OP_SOFT_MAX:
-                case GGML_OP_ROPE:
                 case GGML_OP_ROPE_BACK:
                     {
                         cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
                     } break;
+                case GGML_OP_ROPE:
+                    {
+                        // the second row is used by the fused rope + set_rows to convert the result to the type of the destination
+                        cur = ggml_type_size(GGML_TYPE_F32) * 2 * node->ne[0] * n_tasks;
+                    } break;
                 case GGML_OP_CONV_TRANSPOSE_1D:
                     {
                         GGML_ASSERT(node->src[0]->ne[3] == 1);
@@ -2801,7 +3128,7 @@ struct ggml_cplan ggml_graph_plan(
                         const int64_t ne10 = node->src[1]->ne[0]; // DK
                         const int64_t ne20 = node->src[2]->ne[0]; // DV
 
-                        cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
+                        cur = sizeof(float)*(1*ne10 + 2*ne20 + GGML_FA_TILE_KV)*n_tasks; // 1x head size K + 2x head size V + KQ tile (per thread)
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
@@ -2840,14 +3167,240 @@ struct ggml_cplan ggml_graph_plan(
         work_size += CACHE_LINE_SIZE*(n_threads);
     }
 
+    static int use_fusion = -1;
+    if (use_fusion < 0) {
+        use_fusion = getenv("GGML_CPU_DISABLE_FUSION") == NULL;
+    }
+
     cplan.threadpool = threadpool;
     cplan.n_threads  = MIN(max_tasks, n_threads);
     cplan.work_size  = work_size;
     cplan.work_data  = NULL;
+    cplan.use_fusion = use_fusion;
 
     return cplan;
 }
 
+// fusion planning
+
+static bool ggml_cpu_fusion_is_f32_rows(const struct ggml_tensor * t) {
+    return t->type == GGML_TYPE_F32 && t->nb[0] == sizeof(float);
+}
+
+static const struct ggml_tensor * ggml_cpu_fusion_base(const struct ggml_tensor * t) {
+    return t->view_src ? t->view_src : t;
+}
+
+// true if the memory of a and b partially overlaps - the fused kernels are row-wise, so exact aliasing is fine
+static bool ggml_cpu_fusion_overlaps(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    const char * a0 = (const char *) a->data;
+    const char * b0 = (const char *) b->data;
+
+    if (a0 == b0 && ggml_are_same_stride(a, b)) {
+        return false;
+    }
+
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+static int32_t ggml_cpu_fusion_n_uses(const struct ggml_cgraph * cgraph, const struct ggml_tensor * node) {
+    const size_t hash_pos = ggml_hash_find(&cgraph->visited_hash_set, node);
+    if (!ggml_bitset_get(cgraph->visited_hash_set.used, hash_pos)) {
+        return -1;
+    }
+
+    return cgraph->use_counts[hash_pos];
+}
+
+// rms_norm at node i followed by a mul with a weight broadcast along the rows
+static bool ggml_cpu_fusion_rms_norm_mul(const struct ggml_cgraph * cgraph, int i) {
+    static const enum ggml_op ops[] = { GGML_OP_RMS_NORM, GGML_OP_MUL };
+
+    if (!ggml_can_fuse(cgraph, i, ops, 2)) {
+        return false;
+    }
+
+    const struct ggml_tensor * norm = cgraph->nodes[i];
+    const struct ggml_tensor * mul  = cgraph->nodes[i + 1];
+    const struct ggml_tensor * w    = mul->src[0] == norm ? mul->src[1] : mul->src[0];
+
+    return ggml_cpu_fusion_is_f32_rows(norm->src[0]) && ggml_cpu_fusion_is_f32_rows(mul) && ggml_cpu_fusion_is_f32_rows(w) &&
+        w->ne[0] == norm->ne[0] && ggml_can_repeat(w, norm) &&
+        !ggml_cpu_fusion_overlaps(mul, norm->src[0]) && !ggml_cpu_fusion_overlaps(mul, w);
+}
+
+// add at node i (without broadcasting) whose result is normalized by the next node
+static bool ggml_cpu_fusion_add_rms_norm(const struct ggml_cgraph * cgraph, int i) {
+    if (i + 1 >= cgraph->n_nodes) {
+        return false;
+    }
+
+    const struct ggml_tensor * add  = cgraph->nodes[i];
+    const struct ggml_tensor * norm = cgraph->nodes[i + 1];
+
+    if (add->op != GGML_OP_ADD || norm->op != GGML_OP_RMS_NORM || norm->src[0] != add || add->view_src) {
+        return false;
+    }
+
+    const struct ggml_tensor * a = add->src[0];
+    const struct ggml_tensor * b = add->src[1];
+
+    return ggml_cpu_fusion_is_f32_rows(add) && ggml_cpu_fusion_is_f32_rows(a) && ggml_cpu_fusion_is_f32_rows(b) &&
+        ggml_are_same_shape(add, a) && ggml_are_same_shape(add, b) &&
+        !ggml_cpu_fusion_overlaps(add, a) && !ggml_cpu_fusion_overlaps(add, b);
+}
+
+// rope at node i whose only use is a set_rows (possibly through a reshape) within the next few nodes
+// returns the index of the set_rows node or -1
+static int ggml_cpu_fusion_rope_set_rows(const struct ggml_cgraph * cgraph, int i, const struct ggml_cpu_fusion * fusion) {
+    const int max_lookahead = 32;
+
+    const struct ggml_tensor * rope = cgraph->nodes[i];
+
+    if (rope->op != GGML_OP_ROPE || rope->type != GGML_TYPE_F32 || rope->src[0]->type != GGML_TYPE_F32 || rope->view_src ||
+        !ggml_is_contiguous(rope) || rope->ne[3] != 1 || (rope->flags & GGML_TENSOR_FLAG_OUTPUT) ||
+        ggml_cpu_fusion_n_uses(cgraph, rope) != 1) {
+        return -1;
+    }
+
+    const struct ggml_tensor * src = rope;
+
+    for (int j = i + 1; j < cgraph->n_nodes && j <= i + max_lookahead; ++j) {
+        const struct ggml_tensor * node = cgraph->nodes[j];
+
+        if (node->op == GGML_OP_RESHAPE && node->src[0] == src && src == rope) {
+            if ((node->flags & GGML_TENSOR_FLAG_OUTPUT) || ggml_cpu_fusion_n_uses(cgraph, node) != 1) {
+                return -1;
+            }
+            src = node;
+            continue;
+        }
+
+        if (node->op != GGML_OP_SET_ROWS || node->src[0] != src) {
+            continue;
+        }
+
+        const struct ggml_tensor * set_rows = node;
+        const struct ggml_tensor * idx      = set_rows->src[1];
+
+        if (fusion[j].op != GGML_CPU_FUSION_NONE ||
+            (set_rows->type != GGML_TYPE_F32 && set_rows->type != GGML_TYPE_F16 && set_rows->type != GGML_TYPE_BF16) ||
+            set_rows->ne[2] != 1 || set_rows->ne[3] != 1 || !ggml_is_contiguous_rows(set_rows) ||
+            src->ne[0] != rope->ne[0]*rope->ne[1] || src->ne[1] != rope->ne[2] ||
+            idx->type != GGML_TYPE_I64 || idx->ne[0] != rope->ne[2] || ggml_nrows(idx) != 1 || idx->nb[0] != sizeof(int64_t)) {
+            return -1;
+        }
+
+        // the rows are written when the rope is computed, so the nodes in between must not touch the destination
+        // and the indices must already be available
+        const struct ggml_tensor * dst_base = ggml_cpu_fusion_base(set_rows);
+        const struct ggml_tensor * idx_base = ggml_cpu_fusion_base(idx);
+
+        for (int k = i + 1; k < j; ++k) {
+            const struct ggml_tensor * t = cgraph->nodes[k];
+
+            if (ggml_cpu_fusion_base(t) == dst_base || ggml_cpu_fusion_base(t) == idx_base) {
+                return -1;
+            }
+            for (int s = 0; s < GGML_MAX_SRC; ++s) {
+                if (t->src[s] && ggml_cpu_fusion_base(t->src[s]) == dst_base) {
+                    return -1;
+                }
+            }
+        }
+
+        return j;
+    }
+
+    return -1;
+}
+
+// decide which nodes are computed together, before the threads start
+static void ggml_graph_plan_fusion(const struct ggml_cgraph * cgraph, struct ggml_cpu_fusion * fusion) {
+    for (int i = 0; i < cgraph->n_nodes; ++i) {
+        fusion[i].op   = GGML_CPU_FUSION_NONE;
+        fusion[i].last = i;
+    }
+
+    for (int i = 0; i < cgraph->n_nodes; ++i) {
+        if (fusion[i].op != GGML_CPU_FUSION_NONE) {
+            continue;
+        }
+
+        const struct ggml_tensor * node = cgraph->nodes[i];
+
+        int last = i;
+
+        switch (node->op) {
+            case GGML_OP_RMS_NORM:
+                {
+                    if (ggml_cpu_fusion_rms_norm_mul(cgraph, i)) {
+                        fusion[i].op = GGML_CPU_FUSION_RMS_NORM_MUL;
+                        last = i + 1;
+                    }
+                } break;
+            case GGML_OP_ADD:
+                {
+                    if (ggml_cpu_fusion_add_rms_norm(cgraph, i)) {
+                        const bool with_mul = ggml_cpu_fusion_rms_norm_mul(cgraph, i + 1);
+
+                        // the result is written while other threads may still be reading the operands of the add
+                        const struct ggml_tensor * out = cgraph->nodes[with_mul ? i + 2 : i + 1];
+                        if (!ggml_cpu_fusion_overlaps(out, node->src[0]) && !ggml_cpu_fusion_overlaps(out, node->src[1])) {
+                            fusion[i].op = with_mul ? GGML_CPU_FUSION_ADD_RMS_NORM_MUL : GGML_CPU_FUSION_ADD_RMS_NORM;
+                            last = with_mul ? i + 2 : i + 1;
+                        }
+                    }
+                } break;
+            case GGML_OP_ROPE:
+                {
+                    const int j = ggml_cpu_fusion_rope_set_rows(cgraph, i, fusion);
+                    if (j > 0) {
+                        fusion[i].op   = GGML_CPU_FUSION_ROPE_SET_ROWS;
+                        fusion[i].last = j;
+                        fusion[j].op   = GGML_CPU_FUSION_SKIP;
+                    }
+                } break;
+            default:
+                break;
+        }
+
+        if (last > i) {
+            fusion[i].last = last;
+            for (int k = i + 1; k <= last; ++k) {
+                fusion[k].op = GGML_CPU_FUSION_SKIP;
+            }
+        }
+    }
+}
+
+static void ggml_compute_forward_fused(struct ggml_compute_params * params, const struct ggml_cgraph * cgraph, int node_n, const struct ggml_cpu_fusion * fusion) {
+    struct ggml_tensor ** nodes = cgraph->nodes;
+
+    switch (fusion->op) {
+        case GGML_CPU_FUSION_RMS_NORM_MUL:
+            {
+                ggml_compute_forward_rms_norm_fused(params, NULL, nodes[node_n], nodes[node_n + 1]);
+            } break;
+        case GGML_CPU_FUSION_ADD_RMS_NORM:
+            {
+                ggml_compute_forward_rms_norm_fused(params, nodes[node_n], nodes[node_n + 1], NULL);
+            } break;
+        case GGML_CPU_FUSION_ADD_RMS_NORM_MUL:
+            {
+                ggml_compute_forward_rms_norm_fused(params, nodes[node_n], nodes[node_n + 1], nodes[node_n + 2]);
+            } break;
+        case GGML_CPU_FUSION_ROPE_SET_ROWS:
+            {
+                ggml_compute_forward_rope_set_rows(params, nodes[node_n], nodes[fusion->last]);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
@@ -2857,6 +3410,10 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
 
     set_numa_thread_affinity(state->ith);
 
+#ifndef GGML_USE_OPENMP
+    ggml_barrier_ith = state->ith;
+#endif
+
     struct ggml_compute_params params = {
         /*.ith       =*/ state->ith,
         /*.nth       =*/ atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed),
@@ -2865,10 +3422,30 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         /*.threadpool=*/ tp,
     };
 
+    const struct ggml_cpu_fusion * fusion = cplan->use_fusion ? tp->fusion : NULL;
+
+    // per-node and barrier events of each thread, the barrier waits show the stragglers
+    const bool trace = ggml_trace_enabled();
+
     for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
-        ggml_compute_forward(&params, node);
+        if (fusion && fusion[node_n].op == GGML_CPU_FUSION_SKIP) {
+            // already computed, the previous barrier covers it
+            continue;
+        }
+
+        const int64_t t_node = trace ? ggml_trace_begin() : 0;
+
+        if (fusion && fusion[node_n].op != GGML_CPU_FUSION_NONE) {
+            ggml_compute_forward_fused(&params, cgraph, node_n, &fusion[node_n]);
+        } else {
+            ggml_compute_forward(&params, node);
+        }
+
+        if (trace) {
+            ggml_trace_end(t_node, ggml_op_desc(node), node->name);
+        }
 
         if (state->ith == 0 && cplan->abort_callback &&
                 cplan->abort_callback(cplan->abort_callback_data)) {
@@ -2877,7 +3454,13 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         }
 
         if (node_n + 1 < cgraph->n_nodes) {
+            const int64_t t_barrier = trace && params.nth > 1 ? ggml_trace_begin() : 0;
+
             ggml_barrier(state->threadpool);
+
+            if (t_barrier) {
+                ggml_trace_end(t_barrier, "barrier", node->name);
+            }
         }
     }
 
@@ -3055,9 +3638,23 @@ static struct ggml_threadpool * ggml_threadpool_new_impl(
         threadpool->n_threads_cur    = tpp->n_threads;
         threadpool->poll             = tpp->poll;
         threadpool->prio             = tpp->prio;
+        threadpool->fusion           = NULL;
+        threadpool->fusion_size      = 0;
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
+#ifndef GGML_USE_OPENMP
+    {
+        threadpool->n_barrier_sleep    = 0;
+        threadpool->n_barrier_spin_max = MAX(GGML_BARRIER_SPIN_MIN, GGML_BARRIER_SPIN_POLL * (int) tpp->poll);
+        threadpool->n_barrier_spin     = threadpool->n_barrier_spin_max;
+
+        for (int i = 0; i < GGML_BARRIER_MAX_GROUPS; i++) {
+            threadpool->barrier_groups[i].n_arrived = 0;
+        }
+    }
+#endif
+
     // Allocate and init workers state
     const size_t workers_size = sizeof(struct ggml_compute_state) * tpp->n_threads;
     struct ggml_compute_state * workers = ggml_aligned_malloc(workers_size);
@@ -3132,6 +3729,17 @@ enum ggml_status ggml_graph_compute(struct ggml_cgraph * cgraph, struct ggml_cpl
         threadpool->ec               = GGML_STATUS_SUCCESS;
     }
 
+    if (cplan->use_fusion) {
+        if (threadpool->fusion_size < cgraph->n_nodes) {
+            free(threadpool->fusion);
+            threadpool->fusion      = malloc(sizeof(struct ggml_cpu_fusion) * cgraph->n_nodes);
+            threadpool->fusion_size = cgraph->n_nodes;
+            GGML_ASSERT(threadpool->fusion);
+        }
+
+        ggml_graph_plan_fusion(cgraph, threadpool->fusion);
+    }
+
 #ifdef GGML_USE_OPENMP
     if (n_threads > 1) {
         #pragma omp parallel num_threads(n_threads)
@@ -3571,6 +4179,8 @@ void ggml_cpu_init(void) {
         ggml_init_arm_arch_features();
 #endif
 
+        g_state.hybrid = ggml_cpu_detect_hybrid();
+
         is_first_call = false;
     }
 
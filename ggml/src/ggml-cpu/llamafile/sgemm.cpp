@@ -319,6 +319,10 @@ template <> inline __m256bh load(const float *p) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // FLOATING POINT MATRIX MULTIPLICATION
 
+// the K-quant kernels unpack each super-block of A once per tile, which only pays off
+// when it is reused for enough columns of B - smaller batches use vec_dot
+#define LLAMAFILE_SGEMM_K_MIN_N 4
+
 template <int M>
 static inline int64_t BLOCK_SIZE(size_t m) {
     const int64_t NB_BLOC_M = (m + M - 1) / M;
@@ -440,13 +444,20 @@ class tinyBLAS {
         const int64_t jj_BN = (NB_BN - (NB_BN * SIZE_BN - xtiles));
         const int64_t nb_job = ytiles * NB_BN;
 
+        // a single-threaded call (e.g. one tile of MUL_MAT_ID) runs all the jobs without touching the threadpool
+        const bool single = params->nth == 1;
+
         if (params->ith == 0) {
             GGML_ASSERT( jj_BN * SIZE_BN + (NB_BN - jj_BN) * (SIZE_BN - 1) == xtiles);
             // Every thread starts at ith, so the first unprocessed chunk is nth.  This save a bit of coordination right at the start.
-            ggml_threadpool_chunk_set(params->threadpool, params->nth);
+            if (!single) {
+                ggml_threadpool_chunk_set(params->threadpool, params->nth);
+            }
         }
 
-        ggml_barrier(params->threadpool);
+        if (!single) {
+            ggml_barrier(params->threadpool);
+        }
 
         int64_t job = params->ith;
         while (job < nb_job) {
@@ -472,10 +483,12 @@ class tinyBLAS {
                 GGML_ASSERT(jj == jj2);
             }
 
-            job = ggml_threadpool_chunk_add(params->threadpool, 1);
+            job = single ? job + 1 : ggml_threadpool_chunk_add(params->threadpool, 1);
         }
 
-        ggml_barrier(params->threadpool);
+        if (!single) {
+            ggml_barrier(params->threadpool);
+        }
         return;
     }
 
@@ -1075,6 +1088,304 @@ class tinyBLAS_Q0_AVX {
 };
 #endif // __AVX__
 
+#if defined(__AVX2__)
+// K-quants and IQ4_XS times Q8_K
+//
+// The super-blocks of A are unpacked to int8 once per tile row and then reused for each
+// column of the tile, instead of being decoded again for every dot product as in vec_dot
+template <typename TA>
+class tinyBLAS_K_AVX2 {
+  public:
+    tinyBLAS_K_AVX2(int64_t k,
+                    const TA *A, int64_t lda,
+                    const block_q8_K *B, int64_t ldb,
+                    float *C, int64_t ldc,
+                    int ith, int nth)
+        : A(A), B(B), C(C), k(k), lda(lda), ldb(ldb), ldc(ldc), ith(ith), nth(nth) {
+        const int8_t kvalues_iq4nl[16] = {
+            -127, -104, -83, -65,
+            -49,  -35,  -22, -10,
+              1,   13,   25,  38,
+             53,   69,   89, 113
+        };
+
+        iq4nlt = _mm_loadu_si128((const __m128i *)kvalues_iq4nl);
+    }
+
+    void matmul(int64_t m, int64_t n) {
+        mnpack(0, m, 0, n);
+    }
+
+  private:
+    // Q6_K and IQ4_XS unpack to signed values, Q4_K and Q5_K to unsigned values with a separate min
+    static constexpr bool is_signed = std::is_same<TA, block_q6_K>::value || std::is_same<TA, block_iq4_xs>::value;
+    static constexpr bool has_mins  = std::is_same<TA, block_q4_K>::value || std::is_same<TA, block_q5_K>::value;
+
+    // one super-block of A in the same order as the Q8_K values
+    struct unpacked {
+        __m256i scales[QK_K/32]; // int16 scales for the products of each 32 values (two sub-blocks of 16)
+        int8_t  qs[QK_K];
+        int16_t mins[QK_K/16];   // multiplied with the sums of each 16 values of B (bsums)
+        float   d;
+        float   dmin;
+    };
+
+    void mnpack(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t mc, nc, mp, np;
+        switch ((MIN(m - m0, 4) << 4) | MIN(n - n0, 4)) {
+#if VECTOR_REGISTERS == 32
+        case 0x44:
+            mc = 4;
+            nc = 4;
+            gemm<4, 4>(m0, m, n0, n);
+            break;
+        case 0x43:
+            mc = 4;
+            nc = 3;
+            gemm<4, 3>(m0, m, n0, n);
+            break;
+#else
+        case 0x44:
+        case 0x43:
+            mc = 4;
+            nc = 2;
+            gemm<4, 2>(m0, m, n0, n);
+            break;
+#endif
+        case 0x34:
+            mc = 3;
+            nc = 4;
+            gemm<3, 4>(m0, m, n0, n);
+            break;
+        case 0x33:
+            mc = 3;
+            nc = 3;
+            gemm<3, 3>(m0, m, n0, n);
+            break;
+        case 0x42:
+            mc = 4;
+            nc = 2;
+            gemm<4, 2>(m0, m, n0, n);
+            break;
+        case 0x24:
+            mc = 2;
+            nc = 4;
+            gemm<2, 4>(m0, m, n0, n);
+            break;
+        case 0x32:
+            mc = 3;
+            nc = 2;
+            gemm<3, 2>(m0, m, n0, n);
+            break;
+        case 0x23:
+            mc = 2;
+            nc = 3;
+            gemm<2, 3>(m0, m, n0, n);
+            break;
+        case 0x41:
+            mc = 4;
+            nc = 1;
+            gemm<4, 1>(m0, m, n0, n);
+            break;
+        case 0x22:
+            mc = 2;
+            nc = 2;
+            gemm<2, 2>(m0, m, n0, n);
+            break;
+        case 0x14:
+            mc = 1;
+            nc = 4;
+            gemm<1, 4>(m0, m, n0, n);
+            break;
+        case 0x31:
+            mc = 3;
+            nc = 1;
+            gemm<3, 1>(m0, m, n0, n);
+            break;
+        case 0x13:
+            mc = 1;
+            nc = 3;
+            gemm<1, 3>(m0, m, n0, n);
+            break;
+        case 0x21:
+            mc = 2;
+            nc = 1;
+            gemm<2, 1>(m0, m, n0, n);
+            break;
+        case 0x12:
+            mc = 1;
+            nc = 2;
+            gemm<1, 2>(m0, m, n0, n);
+            break;
+        case 0x11:
+            mc = 1;
+            nc = 1;
+            gemm<1, 1>(m0, m, n0, n);
+            break;
+        default:
+            return;
+        }
+        mp = m0 + (m - m0) / mc * mc;
+        np = n0 + (n - n0) / nc * nc;
+        mnpack(mp, m, n0, np);
+        mnpack(m0, m, np, n);
+    }
+
+    template <int RM, int RN>
+    NOINLINE void gemm(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t ytiles = (m - m0) / RM;
+        int64_t xtiles = (n - n0) / RN;
+        int64_t tiles = xtiles * ytiles;
+        int64_t duty = (tiles + nth - 1) / nth;
+        int64_t start = duty * ith;
+        int64_t end = start + duty;
+        if (end > tiles)
+            end = tiles;
+        unpacked a[RM];
+        for (int64_t job = start; job < end; ++job) {
+            int64_t ii = m0 + job / xtiles * RM;
+            int64_t jj = n0 + job % xtiles * RN;
+            __m256 Cv[RN][RM] = {};
+            float Cm[RN][RM] = {};
+            for (int64_t l = 0; l < k; ++l) {
+                for (int64_t i = 0; i < RM; ++i)
+                    unpack(A + lda * (ii + i) + l, a[i]);
+                for (int64_t j = 0; j < RN; ++j) {
+                    const block_q8_K * b = B + ldb * (jj + j) + l;
+                    for (int64_t i = 0; i < RM; ++i) {
+                        __m256i sumi = _mm256_setzero_si256();
+                        for (int t = 0; t < QK_K/32; ++t) {
+                            const __m256i qa = _mm256_loadu_si256((const __m256i *)(a[i].qs + 32*t));
+                            const __m256i qb = _mm256_loadu_si256((const __m256i *)(b->qs + 32*t));
+                            const __m256i p = is_signed
+                                ? _mm256_maddubs_epi16(_mm256_sign_epi8(qa, qa), _mm256_sign_epi8(qb, qa))
+                                : _mm256_maddubs_epi16(qa, qb);
+                            sumi = _mm256_add_epi32(sumi, _mm256_madd_epi16(a[i].scales[t], p));
+                        }
+                        Cv[j][i] = madd(_mm256_set1_ps(a[i].d * b->d), _mm256_cvtepi32_ps(sumi), Cv[j][i]);
+                        if (has_mins) {
+                            const __m256i mins = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)a[i].mins),
+                                                                   _mm256_loadu_si256((const __m256i *)b->bsums));
+                            Cm[j][i] += a[i].dmin * b->d * hsum_i32(mins);
+                        }
+                    }
+                }
+            }
+            for (int64_t j = 0; j < RN; ++j)
+                for (int64_t i = 0; i < RM; ++i)
+                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]) - Cm[j][i];
+        }
+    }
+
+    static inline int hsum_i32(__m256i x) {
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+        s = _mm_add_epi32(s, _mm_unpackhi_epi64(s, s));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(s);
+    }
+
+    // 6-bit scales and mins of Q4_K and Q5_K
+    static inline void unpack_scales_k4(const uint8_t * q, uint8_t * sc, uint8_t * mn) {
+        for (int j = 0; j < 4; ++j) {
+            sc[j] = q[j] & 63;
+            mn[j] = q[j + 4] & 63;
+        }
+        for (int j = 4; j < 8; ++j) {
+            sc[j] = (q[j + 4] & 0xF) | ((q[j - 4] >> 6) << 4);
+            mn[j] = (q[j + 4] >>  4) | ((q[j - 0] >> 6) << 4);
+        }
+    }
+
+    static inline void set_scales_k4(const uint8_t * scales, unpacked & u) {
+        uint8_t sc[8];
+        uint8_t mn[8];
+        unpack_scales_k4(scales, sc, mn);
+        for (int s = 0; s < 8; ++s) {
+            u.scales[s]       = _mm256_set1_epi16(sc[s]);
+            u.mins[2*s + 0]   = mn[s];
+            u.mins[2*s + 1]   = mn[s];
+        }
+    }
+
+    inline void unpack(const block_q4_K * x, unpacked & u) const {
+        const __m256i m4 = _mm256_set1_epi8(0xF);
+        for (int j = 0; j < QK_K/64; ++j) {
+            const __m256i q = _mm256_loadu_si256((const __m256i *)(x->qs + 32*j));
+            _mm256_storeu_si256((__m256i *)(u.qs + 64*j +  0), _mm256_and_si256(q, m4));
+            _mm256_storeu_si256((__m256i *)(u.qs + 64*j + 32), _mm256_and_si256(_mm256_srli_epi16(q, 4), m4));
+        }
+        set_scales_k4(x->scales, u);
+        u.d    = unhalf(x->d);
+        u.dmin = unhalf(x->dmin);
+    }
+
+    inline void unpack(const block_q5_K * x, unpacked & u) const {
+        const __m256i m4 = _mm256_set1_epi8(0xF);
+        const __m256i m1 = _mm256_set1_epi8(1);
+        const __m256i hbits = _mm256_loadu_si256((const __m256i *)x->qh);
+        for (int j = 0; j < QK_K/64; ++j) {
+            const __m256i q  = _mm256_loadu_si256((const __m256i *)(x->qs + 32*j));
+            const __m256i h0 = _mm256_and_si256(_mm256_srl_epi16(hbits, _mm_cvtsi32_si128(2*j + 0)), m1);
+            const __m256i h1 = _mm256_and_si256(_mm256_srl_epi16(hbits, _mm_cvtsi32_si128(2*j + 1)), m1);
+            _mm256_storeu_si256((__m256i *)(u.qs + 64*j +  0), _mm256_or_si256(_mm256_and_si256(q, m4), _mm256_slli_epi16(h0, 4)));
+            _mm256_storeu_si256((__m256i *)(u.qs + 64*j + 32), _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(q, 4), m4), _mm256_slli_epi16(h1, 4)));
+        }
+        set_scales_k4(x->scales, u);
+        u.d    = unhalf(x->d);
+        u.dmin = unhalf(x->dmin);
+    }
+
+    inline void unpack(const block_q6_K * x, unpacked & u) const {
+        const __m256i m4  = _mm256_set1_epi8(0xF);
+        const __m256i m2  = _mm256_set1_epi8(3);
+        const __m256i m32 = _mm256_set1_epi8(32);
+        for (int j = 0; j < QK_K/128; ++j) {
+            const __m256i ql0 = _mm256_loadu_si256((const __m256i *)(x->ql + 64*j +  0));
+            const __m256i ql1 = _mm256_loadu_si256((const __m256i *)(x->ql + 64*j + 32));
+            const __m256i qh  = _mm256_loadu_si256((const __m256i *)(x->qh + 32*j));
+            const __m256i q0 = _mm256_or_si256(_mm256_and_si256(ql0, m4),                        _mm256_slli_epi16(_mm256_and_si256(qh, m2), 4));
+            const __m256i q1 = _mm256_or_si256(_mm256_and_si256(ql1, m4),                        _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 2), m2), 4));
+            const __m256i q2 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql0, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 4), m2), 4));
+            const __m256i q3 = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(ql1, 4), m4), _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 6), m2), 4));
+            _mm256_storeu_si256((__m256i *)(u.qs + 128*j +  0), _mm256_sub_epi8(q0, m32));
+            _mm256_storeu_si256((__m256i *)(u.qs + 128*j + 32), _mm256_sub_epi8(q1, m32));
+            _mm256_storeu_si256((__m256i *)(u.qs + 128*j + 64), _mm256_sub_epi8(q2, m32));
+            _mm256_storeu_si256((__m256i *)(u.qs + 128*j + 96), _mm256_sub_epi8(q3, m32));
+        }
+        for (int t = 0; t < QK_K/32; ++t) {
+            u.scales[t] = MM256_SET_M128I(_mm_set1_epi16(x->scales[2*t + 1]), _mm_set1_epi16(x->scales[2*t + 0]));
+        }
+        u.d    = unhalf(x->d);
+        u.dmin = 0.0f;
+    }
+
+    inline void unpack(const block_iq4_xs * x, unpacked & u) const {
+        const __m128i m4 = _mm_set1_epi8(0xF);
+        for (int ib = 0; ib < QK_K/32; ++ib) {
+            const __m128i q = _mm_loadu_si128((const __m128i *)(x->qs + 16*ib));
+            _mm_storeu_si128((__m128i *)(u.qs + 32*ib +  0), _mm_shuffle_epi8(iq4nlt, _mm_and_si128(q, m4)));
+            _mm_storeu_si128((__m128i *)(u.qs + 32*ib + 16), _mm_shuffle_epi8(iq4nlt, _mm_and_si128(_mm_srli_epi16(q, 4), m4)));
+
+            const int ls = ((x->scales_l[ib/2] >> 4*(ib%2)) & 0xF) | (((x->scales_h >> 2*ib) & 3) << 4);
+            u.scales[ib] = _mm256_set1_epi16(ls - 32);
+        }
+        u.d    = unhalf(x->d);
+        u.dmin = 0.0f;
+    }
+
+    const TA *const A;
+    const block_q8_K *const B;
+    float *const C;
+    const int64_t k;
+    const int64_t lda;
+    const int64_t ldb;
+    const int64_t ldc;
+    const int ith;
+    const int nth;
+    __m128i iq4nlt;
+};
+#endif // __AVX2__
+
 //PPC Implementation
 #if defined(__MMA__)
 
@@ -2823,6 +3134,78 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
 #endif
     }
 
+    case GGML_TYPE_Q4_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        if (n < LLAMAFILE_SGEMM_K_MIN_N)
+            return false;
+        tinyBLAS_K_AVX2<block_q4_K> tb{
+            k, (const block_q4_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q5_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        if (n < LLAMAFILE_SGEMM_K_MIN_N)
+            return false;
+        tinyBLAS_K_AVX2<block_q5_K> tb{
+            k, (const block_q5_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q6_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        if (n < LLAMAFILE_SGEMM_K_MIN_N)
+            return false;
+        tinyBLAS_K_AVX2<block_q6_K> tb{
+            k, (const block_q6_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_IQ4_XS: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__)
+        if (n < LLAMAFILE_SGEMM_K_MIN_N)
+            return false;
+        tinyBLAS_K_AVX2<block_iq4_xs> tb{
+            k, (const block_iq4_xs *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
     default:
         return false;
     }
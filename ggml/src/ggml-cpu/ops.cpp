@@ -4204,6 +4204,83 @@ void ggml_compute_forward_rms_norm(
     }
 }
 
+// fused add + rms_norm + mul, add and mul are optional
+// the result of add is still written, since it is usually needed later (residual connection)
+void ggml_compute_forward_rms_norm_fused(
+        const ggml_compute_params * params,
+        ggml_tensor * add,
+        ggml_tensor * norm,
+        ggml_tensor * mul) {
+
+    const ggml_tensor * src0 = norm->src[0];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F32 && norm->type == GGML_TYPE_F32);
+    GGML_ASSERT(src0->nb[0] == sizeof(float));
+    GGML_ASSERT(add == nullptr || add == src0);
+
+    // the operand of mul that is not the result of rms_norm
+    const ggml_tensor * w = mul ? (mul->src[0] == norm ? mul->src[1] : mul->src[0]) : nullptr;
+
+    ggml_tensor * dst = mul ? mul : norm;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    GGML_TENSOR_UNARY_OP_LOCALS
+
+    float eps;
+    memcpy(&eps, norm->op_params, sizeof(float));
+
+    GGML_ASSERT(eps >= 0.0f);
+
+    for (int64_t i03 = 0; i03 < ne03; i03++) {
+        for (int64_t i02 = 0; i02 < ne02; i02++) {
+            for (int64_t i01 = ith; i01 < ne01; i01 += nth) {
+                float * x = (float *) ((char *) src0->data + i01*nb01 + i02*nb02 + i03*nb03);
+
+                if (add) {
+                    const ggml_tensor * a = add->src[0];
+                    const ggml_tensor * b = add->src[1];
+
+                    ggml_vec_add_f32(ne00, x,
+                            (const float *) ((const char *) a->data + i01*a->nb[1] + i02*a->nb[2] + i03*a->nb[3]),
+                            (const float *) ((const char *) b->data + i01*b->nb[1] + i02*b->nb[2] + i03*b->nb[3]));
+                }
+
+                ggml_float sum = 0.0;
+                for (int64_t i00 = 0; i00 < ne00; i00++) {
+                    sum += (ggml_float)(x[i00] * x[i00]);
+                }
+
+                const float mean = sum/ne00;
+
+                float * y = (float *) ((char *) dst->data + i01*dst->nb[1] + i02*dst->nb[2] + i03*dst->nb[3]);
+
+                if (y != x) {
+                    memcpy(y, x, ne00 * sizeof(float));
+                }
+
+                const float scale = 1.0f/sqrtf(mean + eps);
+
+                // if you hit this, likely you got an inf somewhere earlier
+                assert(scale > 0.0f);
+
+                ggml_vec_scale_f32(ne00, y, scale);
+
+                if (w) {
+                    const int64_t i11 = i01 % w->ne[1];
+                    const int64_t i12 = i02 % w->ne[2];
+                    const int64_t i13 = i03 % w->ne[3];
+
+                    const float * wr = (const float *) ((const char *) w->data + i11*w->nb[1] + i12*w->nb[2] + i13*w->nb[3]);
+
+                    ggml_vec_mul_f32(ne00, y, y, wr);
+                }
+            }
+        }
+    }
+}
+
 static void ggml_compute_forward_rms_norm_back_f32(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -6144,10 +6221,84 @@ static void ggml_mrope_cache_init(
     }
 }
 
+static void ggml_rope_f32_row(
+        const float * src,
+              float * dst,
+        const float * cache,
+        const int64_t ne0,
+        const int     n_dims,
+        const bool    is_neox,
+        const bool    is_mrope,
+        const bool    is_vision) {
+    if (is_neox || is_mrope) {
+        if (is_vision){
+            for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
+                const int64_t ic = i0/2;
+
+                const float cos_theta = cache[i0 + 0];
+                const float sin_theta = cache[i0 + 1];
+
+                const float x0 = src[ic];
+                const float x1 = src[ic + n_dims];
+
+                dst[ic]          = x0*cos_theta - x1*sin_theta;
+                dst[ic + n_dims] = x0*sin_theta + x1*cos_theta;
+            }
+        } else {
+            for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
+                const int64_t ic = i0/2;
+
+                const float cos_theta = cache[i0 + 0];
+                const float sin_theta = cache[i0 + 1];
+
+                const float x0 = src[ic];
+                const float x1 = src[ic + n_dims/2];
+
+                dst[ic]            = x0*cos_theta - x1*sin_theta;
+                dst[ic + n_dims/2] = x0*sin_theta + x1*cos_theta;
+            }
+        }
+    } else {
+        for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
+            const float cos_theta = cache[i0 + 0];
+            const float sin_theta = cache[i0 + 1];
+
+            const float x0 = src[i0];
+            const float x1 = src[i0 + 1];
+
+            dst[i0]     = x0*cos_theta - x1*sin_theta;
+            dst[i0 + 1] = x0*sin_theta + x1*cos_theta;
+        }
+    }
+
+    if (is_vision) {
+        for (int64_t i0 = n_dims; i0 < ne0; i0 += 2) {
+            const int64_t ic = i0/2;
+
+            const float cos_theta = cache[i0 + 0];
+            const float sin_theta = cache[i0 + 1];
+
+            const float x0 = src[ic];
+            const float x1 = src[ic + n_dims];
+
+            dst[ic]          = x0*cos_theta - x1*sin_theta;
+            dst[ic + n_dims] = x0*sin_theta + x1*cos_theta;
+        }
+    } else {
+        // fill the remain channels with data from src tensor
+        for (int64_t i0 = n_dims; i0 < ne0; i0 += 2) {
+            dst[i0]     = src[i0];
+            dst[i0 + 1] = src[i0 + 1];
+        }
+    }
+}
+
+// if set_rows is not NULL, the rows are written to the destination of set_rows instead of dst (fused rope + set_rows)
 static void ggml_compute_forward_rope_f32(
         const ggml_compute_params * params,
         ggml_tensor * dst,
-        const bool forward) {
+        const bool forward,
+        ggml_tensor * set_rows = nullptr) {
 
     const ggml_tensor * src0 = dst->src[0];
     const ggml_tensor * src1 = dst->src[1];
@@ -6176,6 +6327,7 @@ static void ggml_compute_forward_rope_f32(
     //printf("n_past = %d, ne2 = %d\n", n_past, ne2);
 
     GGML_ASSERT(nb00 == sizeof(float));
+    GGML_ASSERT(nb0  == sizeof(float));
 
     const int ith = params->ith;
     const int nth = params->nth;
@@ -6226,10 +6378,15 @@ static void ggml_compute_forward_rope_f32(
 
     const int32_t * pos = (const int32_t *) src1->data;
 
+    // fused set_rows: row i2 of the rope result (all heads of a token) is written to row idxs[i2] of the destination
+    const int64_t *         idxs       = set_rows ? (const int64_t *) set_rows->src[1]->data : nullptr;
+    const ggml_from_float_t from_float = set_rows ? ggml_get_type_traits_cpu(set_rows->type)->from_float : nullptr;
+    const size_t            row_size   = set_rows ? ggml_row_size(set_rows->type, ne0) : 0;
+
     for (int64_t i3 = 0; i3 < ne3; i3++) { // batch
         for (int64_t i2 = 0; i2 < ne2; i2++) { // seq-len
 
-            float * cache = (float *) params->wdata + (ne0 + CACHE_LINE_SIZE_F32)*ith;
+            float * cache = (float *) params->wdata + ((set_rows ? 2*ne0 : ne0) + CACHE_LINE_SIZE_F32)*ith;
             if (!is_mrope) {
                 const int64_t p = pos[i2];
                 ggml_rope_cache_init(p, freq_scale, freq_factors, corr_dims, ne0, ext_factor, attn_factor, cache, sin_sign, theta_scale);
@@ -6248,80 +6405,26 @@ static void ggml_compute_forward_rope_f32(
                 if (ir++ < ir0) continue;
                 if (ir   > ir1) break;
 
-                if (is_neox || is_mrope) {
-                    if (is_vision){
-                        for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                            const int64_t ic = i0/2;
-
-                            const float cos_theta = cache[i0 + 0];
-                            const float sin_theta = cache[i0 + 1];
+                const float * src_row = (const float *) ((const char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01);
 
-                            const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                            float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
-
-                            const float x0 = src[0];
-                            const float x1 = src[n_dims];
-
-                            dst_data[0]      = x0*cos_theta - x1*sin_theta;
-                            dst_data[n_dims] = x0*sin_theta + x1*cos_theta;
-                        }
-                    } else {
-                        for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                            const int64_t ic = i0/2;
-
-                            const float cos_theta = cache[i0 + 0];
-                            const float sin_theta = cache[i0 + 1];
+                if (set_rows == nullptr) {
+                    float * dst_row = (float *) ((char *) dst->data + i3*nb3 + i2*nb2 + i1*nb1);
 
-                            const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                            float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
-
-                            const float x0 = src[0];
-                            const float x1 = src[n_dims/2];
-
-                            dst_data[0]        = x0*cos_theta - x1*sin_theta;
-                            dst_data[n_dims/2] = x0*sin_theta + x1*cos_theta;
-                        }
-                    }
+                    ggml_rope_f32_row(src_row, dst_row, cache, ne0, n_dims, is_neox, is_mrope, is_vision);
                 } else {
-                    for (int64_t i0 = 0; i0 < n_dims; i0 += 2) {
-                        const float cos_theta = cache[i0 + 0];
-                        const float sin_theta = cache[i0 + 1];
-
-                        const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                              float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                        const float x0 = src[0];
-                        const float x1 = src[1];
+                    const int64_t i = idxs[i2];
 
-                        dst_data[0] = x0*cos_theta - x1*sin_theta;
-                        dst_data[1] = x0*sin_theta + x1*cos_theta;
-                    }
-                }
-
-                if (is_vision) {
-                    for (int64_t i0 = n_dims; i0 < ne0; i0 += 2) {
-                        const int64_t ic = i0/2;
-
-                        const float cos_theta = cache[i0 + 0];
-                        const float sin_theta = cache[i0 + 1];
+                    GGML_ASSERT(i >= 0 && i < set_rows->ne[1]);
 
-                        const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + ic*nb00);
-                        float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + ic*nb0);
+                    char * dst_row = (char *) set_rows->data + i*set_rows->nb[1] + i1*row_size;
 
-                        const float x0 = src[0];
-                        const float x1 = src[n_dims];
+                    if (set_rows->type == GGML_TYPE_F32) {
+                        ggml_rope_f32_row(src_row, (float *) dst_row, cache, ne0, n_dims, is_neox, is_mrope, is_vision);
+                    } else {
+                        float * tmp = cache + ne0;
 
-                        dst_data[0]      = x0*cos_theta - x1*sin_theta;
-                        dst_data[n_dims] = x0*sin_theta + x1*cos_theta;
-                    }
-                } else {
-                    // fill the remain channels with data from src tensor
-                    for (int64_t i0 = n_dims; i0 < ne0; i0 += 2) {
-                        const float * const src = (float *)((char *) src0->data + i3*nb03 + i2*nb02 + i1*nb01 + i0*nb00);
-                        float * dst_data  = (float *)((char *)  dst->data + i3*nb3  + i2*nb2  + i1*nb1  + i0*nb0);
-
-                        dst_data[0] = src[0];
-                        dst_data[1] = src[1];
+                        ggml_rope_f32_row(src_row, tmp, cache, ne0, n_dims, is_neox, is_mrope, is_vision);
+                        from_float(tmp, dst_row, ne0);
                     }
                 }
             }
@@ -6536,6 +6639,15 @@ void ggml_compute_forward_rope(
     }
 }
 
+void ggml_compute_forward_rope_set_rows(
+        const ggml_compute_params * params,
+        ggml_tensor * rope,
+        ggml_tensor * set_rows) {
+    GGML_ASSERT(rope->type == GGML_TYPE_F32 && rope->src[0]->type == GGML_TYPE_F32);
+
+    ggml_compute_forward_rope_f32(params, rope, true, set_rows);
+}
+
 // ggml_compute_forward_rope_back
 
 void ggml_compute_forward_rope_back(
@@ -8308,6 +8420,15 @@ void ggml_compute_forward_argsort(
 
 // ggml_compute_forward_flash_attn_ext
 
+// check if all n values of the FP16 mask are -INFINITY
+static bool ggml_fa_mask_is_inf(const ggml_fp16_t * mp, int64_t n) {
+    int64_t n_inf = 0;
+    for (int64_t j = 0; j < n; ++j) {
+        n_inf += mp[j] == 0xFC00; // -INFINITY in FP16
+    }
+    return n_inf == n;
+}
+
 static void ggml_compute_forward_flash_attn_ext_f16(
         const ggml_compute_params * params,
         ggml_tensor * dst) {
@@ -8315,8 +8436,9 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     const ggml_tensor * q     = dst->src[0];
     const ggml_tensor * k     = dst->src[1];
     const ggml_tensor * v     = dst->src[2];
-    const ggml_tensor * mask  = dst->src[3];
-    const ggml_tensor * sinks = dst->src[4];
+    const ggml_tensor * mask      = dst->src[3];
+    const ggml_tensor * sinks     = dst->src[4];
+    const ggml_tensor * kv_ranges = dst->src[5];
 
     GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
     GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
@@ -8412,10 +8534,11 @@ static void ggml_compute_forward_flash_attn_ext_f16(
         float S = 0.0f;      // sum
         float M = -INFINITY; // maximum KQ value
 
-        float       * VKQ32 = (float       *) params->wdata + ith*(1*DK + 2*DV + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
+        float       * VKQ32 = (float       *) params->wdata + ith*(1*DK + 2*DV + GGML_FA_TILE_KV + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
         float       * V32   =                 (VKQ32 + 1*DV); // (temporary) FP32 V buffer
         ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*DV); // (temporary) FP16 VKQ accumulator
         ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*DV); // (temporary) buffer for Q converted to quantized/FP16
+        float       * KQ    =                 (VKQ32 + 2*DV + 1*DK); // (temporary) KQ values of the current tile
 
         if (v->type == GGML_TYPE_F16) {
             memset(VKQ16, 0, DV*sizeof(ggml_fp16_t));
@@ -8436,65 +8559,91 @@ static void ggml_compute_forward_flash_attn_ext_f16(
         const float * pq = (const float *) ((char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
         q_to_vec_dot(pq, Q_q, DK);
 
+        // the KV rows outside of [ic_beg, ic_end) are masked for this query, e.g. other sequences in a unified KV cache
+        int64_t ic_beg = 0;
+        int64_t ic_end = nek1;
+
+        if (kv_ranges) {
+            const int32_t * pr = (const int32_t *) ((const char *) kv_ranges->data + iq1*kv_ranges->nb[1] + (iq3%kv_ranges->ne[3])*kv_ranges->nb[3]);
+
+            ic_beg = MAX(pr[0], 0);
+            ic_end = MIN(pr[1], nek1);
+        }
+
         // online softmax / attention
-        // loop over n_kv and n_head_kv
+        // loop over n_kv and n_head_kv in tiles of GGML_FA_TILE_KV rows: the KQ values of a tile are computed first,
+        // so that the exponentials are vectorized and the accumulator is rescaled at most once per tile
         // ref: https://arxiv.org/pdf/2112.05682.pdf
-        for (int64_t ic = 0; ic < nek1; ++ic) {
-            const float mv = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
-            if (mv == -INFINITY) {
+        for (int64_t ic0 = ic_beg; ic0 < ic_end; ic0 += GGML_FA_TILE_KV) {
+            const int64_t nc = MIN(GGML_FA_TILE_KV, ic_end - ic0);
+
+            // skip the tiles that are fully masked without converting the mask, e.g. the cells of other sequences
+            if (mp && ggml_fa_mask_is_inf(mp + ic0, nc)) {
                 continue;
             }
 
-            float s; // KQ value
+            float Mt = -INFINITY; // maximum KQ value of the tile
 
-            const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
-            kq_vec_dot(DK, &s, 0, k_data, 0, Q_q, 0, 1);
+            for (int64_t j = 0; j < nc; ++j) {
+                const int64_t ic = ic0 + j;
 
-            s = s*scale; // scale KQ value
+                const float mv = mp ? slope*GGML_CPU_FP16_TO_FP32(mp[ic]) : 0.0f;
+                if (mv == -INFINITY) {
+                    KQ[j] = -INFINITY;
+                    continue;
+                }
 
-            if (logit_softcap != 0.0f) {
-                s = logit_softcap*tanhf(s);
-            }
+                float s; // KQ value
 
-            s += mv; // apply mask
+                const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
+                kq_vec_dot(DK, &s, 0, k_data, 0, Q_q, 0, 1);
 
-            const float Mold = M;
+                s = s*scale; // scale KQ value
+
+                if (logit_softcap != 0.0f) {
+                    s = logit_softcap*tanhf(s);
+                }
 
-            float ms = 1.0f; // upon new higher max val, scale VKQ and KQ sum with this value
-            float vs = 1.0f; // post-softmax KQ value, expf(s - M)
+                s += mv; // apply mask
 
-            const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
+                KQ[j] = s;
+                Mt = MAX(Mt, s);
+            }
+
+            if (Mt == -INFINITY) {
+                // the whole tile is masked
+                continue;
+            }
 
-            if (v->type == GGML_TYPE_F16) {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+            if (Mt > M) {
+                // new maximum, scale VKQ and KQ sum with expf(Mold - M)
+                const float ms = expf(M - Mt);
+                M = Mt;
 
-                    // V = V*expf(Mold - M)
+                if (v->type == GGML_TYPE_F16) {
                     ggml_vec_scale_f16(DV, VKQ16, ms);
                 } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+                    ggml_vec_scale_f32(DV, VKQ32, ms);
                 }
 
-                // V += v*expf(s - M)
-                ggml_vec_mad_f16(DV, VKQ16, (const ggml_fp16_t *) v_data, vs);
-            } else {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
+                S = S*ms;
+            }
 
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f32(DV, VKQ32, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
+            // post-softmax KQ values, expf(s - M), masked values become 0
+            S += (float) ggml_vec_soft_max_f32(nc, KQ, KQ, M);
+
+            for (int64_t j = 0; j < nc; ++j) {
+                const float vs = KQ[j];
+                if (vs == 0.0f) {
+                    continue;
                 }
 
+                const char * v_data = ((const char *) v->data + ((ic0 + j)*nbv1 + iv2*nbv2 + iv3*nbv3));
+
                 // V += v*expf(s - M)
-                if (v_to_float) {
+                if (v->type == GGML_TYPE_F16) {
+                    ggml_vec_mad_f16(DV, VKQ16, (const ggml_fp16_t *) v_data, vs);
+                } else if (v_to_float) {
                     v_to_float(v_data, V32, DV);
                     ggml_vec_mad_f32(DV, VKQ32, V32, vs);
                 } else {
@@ -8502,8 +8651,6 @@ static void ggml_compute_forward_flash_attn_ext_f16(
                     ggml_vec_mad_f32(DV, VKQ32, (const float *) v_data, vs);
                 }
             }
-
-            S = S*ms + vs; // scale and increment sum with partial sum
         }
 
         if (v->type == GGML_TYPE_F16) {
@@ -23,6 +23,9 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 // Work buffer size for im2col operations in CONV2D
 #define GGML_IM2COL_WORK_SIZE (16 * 1024 * 1024)
 
+// Number of KV rows per online softmax step in FLASH_ATTN_EXT
+#define GGML_FA_TILE_KV 64
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -109,6 +112,11 @@ void ggml_compute_forward_cross_entropy_loss_back(const struct ggml_compute_para
 void ggml_compute_forward_opt_step_adamw(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_mul_mat(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_opt_step_sgd(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+
+// fused ops
+void ggml_compute_forward_rms_norm_fused(const struct ggml_compute_params * params, struct ggml_tensor * add, struct ggml_tensor * norm, struct ggml_tensor * mul);
+void ggml_compute_forward_rope_set_rows(const struct ggml_compute_params * params, struct ggml_tensor * rope, struct ggml_tensor * set_rows);
+
 #ifdef __cplusplus
 }
 #endif
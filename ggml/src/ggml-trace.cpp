@@ -0,0 +1,220 @@
+#include "ggml-impl.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// events kept per thread, the oldest events are overwritten when a buffer wraps around
+// the buffers grow as events are recorded, so that threads with few events use little memory
+#define GGML_TRACE_DEFAULT_EVENTS (1 << 17)
+
+struct ggml_trace_event {
+    int64_t      ts;
+    int64_t      dur;
+    const char * cat;
+    char         name[GGML_MAX_NAME];
+};
+
+// single producer ring buffer, only the owning thread writes to it
+// the events are appended until the capacity is reached, after which the buffer wraps around
+struct ggml_trace_buffer {
+    int tid;
+
+    size_t capacity;
+
+    std::atomic<uint64_t> n_events{0};
+
+    std::vector<ggml_trace_event> events;
+};
+
+struct ggml_trace_state {
+    std::mutex mutex;
+
+    std::string fname;
+
+    int64_t t_start  = 0;
+    size_t  capacity = GGML_TRACE_DEFAULT_EVENTS;
+
+    // the buffers outlive their threads, the events of finished threads are still written
+    std::vector<std::unique_ptr<ggml_trace_buffer>> buffers;
+};
+
+static std::atomic<bool> ggml_trace_on{false};
+
+static thread_local ggml_trace_buffer * ggml_trace_tls = nullptr;
+
+static ggml_trace_state & ggml_trace_get_state() {
+    static ggml_trace_state state;
+    return state;
+}
+
+static void ggml_trace_atexit() {
+    ggml_trace_stop();
+}
+
+static ggml_trace_buffer * ggml_trace_thread_buffer() {
+    if (ggml_trace_tls == nullptr) {
+        auto & state = ggml_trace_get_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        auto buf = std::make_unique<ggml_trace_buffer>();
+        buf->tid      = (int) state.buffers.size() + 1;
+        buf->capacity = state.capacity;
+
+        ggml_trace_tls = buf.get();
+        state.buffers.push_back(std::move(buf));
+    }
+
+    return ggml_trace_tls;
+}
+
+static void ggml_trace_write_str(FILE * f, const char * s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        const unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+void ggml_trace_start(const char * fname) {
+    auto & state = ggml_trace_get_state();
+
+    static const bool registered = [] {
+        // the state is constructed before the handler is registered, so it is destroyed after the handler runs
+        atexit(ggml_trace_atexit);
+        return true;
+    }();
+    GGML_UNUSED(registered);
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        if (ggml_trace_on.load(std::memory_order_relaxed)) {
+            GGML_LOG_WARN("%s: tracing already started, writing to %s\n", __func__, state.fname.c_str());
+            return;
+        }
+
+        const char * GGML_TRACE_EVENTS = getenv("GGML_TRACE_EVENTS");
+        if (GGML_TRACE_EVENTS) {
+            state.capacity = std::max<size_t>(1, strtoull(GGML_TRACE_EVENTS, nullptr, 10));
+        }
+
+        for (auto & buf : state.buffers) {
+            buf->n_events.store(0, std::memory_order_relaxed);
+            buf->capacity = state.capacity;
+            buf->events.clear();
+        }
+
+        state.fname   = fname;
+        state.t_start = ggml_time_us();
+    }
+
+    // allocate the buffer of the calling thread now, so that it does not delay its first event
+    ggml_trace_thread_buffer();
+
+    ggml_trace_on.store(true, std::memory_order_release);
+}
+
+void ggml_trace_stop(void) {
+    if (!ggml_trace_on.exchange(false)) {
+        return;
+    }
+
+    auto & state = ggml_trace_get_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    FILE * f = ggml_fopen(state.fname.c_str(), "wb");
+    if (!f) {
+        GGML_LOG_ERROR("%s: failed to open %s\n", __func__, state.fname.c_str());
+        return;
+    }
+
+    size_t n_written = 0;
+    size_t n_dropped = 0;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"ggml\"}}");
+
+    for (const auto & buf : state.buffers) {
+        const uint64_t n   = buf->n_events.load(std::memory_order_acquire);
+        const uint64_t cap = buf->capacity;
+        const uint64_t i0  = n > cap ? n - cap : 0;
+
+        if (n == 0) {
+            continue;
+        }
+
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", buf->tid, buf->tid);
+
+        for (uint64_t i = i0; i < n; ++i) {
+            const auto & ev = buf->events[i % cap];
+
+            fprintf(f, ",\n{\"name\":");
+            ggml_trace_write_str(f, ev.name);
+            fprintf(f, ",\"cat\":");
+            ggml_trace_write_str(f, ev.cat);
+            fprintf(f, ",\"ph\":\"X\",\"ts\":%" PRId64 ",\"dur\":%" PRId64 ",\"pid\":1,\"tid\":%d}",
+                    ev.ts - state.t_start, ev.dur, buf->tid);
+        }
+
+        n_written += n - i0;
+        n_dropped += i0;
+    }
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    GGML_LOG_INFO("%s: wrote %zu events of %zu threads to %s\n", __func__, n_written, state.buffers.size(), state.fname.c_str());
+    if (n_dropped > 0) {
+        GGML_LOG_WARN("%s: %zu older events were overwritten, increase GGML_TRACE_EVENTS (%zu per thread) to keep them\n",
+                __func__, n_dropped, state.capacity);
+    }
+}
+
+bool ggml_trace_enabled(void) {
+    return ggml_trace_on.load(std::memory_order_relaxed);
+}
+
+int64_t ggml_trace_begin(void) {
+    return ggml_trace_on.load(std::memory_order_relaxed) ? ggml_time_us() : 0;
+}
+
+void ggml_trace_end(int64_t t_start, const char * cat, const char * name) {
+    if (t_start == 0 || !ggml_trace_on.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    const int64_t t_end = ggml_time_us();
+
+    ggml_trace_buffer * buf = ggml_trace_thread_buffer();
+
+    const uint64_t n = buf->n_events.load(std::memory_order_relaxed);
+
+    if (buf->events.size() < buf->capacity) {
+        buf->events.emplace_back();
+    }
+
+    auto & ev = buf->events[n % buf->capacity];
+    ev.ts  = t_start;
+    ev.dur = t_end - t_start;
+    ev.cat = cat;
+    strncpy(ev.name, name, sizeof(ev.name) - 1);
+    ev.name[sizeof(ev.name) - 1] = '\0';
+
+    buf->n_events.store(n + 1, std::memory_order_release);
+}
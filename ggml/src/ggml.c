@@ -4943,6 +4943,26 @@ void ggml_flash_attn_ext_add_sinks(
     a->src[4] = sinks;
 }
 
+void ggml_flash_attn_ext_add_kv_ranges(
+        struct ggml_tensor * a,
+        struct ggml_tensor * kv_ranges) {
+    if (!kv_ranges) {
+        a->src[5] = NULL;
+        return;
+    }
+
+    GGML_ASSERT(a->op == GGML_OP_FLASH_ATTN_EXT);
+    GGML_ASSERT(a->src[3] != NULL);
+    GGML_ASSERT(a->src[5] == NULL);
+    GGML_ASSERT(ggml_is_contiguous(kv_ranges));
+    GGML_ASSERT(kv_ranges->type  == GGML_TYPE_I32);
+    GGML_ASSERT(kv_ranges->ne[0] == 2);
+    GGML_ASSERT(kv_ranges->ne[1] >= a->src[0]->ne[1]);
+    GGML_ASSERT(kv_ranges->ne[3] == a->src[3]->ne[3]);
+
+    a->src[5] = kv_ranges;
+}
+
 // ggml_flash_attn_back
 
 struct ggml_tensor * ggml_flash_attn_back(
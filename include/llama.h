@@ -288,6 +288,7 @@ extern "C" {
         bool use_mlock;       // force system to keep model in RAM
         bool check_tensors;   // validate model tensor data
         bool use_extra_bufts; // use extra buffer types (used for weight repacking)
+        bool use_hugepages;   // allocate the CPU weights and KV cache with huge pages (the weights are not mmapped)
     };
 
     // NOTE: changing the default values of parameters marked as [EXPERIMENTAL] may cause crashes or incorrect results in certain configurations
@@ -314,6 +315,10 @@ extern "C" {
         uint32_t yarn_orig_ctx;    // YaRN original context size
         float    defrag_thold;     // [DEPRECATED] defragment the KV cache if holes/size > thold, <= 0 disabled (default)
 
+        // keep the most used MoE experts in host memory resident (locked), up to this size in MiB, 0 = disabled [EXPERIMENTAL]
+        // the routing statistics are collected at runtime, the next most used experts are prefetched
+        uint32_t expert_cache_mib;
+
         ggml_backend_sched_eval_callback cb_eval;
         void * cb_eval_user_data;
 
@@ -338,6 +343,7 @@ extern "C" {
         bool kv_unified;  // use a unified buffer across the input sequences when computing the attention
                           // try to disable when n_seq_max > 1 for improved performance when the sequences do not share a large prefix
                           // ref: https://github.com/ggml-org/llama.cpp/pull/14363
+        bool weight_prefetch; // prefetch the memory mapped weights of the next layers during the compute [EXPERIMENTAL]
     };
 
     // model quantization parameters
@@ -404,6 +404,66 @@ llama_ubatch llama_batch_allocr::ubatch_reserve(uint32_t n_seq_tokens, uint32_t
     return res;
 }
 
+llama_ubatch llama_batch_allocr::ubatch_pad(const llama_ubatch & ubatch, uint32_t n_tokens) const {
+    GGML_ASSERT(!ubatch.equal_seqs() && ubatch.n_seq_tokens == 1);
+    GGML_ASSERT(ubatch.n_tokens > 0 && n_tokens >= ubatch.n_tokens);
+
+    const uint32_t n_real = ubatch.n_tokens;
+
+    const int32_t n_pos_cur = ubatch.embd ? n_pos_per_embd : 1;
+
+    auto udata = std::make_shared<llama_ubatch::data_t>();
+
+    udata->token     .resize(n_tokens);
+    udata->embd      .resize(ubatch.embd ? (int64_t) n_tokens*n_embd : 0);
+    udata->pos       .resize((int64_t) n_tokens*n_pos_cur);
+    udata->n_seq_id  .resize(n_tokens);
+    udata->seq_id    .resize(n_tokens);
+    udata->seq_id_unq.assign(ubatch.seq_id_unq, ubatch.seq_id_unq + ubatch.n_seqs_unq);
+    udata->seq_idx   .assign(ubatch.seq_idx,    ubatch.seq_idx    + LLAMA_MAX_SEQ);
+    udata->output    .resize(n_tokens);
+
+    for (uint32_t i = 0; i < n_tokens; ++i) {
+        const uint32_t j = std::min(i, n_real - 1);
+
+        if (ubatch.token) {
+            udata->token[i] = ubatch.token[j];
+        }
+
+        if (ubatch.embd) {
+            memcpy(udata->embd.data() + (int64_t) i*n_embd, ubatch.embd + (int64_t) j*n_embd, n_embd*sizeof(float));
+        }
+
+        for (int k = 0; k < n_pos_cur; ++k) {
+            udata->pos[k*n_tokens + i] = ubatch.pos[k*n_real + j];
+        }
+
+        udata->n_seq_id[i] = ubatch.n_seq_id[j];
+        udata->seq_id[i]   = ubatch.seq_id[j];
+        udata->output[i]   = ubatch.output[j];
+    }
+
+    llama_ubatch res {
+        /*.b_equal_seqs =*/ false,
+        /*.n_tokens     =*/ n_tokens,
+        /*.n_seq_tokens =*/ 1,
+        /*.n_seqs       =*/ n_tokens,
+        /*.n_seqs_unq   =*/ ubatch.n_seqs_unq,
+
+        /*.token        =*/ ubatch.token ? udata->token.data() : nullptr,
+        /*.embd         =*/ ubatch.embd ? udata->embd.data() : nullptr,
+        /*.pos          =*/ udata->pos.data(),
+        /*.n_seq_id     =*/ udata->n_seq_id.data(),
+        /*.seq_id       =*/ udata->seq_id.data(),
+        /*.seq_id_unq   =*/ udata->seq_id_unq.data(),
+        /*.seq_idx      =*/ udata->seq_idx.data(),
+        /*.output       =*/ udata->output.data(),
+        /*.data         =*/ std::move(udata),
+    };
+
+    return res;
+}
+
 const llama_batch & llama_batch_allocr::get_batch() const {
     return batch;
 }
@@ -100,6 +100,10 @@ public:
     // TODO: support embeddings if needed in the future
     llama_ubatch ubatch_reserve(uint32_t n_seq_tokens, uint32_t n_seqs);
 
+    // pad a ubatch from split_simple() to n_tokens by repeating its last token
+    // the padding tokens compute the same thing as the last token, their KV data goes to an empty cell and their outputs are ignored
+    llama_ubatch ubatch_pad(const llama_ubatch & ubatch, uint32_t n_tokens) const;
+
 private:
     void clear();
 
@@ -2,10 +2,14 @@
 
 #include "llama-impl.h"
 #include "llama-batch.h"
+#include "llama-expert-cache.h"
 #include "llama-io.h"
+#include "llama-kv-cache.h"
+#include "llama-kv-cache-iswa.h"
 #include "llama-memory.h"
 #include "llama-mmap.h"
 #include "llama-model.h"
+#include "llama-prefetch.h"
 
 #include <cinttypes>
 #include <cstring>
@@ -39,6 +43,7 @@ llama_context::llama_context(
     cparams.yarn_attn_factor = params.yarn_attn_factor;
     cparams.yarn_beta_fast   = params.yarn_beta_fast;
     cparams.yarn_beta_slow   = params.yarn_beta_slow;
+    cparams.expert_cache_mib = params.expert_cache_mib;
     cparams.embeddings       = params.embeddings;
     cparams.offload_kqv      = params.offload_kqv;
     cparams.flash_attn       = params.flash_attn;
@@ -102,6 +107,8 @@ llama_context::llama_context(
     cparams.op_offload = params.op_offload;
     cparams.kv_unified = params.kv_unified;
 
+    cparams.weight_prefetch = params.weight_prefetch;
+
     {
         const char * LLAMA_SET_ROWS = getenv("LLAMA_SET_ROWS");
         supports_set_rows = LLAMA_SET_ROWS ? (atoi(LLAMA_SET_ROWS) != 0) : supports_set_rows;
@@ -211,6 +218,42 @@ llama_context::llama_context(
         memory.reset(model.create_memory(params_mem, cparams));
     }
 
+    // init the expert cache
+    if (!hparams.vocab_only && cparams.expert_cache_mib > 0) {
+        if (model.params.use_mlock) {
+            LLAMA_LOG_WARN("%s: the model is already locked in memory - disabling the expert cache\n", __func__);
+        } else {
+            expert_cache = std::make_unique<llama_expert_cache>(model, (size_t) cparams.expert_cache_mib*1024*1024);
+
+            if (!expert_cache->enabled()) {
+                LLAMA_LOG_WARN("%s: the model has no experts in host memory - disabling the expert cache\n", __func__);
+                expert_cache.reset();
+            }
+        }
+
+        if (!expert_cache) {
+            cparams.expert_cache_mib = 0;
+        }
+    }
+
+    // init the weight prefetcher
+    if (!hparams.vocab_only && cparams.weight_prefetch) {
+        if (!model.params.use_mmap || model.params.use_mlock) {
+            LLAMA_LOG_WARN("%s: the model is not memory mapped or is locked in memory - disabling the weight prefetch\n", __func__);
+        } else {
+            prefetch = std::make_unique<llama_prefetch>(model, cparams.cb_eval, cparams.cb_eval_user_data);
+
+            if (!prefetch->enabled()) {
+                LLAMA_LOG_WARN("%s: the model has no memory mapped layer weights - disabling the weight prefetch\n", __func__);
+                prefetch.reset();
+            }
+        }
+
+        if (!prefetch) {
+            cparams.weight_prefetch = false;
+        }
+    }
+
     // init backends
     if (!hparams.vocab_only) {
         LLAMA_LOG_DEBUG("%s: enumerating backends\n", __func__);
@@ -701,9 +744,18 @@ llm_graph_result * llama_context::process_ubatch(const llama_ubatch & ubatch, ll
     auto * res = gf_res_prev.get();
     auto * gf  = res->get_gf();
 
+    // the graph is built for the padded ubatch, the outputs of the padding tokens come last and are ignored
+    const uint32_t n_tokens_pad = graph_n_tokens_pad(ubatch, mctx, gtype);
+
+    const llama_ubatch ubatch_graph = n_tokens_pad > ubatch.n_tokens ? balloc->ubatch_pad(ubatch, n_tokens_pad) : ubatch;
+
     // the new graph parameters
     // in order to correctly reuse a graph, it's full topology has to be uniquely determined by these parameters
-    const auto gparams = graph_params(res, ubatch, mctx, gtype);
+    auto gparams = graph_params(res, ubatch_graph, mctx, gtype);
+
+    if (n_tokens_pad > ubatch.n_tokens && ubatch.output[ubatch.n_tokens - 1]) {
+        gparams.n_outputs += n_tokens_pad - ubatch.n_tokens;
+    }
 
     if (!graph_reuse_disable && res->can_reuse(gparams)) {
         //LLAMA_LOG_DEBUG("%s: reusing previous graph\n", __func__);
@@ -713,13 +765,17 @@ llm_graph_result * llama_context::process_ubatch(const llama_ubatch & ubatch, ll
         res->reset();
 
         ggml_backend_sched_reset(sched.get());
-        ggml_backend_sched_set_eval_callback(sched.get(), cparams.cb_eval, cparams.cb_eval_user_data);
+        if (prefetch) {
+            ggml_backend_sched_set_eval_callback(sched.get(), llama_prefetch::eval_callback, prefetch.get());
+        } else {
+            ggml_backend_sched_set_eval_callback(sched.get(), cparams.cb_eval, cparams.cb_eval_user_data);
+        }
 
-        //const auto t_start_us = ggml_time_us();
+        const int64_t t_build = ggml_trace_begin();
 
         gf = model.build_graph(gparams);
 
-        //LLAMA_LOG_INFO("graph build time: %.3f ms\n", (ggml_time_us() - t_start_us)/1000.0);
+        ggml_trace_end(t_build, "llama", "graph_build");
 
         if (!gf) {
             LLAMA_LOG_ERROR("%s: failed to initialize graph\n", __func__);
@@ -727,23 +783,32 @@ llm_graph_result * llama_context::process_ubatch(const llama_ubatch & ubatch, ll
             return nullptr;
         }
 
+        const int64_t t_alloc = ggml_trace_begin();
+
         if (!ggml_backend_sched_alloc_graph(sched.get(), gf)) {
             LLAMA_LOG_ERROR("%s: failed to allocate graph\n", __func__);
             ret = GGML_STATUS_ALLOC_FAILED;
             return nullptr;
         }
+
+        ggml_trace_end(t_alloc, "llama", "graph_alloc");
     }
 
     // set the input data for the input tensors
     {
-        //const auto t_start_us = ggml_time_us();
+        const int64_t t_inputs = ggml_trace_begin();
 
-        res->set_inputs(&ubatch);
+        res->set_inputs(&ubatch_graph);
 
-        //LLAMA_LOG_INFO("graph set inputs time: %.3f ms\n", (ggml_time_us() - t_start_us)/1000.0);
+        ggml_trace_end(t_inputs, "llama", "set_inputs");
     }
 
+    const int64_t t_compute = ggml_trace_begin();
+
     const auto status = graph_compute(res->get_gf(), ubatch.n_tokens > 1);
+
+    ggml_trace_end(t_compute, "llama", "graph_compute");
+
     if (status != GGML_STATUS_SUCCESS) {
         LLAMA_LOG_ERROR("%s: failed to compute graph, compute status: %d\n", __func__, status);
         ret = status;
@@ -1098,6 +1163,24 @@ int llama_context::decode(const llama_batch & batch_inp) {
             t_embd = res->get_embd_pooled();
         }
 
+        // feed the expert routing of this ubatch to the expert cache
+        if (expert_cache) {
+            std::vector<int32_t> topk;
+
+            for (const auto & [il, t_topk] : res->t_moe_topk) {
+                ggml_backend_t backend_topk = ggml_backend_sched_get_tensor_backend(sched.get(), t_topk);
+                GGML_ASSERT(backend_topk != nullptr);
+
+                topk.resize(ggml_nelements(t_topk));
+
+                ggml_backend_tensor_get_async(backend_topk, t_topk, topk.data(), 0, ggml_nbytes(t_topk));
+                ggml_backend_synchronize(backend_topk);
+
+                // the graph may be padded, only the rows of the tokens of the ubatch are real
+                expert_cache->observe(il, topk.data(), ubatch.n_tokens, t_topk->ne[0]);
+            }
+        }
+
         // extract logits
         if (t_logits && n_outputs > 0) {
             ggml_backend_t backend_res = ggml_backend_sched_get_tensor_backend(sched.get(), t_logits);
@@ -1221,6 +1304,10 @@ int llama_context::decode(const llama_batch & batch_inp) {
         }
     }
 
+    if (expert_cache) {
+        expert_cache->update();
+    }
+
     // wait for the computation to finish (automatically done when obtaining the model output)
     //synchronize();
 
@@ -1436,6 +1523,46 @@ ggml_status llama_context::graph_compute(
     return status;
 }
 
+uint32_t llama_context::graph_n_tokens_pad(
+                      const llama_ubatch & ubatch,
+            const llama_memory_context_i * mctx,
+                          llm_graph_type   gtype) const {
+    const uint32_t n_tokens = ubatch.n_tokens;
+
+    // the padding tokens must write their KV data to an empty cell, instead of being new keys in the attention
+    // this rules out the recurrent state, the pooled embeddings and the ggml_cpy() path of the KV cache
+    if (graph_reuse_disable || !supports_set_rows || gtype != LLM_GRAPH_TYPE_DECODER || mctx == nullptr || cparams.embeddings ||
+        llm_arch_is_recurrent(model.arch) || llm_arch_is_hybrid(model.arch) ||
+        ubatch.equal_seqs() || ubatch.n_seq_tokens != 1 || n_tokens <= 1) {
+        return n_tokens;
+    }
+
+    if (const auto * kv = dynamic_cast<const llama_kv_cache_context *>(mctx)) {
+        if (!kv->get_can_pad()) {
+            return n_tokens;
+        }
+    } else if (const auto * kv = dynamic_cast<const llama_kv_cache_iswa_context *>(mctx)) {
+        if (!kv->get_base()->get_can_pad() || !kv->get_swa()->get_can_pad()) {
+            return n_tokens;
+        }
+    } else {
+        return n_tokens;
+    }
+
+    // larger ubatches are compute bound and the graph build time is negligible in comparison
+    if (n_tokens > 64) {
+        return n_tokens;
+    }
+
+    // buckets: 2, 4, 8, 16, 24, 32, ..., 64
+    uint32_t n_tokens_pad = GGML_PAD(n_tokens, 8);
+    if (n_tokens <= 4) {
+        n_tokens_pad = n_tokens <= 2 ? 2 : 4;
+    }
+
+    return n_tokens_pad <= cparams.n_ubatch ? n_tokens_pad : n_tokens;
+}
+
 llm_graph_cb llama_context::graph_get_cb() const {
     return [&](const llama_ubatch & ubatch, ggml_tensor * cur, const char * name, int il) {
         if (il >= 0) {
@@ -2236,6 +2363,7 @@ llama_context_params llama_context_default_params() {
         /*.yarn_beta_slow              =*/ 1.0f,
         /*.yarn_orig_ctx               =*/ 0,
         /*.defrag_thold                =*/ -1.0f,
+        /*.expert_cache_mib            =*/ 0,
         /*.cb_eval                     =*/ nullptr,
         /*.cb_eval_user_data           =*/ nullptr,
         /*.type_k                      =*/ GGML_TYPE_F16,
@@ -2249,6 +2377,7 @@ llama_context_params llama_context_default_params() {
         /*.op_offload                  =*/ true,
         /*.swa_full                    =*/ true,
         /*.kv_unified                  =*/ false,
+        /*.weight_prefetch             =*/ false,
     };
 
     return result;
@@ -2663,7 +2792,12 @@ size_t llama_state_seq_load_file(llama_context * ctx, const char * filepath, lla
 int32_t llama_encode(
         llama_context * ctx,
           llama_batch   batch) {
+    const int64_t t_start = ggml_trace_begin();
+
     const int ret = ctx->encode(batch);
+
+    ggml_trace_end(t_start, "llama", "encode");
+
     if (ret != 0) {
         LLAMA_LOG_ERROR("%s: failed to encode, ret = %d\n", __func__, ret);
     }
@@ -2674,7 +2808,12 @@ int32_t llama_encode(
 int32_t llama_decode(
         llama_context * ctx,
           llama_batch   batch) {
+    const int64_t t_start = ggml_trace_begin();
+
     const int ret = ctx->decode(batch);
+
+    ggml_trace_end(t_start, "llama", "decode");
+
     if (ret != 0 && ret != 1) {
         LLAMA_LOG_ERROR("%s: failed to decode, ret = %d\n", __func__, ret);
     }
@@ -20,6 +20,9 @@ class llama_io_write_i;
 struct llama_memory_i;
 struct llama_memory_context_i;
 
+struct llama_expert_cache;
+struct llama_prefetch;
+
 struct llama_context {
     // init scheduler and compute buffers, reserve worst-case graphs
     llama_context(
@@ -205,6 +208,12 @@ private:
             const llama_memory_context_i * mctx,
                           llm_graph_type   gtype) const;
 
+    // number of tokens to pad the ubatch to, so that the previous graph can be reused while the number of tokens varies
+    uint32_t graph_n_tokens_pad(
+                      const llama_ubatch & ubatch,
+            const llama_memory_context_i * mctx,
+                          llm_graph_type   gtype) const;
+
     llm_graph_cb graph_get_cb() const;
 
     // TODO: read/write lora adapters and cvec
@@ -228,6 +237,12 @@ private:
 
     std::unique_ptr<llama_memory_i> memory;
 
+    // adaptive residency of the MoE experts in host memory (optional)
+    std::unique_ptr<llama_expert_cache> expert_cache;
+
+    // layer by layer prefetch of the memory mapped weights (optional)
+    std::unique_ptr<llama_prefetch> prefetch;
+
     // decode output (2-dimensional array: [n_outputs][n_vocab])
     size_t  logits_size = 0; // capacity (of floats) for logits
     float * logits      = nullptr;
@@ -25,6 +25,8 @@ struct llama_cparams {
     float yarn_beta_fast;
     float yarn_beta_slow;
 
+    uint32_t expert_cache_mib;
+
     bool embeddings;
     bool causal_attn;
     bool offload_kqv;
@@ -33,6 +35,7 @@ struct llama_cparams {
     bool warmup;
     bool op_offload;
     bool kv_unified;
+    bool weight_prefetch;
 
     enum llama_pooling_type pooling_type;
 
@@ -0,0 +1,307 @@
+#include "llama-expert-cache.h"
+
+#include "llama-impl.h"
+#include "llama-mmap.h"
+#include "llama-model.h"
+
+#include <algorithm>
+#include <numeric>
+
+llama_expert_cache::llama_expert_cache(const llama_model & model, size_t budget) :
+    llama_expert_cache(model.hparams.n_layer, model.hparams.n_expert, host_ranges(model), budget) {
+}
+
+llama_expert_cache::llama_expert_cache(uint32_t n_layer, uint32_t n_expert, std::vector<std::vector<range>> ranges, size_t budget) :
+    n_layer(n_layer),
+    n_expert(n_expert),
+    budget(budget),
+    ranges(std::move(ranges)) {
+    if (!enabled()) {
+        return;
+    }
+
+    GGML_ASSERT(this->ranges.size() == n_layer*n_expert);
+
+    sizes .resize(n_layer*n_expert, 0);
+    counts.resize(n_layer*n_expert, 0.0f);
+    hot   .resize(n_layer*n_expert, 0);
+    warm  .resize(n_layer*n_expert, 0);
+
+    hot_applied.resize(n_layer*n_expert, 0);
+
+    locked = std::vector<std::atomic<uint8_t>>(n_layer*n_expert);
+
+    size_t total = 0;
+
+    for (uint32_t i = 0; i < n_layer*n_expert; ++i) {
+        for (const auto & r : this->ranges[i]) {
+            sizes[i] += r.size;
+        }
+        total += sizes[i];
+    }
+
+    LLAMA_LOG_INFO("%s: %.2f MiB of experts in host memory, keeping up to %.2f MiB resident\n", __func__,
+            total / (1024.0 * 1024.0), budget / (1024.0 * 1024.0));
+
+    thread = std::thread(&llama_expert_cache::worker, this);
+}
+
+std::vector<std::vector<llama_expert_cache::range>> llama_expert_cache::host_ranges(const llama_model & model) {
+    const uint32_t n_layer  = model.hparams.n_layer;
+    const uint32_t n_expert = model.hparams.n_expert;
+
+    if (n_expert == 0) {
+        return {};
+    }
+
+    std::vector<std::vector<range>> res(n_layer*n_expert);
+
+    bool found = false;
+
+    for (uint32_t il = 0; il < n_layer; ++il) {
+        const auto & layer = model.layers[il];
+
+        for (const ggml_tensor * t : { layer.ffn_gate_exps, layer.ffn_up_exps, layer.ffn_down_exps }) {
+            if (t == nullptr || t->data == nullptr || t->buffer == nullptr) {
+                continue;
+            }
+
+            // the CPU extra buffer types (e.g. repacked weights) are in host memory even if they are not host buffers
+            ggml_backend_dev_t dev = ggml_backend_buft_get_device(ggml_backend_buffer_get_type(t->buffer));
+            if (!ggml_backend_buffer_is_host(t->buffer) && (!dev || ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_CPU)) {
+                continue;
+            }
+
+            if (t->ne[2] != (int64_t) n_expert) {
+                continue;
+            }
+
+            for (uint32_t e = 0; e < n_expert; ++e) {
+                res[il*n_expert + e].push_back({ (const uint8_t *) t->data + e*t->nb[2], t->nb[2] });
+            }
+
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return {};
+    }
+
+    return res;
+}
+
+llama_expert_cache::~llama_expert_cache() {
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    if (n_total > 0) {
+        LLAMA_LOG_INFO("%s: %.2f MiB of experts resident, %.1f%% of the expert selections were resident\n", __func__,
+                n_locked.load() / (1024.0 * 1024.0), 100.0 * n_hits / n_total);
+    }
+
+    // the model can outlive the context
+    for (uint32_t i = 0; i < locked.size(); ++i) {
+        if (locked[i]) {
+            for (const auto & r : ranges[i]) {
+                llama_mem_unlock(r.data, r.size);
+            }
+        }
+    }
+}
+
+void llama_expert_cache::observe(int32_t il, const int32_t * ids, int64_t n_tokens, int64_t n_expert_used) {
+    if (!enabled() || il < 0 || il >= (int32_t) n_layer) {
+        return;
+    }
+
+    for (int64_t i = 0; i < n_tokens*n_expert_used; ++i) {
+        const int32_t e = ids[i];
+        if (e < 0 || e >= (int32_t) n_expert) {
+            continue;
+        }
+
+        counts[idx(il, e)] += 1.0f;
+
+        n_hits  += locked[idx(il, e)].load(std::memory_order_relaxed);
+        n_total += 1;
+    }
+}
+
+void llama_expert_cache::update() {
+    if (!enabled() || ++n_updates % n_update_interval != 0) {
+        return;
+    }
+
+    plan p = make_plan(counts, sizes, budget);
+
+    // older routing counts less
+    for (auto & c : counts) {
+        c *= decay;
+    }
+
+    // only the experts that just became warm are prefetched, the others were prefetched by an earlier plan or were locked
+    std::vector<uint8_t>  warm_cur(warm.size(), 0);
+    std::vector<uint32_t> prefetch;
+
+    for (const uint32_t i : p.prefetch) {
+        warm_cur[i] = 1;
+
+        if (!warm[i] && !hot[i]) {
+            prefetch.push_back(i);
+        }
+    }
+
+    warm       = std::move(warm_cur);
+    p.prefetch = std::move(prefetch);
+
+    if (p.hot == hot && p.prefetch.empty()) {
+        return;
+    }
+
+    hot = p.hot;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // a plan that was not applied yet is simply superseded
+        pending     = std::move(p);
+        has_pending = true;
+    }
+    cv.notify_one();
+}
+
+llama_expert_cache::plan llama_expert_cache::make_plan(const std::vector<float> & counts, const std::vector<size_t> & sizes, size_t budget) {
+    std::vector<uint32_t> order(counts.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return counts[a] > counts[b];
+    });
+
+    plan p;
+    p.hot.resize(counts.size(), 0);
+
+    size_t size_hot  = 0;
+    size_t size_warm = 0;
+
+    for (const uint32_t i : order) {
+        if (counts[i] == 0.0f) {
+            break;
+        }
+
+        if (sizes[i] == 0) {
+            continue;
+        }
+
+        if (size_hot + sizes[i] <= budget) {
+            size_hot += sizes[i];
+            p.hot[i] = 1;
+        } else if (size_warm + sizes[i] <= budget) {
+            size_warm += sizes[i];
+            p.prefetch.push_back(i);
+        }
+    }
+
+    return p;
+}
+
+void llama_expert_cache::sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv_idle.wait(lock, [&] { return !has_pending && !busy; });
+}
+
+void llama_expert_cache::worker() {
+    while (true) {
+        plan p;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return stop || has_pending; });
+
+            if (stop) {
+                return;
+            }
+
+            p = std::move(pending);
+            pending     = {};
+            has_pending = false;
+            busy        = true;
+        }
+
+        apply(p);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy = false;
+        }
+        cv_idle.notify_all();
+    }
+}
+
+void llama_expert_cache::apply(const plan & p) {
+    // note: llama_mem_lock/unlock only touch the whole pages inside a range, so the page that an expert shares with
+    //       its neighbour is never locked and unlocking a cooled expert cannot unlock a page of a hot one
+
+    // unlock first to make room for the new hot experts
+    for (uint32_t i = 0; i < locked.size(); ++i) {
+        if (locked[i] && !p.hot[i]) {
+            for (const auto & r : ranges[i]) {
+                llama_mem_unlock(r.data, r.size);
+            }
+            locked[i] = 0;
+            n_locked -= sizes[i];
+        }
+    }
+
+    for (uint32_t i = 0; i < locked.size(); ++i) {
+        if (locked[i] || !p.hot[i]) {
+            continue;
+        }
+
+        if (!lock_failed) {
+            size_t n_ok = 0;
+            for (const auto & r : ranges[i]) {
+                if (!llama_mem_lock(r.data, r.size)) {
+                    LLAMA_LOG_WARN("%s: failed to lock the hot experts, prefetching them instead\n", __func__);
+                    lock_failed = true;
+                    break;
+                }
+                n_ok++;
+            }
+
+            if (!lock_failed) {
+                locked[i] = 1;
+                n_locked += sizes[i];
+                continue;
+            }
+
+            for (size_t j = 0; j < n_ok; ++j) {
+                llama_mem_unlock(ranges[i][j].data, ranges[i][j].size);
+            }
+        }
+
+        // without locking, prefetching the hot experts is the best we can do
+        if (!hot_applied[i]) {
+            prefetch(i);
+        }
+    }
+
+    for (const uint32_t i : p.prefetch) {
+        prefetch(i);
+    }
+
+    hot_applied = p.hot;
+}
+
+void llama_expert_cache::prefetch(uint32_t i) {
+    for (const auto & r : ranges[i]) {
+        llama_mem_prefetch(r.data, r.size);
+    }
+
+    n_prefetched += sizes[i];
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct llama_model;
+
+//
+// llama_expert_cache
+//
+
+// adaptive residency of the MoE expert weights that live in host memory (e.g. mmapped from the model file)
+//
+// the routing of every ubatch is fed to observe(), which keeps a decaying hit count per (layer, expert)
+// update() ranks the experts and a background thread applies the placement:
+//   - hot:  the most used experts that fit in the budget are locked in physical memory so that the
+//           page cache cannot evict them when the model is larger than the RAM
+//   - warm: the next experts in the ranking (up to the same size again) are prefetched
+//   - cold: everything else is left to the OS
+struct llama_expert_cache {
+    struct range {
+        const uint8_t * data;
+        size_t          size;
+    };
+
+    struct plan {
+        std::vector<uint8_t>  hot;      // [n_layer*n_expert] experts to keep locked
+        std::vector<uint32_t> prefetch; // experts to prefetch
+    };
+
+    llama_expert_cache(const llama_model & model, size_t budget);
+
+    // ranges: [n_layer*n_expert] memory of each expert
+    llama_expert_cache(uint32_t n_layer, uint32_t n_expert, std::vector<std::vector<range>> ranges, size_t budget);
+
+    ~llama_expert_cache();
+
+    // false if the model has no expert tensors in host memory
+    bool enabled() const { return n_expert > 0 && !ranges.empty(); }
+
+    // ids: [n_tokens][n_expert_used] experts selected by layer il
+    void observe(int32_t il, const int32_t * ids, int64_t n_tokens, int64_t n_expert_used);
+
+    // call after each decode, the placement is recomputed every n_update_interval calls
+    void update();
+
+    // wait until the background thread has applied the last placement
+    void sync();
+
+    // expert selections so far, and how many of them were locked in memory at the time
+    uint64_t get_n_total() const { return n_total; }
+    uint64_t get_n_hits()  const { return n_hits; }
+
+    // bytes of experts currently locked in memory
+    size_t get_n_locked() const { return n_locked.load(); }
+
+    // bytes of experts prefetched so far
+    size_t get_n_prefetched() const { return n_prefetched.load(); }
+
+    // hot: the most used experts that fit in budget, prefetch: the next ones up to budget again
+    static plan make_plan(const std::vector<float> & counts, const std::vector<size_t> & sizes, size_t budget);
+
+    static constexpr uint32_t n_update_interval = 16;
+
+private:
+    static std::vector<std::vector<range>> host_ranges(const llama_model & model);
+
+    void worker();
+    void apply(const plan & p);
+    void prefetch(uint32_t i);
+
+    // index of the (layer, expert) pair
+    uint32_t idx(int32_t il, int32_t e) const { return il*n_expert + e; }
+
+    static constexpr float decay = 0.9f;
+
+    const uint32_t n_layer;
+    const uint32_t n_expert;
+
+    const size_t budget;
+
+    // [n_layer*n_expert] memory of each expert, one range per expert tensor (gate, up, down)
+    const std::vector<std::vector<range>> ranges;
+    std::vector<size_t>                   sizes;
+
+    std::vector<float>   counts;
+    std::vector<uint8_t> hot;
+    std::vector<uint8_t> warm;
+
+    uint32_t n_updates = 0;
+
+    // routing statistics
+    uint64_t n_hits  = 0;
+    uint64_t n_total = 0;
+
+    // background placement
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::condition_variable cv_idle;
+    std::thread             thread;
+
+    plan pending;
+    bool has_pending = false;
+    bool busy        = false;
+    bool stop        = false;
+
+    // written by the worker, read by observe() - a hot expert only counts as resident once it is actually locked
+    std::vector<std::atomic<uint8_t>> locked;
+    std::atomic<size_t>               n_locked{0};
+    std::atomic<size_t>               n_prefetched{0};
+
+    // owned by the worker
+    std::vector<uint8_t> hot_applied;
+
+    bool lock_failed = false;
+};
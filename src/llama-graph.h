@@ -276,13 +276,15 @@ public:
     ggml_tensor * get_k_idxs() const { return self_k_idxs; }
     ggml_tensor * get_v_idxs() const { return self_v_idxs; }
 
-    ggml_tensor * get_kq_mask() const { return self_kq_mask_cnv; }
+    ggml_tensor * get_kq_mask()   const { return self_kq_mask_cnv; }
+    ggml_tensor * get_kq_ranges() const { return self_kq_ranges; }
 
     ggml_tensor * self_k_idxs = nullptr; // I64 [n_batch]
     ggml_tensor * self_v_idxs = nullptr; // I64 [n_batch] or [n_batch*n_embd_v_gqa]
 
     ggml_tensor * self_kq_mask     = nullptr; // F32 [n_kv, n_batch/n_stream, 1, n_stream]
     ggml_tensor * self_kq_mask_cnv = nullptr; //     [n_kv, n_batch/n_stream, 1, n_stream]
+    ggml_tensor * self_kq_ranges   = nullptr; // I32 [2,    n_batch/n_stream, 1, n_stream] (FA only, optional)
 
     // note: these have to be copies because in order to be able to reuse a graph, its inputs
     //       need to carry these parameters with them. otherwise, they can point to freed
@@ -491,6 +493,9 @@ public:
     ggml_tensor * t_embd        = nullptr;
     ggml_tensor * t_embd_pooled = nullptr;
 
+    // experts selected by each MoE layer, only kept when the routing is observed (see llama_expert_cache)
+    std::vector<std::pair<int, ggml_tensor *>> t_moe_topk;
+
     std::vector<llm_graph_input_ptr> inputs;
 
     ggml_context_ptr ctx_compute;
@@ -680,13 +685,14 @@ struct llm_graph_context {
     //
 
     ggml_tensor * build_attn_mha(
-            ggml_tensor * q,       // [n_embd_head_q, n_head_q, n_tokens]
-            ggml_tensor * k,       // [n_embd_head_k, n_head_k, n_tokens]
-            ggml_tensor * v,       // [n_embd_head_v, n_head_v, n_tokens] (v_trans == false)
+            ggml_tensor * q,         // [n_embd_head_q, n_head_q, n_tokens]
+            ggml_tensor * k,         // [n_embd_head_k, n_head_k, n_tokens]
+            ggml_tensor * v,         // [n_embd_head_v, n_head_v, n_tokens] (v_trans == false)
             ggml_tensor * kq_b,
             ggml_tensor * kq_mask,
-            ggml_tensor * sinks,   // [n_head_q]
-            ggml_tensor * v_mla,   // [n_embd_head_v_mla, n_embd_head_v, n_head_v]
+            ggml_tensor * kq_ranges, // [2, n_tokens/n_stream, 1, n_stream] (optional)
+            ggml_tensor * sinks,     // [n_head_q]
+            ggml_tensor * v_mla,     // [n_embd_head_v_mla, n_embd_head_v, n_head_v]
                   float   kq_scale) const;
 
     llm_graph_input_attn_no_cache * build_attn_inp_no_cache() const;
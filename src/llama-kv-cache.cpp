@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <limits>
 #include <map>
 #include <stdexcept>
@@ -116,6 +117,10 @@ llama_kv_cache::llama_kv_cache(
             dev_name = ggml_backend_dev_name(dev);
         }
 
+        if (model.params.use_hugepages && buft == ggml_backend_cpu_buffer_type()) {
+            buft = ggml_backend_cpu_hugepage_buffer_type();
+        }
+
         LLAMA_LOG_DEBUG("%s: layer %3d: dev = %s\n", __func__, il, dev_name);
 
         ggml_context * ctx = ctx_for_buft(buft);
@@ -209,6 +214,10 @@ llama_kv_cache::llama_kv_cache(
     if (!supports_set_rows) {
         LLAMA_LOG_WARN("%s: LLAMA_SET_ROWS=0, using old ggml_cpy() method for backwards compatibility\n", __func__);
     }
+
+    // the graph is only reused with ggml_set_rows(), see llama_context::graph_n_tokens_pad()
+    const char * LLAMA_GRAPH_REUSE_DISABLE = getenv("LLAMA_GRAPH_REUSE_DISABLE");
+    graph_reuse = supports_set_rows && !(LLAMA_GRAPH_REUSE_DISABLE && atoi(LLAMA_GRAPH_REUSE_DISABLE) != 0);
 }
 
 void llama_kv_cache::clear(bool data) {
@@ -970,7 +979,16 @@ uint32_t llama_kv_cache::get_n_kv() const {
     for (uint32_t s = 0; s < n_stream; ++s) {
         const auto & cells = v_cells[s];
 
-        result = std::max(std::min(cells.size(), std::max(n_pad, GGML_PAD(cells.used_max_p1(), n_pad))), result);
+        const uint32_t used = cells.used_max_p1();
+
+        // with graph reuse, the padding grows with the number of used cells, so that n_kv (and with it the graph)
+        // changes every 1/16 to 1/8 of the context instead of every n_pad cells - the extra cells are masked
+        uint32_t n_pad_cur = n_pad;
+        while (graph_reuse && n_pad_cur*16 <= used) {
+            n_pad_cur *= 2;
+        }
+
+        result = std::max(std::min(cells.size(), std::max(n_pad, GGML_PAD(used, n_pad_cur))), result);
     }
 
     return result;
@@ -980,6 +998,19 @@ bool llama_kv_cache::get_supports_set_rows() const {
     return supports_set_rows;
 }
 
+int32_t llama_kv_cache::get_cell_pad(uint32_t strm) const {
+    const auto & cells = v_cells[strm];
+
+    // the cells past the last used one are usually empty, so start from the end
+    for (int32_t i = cells.size() - 1; i >= 0; --i) {
+        if (cells.is_empty(i)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 ggml_tensor * llama_kv_cache::get_k(ggml_context * ctx, int32_t il, uint32_t n_kv, const slot_info & sinfo) const {
     const int32_t ikv = map_layer_ids.at(il);
 
@@ -1148,7 +1179,7 @@ void llama_kv_cache::set_input_k_idxs(ggml_tensor * dst, const llama_ubatch * ub
     }
 
     const uint32_t n_tokens = ubatch->n_tokens;
-    GGML_ASSERT(n_tokens == (int64_t) sinfo.size()*sinfo.n_stream());
+    GGML_ASSERT(n_tokens == (int64_t) sinfo.size()*sinfo.n_stream() || (sinfo.n_stream() == 1 && n_tokens > sinfo.size()));
 
     GGML_ASSERT(ggml_backend_buffer_is_host(dst->buffer));
     int64_t * data = (int64_t *) dst->data;
@@ -1160,6 +1191,16 @@ void llama_kv_cache::set_input_k_idxs(ggml_tensor * dst, const llama_ubatch * ub
             data[s*sinfo.size() + i] = offs + sinfo.idxs[s][i];
         }
     }
+
+    // the tokens of a padded ubatch (see llama_batch_allocr::ubatch_pad) write to an empty cell, which is masked in the attention
+    if (n_tokens > sinfo.size()*sinfo.n_stream()) {
+        const int32_t idx_pad = get_cell_pad(sinfo.strm[0]);
+        GGML_ASSERT(idx_pad >= 0);
+
+        for (uint32_t i = sinfo.size(); i < n_tokens; ++i) {
+            data[i] = sinfo.strm[0]*get_size() + idx_pad;
+        }
+    }
 }
 
 void llama_kv_cache::set_input_v_idxs(ggml_tensor * dst, const llama_ubatch * ubatch, const slot_info & sinfo) const {
@@ -1168,7 +1209,7 @@ void llama_kv_cache::set_input_v_idxs(ggml_tensor * dst, const llama_ubatch * ub
     }
 
     const uint32_t n_tokens = ubatch->n_tokens;
-    GGML_ASSERT(n_tokens == (int64_t) sinfo.size()*sinfo.n_stream());
+    GGML_ASSERT(n_tokens == (int64_t) sinfo.size()*sinfo.n_stream() || (sinfo.n_stream() == 1 && n_tokens > sinfo.size()));
 
     GGML_ASSERT(ggml_backend_buffer_is_host(dst->buffer));
     int64_t * data = (int64_t *) dst->data;
@@ -1181,6 +1222,15 @@ void llama_kv_cache::set_input_v_idxs(ggml_tensor * dst, const llama_ubatch * ub
                 data[s*sinfo.size() + i] = offs + sinfo.idxs[s][i];
             }
         }
+
+        if (n_tokens > sinfo.size()*sinfo.n_stream()) {
+            const int32_t idx_pad = get_cell_pad(sinfo.strm[0]);
+            GGML_ASSERT(idx_pad >= 0);
+
+            for (uint32_t i = sinfo.size(); i < n_tokens; ++i) {
+                data[i] = sinfo.strm[0]*get_size() + idx_pad;
+            }
+        }
     } else {
         // note: the V cache is transposed when not using flash attention
         const int64_t kv_size = get_size();
@@ -1196,6 +1246,19 @@ void llama_kv_cache::set_input_v_idxs(ggml_tensor * dst, const llama_ubatch * ub
                 }
             }
         }
+
+        if (n_tokens > sinfo.size()*sinfo.n_stream()) {
+            const int32_t idx_pad = get_cell_pad(sinfo.strm[0]);
+            GGML_ASSERT(idx_pad >= 0);
+
+            const int64_t offs = sinfo.strm[0]*kv_size*n_embd_v_gqa;
+
+            for (uint32_t i = sinfo.size(); i < n_tokens; ++i) {
+                for (uint32_t j = 0; j < n_embd_v_gqa; ++j) {
+                    data[i*n_embd_v_gqa + j] = offs + j*kv_size + idx_pad;
+                }
+            }
+        }
     }
 }
 
@@ -1228,6 +1291,13 @@ void llama_kv_cache::set_input_kq_mask(ggml_tensor * dst, const llama_ubatch * u
     const int64_t n_tps     = n_tokens/n_stream;
     const int64_t n_tps_pad = GGML_PAD(n_tps, GGML_KQ_MASK_PAD);
 
+    // without ALiBi and SWA, the mask values do not depend on the distance between the positions
+    // in this case, build the rows from the per-sequence cell bitmasks instead of checking each cell for each token
+    if (!hparams.use_alibi && swa_type == LLAMA_SWA_TYPE_NONE) {
+        set_input_kq_mask_seq(data, ubatch, causal_attn, n_kv, n_stream);
+        return;
+    }
+
     std::fill(data, data + ggml_nelements(dst), -INFINITY);
 
     // Use only the previous KV cells of the correct sequence for each token of the ubatch.
@@ -1285,6 +1355,149 @@ void llama_kv_cache::set_input_kq_mask(ggml_tensor * dst, const llama_ubatch * u
     }
 }
 
+// dst[j] = 0.0f if cell j is set in the bitmask, -INFINITY otherwise
+static void llama_kv_mask_row(float * dst, const uint64_t * mask, int64_t n) {
+    for (int64_t j0 = 0; j0 < n; j0 += 64) {
+        const int64_t  nj = std::min<int64_t>(64, n - j0);
+        const uint64_t w  = mask[j0/64];
+
+        if (w == 0) {
+            std::fill(dst + j0, dst + j0 + nj, -INFINITY);
+            continue;
+        }
+
+        if (w == ~uint64_t(0)) {
+            std::fill(dst + j0, dst + j0 + nj, 0.0f);
+            continue;
+        }
+
+        for (int64_t j = 0; j < nj; ++j) {
+            dst[j0 + j] = (w >> j) & 1 ? 0.0f : -INFINITY;
+        }
+    }
+}
+
+void llama_kv_cache::set_input_kq_mask_seq(float * data, const llama_ubatch * ubatch, bool causal_attn, int64_t n_kv, int64_t n_stream) const {
+    const int64_t n_tps     = ubatch->n_tokens/n_stream;
+    const int64_t n_tps_pad = GGML_PAD(n_tps, GGML_KQ_MASK_PAD);
+
+    // cells of the current sequence that are in the future of some of the tokens (cell, pos)
+    std::vector<std::pair<uint32_t, llama_pos>> cells_future;
+
+    for (int64_t s = 0; s < n_stream; ++s) {
+        for (int64_t ii0 = 0; ii0 < n_tps; ) {
+            const llama_seq_id seq_id = ubatch->seq_id[s*n_tps + ii0][0];
+
+            const auto & cells = v_cells[seq_to_stream[seq_id]];
+
+            const uint64_t * mask = cells.seq_mask_get(seq_id);
+
+            // the consecutive tokens [ii0, ii1) of the same sequence share the same row, up to causality
+            int64_t   ii1    = ii0 + 1;
+            llama_pos p1_min = ubatch->pos[s*n_tps + ii0];
+
+            while (ii1 < n_tps && ubatch->seq_id[s*n_tps + ii1][0] == seq_id) {
+                p1_min = std::min(p1_min, ubatch->pos[s*n_tps + ii1]);
+                ++ii1;
+            }
+
+            float * row0 = data + n_kv*(s*n_tps_pad + ii0);
+
+            llama_kv_mask_row(row0, mask, n_kv);
+
+            for (int64_t ii = ii0 + 1; ii < ii1; ++ii) {
+                memcpy(data + n_kv*(s*n_tps_pad + ii), row0, n_kv*sizeof(float));
+            }
+
+            // mask future tokens
+            // during generation, the newest cell of the sequence is the current token and there is nothing to mask
+            // during prompt processing, these are typically the cells of the tokens in the ubatch
+            cells_future.clear();
+
+            if (causal_attn && cells.seq_pos_max(seq_id) > p1_min) {
+                for (int64_t j0 = 0; j0 < n_kv; j0 += 64) {
+                    const uint64_t w = mask[j0/64];
+                    if (w == 0) {
+                        continue;
+                    }
+
+                    for (int64_t j = j0; j < std::min<int64_t>(j0 + 64, n_kv); ++j) {
+                        if ((w >> (j - j0)) & 1) {
+                            const llama_pos p0 = cells.pos_get(j);
+                            if (p0 > p1_min) {
+                                cells_future.emplace_back(j, p0);
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (int64_t ii = ii0; ii < ii1 && !cells_future.empty(); ++ii) {
+                const llama_pos p1 = ubatch->pos[s*n_tps + ii];
+
+                float * row = data + n_kv*(s*n_tps_pad + ii);
+
+                for (const auto & [j, p0] : cells_future) {
+                    if (p0 > p1) {
+                        row[j] = -INFINITY;
+                    }
+                }
+            }
+
+            ii0 = ii1;
+        }
+
+        // padding
+        std::fill(data + n_kv*(s*n_tps_pad + n_tps), data + n_kv*(s + 1)*n_tps_pad, -INFINITY);
+    }
+}
+
+void llama_kv_cache::set_input_kq_ranges(ggml_tensor * dst, const llama_ubatch * ubatch, uint32_t n_kv) const {
+    GGML_ASSERT(ggml_backend_buffer_is_host(dst->buffer));
+    int32_t * data = (int32_t *) dst->data;
+
+    const int64_t n_stream = dst->ne[3];
+    const int64_t n_tps    = ubatch->n_tokens/n_stream;
+    const int64_t n_words  = llama_kv_cells::n_mask_words(n_kv);
+
+    // the range of 64-cell words that contain cells of the sequence of the token
+    // this is a superset of the cells that are not masked by set_input_kq_mask()
+    llama_seq_id seq_id_prev = -1;
+
+    int32_t beg = 0;
+    int32_t end = 0;
+
+    for (int64_t s = 0; s < n_stream; ++s) {
+        for (int64_t ii = 0; ii < n_tps; ++ii) {
+            const int64_t i = s*n_tps + ii;
+
+            const llama_seq_id seq_id = ubatch->seq_id[i][0];
+
+            if (seq_id != seq_id_prev) {
+                const uint64_t * mask = v_cells[seq_to_stream[seq_id]].seq_mask_get(seq_id);
+
+                int64_t w0 = 0;
+                while (w0 < n_words && mask[w0] == 0) {
+                    ++w0;
+                }
+
+                int64_t w1 = n_words;
+                while (w1 > w0 && mask[w1 - 1] == 0) {
+                    --w1;
+                }
+
+                beg = w0*64;
+                end = std::min<int64_t>(w1*64, n_kv);
+
+                seq_id_prev = seq_id;
+            }
+
+            data[2*i + 0] = beg;
+            data[2*i + 1] = end;
+        }
+    }
+}
+
 void llama_kv_cache::set_input_pos_bucket(ggml_tensor * dst, const llama_ubatch * ubatch) const {
     const int64_t n_tokens = ubatch->n_tokens;
 
@@ -2009,6 +2222,12 @@ bool llama_kv_cache_context::get_supports_set_rows() const {
     return kv->get_supports_set_rows();
 }
 
+bool llama_kv_cache_context::get_can_pad() const {
+    const auto & sinfo = sinfos[i_cur];
+
+    return sinfo.n_stream() == 1 && kv->get_cell_pad(sinfo.strm[0]) >= 0;
+}
+
 ggml_tensor * llama_kv_cache_context::get_k(ggml_context * ctx, int32_t il) const {
     return kv->get_k(ctx, il, n_kv, sinfos[i_cur]);
 }
@@ -2049,6 +2268,10 @@ void llama_kv_cache_context::set_input_kq_mask(ggml_tensor * dst, const llama_ub
     kv->set_input_kq_mask(dst, ubatch, causal_attn);
 }
 
+void llama_kv_cache_context::set_input_kq_ranges(ggml_tensor * dst, const llama_ubatch * ubatch) const {
+    kv->set_input_kq_ranges(dst, ubatch, n_kv);
+}
+
 void llama_kv_cache_context::set_input_pos_bucket(ggml_tensor * dst, const llama_ubatch * ubatch) const {
     kv->set_input_pos_bucket(dst, ubatch);
 }
@@ -144,6 +144,10 @@ public:
     // TODO: temporary
     bool get_supports_set_rows() const;
 
+    // an empty cell of the stream, to which the padding tokens of a ubatch write their KV data (see llama_batch_allocr::ubatch_pad)
+    // returns -1 if all cells of the stream are in use
+    int32_t get_cell_pad(uint32_t strm) const;
+
     // get views of the current state of the cache
     ggml_tensor * get_k(ggml_context * ctx, int32_t il, uint32_t n_kv, const slot_info & sinfo) const;
     ggml_tensor * get_v(ggml_context * ctx, int32_t il, uint32_t n_kv, const slot_info & sinfo) const;
@@ -183,6 +187,7 @@ public:
     void set_input_k_shift(ggml_tensor * dst) const;
 
     void set_input_kq_mask   (ggml_tensor * dst, const llama_ubatch * ubatch, bool causal_attn) const;
+    void set_input_kq_ranges (ggml_tensor * dst, const llama_ubatch * ubatch, uint32_t n_kv) const;
     void set_input_pos_bucket(ggml_tensor * dst, const llama_ubatch * ubatch) const;
 
 private:
@@ -219,6 +224,10 @@ private:
     // ref: https://github.com/ggml-org/llama.cpp/pull/14285
     bool supports_set_rows = true;
 
+    // env: LLAMA_GRAPH_REUSE_DISABLE
+    // the n_kv padding is only coarsened when the graph can be reused
+    bool graph_reuse = true;
+
     const llama_swa_type swa_type = LLAMA_SWA_TYPE_NONE;
 
     std::vector<ggml_context_ptr>        ctxs;
@@ -248,6 +257,9 @@ private:
 
     bool is_masked_swa(llama_pos p0, llama_pos p1) const;
 
+    // fast path of set_input_kq_mask() for models without ALiBi and SWA
+    void set_input_kq_mask_seq(float * data, const llama_ubatch * ubatch, bool causal_attn, int64_t n_kv, int64_t n_stream) const;
+
     ggml_tensor * build_rope_shift(
             const llama_cparams & cparams,
                    ggml_context * ctx,
@@ -321,6 +333,9 @@ public:
     // TODO: temporary
     bool get_supports_set_rows() const;
 
+    // whether the current ubatch can be padded, i.e. its stream has an empty cell for the padding tokens
+    bool get_can_pad() const;
+
     // get views of the current state of the cache
     ggml_tensor * get_k(ggml_context * ctx, int32_t il) const;
     ggml_tensor * get_v(ggml_context * ctx, int32_t il) const;
@@ -337,6 +352,7 @@ public:
 
     void set_input_k_shift   (ggml_tensor * dst) const;
     void set_input_kq_mask   (ggml_tensor * dst, const llama_ubatch * ubatch, bool causal_attn) const;
+    void set_input_kq_ranges (ggml_tensor * dst, const llama_ubatch * ubatch) const;
     void set_input_pos_bucket(ggml_tensor * dst, const llama_ubatch * ubatch) const;
 
 private:
@@ -3,6 +3,7 @@
 #include "llama.h"
 #include "llama-cparams.h"
 
+#include <algorithm>
 #include <bitset>
 #include <cassert>
 #include <vector>
@@ -20,6 +21,8 @@ public:
             seq[i].reset();
         }
 
+        std::fill(seq_mask.begin(), seq_mask.end(), 0);
+
         has_shift = false;
 
         used.clear();
@@ -46,6 +49,8 @@ public:
         shift.resize(n);
         seq.resize(n);
 
+        seq_mask.resize(LLAMA_MAX_SEQ*n_mask_words(n));
+
         reset();
     }
 
@@ -109,6 +114,7 @@ public:
 
             res.pos[j] = pos[idx];
             res.seq[j] = seq[idx];
+            res.seq_mask_upd(j);
 
             assert(shift[idx] == 0);
         }
@@ -127,6 +133,7 @@ public:
 
             res.pos[j] = pos[idx];
             res.seq[j] = seq[idx];
+            res.seq_mask_upd(j);
 
             assert(shift[idx] == 0);
         }
@@ -155,6 +162,7 @@ public:
 
             pos[idx] = other.pos[j];
             seq[idx] = other.seq[j];
+            seq_mask_upd(idx);
 
             if (pos[idx] != -1) {
                 seq_pos_add(i + j);
@@ -185,6 +193,7 @@ public:
 
             pos[idx] = other.pos[j];
             seq[idx] = other.seq[j];
+            seq_mask_upd(idx);
 
             if (pos[idx] != -1) {
                 seq_pos_add(idx);
@@ -200,6 +209,7 @@ public:
         assert(pos[i] != -1);
 
         seq_pos_rm(i);
+        seq_mask_clr(i);
         seq[i].reset();
 
         pos[i] = -1;
@@ -218,6 +228,7 @@ public:
 
         seq[i].reset(seq_id);
         seq_pos_dec(seq_id, pos[i]);
+        seq_mask[seq_id*n_mask_words(pos.size()) + i/64] &= ~(uint64_t(1) << (i%64));
 
         if (seq[i].none()) {
             pos[i] = -1;
@@ -237,16 +248,19 @@ public:
 
         if (seq[i].test(seq_id)) {
             seq_pos_rm(i);
+            seq_mask_clr(i);
             seq[i].reset();
 
             seq[i].set(seq_id);
             seq_pos_inc(seq_id, pos[i]);
+            seq_mask_upd(i);
 
             return false;
         }
 
         if (seq[i].any()) {
             seq_pos_rm(i);
+            seq_mask_clr(i);
             seq[i].reset();
 
             pos[i] = -1;
@@ -278,6 +292,19 @@ public:
         return seq[i].test(seq_id);
     }
 
+    // bit (j % 64) of word (j / 64) is set if cell j contains seq_id
+    // the words are kept up to date by the mutators, so that the KQ mask can be built without visiting every cell
+    const uint64_t * seq_mask_get(llama_seq_id seq_id) const {
+        assert(seq_id >= 0);
+        assert(seq_id < LLAMA_MAX_SEQ);
+
+        return seq_mask.data() + seq_id*n_mask_words(pos.size());
+    }
+
+    static uint32_t n_mask_words(uint32_t n) {
+        return (n + 63)/64;
+    }
+
     // note: call only if the cell is not empty and the seq_id is not in the cell
     void seq_add(uint32_t i, llama_seq_id seq_id) {
         assert(i < pos.size());
@@ -286,6 +313,7 @@ public:
 
         seq[i].set(seq_id);
         seq_pos_inc(seq_id, pos[i]);
+        seq_mask[seq_id*n_mask_words(pos.size()) + i/64] |= uint64_t(1) << (i%64);
     }
 
     // return the sequence id of this cell
@@ -383,6 +411,7 @@ public:
         has_shift = true;
 
         if (pos[i] < 0) {
+            seq_mask_clr(i);
             seq[i].reset();
             pos[i] = -1;
             shift[i] = 0;
@@ -446,6 +475,9 @@ private:
     // the bitset seq[i] tells us which sequences are currently occupying the i-th cell
     std::vector<seq_set_t> seq;
 
+    // the transpose of `seq`: for each sequence, a bitmask over the cells, see seq_mask_get()
+    std::vector<uint64_t> seq_mask;
+
     // the set seq_pos[s][p] tells us how many times the position p is currently present for sequence s
     // if the position p is not present, seq_pos[s][p] is not set
     // this way seq_pos[s].begin() and seq_pos[s].rbegin() give us the min/max positions currently in the cache
@@ -488,4 +520,32 @@ private:
             }
         }
     }
+
+    // helper functions for updating `seq_mask` after seq[i] is modified:
+
+    // clear the bits of cell i for all of its current sequences
+    void seq_mask_clr(uint32_t i) {
+        const uint32_t n_words = n_mask_words(pos.size());
+
+        for (int s = 0; s < LLAMA_MAX_SEQ; ++s) {
+            if (seq[i].test(s)) {
+                seq_mask[s*n_words + i/64] &= ~(uint64_t(1) << (i%64));
+            }
+        }
+    }
+
+    // set the bits of cell i to match seq[i]
+    void seq_mask_upd(uint32_t i) {
+        const uint32_t n_words = n_mask_words(pos.size());
+
+        for (int s = 0; s < LLAMA_MAX_SEQ; ++s) {
+            uint64_t & w = seq_mask[s*n_words + i/64];
+
+            if (seq[i].test(s)) {
+                w |=  (uint64_t(1) << (i%64));
+            } else {
+                w &= ~(uint64_t(1) << (i%64));
+            }
+        }
+    }
 };
@@ -77,6 +77,10 @@ llama_memory_recurrent::llama_memory_recurrent(
             dev_name = ggml_backend_dev_name(dev);
         }
 
+        if (model.params.use_hugepages && buft == ggml_backend_cpu_buffer_type()) {
+            buft = ggml_backend_cpu_hugepage_buffer_type();
+        }
+
         LLAMA_LOG_DEBUG("%s, layer %3d: dev = %s\n", __func__, i, dev_name);
 
         ggml_context * ctx = ctx_for_buft(buft);
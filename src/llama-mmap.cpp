@@ -595,6 +595,118 @@ const bool llama_mlock::SUPPORTED = true;
 const bool llama_mlock::SUPPORTED = false;
 #endif
 
+// memory range hints
+
+static size_t llama_page_size() {
+#if defined(_WIN32)
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (size_t) si.dwPageSize;
+#elif defined(_POSIX_MAPPED_FILES) || defined(_POSIX_MEMLOCK_RANGE)
+    return (size_t) sysconf(_SC_PAGESIZE);
+#else
+    return 4096;
+#endif
+}
+
+// shrink [addr, addr + size) to whole pages, returns false if no page is left
+static bool llama_page_range(const void * addr, size_t size, void ** first, size_t * len) {
+    const size_t page_size = llama_page_size();
+
+    const uintptr_t beg = ((uintptr_t) addr + page_size - 1) & ~(page_size - 1);
+    const uintptr_t end = ((uintptr_t) addr + size) & ~(page_size - 1);
+
+    if (end <= beg) {
+        return false;
+    }
+
+    *first = (void *) beg;
+    *len   = end - beg;
+
+    return true;
+}
+
+bool llama_mem_lock(const void * addr, size_t size) {
+    void * first;
+    size_t len;
+    if (!llama_page_range(addr, size, &first, &len)) {
+        return true;
+    }
+
+#if defined(_POSIX_MEMLOCK_RANGE)
+    if (mlock(first, len)) {
+        LLAMA_LOG_WARN("warning: failed to mlock %zu-byte range: %s\n", len, std::strerror(errno));
+        return false;
+    }
+    return true;
+#elif defined(_WIN32)
+    if (!VirtualLock(first, len)) {
+        LLAMA_LOG_WARN("warning: failed to VirtualLock %zu-byte range: %s\n", len, llama_format_win_err(GetLastError()).c_str());
+        return false;
+    }
+    return true;
+#else
+    LLAMA_LOG_WARN("warning: mlock not supported on this system\n");
+    return false;
+#endif
+}
+
+void llama_mem_unlock(const void * addr, size_t size) {
+    void * first;
+    size_t len;
+    if (!llama_page_range(addr, size, &first, &len)) {
+        return;
+    }
+
+#if defined(_POSIX_MEMLOCK_RANGE)
+    if (munlock(first, len)) {
+        LLAMA_LOG_WARN("warning: failed to munlock range: %s\n", std::strerror(errno));
+    }
+#elif defined(_WIN32)
+    VirtualUnlock(first, len);
+#endif
+}
+
+void llama_mem_prefetch(const void * addr, size_t size) {
+    void * first;
+    size_t len;
+    if (!llama_page_range(addr, size, &first, &len)) {
+        return;
+    }
+
+#if defined(_POSIX_MAPPED_FILES)
+    if (posix_madvise(first, len, POSIX_MADV_WILLNEED)) {
+        LLAMA_LOG_DEBUG("%s: posix_madvise(.., POSIX_MADV_WILLNEED) failed: %s\n", __func__, strerror(errno));
+    }
+#elif defined(_WIN32) && _WIN32_WINNT >= 0x602
+    BOOL (WINAPI *pPrefetchVirtualMemory) (HANDLE, ULONG_PTR, PWIN32_MEMORY_RANGE_ENTRY, ULONG);
+    HMODULE hKernel32 = GetModuleHandleW(L"kernel32.dll");
+
+    pPrefetchVirtualMemory = (decltype(pPrefetchVirtualMemory))(void *) GetProcAddress(hKernel32, "PrefetchVirtualMemory");
+
+    if (pPrefetchVirtualMemory) {
+        WIN32_MEMORY_RANGE_ENTRY range;
+        range.VirtualAddress = first;
+        range.NumberOfBytes  = (SIZE_T) len;
+        pPrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+#endif
+}
+
+void llama_mem_cold(const void * addr, size_t size) {
+    void * first;
+    size_t len;
+    if (!llama_page_range(addr, size, &first, &len)) {
+        return;
+    }
+
+#if defined(__linux__) && defined(MADV_COLD)
+    if (madvise(first, len, MADV_COLD)) {
+        LLAMA_LOG_DEBUG("%s: madvise(.., MADV_COLD) failed: %s\n", __func__, strerror(errno));
+    }
+#endif
+}
+
 size_t llama_path_max() {
     return PATH_MAX;
 }
@@ -65,4 +65,17 @@ private:
     std::unique_ptr<impl> pimpl;
 };
 
+// hints for ranges of host memory (e.g. the weights of a single expert)
+// only the whole pages inside [addr, addr + size) are affected
+
+// lock the pages in physical memory, returns false on failure
+bool llama_mem_lock(const void * addr, size_t size);
+void llama_mem_unlock(const void * addr, size_t size);
+
+// ask the OS to start reading the pages in the background
+void llama_mem_prefetch(const void * addr, size_t size);
+
+// tell the OS that the pages will not be needed soon, they are reclaimed first under memory pressure (Linux only)
+void llama_mem_cold(const void * addr, size_t size);
+
 size_t llama_path_max();
@@ -465,6 +465,9 @@ struct llama_model {
 
     bool has_tensor_overrides() const;
 
+    // true if addr is in one of the memory mapped model files
+    bool is_mapped(const void * addr) const;
+
     const struct ggml_tensor * get_tensor(const char * name) const;
 
     float get_rope_freq_base (const llama_cparams & cparams, int il) const;
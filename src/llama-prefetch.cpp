@@ -0,0 +1,243 @@
+#include "llama-prefetch.h"
+
+#include "llama-impl.h"
+#include "llama-mmap.h"
+#include "llama-model.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// layer of a graph node named "<prefix>-<il>", -1 if the name does not match
+static int32_t llama_prefetch_node_layer(const char * name, const char * prefix) {
+    const size_t n = strlen(prefix);
+    if (strncmp(name, prefix, n) != 0 || name[n] != '-') {
+        return -1;
+    }
+    return atoi(name + n + 1);
+}
+
+llama_prefetch::llama_prefetch(const llama_model & model, ggml_backend_sched_eval_callback cb_eval, void * cb_eval_user_data) :
+    n_layer(model.hparams.n_layer),
+    n_expert(model.hparams.n_expert),
+    cb_eval(cb_eval),
+    cb_eval_user_data(cb_eval_user_data) {
+    groups .resize(n_layer + 1);
+    experts.resize(n_layer*n_expert);
+    routed .resize(n_layer);
+
+    need_done   .resize(n_layer, 0);
+    need_routing.resize(n_layer, 0);
+
+    selected.resize(n_expert, 0);
+
+    auto add_range = [&](std::vector<range> & dst, const ggml_tensor * t, const uint8_t * data, size_t size) {
+        if (t->buffer == nullptr || !model.is_mapped(data)) {
+            return;
+        }
+        dst.push_back({ data, size });
+        n_bytes += size;
+    };
+
+    for (const auto & [name, t] : model.tensors_by_name) {
+        int il = -1;
+        if (sscanf(name.c_str(), "blk.%d.", &il) != 1 || il < 0 || il >= (int) n_layer || t->data == nullptr) {
+            continue;
+        }
+
+        const auto & layer = model.layers[il];
+
+        const bool is_exps = n_expert > 0 && t->ne[2] == (int64_t) n_expert &&
+            (t == layer.ffn_gate_exps || t == layer.ffn_up_exps || t == layer.ffn_down_exps);
+
+        if (is_exps) {
+            for (uint32_t e = 0; e < n_expert; ++e) {
+                add_range(experts[il*n_expert + e], t, (const uint8_t *) t->data + e*t->nb[2], t->nb[2]);
+            }
+        } else {
+            add_range(groups[il], t, (const uint8_t *) t->data, ggml_nbytes(t));
+        }
+    }
+
+    for (const ggml_tensor * t : { model.output_norm, model.output_norm_b, model.output, model.output_b }) {
+        if (t != nullptr && t->data != nullptr) {
+            add_range(groups[n_layer], t, (const uint8_t *) t->data, ggml_nbytes(t));
+        }
+    }
+
+    if (n_bytes == 0) {
+        return;
+    }
+
+    auto has_data = [&](uint32_t ig) {
+        if (!groups[ig].empty()) {
+            return true;
+        }
+        for (uint32_t e = 0; ig < n_layer && e < n_expert; ++e) {
+            if (!experts[ig*n_expert + e].empty()) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    for (uint32_t il = 0; il < n_layer; ++il) {
+        for (uint32_t k = 0; k <= n_ahead; ++k) {
+            need_done[il] |= has_data((il + k) % (n_layer + 1));
+        }
+        for (uint32_t e = 0; e < n_expert; ++e) {
+            need_routing[il] |= !experts[il*n_expert + e].empty();
+        }
+    }
+
+    LLAMA_LOG_INFO("%s: prefetching %.2f MiB of memory mapped weights layer by layer\n", __func__, n_bytes / (1024.0 * 1024.0));
+
+    thread = std::thread(&llama_prefetch::worker, this);
+
+    // the first layers of the first graph
+    for (uint32_t ig = 0; ig < n_ahead; ++ig) {
+        queue_group(OP_PREFETCH, ig);
+    }
+    flush();
+}
+
+llama_prefetch::~llama_prefetch() {
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+}
+
+bool llama_prefetch::eval_callback(ggml_tensor * t, bool ask, void * user_data) {
+    return ((llama_prefetch *) user_data)->eval(t, ask);
+}
+
+bool llama_prefetch::eval(ggml_tensor * t, bool ask) {
+    const int32_t il_done    = llama_prefetch_node_layer(t->name, "l_out");
+    const int32_t il_routing = llama_prefetch_node_layer(t->name, "ffn_moe_topk");
+
+    const bool need =
+        (il_done    >= 0 && il_done    < (int32_t) n_layer && need_done   [il_done]) ||
+        (il_routing >= 0 && il_routing < (int32_t) n_layer && need_routing[il_routing]);
+
+    const bool need_user = cb_eval && cb_eval(t, true, cb_eval_user_data);
+
+    if (ask) {
+        return need || need_user;
+    }
+
+    if (need) {
+        if (il_done >= 0) {
+            layer_done(il_done);
+        } else {
+            layer_routing(il_routing, t);
+        }
+    }
+
+    return need_user ? cb_eval(t, false, cb_eval_user_data) : true;
+}
+
+void llama_prefetch::layer_done(int32_t il) {
+    for (uint32_t k = 1; k <= n_ahead; ++k) {
+        queue_group(OP_PREFETCH, (il + k) % (n_layer + 1));
+    }
+
+    queue_group(OP_COLD, il);
+
+    flush();
+}
+
+void llama_prefetch::layer_routing(int32_t il, const ggml_tensor * t) {
+    if (t->type != GGML_TYPE_I32 || t->buffer == nullptr) {
+        return;
+    }
+
+    // the routing is a view of the sorted expert ids: [n_expert_used, n_tokens]
+    ids.resize(ggml_nbytes(t));
+    ggml_backend_tensor_get(t, ids.data(), 0, ids.size());
+
+    std::fill(selected.begin(), selected.end(), 0);
+
+    auto & cur = routed[il];
+    cur.clear();
+
+    for (int64_t i1 = 0; i1 < t->ne[1]; ++i1) {
+        for (int64_t i0 = 0; i0 < t->ne[0]; ++i0) {
+            int32_t e;
+            memcpy(&e, ids.data() + i1*t->nb[1] + i0*t->nb[0], sizeof(e));
+
+            if (e < 0 || e >= (int32_t) n_expert || selected[e]) {
+                continue;
+            }
+
+            selected[e] = 1;
+            cur.push_back(e);
+
+            queue_expert(OP_PREFETCH, il, e);
+        }
+    }
+
+    flush();
+}
+
+void llama_prefetch::queue_group(op_type type, uint32_t ig) {
+    for (const auto & r : groups[ig]) {
+        ops.push_back({ type, r });
+    }
+
+    if (ig < n_layer) {
+        for (const int32_t e : routed[ig]) {
+            queue_expert(type, ig, e);
+        }
+    }
+}
+
+void llama_prefetch::queue_expert(op_type type, uint32_t il, int32_t e) {
+    for (const auto & r : experts[il*n_expert + e]) {
+        ops.push_back({ type, r });
+    }
+}
+
+void llama_prefetch::flush() {
+    if (ops.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.insert(pending.end(), ops.begin(), ops.end());
+    }
+    cv.notify_one();
+
+    ops.clear();
+}
+
+void llama_prefetch::worker() {
+    std::vector<op> cur;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return stop || !pending.empty(); });
+
+            if (stop) {
+                return;
+            }
+
+            cur.swap(pending);
+        }
+
+        for (const auto & o : cur) {
+            switch (o.type) {
+                case OP_PREFETCH: llama_mem_prefetch(o.r.data, o.r.size); break;
+                case OP_COLD:     llama_mem_cold    (o.r.data, o.r.size); break;
+            }
+        }
+
+        cur.clear();
+    }
+}
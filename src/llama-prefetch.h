@@ -0,0 +1,99 @@
+#pragma once
+
+#include "ggml-backend.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct llama_model;
+
+//
+// llama_prefetch
+//
+
+// asynchronous prefetch of the weights of memory mapped models, for models that do not fit in the RAM
+//
+// the graph is computed layer by layer through the scheduler eval callback:
+//   - when layer il is done, the weights of the next layers are prefetched and the weights of layer il are
+//     marked cold, so that the page cache evicts them before the weights that are needed next
+//   - the experts of a MoE layer are prefetched as soon as the routing of the layer is known, the experts
+//     of the upcoming layers are predicted from the routing of the previous ubatch
+// the hints are applied by a background thread so that the compute is never blocked by the page cache
+struct llama_prefetch {
+    llama_prefetch(const llama_model & model, ggml_backend_sched_eval_callback cb_eval, void * cb_eval_user_data);
+    ~llama_prefetch();
+
+    // false if the model has no memory mapped layer weights
+    bool enabled() const { return n_bytes > 0; }
+
+    // scheduler eval callback, the user callback (if any) is still called for the tensors it asks for
+    static bool eval_callback(ggml_tensor * t, bool ask, void * user_data);
+
+private:
+    struct range {
+        const uint8_t * data;
+        size_t          size;
+    };
+
+    enum op_type {
+        OP_PREFETCH,
+        OP_COLD,
+    };
+
+    struct op {
+        op_type type;
+        range   r;
+    };
+
+    bool eval(ggml_tensor * t, bool ask);
+
+    void layer_done(int32_t il);
+    void layer_routing(int32_t il, const ggml_tensor * t);
+
+    // queue the hints for the weights of group ig and its predicted experts
+    void queue_group(op_type type, uint32_t ig);
+    void queue_expert(op_type type, uint32_t il, int32_t e);
+    void flush();
+
+    void worker();
+
+    // number of groups prefetched ahead of the layer that is being computed
+    static constexpr uint32_t n_ahead = 2;
+
+    const uint32_t n_layer;
+    const uint32_t n_expert;
+
+    const ggml_backend_sched_eval_callback cb_eval;
+    void * const cb_eval_user_data;
+
+    // [n_layer + 1] memory mapped weights of each layer except the experts, the last group is the output
+    std::vector<std::vector<range>> groups;
+
+    // [n_layer*n_expert] memory mapped weights of each expert, one range per expert tensor (gate, up, down)
+    std::vector<std::vector<range>> experts;
+
+    // [n_layer] the experts selected by the last routing of each layer
+    std::vector<std::vector<int32_t>> routed;
+
+    // [n_layer] layers that need to be observed
+    std::vector<uint8_t> need_done;
+    std::vector<uint8_t> need_routing;
+
+    size_t n_bytes = 0;
+
+    std::vector<op>      ops;
+    std::vector<uint8_t> ids;
+    std::vector<uint8_t> selected;
+
+    // background hints
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::thread             thread;
+
+    std::vector<op> pending;
+    bool stop = false;
+};
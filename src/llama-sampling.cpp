@@ -340,7 +340,14 @@ void llama_sampler_accept(struct llama_sampler * smpl, llama_token token) {
 
 void llama_sampler_apply(struct llama_sampler * smpl, struct llama_token_data_array * cur_p) {
     GGML_ASSERT(smpl->iface->apply);
+
+    const int64_t t_start = ggml_trace_begin();
+
     smpl->iface->apply(smpl, cur_p);
+
+    if (t_start) {
+        ggml_trace_end(t_start, "sampling", llama_sampler_name(smpl));
+    }
 }
 
 void llama_sampler_reset(struct llama_sampler * smpl) {
@@ -8,6 +8,7 @@
 #include "unicode.h"
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cctype>
 #include <cfloat>
@@ -17,6 +18,7 @@
 #include <forward_list>
 #include <limits>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <unordered_map>
@@ -271,11 +273,62 @@ struct llm_bigram_bpe {
     using queue = llama_priority_queue<llm_bigram_bpe, queue_storage, comparator>;
     llm_symbol::index left;
     llm_symbol::index right;
-    std::string text;
     int rank;
     size_t size;
 };
 
+// bounded word -> tokens cache, shared by all sessions of a BPE tokenizer
+// natural text repeats the same words constantly, so most words skip the merge loop entirely
+struct llm_tokenizer_bpe_cache {
+    static constexpr size_t n_shards      = 16;
+    static constexpr size_t n_shard_words = 4096;
+    static constexpr size_t max_word_size = 256; // longer words are not cached
+
+    bool get(const std::string & word, std::vector<llama_token> & output) const {
+        if (word.size() > max_word_size) {
+            return false;
+        }
+
+        auto & shard = shards[std::hash<std::string>{}(word) % n_shards];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        const auto it = shard.words.find(word);
+        if (it == shard.words.end()) {
+            return false;
+        }
+
+        output.insert(output.end(), it->second.begin(), it->second.end());
+
+        return true;
+    }
+
+    void put(const std::string & word, const llama_token * tokens, size_t n_tokens) const {
+        if (word.size() > max_word_size) {
+            return;
+        }
+
+        auto & shard = shards[std::hash<std::string>{}(word) % n_shards];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        // simple eviction policy: start over when the shard is full
+        if (shard.words.size() >= n_shard_words) {
+            shard.words.clear();
+        }
+
+        shard.words.emplace(word, std::vector<llama_token>(tokens, tokens + n_tokens));
+    }
+
+private:
+    struct shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::vector<llama_token>> words;
+    };
+
+    mutable std::array<shard, n_shards> shards;
+};
+
 struct llm_tokenizer_bpe : llm_tokenizer {
     llm_tokenizer_bpe(const llama_vocab & vocab) {
         GGML_ASSERT(vocab.get_type() == LLAMA_VOCAB_TYPE_BPE);
@@ -446,7 +499,36 @@ struct llm_tokenizer_bpe : llm_tokenizer {
         }
     }
 
+    // the merge ranks are keyed on a single string to avoid building a pair of strings for every lookup
+    // the length of the left part is prefixed so that different pairs never map to the same key
+    static void make_rank_key(std::string & key, const char * left, size_t n_left, const char * right, size_t n_right) {
+        const uint32_t n = n_left;
+
+        key.assign((const char *) &n, sizeof(n));
+        key.append(left, n_left);
+        key.append(right, n_right);
+    }
+
+    void add_rank(const std::string & left, const std::string & right, int rank) {
+        std::string key;
+        make_rank_key(key, left.data(), left.size(), right.data(), right.size());
+
+        ranks.emplace(std::move(key), rank);
+    }
+
+    int find_rank(const char * left, size_t n_left, const char * right, size_t n_right, std::string & key) const {
+        make_rank_key(key, left, n_left, right, n_right);
+
+        const auto it = ranks.find(key);
+
+        return it == ranks.end() ? -1 : it->second;
+    }
+
     std::vector<std::string> regex_exprs;
+
+    std::unordered_map<std::string, int> ranks;
+
+    llm_tokenizer_bpe_cache cache;
 };
 
 struct llm_tokenizer_bpe_session {
@@ -490,121 +572,115 @@ struct llm_tokenizer_bpe_session {
     }
 
     void tokenize(const std::string & text, std::vector<llama_token> & output) {
-        int final_prev_index = -1;
         const auto word_collection = unicode_regex_split(text, tokenizer.regex_exprs);
 
-        symbols_final.clear();
-
-        for (const auto & word : word_collection) {
-            work_queue = llm_bigram_bpe::queue();
-            symbols.clear();
+        tokenize_words(word_collection.data(), word_collection.size(), output);
+    }
 
-            int index = 0;
-            size_t offset = 0;
+private:
+    void tokenize_words(const std::string * words, size_t n_words, std::vector<llama_token> & output) {
+        for (size_t iw = 0; iw < n_words; ++iw) {
+            const std::string & word = words[iw];
 
-            //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
-            if (vocab.get_ignore_merges() && vocab.text_to_token(word) != LLAMA_TOKEN_NULL) {
-                symbols.emplace_back(llm_symbol{-1, -1, word.c_str(), word.size()});
-                offset = word.size();
+            if (tokenizer.cache.get(word, output)) {
+                continue;
             }
 
-            while (offset < word.size()) {
-                llm_symbol sym;
-                size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
-                sym.text = word.c_str() + offset;
-                sym.n = char_len;
-                offset += sym.n;
-                sym.prev = index - 1;
-                sym.next = offset == word.size() ? -1 : index + 1;
-                index++;
-                symbols.emplace_back(sym);
-            }
-            for (int i = 1; i < (int) symbols.size(); ++i) {
-                add_new_bigram(i - 1, i);
-            }
+            const size_t n_prev = output.size();
 
-            // build token(s)
-            while (!work_queue.empty()) {
-                auto bigram = work_queue.pop_move();
+            tokenize_word(word, output);
 
-                auto & left_symbol = symbols[bigram.left];
-                auto & right_symbol = symbols[bigram.right];
+            tokenizer.cache.put(word, output.data() + n_prev, output.size() - n_prev);
+        }
+    }
 
-                if (left_symbol.n == 0 || right_symbol.n == 0) {
-                    continue;
-                }
-                std::string left_token = std::string(left_symbol.text, left_symbol.n);
-                std::string right_token = std::string(right_symbol.text, right_symbol.n);
-                if (left_token + right_token != bigram.text) {
-                    continue;  // Skip this bigram if it's outdated
-                }
+    void tokenize_word(const std::string & word, std::vector<llama_token> & output) {
+        work_queue = llm_bigram_bpe::queue();
+        symbols.clear();
 
-                // merge the right sym into the left one
-                left_symbol.n += right_symbol.n;
-                right_symbol.n = 0;
+        int index = 0;
+        size_t offset = 0;
 
-                // remove the right sym from the chain
-                left_symbol.next = right_symbol.next;
-                if (right_symbol.next >= 0) {
-                    symbols[right_symbol.next].prev = bigram.left;
-                }
+        //if (vocab.tokenizer_ignore_merges && vocab.token_to_id.find(word) != vocab.token_to_id.end()) {
+        if (vocab.get_ignore_merges() && vocab.text_to_token(word) != LLAMA_TOKEN_NULL) {
+            symbols.emplace_back(llm_symbol{-1, -1, word.c_str(), word.size()});
+            offset = word.size();
+        }
+
+        while (offset < word.size()) {
+            llm_symbol sym;
+            size_t char_len = std::min(word.size() - offset, (size_t) unicode_len_utf8(word[offset]));
+            sym.text = word.c_str() + offset;
+            sym.n = char_len;
+            offset += sym.n;
+            sym.prev = index - 1;
+            sym.next = offset == word.size() ? -1 : index + 1;
+            index++;
+            symbols.emplace_back(sym);
+        }
+        for (int i = 1; i < (int) symbols.size(); ++i) {
+            add_new_bigram(i - 1, i);
+        }
 
-                add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
-                add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+        // build token(s)
+        while (!work_queue.empty()) {
+            auto bigram = work_queue.pop_move();
+
+            auto & left_symbol = symbols[bigram.left];
+            auto & right_symbol = symbols[bigram.right];
+
+            if (left_symbol.n == 0 || right_symbol.n == 0) {
+                continue;
+            }
+            // symbols only grow to the right and always start at the same offset in the word,
+            // so a bigram is outdated exactly when the combined size of its symbols changed
+            if (left_symbol.n + right_symbol.n != bigram.size) {
+                continue;
             }
 
-            // add the finished tokens to the final list keeping correct order for next and prev
-            for (auto & sym : symbols) {
-                if (sym.n > 0) {
-                    sym.prev = final_prev_index;
-                    sym.next = -1;
-                    if (final_prev_index != -1) {
-                        symbols_final[final_prev_index].next = symbols_final.size();
-                    }
-                    symbols_final.emplace_back(sym);
-                    final_prev_index = symbols_final.size() - 1;
-                }
+            // merge the right sym into the left one
+            left_symbol.n += right_symbol.n;
+            right_symbol.n = 0;
+
+            // remove the right sym from the chain
+            left_symbol.next = right_symbol.next;
+            if (right_symbol.next >= 0) {
+                symbols[right_symbol.next].prev = bigram.left;
             }
-        }
 
-        symbols = symbols_final;
+            add_new_bigram(left_symbol.prev, bigram.left);  // left side of current symbol
+            add_new_bigram(bigram.left, left_symbol.next);  // right side of current symbol
+        }
 
-        if (!symbols.empty()) {
-            for (int i = 0; i != -1; i = symbols[i].next) {
-                auto & symbol = symbols[i];
-                if (symbol.n == 0) {
-                    continue;
-                }
+        // the merged symbols are still in word order
+        for (const auto & symbol : symbols) {
+            if (symbol.n == 0) {
+                continue;
+            }
 
-                const std::string str = std::string(symbol.text, symbol.n);
-                const auto token = vocab.text_to_token(str);
+            const std::string str = std::string(symbol.text, symbol.n);
+            const auto token = vocab.text_to_token(str);
 
-                if (token == LLAMA_TOKEN_NULL) {
-                    for (auto j = str.begin(); j != str.end(); ++j) {
-                        std::string byte_str(1, *j);
-                        auto token_multibyte = vocab.text_to_token(byte_str);
-                        if (token_multibyte != LLAMA_TOKEN_NULL) {
-                            output.push_back(token_multibyte);
-                        }
+            if (token == LLAMA_TOKEN_NULL) {
+                for (auto j = str.begin(); j != str.end(); ++j) {
+                    std::string byte_str(1, *j);
+                    auto token_multibyte = vocab.text_to_token(byte_str);
+                    if (token_multibyte != LLAMA_TOKEN_NULL) {
+                        output.push_back(token_multibyte);
                     }
-                } else {
-                    output.push_back(token);
                 }
+            } else {
+                output.push_back(token);
             }
         }
     }
 
-private:
     void add_new_bigram(int left, int right) {
         if (left == -1 || right == -1) {
             return;
         }
-        std::string left_token  = std::string(symbols[left].text,  symbols[left].n);
-        std::string right_token = std::string(symbols[right].text, symbols[right].n);
 
-        int rank_found = -1;
-
-        rank_found = vocab.find_bpe_rank(left_token, right_token);
+        const int rank_found = tokenizer.find_rank(symbols[left].text, symbols[left].n, symbols[right].text, symbols[right].n, rank_key);
 
         if (rank_found < 0) {
             return;
@@ -614,8 +690,7 @@ private:
 
         bigram.left  = left;
         bigram.right = right;
-        bigram.text  = left_token + right_token;
-        bigram.size  = left_token.size() + right_token.size();
+        bigram.size  = symbols[left].n + symbols[right].n;
         bigram.rank  = rank_found;
 
         work_queue.push(bigram);
@@ -625,8 +700,10 @@ private:
     const llm_tokenizer_bpe & tokenizer;
 
     std::vector<llm_symbol> symbols;
-    std::vector<llm_symbol> symbols_final;
     llm_bigram_bpe::queue work_queue;
+
+    // scratch buffer for the merge rank lookups
+    std::string rank_key;
 };
 
 //
@@ -2576,8 +2653,16 @@ void llama_vocab::impl::init_tokenizer(enum llama_vocab_type type) {
             tokenizer = std::make_unique<llm_tokenizer_spm>(vocab);
             break;
         case LLAMA_VOCAB_TYPE_BPE:
-            tokenizer = std::make_unique<llm_tokenizer_bpe>(vocab);
-            break;
+            {
+                auto tokenizer_bpe = std::make_unique<llm_tokenizer_bpe>(vocab);
+
+                tokenizer_bpe->ranks.reserve(bpe_ranks.size());
+                for (const auto & it : bpe_ranks) {
+                    tokenizer_bpe->add_rank(it.first.first, it.first.second, it.second);
+                }
+
+                tokenizer = std::move(tokenizer_bpe);
+            } break;
         case LLAMA_VOCAB_TYPE_WPM:
             tokenizer = std::make_unique<llm_tokenizer_wpm>(vocab);
             break;
@@ -3451,11 +3536,17 @@ int llama_vocab::max_token_len() const {
 }
 
 int llama_vocab::find_bpe_rank(const std::string & token_left, const std::string & token_right) const {
-    GGML_ASSERT(token_left.find(' ')   == std::string::npos);
     GGML_ASSERT(token_left.find('\n')  == std::string::npos);
-    GGML_ASSERT(token_right.find(' ')  == std::string::npos);
     GGML_ASSERT(token_right.find('\n') == std::string::npos);
 
+    // look up the table that the tokenizer merges with
+    if (pimpl->type == LLAMA_VOCAB_TYPE_BPE && pimpl->tokenizer) {
+        const auto & tokenizer = *static_cast<const llm_tokenizer_bpe *>(pimpl->tokenizer.get());
+
+        std::string key;
+        return tokenizer.find_rank(token_left.data(), token_left.size(), token_right.data(), token_right.size(), key);
+    }
+
     auto it = pimpl->bpe_ranks.find(std::make_pair(token_left, token_right));
     if (it == pimpl->bpe_ranks.end()) {
         return -1;
@@ -3465,10 +3556,22 @@ int llama_vocab::find_bpe_rank(const std::string & token_left, const std::string
 }
 
 std::vector<std::string> llama_vocab::get_bpe_merges() const {
-    std::vector<std::string> result(pimpl->bpe_ranks.size());
+    // the ranks are the indices in the original merges array, which can have gaps when it contains
+    // duplicates or entries without a space, so sort by rank instead of indexing with it
+    std::vector<std::pair<int, std::string>> merges;
+    merges.reserve(pimpl->bpe_ranks.size());
 
     for (const auto & pair : pimpl->bpe_ranks) {
-        result[pair.second] = pair.first.first + " " + pair.first.second;
+        merges.emplace_back(pair.second, pair.first.first + " " + pair.first.second);
+    }
+
+    std::sort(merges.begin(), merges.end());
+
+    std::vector<std::string> result;
+    result.reserve(merges.size());
+
+    for (auto & merge : merges) {
+        result.push_back(std::move(merge.second));
     }
 
     return result;
@@ -0,0 +1,302 @@
+// Tests the graph allocator (ggml-alloc) on random graphs: the outputs computed with the tensors placed by ggml_gallocr
+// must match the outputs computed with every tensor in its own memory, including when the allocator reuses a cached plan
+// of another graph or packs the blocks offline.
+
+#include "ggml.h"
+#include "ggml-alloc.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+struct random_graph {
+    ggml_context * ctx = nullptr;
+    ggml_cgraph  * gf  = nullptr;
+
+    std::vector<ggml_tensor *> inputs;
+    std::vector<ggml_tensor *> outputs;
+
+    ~random_graph() {
+        ggml_free(ctx);
+    }
+};
+
+// random DAG of element-wise ops, concats and views on 1D tensors with power of 2 sizes
+// the topology depends only on seed, the sizes are multiplied by scale
+static void build_random_graph(random_graph & g, uint32_t seed, int scale, bool no_alloc) {
+    std::mt19937 rng(seed);
+
+    const int n_inputs = 2 + rng() % 4;
+    const int n_ops    = 8 + rng() % 40;
+
+    ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead()*(n_inputs + 2*n_ops + 8) + ggml_graph_overhead() + (no_alloc ? 0 : (size_t) 64*1024*1024),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ no_alloc,
+    };
+    g.ctx = ggml_init(params);
+
+    std::vector<ggml_tensor *> pool;
+
+    for (int i = 0; i < n_inputs; ++i) {
+        ggml_tensor * t = ggml_new_tensor_1d(g.ctx, GGML_TYPE_F32, (16 << (rng() % 6))*scale);
+        ggml_set_input(t);
+        g.inputs.push_back(t);
+        pool.push_back(t);
+    }
+
+    // pick mostly recent tensors so that some of them die early and some live long
+    auto pick = [&]() -> ggml_tensor * {
+        if (rng() % 4 == 0) {
+            return pool[rng() % pool.size()];
+        }
+        const size_t n = std::min<size_t>(pool.size(), 4);
+        return pool[pool.size() - 1 - rng() % n];
+    };
+
+    for (int i = 0; i < n_ops; ++i) {
+        ggml_tensor * a = pick();
+        ggml_tensor * b = pick();
+        if (ggml_nelements(a) < ggml_nelements(b)) {
+            std::swap(a, b);
+        }
+
+        ggml_tensor * t = nullptr;
+        switch (rng() % 6) {
+            case 0: t = ggml_add(g.ctx, a, b);                 break;
+            case 1: t = ggml_mul(g.ctx, a, b);                 break;
+            case 2: t = ggml_scale(g.ctx, a, 0.5f);            break;
+            case 3: t = ggml_sqr(g.ctx, ggml_scale(g.ctx, a, 0.25f)); break;
+            case 4:
+                // the sizes stay powers of 2 so that any two tensors can be broadcast
+                if (ggml_nelements(a) == ggml_nelements(b) && ggml_nelements(a) <= 512*scale) {
+                    t = ggml_concat(g.ctx, a, b, 0);
+                } else {
+                    t = ggml_add(g.ctx, a, b);
+                }
+                break;
+            case 5:
+                // second half of a, the view keeps its source alive
+                t = ggml_add(g.ctx, ggml_view_1d(g.ctx, a, ggml_nelements(a)/2, ggml_nbytes(a)/2), ggml_view_1d(g.ctx, b, ggml_nelements(b)/2, 0));
+                break;
+        }
+
+        if (rng() % 8 == 0) {
+            ggml_set_output(t);
+            g.outputs.push_back(t);
+        }
+        pool.push_back(t);
+    }
+
+    ggml_set_output(pool.back());
+    g.outputs.push_back(pool.back());
+
+    g.gf = ggml_new_graph(g.ctx);
+    for (ggml_tensor * t : g.outputs) {
+        ggml_build_forward_expand(g.gf, t);
+    }
+}
+
+static std::vector<float> input_data(const ggml_tensor * t, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> data(ggml_nelements(t));
+    for (auto & v : data) {
+        v = dist(rng);
+    }
+    return data;
+}
+
+static std::vector<std::vector<float>> compute_reference(uint32_t seed, int scale) {
+    random_graph g;
+    build_random_graph(g, seed, scale, false);
+
+    for (size_t i = 0; i < g.inputs.size(); ++i) {
+        const auto data = input_data(g.inputs[i], seed + i);
+        memcpy(g.inputs[i]->data, data.data(), ggml_nbytes(g.inputs[i]));
+    }
+
+    ggml_graph_compute_with_ctx(g.ctx, g.gf, 1);
+
+    std::vector<std::vector<float>> res;
+    for (ggml_tensor * t : g.outputs) {
+        const float * p = (const float *) t->data;
+        res.emplace_back(p, p + ggml_nelements(t));
+    }
+    return res;
+}
+
+static bool compute_allocated(ggml_backend_t backend, ggml_gallocr_t galloc, uint32_t seed, int scale) {
+    random_graph g;
+    build_random_graph(g, seed, scale, true);
+
+    if (!ggml_gallocr_alloc_graph(galloc, g.gf)) {
+        // the topology changed, the buffers have to be reserved again
+        if (!ggml_gallocr_reserve(galloc, g.gf) || !ggml_gallocr_alloc_graph(galloc, g.gf)) {
+            fprintf(stderr, "%s: seed %u: allocation failed\n", __func__, seed);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < g.inputs.size(); ++i) {
+        if (g.inputs[i]->buffer == nullptr) {
+            // not used by the outputs
+            continue;
+        }
+        const auto data = input_data(g.inputs[i], seed + i);
+        ggml_backend_tensor_set(g.inputs[i], data.data(), 0, ggml_nbytes(g.inputs[i]));
+    }
+
+    if (ggml_backend_graph_compute(backend, g.gf) != GGML_STATUS_SUCCESS) {
+        fprintf(stderr, "%s: seed %u: compute failed\n", __func__, seed);
+        return false;
+    }
+
+    const auto ref = compute_reference(seed, scale);
+
+    for (size_t i = 0; i < g.outputs.size(); ++i) {
+        std::vector<float> out(ggml_nelements(g.outputs[i]));
+        ggml_backend_tensor_get(g.outputs[i], out.data(), 0, ggml_nbytes(g.outputs[i]));
+
+        for (size_t j = 0; j < out.size(); ++j) {
+            if (out[j] != ref[i][j] && !(std::isnan(out[j]) && std::isnan(ref[i][j]))) {
+                fprintf(stderr, "%s: seed %u, scale %d: output %zu differs at %zu: %f != %f\n", __func__, seed, scale, i, j, out[j], ref[i][j]);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// two graphs with the same ops in the same order, in the first one the output of the first op is dead after the second op,
+// in the second one it is still used by the third op - a plan of the first graph must not be used for the second one
+static void build_wiring_graph(random_graph & g, bool long_lived) {
+    ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead()*16 + ggml_graph_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+    g.ctx = ggml_init(params);
+
+    ggml_tensor * a = ggml_new_tensor_1d(g.ctx, GGML_TYPE_F32, 1024);
+    ggml_tensor * b = ggml_new_tensor_1d(g.ctx, GGML_TYPE_F32, 1024);
+    ggml_set_input(a);
+    ggml_set_input(b);
+    g.inputs = { a, b };
+
+    ggml_tensor * t1 = ggml_add(g.ctx, a, b);
+    ggml_tensor * t2 = ggml_mul(g.ctx, t1, b);
+    ggml_tensor * t3 = ggml_add(g.ctx, t2, b);
+    ggml_tensor * t4 = ggml_mul(g.ctx, t3, long_lived ? t1 : t3);
+    ggml_set_output(t4);
+    g.outputs = { t4 };
+
+    g.gf = ggml_new_graph(g.ctx);
+    ggml_build_forward_expand(g.gf, t4);
+}
+
+static bool test_wiring(ggml_backend_t backend) {
+    ggml_gallocr_t galloc = ggml_gallocr_new(ggml_backend_get_default_buffer_type(backend));
+
+    bool ok = true;
+
+    // the second allocation of each graph goes through the plan cache
+    for (int iter = 0; iter < 4 && ok; ++iter) {
+        for (bool long_lived : { false, true }) {
+            random_graph g;
+            build_wiring_graph(g, long_lived);
+
+            // a graph with another topology in between, so that the allocator has to plan again
+            {
+                random_graph other;
+                build_random_graph(other, 1000 + iter, 1, true);
+                ggml_gallocr_reserve(galloc, other.gf);
+            }
+
+            if (!ggml_gallocr_reserve(galloc, g.gf) || !ggml_gallocr_alloc_graph(galloc, g.gf)) {
+                ok = false;
+                break;
+            }
+
+            std::vector<float> a(1024);
+            std::vector<float> b(1024);
+            for (int i = 0; i < 1024; ++i) {
+                a[i] = (float) i;
+                b[i] = 2.0f;
+            }
+            ggml_backend_tensor_set(g.inputs[0], a.data(), 0, sizeof(float)*a.size());
+            ggml_backend_tensor_set(g.inputs[1], b.data(), 0, sizeof(float)*b.size());
+
+            ggml_backend_graph_compute(backend, g.gf);
+
+            std::vector<float> out(1024);
+            ggml_backend_tensor_get(g.outputs[0], out.data(), 0, sizeof(float)*out.size());
+
+            for (int i = 0; i < 1024; ++i) {
+                const float t1 = a[i] + b[i];
+                const float t3 = t1*b[i] + b[i];
+                const float expected = t3*(long_lived ? t1 : t3);
+                if (out[i] != expected) {
+                    fprintf(stderr, "%s: long_lived = %d: output differs at %d: %f != %f\n", __func__, long_lived, i, out[i], expected);
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    ggml_gallocr_free(galloc);
+
+    return ok;
+}
+
+int main(int argc, char ** argv) {
+    const int n_graphs = argc > 1 ? atoi(argv[1]) : 200;
+
+    ggml_backend_t backend = ggml_backend_cpu_init();
+    ggml_backend_cpu_set_n_threads(backend, 1);
+
+    bool ok = true;
+
+    // every graph with a fresh allocator
+    for (int i = 0; i < n_graphs && ok; ++i) {
+        ggml_gallocr_t galloc = ggml_gallocr_new(ggml_backend_get_default_buffer_type(backend));
+        ok = compute_allocated(backend, galloc, i, 1);
+        ggml_gallocr_free(galloc);
+    }
+    printf("fresh allocator:  %s\n", ok ? "OK" : "FAILED");
+
+    // a single allocator for graphs that alternate between a few topologies and sizes, so that plans are cached,
+    // reused for smaller tensors and evicted
+    if (ok) {
+        ggml_gallocr_t galloc = ggml_gallocr_new(ggml_backend_get_default_buffer_type(backend));
+
+        std::mt19937 rng(42);
+        for (int i = 0; i < n_graphs && ok; ++i) {
+            const uint32_t seed  = rng() % 12;
+            const int      scale = 1 << (rng() % 3);
+            ok = compute_allocated(backend, galloc, seed, scale);
+        }
+
+        ggml_gallocr_free(galloc);
+        printf("shared allocator: %s\n", ok ? "OK" : "FAILED");
+    }
+
+    if (ok) {
+        ok = test_wiring(backend);
+        printf("wiring:           %s\n", ok ? "OK" : "FAILED");
+    }
+
+    ggml_backend_free(backend);
+
+    return ok ? 0 : 1;
+}
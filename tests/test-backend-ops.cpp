@@ -2,7 +2,8 @@
 // For the forward pass it asserts that the results of multiple backends computing the same GGML ops are consistent.
 // For the backward pass it asserts that the gradients from backpropagation are consistent
 // with the gradients obtained via the method of finite differences ("grad" mode, this is optional).
-// It is also possible to check the performance ("perf" mode).
+// It is also possible to check the performance ("perf" mode), or the performance of the ops of a model
+// against the measured peak bandwidth and FLOP/s of the backend ("roofline" mode).
 //
 // this file has three sections: Section 1 does general setup, section 2 defines the GGML ops to be tested,
 // and section 3 defines which tests to run.
@@ -19,6 +20,7 @@
 #include <ggml-alloc.h>
 #include <ggml-backend.h>
 #include <ggml-cpp.h>
+#include <llama.h>
 
 #include <algorithm>
 #include <array>
@@ -32,11 +34,13 @@
 #include <ctime>
 #include <future>
 #include <memory>
+#include <numeric>
 #include <random>
 #include <regex>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 static void init_tensor_uniform(ggml_tensor * tensor, float min = -1.0f, float max = 1.0f) {
@@ -103,7 +107,7 @@ static void init_tensor_uniform(ggml_tensor * tensor, float min = -1.0f, float m
             };
 
             const size_t min_blocks_per_thread = 1;
-            const size_t n_threads = std::min<size_t>(std::thread::hardware_concurrency()/2,
+            const size_t n_threads = std::min<size_t>(std::max<size_t>(1, std::thread::hardware_concurrency()/2),
                                                       std::max<size_t>(1, n_blocks / min_blocks_per_thread));
             std::vector<std::future<void>> tasks;
             tasks.reserve(n_threads);
@@ -320,10 +324,12 @@ enum test_mode {
     MODE_PERF,
     MODE_GRAD,
     MODE_SUPPORT,
+    MODE_FUSION,
+    MODE_ROOFLINE,
 };
 
 // Output format support similar to llama-bench
-enum output_formats { CONSOLE, SQL, CSV };
+enum output_formats { CONSOLE, SQL, CSV, JSON };
 
 static const char * output_format_str(output_formats format) {
     switch (format) {
@@ -333,6 +339,8 @@ static const char * output_format_str(output_formats format) {
             return "sql";
         case CSV:
             return "csv";
+        case JSON:
+            return "json";
         default:
             GGML_ABORT("invalid output format");
     }
@@ -345,6 +353,8 @@ static bool output_format_from_str(const std::string & s, output_formats & forma
         format = SQL;
     } else if (s == "csv") {
         format = CSV;
+    } else if (s == "json") {
+        format = JSON;
     } else {
         return false;
     }
@@ -462,6 +472,32 @@ struct test_result {
     }
 };
 
+// measured peaks of a backend, the roofline of the ops is min(flops, intensity*bandwidth)
+struct roofline_peaks {
+    std::string backend_name;
+    double      bandwidth_gb_s = 0.0;
+    std::string bandwidth_op;
+    double      flops          = 0.0;
+    std::string flops_op;
+};
+
+// an op of a model graph measured against the roofline of the backend
+struct roofline_result {
+    std::string backend_name;
+    std::string graph;
+    std::string name;
+    std::string op_name;
+    std::string op_params;
+    int         count          = 0;
+    bool        supported      = false;
+    double      time_us        = 0.0;
+    double      flops          = 0.0;
+    double      bandwidth_gb_s = 0.0;
+    double      intensity      = 0.0; // FLOP/byte
+    double      roofline       = 0.0; // fraction of the attainable performance, above 1 when the data fits in the cache
+    double      graph_share    = 0.0; // fraction of count*time_us of the measured ops of the graph
+};
+
 // Printer classes for different output formats
 enum class test_status_t { NOT_SUPPORTED, OK, FAIL };
 
@@ -639,6 +675,10 @@ struct printer {
     virtual void print_backend_status(const backend_status_info & info) { (void) info; }
 
     virtual void print_overall_summary(const overall_summary_info & info) { (void) info; }
+
+    virtual void print_roofline_peaks(const roofline_peaks & peaks) { (void) peaks; }
+
+    virtual void print_roofline_result(const roofline_result & result) { (void) result; }
 };
 
 struct console_printer : public printer {
@@ -756,6 +796,33 @@ struct console_printer : public printer {
         }
     }
 
+    void print_roofline_peaks(const roofline_peaks & peaks) override {
+        printf("  Roofline: %.2f GB/s [%s], %.2f GFLOPS [%s]\n\n",
+               peaks.bandwidth_gb_s, peaks.bandwidth_op.c_str(), peaks.flops / 1e9, peaks.flops_op.c_str());
+    }
+
+    void print_roofline_result(const roofline_result & result) override {
+        int len = printf("  %s %s%s%s(%s): ", result.graph.c_str(), result.name.c_str(), result.name.empty() ? "" : " ",
+                         result.op_name.c_str(), result.op_params.c_str());
+        fflush(stdout);
+
+        if (!result.supported) {
+            printf("not supported\n");
+            return;
+        }
+
+        int align = 8;
+        int last  = (len + align - 1) / align * align;
+        if (last - len < 5) {
+            last += align;
+        }
+        printf("%*s", last - len, "");
+
+        printf("x%-4d %10.2f us - %8.2f GB/s - %9.2f GFLOPS - %8.2f FLOP/B - \033[1;34m%5.1f%%\033[0m of roofline - %5.1f%% of graph\n",
+               result.count, result.time_us, result.bandwidth_gb_s, result.flops / 1e9, result.intensity,
+               100.0 * result.roofline, 100.0 * result.graph_share);
+    }
+
   private:
     void print_test_console(const test_result & result) {
         printf("  %s(%s): ", result.op_name.c_str(), result.op_params.c_str());
@@ -920,6 +987,100 @@ struct csv_printer : public printer {
 
 };
 
+// an array of objects, one per test result
+struct json_printer : public printer {
+    void print_header() override {
+        fprintf(fout, "[");
+    }
+
+    void print_footer() override {
+        fprintf(fout, "\n]\n");
+    }
+
+    void print_test_result(const test_result & result) override {
+        const std::vector<std::string> fields = test_result::get_fields();
+        const std::vector<std::string> values = result.get_values();
+
+        std::vector<std::pair<std::string, std::string>> obj;
+        for (size_t i = 0; i < fields.size(); i++) {
+            switch (test_result::get_field_type(fields[i])) {
+                case test_result::STRING:
+                    obj.emplace_back(fields[i], escape(values[i]));
+                    break;
+                case test_result::BOOL:
+                    obj.emplace_back(fields[i], values[i] == "1" ? "true" : "false");
+                    break;
+                default:
+                    obj.emplace_back(fields[i], values[i]);
+                    break;
+            }
+        }
+        print_object(obj);
+    }
+
+    void print_roofline_peaks(const roofline_peaks & peaks) override {
+        print_object({
+            { "test_mode",      escape("roofline_peaks")          },
+            { "build_commit",   escape(ggml_commit())             },
+            { "backend_name",   escape(peaks.backend_name)        },
+            { "bandwidth_gb_s", std::to_string(peaks.bandwidth_gb_s) },
+            { "bandwidth_op",   escape(peaks.bandwidth_op)        },
+            { "flops",          std::to_string(peaks.flops)       },
+            { "flops_op",       escape(peaks.flops_op)            },
+        });
+    }
+
+    void print_roofline_result(const roofline_result & result) override {
+        print_object({
+            { "test_mode",      escape("roofline")                  },
+            { "build_commit",   escape(ggml_commit())               },
+            { "backend_name",   escape(result.backend_name)         },
+            { "graph",          escape(result.graph)                },
+            { "name",           escape(result.name)                 },
+            { "op_name",        escape(result.op_name)              },
+            { "op_params",      escape(result.op_params)            },
+            { "count",          std::to_string(result.count)        },
+            { "supported",      result.supported ? "true" : "false" },
+            { "time_us",        std::to_string(result.time_us)      },
+            { "flops",          std::to_string(result.flops)        },
+            { "bandwidth_gb_s", std::to_string(result.bandwidth_gb_s) },
+            { "intensity",      std::to_string(result.intensity)    },
+            { "roofline",       std::to_string(result.roofline)     },
+            { "graph_share",    std::to_string(result.graph_share)  },
+        });
+    }
+
+  private:
+    bool first = true;
+
+    static std::string escape(const std::string & s) {
+        std::string res = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                res += '\\';
+                res += c;
+            } else if ((unsigned char) c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                res += buf;
+            } else {
+                res += c;
+            }
+        }
+        res += "\"";
+        return res;
+    }
+
+    void print_object(const std::vector<std::pair<std::string, std::string>> & obj) {
+        fprintf(fout, "%s\n  {", first ? "" : ",");
+        for (size_t i = 0; i < obj.size(); i++) {
+            fprintf(fout, "\"%s\": %s%s", obj[i].first.c_str(), obj[i].second.c_str(), i < obj.size() - 1 ? ", " : "");
+        }
+        fprintf(fout, "}");
+        first = false;
+    }
+};
+
 static std::unique_ptr<printer> create_printer(output_formats format) {
     switch (format) {
         case CONSOLE:
@@ -928,6 +1089,8 @@ static std::unique_ptr<printer> create_printer(output_formats format) {
             return std::make_unique<sql_printer>();
         case CSV:
             return std::make_unique<csv_printer>();
+        case JSON:
+            return std::make_unique<json_printer>();
     }
     GGML_ABORT("invalid output format");
 }
@@ -1374,6 +1537,92 @@ struct test_case {
         return true;
     }
 
+    // time of one op, averaged over copies of it with their own tensors until the copies are at least min_size bytes,
+    // so that like in a model the weights are read from memory and not from the cache
+    // returns false if the op does not match the filter or fails to run
+    bool eval_roofline(ggml_backend_t backend, const char * op_names_filter, size_t min_size,
+                       bool & supported, double & time_us, uint64_t & flops, size_t & size) {
+        mode = MODE_PERF;
+
+        static const size_t graph_nodes = 8192;
+        static const int    max_copies  = 64;
+
+        int n_copies = 1;
+        {
+            ggml_init_params params = {
+                /* .mem_size = */ ggml_tensor_overhead()*128,
+                /* .mem_base = */ NULL,
+                /* .no_alloc = */ true,
+            };
+            ggml_context_ptr ctx(ggml_init(params)); // smart ptr
+            GGML_ASSERT(ctx);
+
+            ggml_tensor * out = build_graph(ctx.get());
+            if (!matches_filter(out, op_names_filter)) {
+                return false;
+            }
+
+            supported = ggml_backend_supports_op(backend, out);
+            if (!supported) {
+                return true;
+            }
+
+            n_copies = std::clamp<int>(min_size / std::max<size_t>(op_size(out), 1), 1, max_copies);
+        }
+
+        ggml_init_params params = {
+            /* .mem_size = */ ggml_tensor_overhead()*128*n_copies + ggml_graph_overhead_custom(graph_nodes, false),
+            /* .mem_base = */ NULL,
+            /* .no_alloc = */ true,
+        };
+        ggml_context_ptr ctx(ggml_init(params)); // smart ptr
+        GGML_ASSERT(ctx);
+
+        std::vector<ggml_tensor *> outs;
+        for (int i = 0; i < n_copies; i++) {
+            outs.push_back(build_graph(ctx.get()));
+        }
+
+        ggml_backend_buffer_ptr buf(ggml_backend_alloc_ctx_tensors(ctx.get(), backend)); // smart ptr
+        if (buf == NULL) {
+            fprintf(stderr, "%s: failed to allocate tensors\n", __func__);
+            return false;
+        }
+
+        initialize_tensors(ctx.get());
+
+        ggml_cgraph * gf = ggml_new_graph_custom(ctx.get(), graph_nodes, false);
+        for (ggml_tensor * out : outs) {
+            ggml_build_forward_expand(gf, out);
+        }
+
+        // warmup run
+        ggml_status status = ggml_backend_graph_compute(backend, gf);
+        if (status != GGML_STATUS_SUCCESS) {
+            fprintf(stderr, "%s: ggml_backend_graph_compute failed. status=%s \n", __func__, ggml_status_to_string(status));
+            return false;
+        }
+
+        int64_t total_time_us = 0;
+        int     total_runs    = 0;
+        do {
+            int64_t start_time = ggml_time_us();
+            status = ggml_backend_graph_compute(backend, gf);
+            if (status != GGML_STATUS_SUCCESS) {
+                fprintf(stderr, "%s: ggml_backend_graph_compute failed. status=%s \n", __func__, ggml_status_to_string(status));
+                return false;
+            }
+            total_time_us += ggml_time_us() - start_time;
+            total_runs    += n_copies;
+        } while (total_time_us < 250*1000);
+
+        time_us = (double) total_time_us / total_runs;
+        flops   = op_flops(outs[0]);
+        size    = op_size(outs[0]);
+
+        return true;
+    }
+
     bool eval_support(ggml_backend_t backend, const char * op_names_filter, printer * output_printer) {
         mode = MODE_SUPPORT;
 
@@ -3833,6 +4082,80 @@ struct test_rope : public test_case {
     }
 };
 
+// GGML_OP_ROPE + GGML_OP_SET_ROWS (storing the roped K in the KV cache)
+struct test_rope_set_rows : public test_case {
+    const ggml_type type; // type of the cache
+    const std::array<int64_t, 4> ne_a;
+    int mode;
+    int n_ctx; // number of rows in the cache, also used to generate positions
+
+    std::string op_desc(ggml_tensor * t) override {
+        GGML_UNUSED(t);
+        return "ROPE_SET_ROWS";
+    }
+
+    bool run_whole_graph() override { return true; }
+
+    std::string vars() override {
+        return VARS_TO_STR4(type, ne_a, mode, n_ctx);
+    }
+
+    test_rope_set_rows(ggml_type type = GGML_TYPE_F16,
+            std::array<int64_t, 4> ne_a = {128, 8, 7, 1},
+            int mode = 0, int n_ctx = 64)
+        : type(type), ne_a(ne_a), mode(mode), n_ctx(n_ctx) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * a = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, ne_a.data());
+        ggml_set_name(a, "a");
+
+        ggml_tensor * pos = ggml_new_tensor_1d(ctx, GGML_TYPE_I32, ne_a[2]);
+        ggml_set_name(pos, "pos");
+
+        ggml_tensor * cache = ggml_new_tensor_2d(ctx, type, ne_a[0]*ne_a[1], n_ctx);
+        ggml_set_name(cache, "cache");
+
+        ggml_tensor * idxs = ggml_new_tensor_1d(ctx, GGML_TYPE_I64, ne_a[2]);
+        ggml_set_name(idxs, "idxs");
+
+        ggml_tensor * cur = ggml_rope_ext(ctx, a, pos, nullptr, ne_a[0], mode, 0, 10000.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+        ggml_set_name(cur, "rope");
+
+        cur = ggml_reshape_2d(ctx, cur, ne_a[0]*ne_a[1], ne_a[2]);
+        ggml_set_name(cur, "rope_2d");
+
+        ggml_tensor * out = ggml_set_rows(ctx, cache, cur, idxs);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        std::random_device rd;
+        std::default_random_engine rng(rd());
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+            if (t->type == GGML_TYPE_I32) {
+                // pos
+                std::vector<int> data(ne_a[2]);
+                for (int i = 0; i < ne_a[2]; i++) {
+                    data[i] = rand() % n_ctx;
+                }
+                ggml_backend_tensor_set(t, data.data(), 0, ne_a[2] * sizeof(int));
+            } else if (t->type == GGML_TYPE_I64) {
+                // unique destination rows
+                std::vector<int64_t> data(n_ctx);
+                for (int i = 0; i < n_ctx; i++) {
+                    data[i] = i;
+                }
+                std::shuffle(data.begin(), data.end(), rng);
+                ggml_backend_tensor_set(t, data.data(), 0, ne_a[2] * sizeof(int64_t));
+            } else {
+                init_tensor_uniform(t);
+            }
+        }
+    }
+};
+
 // GGML_OP_POOL2D
 struct test_pool2d : public test_case {
     enum ggml_op_pool pool_type;
@@ -4795,6 +5118,83 @@ struct test_flash_attn_ext : public test_case {
     }
 };
 
+// GGML_OP_FLASH_ATTN_EXT with KV ranges
+// several sequences in a unified KV cache: each sequence owns a contiguous range of cells and attends only to it
+struct test_flash_attn_ext_kv_ranges : public test_case {
+    const int64_t hs; // head size
+    const int64_t nh; // num heads
+    const int64_t kv; // kv size
+    const int64_t nb; // batch size
+    const int64_t ns; // num sequences
+
+    const ggml_type type_KV;
+
+    std::string vars() override {
+        return VARS_TO_STR6(hs, nh, kv, nb, ns, type_KV);
+    }
+
+    double max_nmse_err() override {
+        return 5e-4;
+    }
+
+    test_flash_attn_ext_kv_ranges(int64_t hs = 128, int64_t nh = 4, int64_t kv = 1024, int64_t nb = 8, int64_t ns = 4,
+                                  ggml_type type_KV = GGML_TYPE_F16)
+        : hs(hs), nh(nh), kv(kv), nb(nb), ns(ns), type_KV(type_KV) {}
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * q = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, hs, nb, nh);
+        ggml_set_name(q, "q");
+
+        ggml_tensor * k = ggml_new_tensor_3d(ctx, type_KV, hs, kv, nh);
+        ggml_set_name(k, "k");
+
+        ggml_tensor * v = ggml_new_tensor_3d(ctx, type_KV, hs, kv, nh);
+        ggml_set_name(v, "v");
+
+        ggml_tensor * m = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, kv, GGML_PAD(nb, GGML_KQ_MASK_PAD));
+        ggml_set_name(m, "m");
+
+        ggml_tensor * r = ggml_new_tensor_2d(ctx, GGML_TYPE_I32, 2, nb);
+        ggml_set_name(r, "r");
+
+        ggml_tensor * out = ggml_flash_attn_ext(ctx, q, k, v, m, 1.0f/sqrtf(hs), 0.0f, 0.0f);
+        ggml_flash_attn_ext_add_kv_ranges(out, r);
+        ggml_flash_attn_ext_set_prec     (out, GGML_PREC_F32);
+        ggml_set_name(out, "out");
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        // token i belongs to sequence i % ns, which owns the cells [kv*s/ns, kv*(s + 1)/ns)
+        // the mask also has holes inside of the range of the sequence
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != NULL; t = ggml_get_next_tensor(ctx, t)) {
+            if (strcmp(t->name, "m") == 0) {
+                std::vector<ggml_fp16_t> data(ggml_nelements(t), ggml_fp32_to_fp16(-INFINITY));
+                for (int64_t i = 0; i < nb; ++i) {
+                    const int64_t s = i % ns;
+                    for (int64_t j = kv*s/ns; j < kv*(s + 1)/ns; ++j) {
+                        if (j % 7 != 3) {
+                            data[i*kv + j] = ggml_fp32_to_fp16(0.0f);
+                        }
+                    }
+                }
+                ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+            } else if (strcmp(t->name, "r") == 0) {
+                std::vector<int32_t> data(ggml_nelements(t));
+                for (int64_t i = 0; i < nb; ++i) {
+                    const int64_t s = i % ns;
+                    data[2*i + 0] = kv*s/ns;
+                    data[2*i + 1] = kv*(s + 1)/ns;
+                }
+                ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+            } else {
+                init_tensor_uniform(t);
+            }
+        }
+    }
+};
+
 // GGML_OP_CROSS_ENTROPY_LOSS
 struct test_cross_entropy_loss : public test_case {
     const ggml_type type;
@@ -5352,76 +5752,337 @@ struct test_falcon : public test_llm {
     }
 };
 
+// An op of a model graph, rebuilt from the types, shapes, strides and op params of the node
+// recorded while the model was evaluated. The data is random, only the index inputs are valid.
+struct test_graph_op : public test_case {
+    struct tensor_desc {
+        ggml_type              type = GGML_TYPE_COUNT; // GGML_TYPE_COUNT if there is no tensor
+        std::array<int64_t, 4> ne   = {};
+        std::array<size_t, 4>  nb   = {};
+    };
 
-// ###########################################
-// ## Section 3: GGML Op Test Instantiation ##
-// ###########################################
-static const ggml_type all_types[] = {
-    GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_BF16,
-    GGML_TYPE_Q4_0, GGML_TYPE_Q4_1,
-    GGML_TYPE_Q5_0, GGML_TYPE_Q5_1,
-    GGML_TYPE_Q8_0,
-    GGML_TYPE_MXFP4,
-    GGML_TYPE_Q2_K, GGML_TYPE_Q3_K,
-    GGML_TYPE_Q4_K, GGML_TYPE_Q5_K,
-    GGML_TYPE_Q6_K,
-    // GGML_TYPE_TQ1_0, GGML_TYPE_TQ2_0, // TODO: implement for all backends
-    GGML_TYPE_IQ2_XXS, GGML_TYPE_IQ2_XS, GGML_TYPE_IQ2_S,
-    GGML_TYPE_IQ3_XXS, GGML_TYPE_IQ1_S, GGML_TYPE_IQ1_M,
-    GGML_TYPE_IQ4_NL, GGML_TYPE_IQ3_S, GGML_TYPE_IQ4_XS,
-};
+    const std::string graph;
+    const std::string name;
+    const ggml_op     op;
 
-static const ggml_type base_types[] = {
-    GGML_TYPE_F32, GGML_TYPE_F16,
-    GGML_TYPE_Q8_0, // for I8MM tests
-    GGML_TYPE_Q4_0,
-    GGML_TYPE_Q4_1, // for I8MM tests
-    GGML_TYPE_Q4_K,
-    GGML_TYPE_MXFP4, // TODO: or "other"
-    GGML_TYPE_IQ2_XXS
-};
+    std::array<int32_t, GGML_MAX_OP_PARAMS / sizeof(int32_t)> op_params;
 
-static const ggml_type other_types[] = {
-    GGML_TYPE_Q4_1,
-    GGML_TYPE_Q5_0, GGML_TYPE_Q5_1,
-    GGML_TYPE_Q8_0,
-    GGML_TYPE_Q2_K, GGML_TYPE_Q3_K,
-    GGML_TYPE_Q5_K,
-    GGML_TYPE_Q6_K,
-    // GGML_TYPE_TQ1_0, GGML_TYPE_TQ2_0, // TODO: implement for all backends
-    GGML_TYPE_IQ2_XS, GGML_TYPE_IQ2_S,
-    GGML_TYPE_IQ3_XXS, GGML_TYPE_IQ1_S, GGML_TYPE_IQ1_M,
-    GGML_TYPE_IQ4_NL, GGML_TYPE_IQ3_S, GGML_TYPE_IQ4_XS,
-    GGML_TYPE_BF16,
-};
+    tensor_desc                           dst;
+    std::array<tensor_desc, GGML_MAX_SRC> src;
 
-// Test cases for evaluation: should try to cover edge cases while using small input sizes to keep the runtime low
-static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
-    std::vector<std::unique_ptr<test_case>> test_cases;
-    std::default_random_engine rng(0);
+    // number of nodes of the graph with the same op, types, shapes and params, the name is the one of the first node
+    int count = 1;
 
-    // unary ops
-    for (ggml_type type : {GGML_TYPE_F16, GGML_TYPE_F32}) {
-        for (int v : {0, 1}) {
-            for (int op = 0; op < GGML_UNARY_OP_COUNT; op++) {
-                test_cases.emplace_back(new test_unary((ggml_unary_op) op, type, { 128, 2, 2, 2 }, v));
-                test_cases.emplace_back(new test_unary((ggml_unary_op) op, type, { 5, 7, 11, 13 }, v));
-            }
+    // experts of a GGML_OP_MUL_MAT_ID selected by the ids, only their weights are read
+    int64_t n_expert_used = 0;
+
+    static tensor_desc make_desc(const ggml_tensor * t) {
+        tensor_desc d;
+        d.type = t->type;
+        for (int i = 0; i < 4; i++) {
+            d.ne[i] = t->ne[i];
+            d.nb[i] = t->nb[i];
         }
+        return d;
     }
 
-    // glu ops
-    for (ggml_type type : {GGML_TYPE_F16, GGML_TYPE_F32}) {
-        for (int v : {0, 1}) {
-            for (int op = 0; op < GGML_GLU_OP_COUNT; op++) {
-                if (op == GGML_GLU_OP_SWIGLU_OAI) {
-                    // SWIGLU_OAI is handled separately
-                    continue;
-                }
+    // "attn_norm-12" -> "attn_norm", the names given by ggml ("node_12") are dropped
+    static std::string strip_layer(const char * name) {
+        std::string res = name;
+        if (res.rfind("node_", 0) == 0) {
+            return "";
+        }
+        const size_t pos = res.rfind('-');
+        if (pos != std::string::npos && pos + 1 < res.size() &&
+            res.find_first_not_of("0123456789", pos + 1) == std::string::npos) {
+            res.resize(pos);
+        }
+        return res;
+    }
 
-                for (bool swapped : {false, true}) {
-                    test_cases.emplace_back(new test_glu((ggml_glu_op) op, type, { 128, 2, 2, 2 }, v, swapped));
-                    test_cases.emplace_back(new test_glu((ggml_glu_op) op, type, { 5, 7, 11, 13 }, v, swapped));
+    test_graph_op(const std::string & graph, const ggml_tensor * t)
+        : graph(graph), name(strip_layer(t->name)), op(t->op) {
+        memcpy(op_params.data(), t->op_params, sizeof(t->op_params));
+        dst = make_desc(t);
+        for (int i = 0; i < GGML_MAX_SRC; i++) {
+            if (t->src[i] != nullptr) {
+                src[i] = make_desc(t->src[i]);
+            }
+        }
+    }
+
+    static bool is_contiguous(const tensor_desc & d) {
+        size_t nb = ggml_row_size(d.type, d.ne[0]);
+        if (d.nb[0] != ggml_type_size(d.type)) {
+            return false;
+        }
+        for (int i = 1; i < 4; i++) {
+            if (d.ne[i] > 1 && d.nb[i] != nb) {
+                return false;
+            }
+            nb *= d.ne[i];
+        }
+        return true;
+    }
+
+    std::string vars() override {
+        std::string res = "type=" + var_to_str(dst.type) + ",ne=" + var_to_str(dst.ne);
+        for (int i = 0; i < GGML_MAX_SRC; i++) {
+            if (src[i].type == GGML_TYPE_COUNT) {
+                continue;
+            }
+            res += ",src" + std::to_string(i) + "=" + var_to_str(src[i].type) + var_to_str(src[i].ne);
+            if (!is_contiguous(src[i])) {
+                res += "(nc)";
+            }
+        }
+        return res;
+    }
+
+    // identifies the nodes that run the same kernel on the same shapes
+    std::string key() {
+        std::string res = std::string(ggml_op_name(op)) + "/" + vars() + "/" + var_to_str(op_params) + "/" + var_to_str(dst.nb);
+        for (int i = 0; i < GGML_MAX_SRC; i++) {
+            res += "/" + var_to_str(src[i].nb);
+        }
+        return res;
+    }
+
+    // a strided tensor is a view of a buffer large enough for its strides
+    ggml_tensor * new_tensor(ggml_context * ctx, const tensor_desc & d) {
+        if (is_contiguous(d) || d.nb[0] != ggml_type_size(d.type)) {
+            return ggml_new_tensor(ctx, d.type, 4, d.ne.data());
+        }
+
+        size_t size = ggml_row_size(d.type, d.ne[0]);
+        for (int i = 1; i < 4; i++) {
+            size += (d.ne[i] - 1)*d.nb[i];
+        }
+
+        ggml_tensor * base = ggml_new_tensor_1d(ctx, d.type, size/ggml_type_size(d.type)*ggml_blck_size(d.type));
+
+        return ggml_view_4d(ctx, base, d.ne[0], d.ne[1], d.ne[2], d.ne[3], d.nb[1], d.nb[2], d.nb[3], 0);
+    }
+
+    ggml_tensor * build_graph(ggml_context * ctx) override {
+        ggml_tensor * srcs[GGML_MAX_SRC] = {};
+        for (int i = 0; i < GGML_MAX_SRC; i++) {
+            if (src[i].type != GGML_TYPE_COUNT) {
+                srcs[i] = new_tensor(ctx, src[i]);
+            }
+        }
+
+        ggml_tensor * out = new_tensor(ctx, dst);
+        out->op = op;
+        memcpy(out->op_params, op_params.data(), sizeof(out->op_params));
+        for (int i = 0; i < GGML_MAX_SRC; i++) {
+            out->src[i] = srcs[i];
+        }
+        ggml_set_name(out, name.c_str());
+
+        return out;
+    }
+
+    void initialize_tensors(ggml_context * ctx) override {
+        // index inputs are filled with valid values in [0, n), distinct within rows of n_row values
+        struct index_desc {
+            int64_t n;
+            int64_t n_row;
+        };
+        std::unordered_map<const ggml_tensor *, index_desc> indices;
+
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+            if (t->op != op) {
+                continue;
+            }
+
+            auto add_index = [&](const ggml_tensor * idx, int64_t n, int64_t n_row) {
+                indices[idx->view_src ? idx->view_src : idx] = { n, n_row };
+            };
+
+            switch (op) {
+                case GGML_OP_GET_ROWS:   add_index(t->src[1], t->src[0]->ne[1], 1);                break;
+                case GGML_OP_SET_ROWS:   add_index(t->src[1], t->ne[1],         1);                break;
+                case GGML_OP_MUL_MAT_ID: add_index(t->src[2], t->src[0]->ne[2], t->src[2]->ne[0]); break;
+                case GGML_OP_ADD_ID:     add_index(t->src[2], t->src[1]->ne[1], 1);                break;
+                default: break;
+            }
+        }
+
+        std::mt19937 rng(1234);
+
+        for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+            if (t->view_src != nullptr) {
+                continue;
+            }
+
+            auto it = indices.find(t);
+            if (it != indices.end()) {
+                const int64_t n     = it->second.n;
+                const int64_t n_row = it->second.n_row;
+                const int64_t n_el  = ggml_nelements(t);
+
+                std::vector<int64_t> ids(n_el);
+                if (n_row == 1) {
+                    std::uniform_int_distribution<int64_t> dist(0, n - 1);
+                    for (int64_t & id : ids) {
+                        id = dist(rng);
+                    }
+                } else {
+                    std::vector<int64_t> perm(n);
+                    std::iota(perm.begin(), perm.end(), 0);
+                    for (int64_t i = 0; i < n_el; i += n_row) {
+                        std::shuffle(perm.begin(), perm.end(), rng);
+                        for (int64_t j = 0; j < n_row && i + j < n_el; j++) {
+                            ids[i + j] = perm[j % n];
+                        }
+                    }
+                }
+
+                if (op == GGML_OP_MUL_MAT_ID) {
+                    std::vector<bool> used(n, false);
+                    for (int64_t id : ids) {
+                        used[id] = true;
+                    }
+                    n_expert_used = std::count(used.begin(), used.end(), true);
+                }
+
+                if (t->type == GGML_TYPE_I64) {
+                    ggml_backend_tensor_set(t, ids.data(), 0, ggml_nbytes(t));
+                } else {
+                    std::vector<int32_t> ids32(ids.begin(), ids.end());
+                    ggml_backend_tensor_set(t, ids32.data(), 0, ggml_nbytes(t));
+                }
+            } else if (t->type == GGML_TYPE_I32 || t->type == GGML_TYPE_I64) {
+                // positions and other integer inputs
+                std::vector<uint8_t> zeros(ggml_nbytes(t), 0);
+                ggml_backend_tensor_set(t, zeros.data(), 0, zeros.size());
+            } else {
+                init_tensor_uniform(t);
+            }
+        }
+    }
+
+    size_t op_size(ggml_tensor * t) override {
+        size_t size = ggml_nbytes(t);
+        for (int i = 0; i < GGML_MAX_SRC; i++) {
+            if (t->src[i] != nullptr) {
+                size += ggml_nbytes(t->src[i]);
+            }
+        }
+
+        const ggml_tensor * src0 = t->src[0];
+
+        switch (op) {
+            case GGML_OP_MUL_MAT_ID:
+                // only the weights of the used experts
+                if (n_expert_used > 0) {
+                    size -= ggml_nbytes(src0) - ggml_nbytes(src0)/src0->ne[2]*n_expert_used;
+                }
+                break;
+            case GGML_OP_GET_ROWS:
+                // only the gathered rows
+                size -= ggml_nbytes(src0) - ggml_nrows(t)*ggml_row_size(src0->type, src0->ne[0]);
+                break;
+            case GGML_OP_SET_ROWS:
+                // only the written rows
+                size -= ggml_nbytes(t) - ggml_nrows(src0)*ggml_row_size(t->type, t->ne[0]);
+                break;
+            default:
+                break;
+        }
+
+        return size;
+    }
+
+    uint64_t op_flops(ggml_tensor * t) override {
+        switch (op) {
+            case GGML_OP_MUL_MAT:
+            case GGML_OP_MUL_MAT_ID:
+                return 2 * t->src[0]->ne[0] * ggml_nelements(t);
+            case GGML_OP_FLASH_ATTN_EXT:
+                {
+                    const ggml_tensor * q = t->src[0];
+                    const ggml_tensor * k = t->src[1];
+                    const ggml_tensor * v = t->src[2];
+                    return 2 * q->ne[1] * q->ne[2] * q->ne[3] * k->ne[1] * (q->ne[0] + v->ne[0]);
+                }
+            default:
+                return 0;
+        }
+    }
+};
+
+
+// ###########################################
+// ## Section 3: GGML Op Test Instantiation ##
+// ###########################################
+static const ggml_type all_types[] = {
+    GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_BF16,
+    GGML_TYPE_Q4_0, GGML_TYPE_Q4_1,
+    GGML_TYPE_Q5_0, GGML_TYPE_Q5_1,
+    GGML_TYPE_Q8_0,
+    GGML_TYPE_MXFP4,
+    GGML_TYPE_Q2_K, GGML_TYPE_Q3_K,
+    GGML_TYPE_Q4_K, GGML_TYPE_Q5_K,
+    GGML_TYPE_Q6_K,
+    // GGML_TYPE_TQ1_0, GGML_TYPE_TQ2_0, // TODO: implement for all backends
+    GGML_TYPE_IQ2_XXS, GGML_TYPE_IQ2_XS, GGML_TYPE_IQ2_S,
+    GGML_TYPE_IQ3_XXS, GGML_TYPE_IQ1_S, GGML_TYPE_IQ1_M,
+    GGML_TYPE_IQ4_NL, GGML_TYPE_IQ3_S, GGML_TYPE_IQ4_XS,
+};
+
+static const ggml_type base_types[] = {
+    GGML_TYPE_F32, GGML_TYPE_F16,
+    GGML_TYPE_Q8_0, // for I8MM tests
+    GGML_TYPE_Q4_0,
+    GGML_TYPE_Q4_1, // for I8MM tests
+    GGML_TYPE_Q4_K,
+    GGML_TYPE_MXFP4, // TODO: or "other"
+    GGML_TYPE_IQ2_XXS
+};
+
+static const ggml_type other_types[] = {
+    GGML_TYPE_Q4_1,
+    GGML_TYPE_Q5_0, GGML_TYPE_Q5_1,
+    GGML_TYPE_Q8_0,
+    GGML_TYPE_Q2_K, GGML_TYPE_Q3_K,
+    GGML_TYPE_Q5_K,
+    GGML_TYPE_Q6_K,
+    // GGML_TYPE_TQ1_0, GGML_TYPE_TQ2_0, // TODO: implement for all backends
+    GGML_TYPE_IQ2_XS, GGML_TYPE_IQ2_S,
+    GGML_TYPE_IQ3_XXS, GGML_TYPE_IQ1_S, GGML_TYPE_IQ1_M,
+    GGML_TYPE_IQ4_NL, GGML_TYPE_IQ3_S, GGML_TYPE_IQ4_XS,
+    GGML_TYPE_BF16,
+};
+
+// Test cases for evaluation: should try to cover edge cases while using small input sizes to keep the runtime low
+static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
+    std::vector<std::unique_ptr<test_case>> test_cases;
+    std::default_random_engine rng(0);
+
+    // unary ops
+    for (ggml_type type : {GGML_TYPE_F16, GGML_TYPE_F32}) {
+        for (int v : {0, 1}) {
+            for (int op = 0; op < GGML_UNARY_OP_COUNT; op++) {
+                test_cases.emplace_back(new test_unary((ggml_unary_op) op, type, { 128, 2, 2, 2 }, v));
+                test_cases.emplace_back(new test_unary((ggml_unary_op) op, type, { 5, 7, 11, 13 }, v));
+            }
+        }
+    }
+
+    // glu ops
+    for (ggml_type type : {GGML_TYPE_F16, GGML_TYPE_F32}) {
+        for (int v : {0, 1}) {
+            for (int op = 0; op < GGML_GLU_OP_COUNT; op++) {
+                if (op == GGML_GLU_OP_SWIGLU_OAI) {
+                    // SWIGLU_OAI is handled separately
+                    continue;
+                }
+
+                for (bool swapped : {false, true}) {
+                    test_cases.emplace_back(new test_glu((ggml_glu_op) op, type, { 128, 2, 2, 2 }, v, swapped));
+                    test_cases.emplace_back(new test_glu((ggml_glu_op) op, type, { 5, 7, 11, 13 }, v, swapped));
                 }
 
                 test_cases.emplace_back(new test_glu_split((ggml_glu_op) op, type, { 128, 2, 2, 2 }, v));
@@ -6213,6 +6874,12 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         }
     }
 
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16 }) {
+        test_cases.emplace_back(new test_rope_set_rows(type, {128,  8,  7, 1}, 0, 64)); // llama
+        test_cases.emplace_back(new test_rope_set_rows(type, {128,  8, 32, 1}, 2, 64)); // neox
+        test_cases.emplace_back(new test_rope_set_rows(type, { 64,  2,  1, 1}, 0, 16)); // single token
+    }
+
     for (int v : { 0, 1, 2, 3 }) {
         for (int dim : { 0, 1, 2, 3, }) {
             test_cases.emplace_back(new test_concat(GGML_TYPE_F32, {11, 12, 13, 14}, 7, dim, v));
@@ -6304,6 +6971,14 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_eval() {
         }
     }
 
+    for (int nb : { 1, 3, 32, 35, }) {
+        for (int ns : { 1, 4, }) {
+            for (ggml_type type_KV : { GGML_TYPE_F16, GGML_TYPE_Q8_0, }) {
+                test_cases.emplace_back(new test_flash_attn_ext_kv_ranges(128, 4, 1024, nb, ns, type_KV));
+            }
+        }
+    }
+
     test_cases.emplace_back(new test_cross_entropy_loss     (GGML_TYPE_F32, {   10, 5, 4, 3}));
     test_cases.emplace_back(new test_cross_entropy_loss     (GGML_TYPE_F32, {30000, 1, 1, 1}));
     test_cases.emplace_back(new test_cross_entropy_loss_back(GGML_TYPE_F32, {   10, 5, 4, 3}));
@@ -6419,6 +7094,10 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_perf() {
         }
     }
 
+    for (int ns : { 4, 32, }) {
+        test_cases.emplace_back(new test_flash_attn_ext_kv_ranges(128, 8, 16384, ns, ns, GGML_TYPE_F16));
+    }
+
     test_cases.emplace_back(new test_conv_2d_dw({512, 512, 256, 1}, {3, 3, 1, 256}, 1, 1, 1, false));
     test_cases.emplace_back(new test_conv_2d_dw({512, 512, 256, 1}, {3, 3, 1, 256}, 1, 1, 1, true));
 
@@ -6447,8 +7126,282 @@ static std::vector<std::unique_ptr<test_case>> make_test_cases_perf() {
     return test_cases;
 }
 
+// the distinct ops of the graphs of a model, recorded with the eval callback of the context
+struct roofline_capture {
+    std::string graph; // empty while not recording
+
+    std::vector<std::unique_ptr<test_graph_op>>       ops;
+    std::unordered_map<std::string, test_graph_op *> index;
+};
+
+static bool roofline_capture_cb(ggml_tensor * t, bool ask, void * user_data) {
+    auto * cap = (roofline_capture *) user_data;
+
+    if (ask && !cap->graph.empty() && t->op != GGML_OP_NONE && !ggml_is_view_op(t->op)) {
+        auto op = std::make_unique<test_graph_op>(cap->graph, t);
+
+        const std::string key = op->key();
+
+        auto it = cap->index.find(key);
+        if (it != cap->index.end()) {
+            it->second->count++;
+        } else {
+            cap->index[key] = op.get();
+            cap->ops.push_back(std::move(op));
+        }
+    }
+
+    // never request the data, the graph is computed without interruptions
+    return false;
+}
+
+// evaluates a batch of each size after n_depth tokens and records the ops of the graphs
+// the shapes are taken from the graphs of the CPU backend
+static std::vector<std::unique_ptr<test_graph_op>> make_test_cases_roofline(const char * model_path, const std::vector<int> & n_tokens, int n_depth) {
+    llama_backend_init();
+
+    llama_model_params mparams = llama_model_default_params();
+    mparams.n_gpu_layers = 0;
+
+    llama_model * model = llama_model_load_from_file(model_path, mparams);
+    if (model == nullptr) {
+        fprintf(stderr, "%s: failed to load model '%s'\n", __func__, model_path);
+        llama_backend_free();
+        return {};
+    }
+
+    const int n_batch = *std::max_element(n_tokens.begin(), n_tokens.end());
+
+    roofline_capture cap;
+
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx             = n_depth + n_batch;
+    cparams.n_batch           = n_batch;
+    cparams.n_ubatch          = n_batch;
+    cparams.no_perf           = true;
+    cparams.cb_eval           = roofline_capture_cb;
+    cparams.cb_eval_user_data = &cap;
+
+    llama_context * lctx = llama_init_from_model(model, cparams);
+    if (lctx == nullptr) {
+        fprintf(stderr, "%s: failed to create context\n", __func__);
+        llama_model_free(model);
+        llama_backend_free();
+        return {};
+    }
+
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model));
+
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+
+    auto decode = [&](int pos, int n) {
+        batch.n_tokens = n;
+        for (int i = 0; i < n; i++) {
+            batch.token   [i]    = (pos + i) % n_vocab;
+            batch.pos     [i]    = pos + i;
+            batch.n_seq_id[i]    = 1;
+            batch.seq_id  [i][0] = 0;
+            batch.logits  [i]    = i == n - 1;
+        }
+        return llama_decode(lctx, batch) == 0;
+    };
+
+    for (int n : n_tokens) {
+        llama_memory_clear(llama_get_memory(lctx), true);
+
+        bool ok = true;
+        for (int pos = 0; ok && pos < n_depth; pos += n_batch) {
+            ok = decode(pos, std::min(n_batch, n_depth - pos));
+        }
+
+        cap.graph = "n_tokens=" + std::to_string(n) + (n_depth > 0 ? ",depth=" + std::to_string(n_depth) : "");
+        ok = ok && decode(n_depth, n);
+        cap.graph.clear();
+
+        if (!ok) {
+            fprintf(stderr, "%s: failed to decode a batch of %d tokens\n", __func__, n);
+        }
+    }
+
+    llama_batch_free(batch);
+    llama_free(lctx);
+    llama_model_free(model);
+    llama_backend_free();
+
+    return std::move(cap.ops);
+}
+
+// peak bandwidth with a large F32 add (STREAM add), peak FLOP/s with the fastest of a few matrix multiplications
+static roofline_peaks measure_roofline_peaks(ggml_backend_t backend) {
+    roofline_peaks peaks;
+    peaks.backend_name = ggml_backend_name(backend);
+
+    bool     supported;
+    double   time_us;
+    uint64_t flops;
+    size_t   size;
+
+    {
+        const int64_t n = 32*1024*1024;
+        test_bin_bcast test(ggml_add, GGML_TYPE_F32, {n, 1, 1, 1}, {1, 1, 1, 1});
+        if (test.eval_roofline(backend, nullptr, 0, supported, time_us, flops, size) && supported) {
+            peaks.bandwidth_gb_s = size / (time_us / 1e6) / 1024.0 / 1024.0 / 1024.0;
+            peaks.bandwidth_op   = "ADD(" + test.vars() + ")";
+        }
+    }
+
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0 }) {
+        test_mul_mat test(type, GGML_TYPE_F32, 2048, 512, 2048, { 1, 1 }, { 1, 1 });
+        if (test.eval_roofline(backend, nullptr, 0, supported, time_us, flops, size) && supported) {
+            const double cur = flops / (time_us / 1e6);
+            if (cur > peaks.flops) {
+                peaks.flops    = cur;
+                peaks.flops_op = "MUL_MAT(" + test.vars() + ")";
+            }
+        }
+    }
+
+    return peaks;
+}
+
+// MUL_MAT with the weights in a CPU extra buffer type (e.g. CPU_REPACK), compared with the same weights in a plain CPU buffer
+// the extra buffer types convert the weights in set_tensor and cannot read them back, so these tests do not fit test_case::eval
+struct test_mul_mat_extra_buft {
+    const ggml_type type_a;
+    const int64_t   m; // rows of the weights, a multiple of the interleave of the layouts (8)
+    const int64_t   n;
+    const int64_t   k;
+
+    std::string vars() const {
+        return VARS_TO_STR4(type_a, m, n, k);
+    }
+
+    bool eval(ggml_backend_t backend, ggml_backend_buffer_type_t buft, const char * op_names_filter, const char * params_filter,
+              printer * output_printer) const {
+        if (op_names_filter != nullptr) {
+            bool match = false;
+            for (std::string_view filter(op_names_filter); !filter.empty() && !match; ) {
+                const auto comma_pos = filter.find_first_of(',');
+                match  = filter.substr(0, comma_pos) == ggml_op_name(GGML_OP_MUL_MAT);
+                filter = comma_pos != std::string_view::npos ? filter.substr(comma_pos + 1) : "";
+            }
+            if (!match) {
+                return true;
+            }
+        }
+
+        if (params_filter != nullptr && !std::regex_search(vars(), std::regex(params_filter))) {
+            return true;
+        }
+
+        const std::string op_name = std::string(ggml_op_name(GGML_OP_MUL_MAT)) + "(" + ggml_backend_buft_name(buft) + ")";
+
+        ggml_init_params params = {
+            /* .mem_size = */ ggml_tensor_overhead()*8 + ggml_graph_overhead(),
+            /* .mem_base = */ NULL,
+            /* .no_alloc = */ true,
+        };
+        ggml_context_ptr ctx_w(ggml_init(params));
+        ggml_context_ptr ctx  (ggml_init(params));
+
+        ggml_tensor * a_ref = ggml_new_tensor_2d(ctx.get(),   type_a, k, m);
+        ggml_tensor * a     = ggml_new_tensor_2d(ctx_w.get(), type_a, k, m);
+        ggml_tensor * b     = ggml_new_tensor_2d(ctx.get(),   GGML_TYPE_F32, k, n);
+
+        ggml_tensor * out_ref = ggml_mul_mat(ctx.get(), a_ref, b);
+        ggml_tensor * out     = ggml_mul_mat(ctx.get(), a,     b);
+
+        // the buffer type has no layout for this shape or CPU features
+        ggml_backend_buffer_ptr buf_w(ggml_backend_alloc_ctx_tensors_from_buft(ctx_w.get(), buft));
+        if (!buf_w || !ggml_backend_supports_op(backend, out)) {
+            output_printer->print_test_result(test_result(ggml_backend_name(backend), op_name, vars(), "test", false, false, "not supported"));
+            return true;
+        }
+        ggml_backend_buffer_set_usage(buf_w.get(), GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+
+        ggml_backend_buffer_ptr buf(ggml_backend_alloc_ctx_tensors(ctx.get(), backend));
+
+        init_tensor_uniform(a_ref);
+        init_tensor_uniform(b);
+
+        {
+            std::vector<uint8_t> data(ggml_nbytes(a_ref));
+            ggml_backend_tensor_get(a_ref, data.data(), 0, data.size());
+            ggml_backend_tensor_set(a,     data.data(), 0, data.size());
+        }
+
+        ggml_cgraph * gf = ggml_new_graph(ctx.get());
+        ggml_build_forward_expand(gf, out_ref);
+        ggml_build_forward_expand(gf, out);
+
+        const bool compute_ok = ggml_backend_graph_compute(backend, gf) == GGML_STATUS_SUCCESS;
+
+        const std::vector<float> f_ref = tensor_to_float(out_ref);
+        const std::vector<float> f     = tensor_to_float(out);
+
+        const double err     = nmse(f_ref.data(), f.data(), f.size());
+        const double err_max = 5e-4;
+
+        const bool passed = compute_ok && std::isfinite(err) && err <= err_max;
+
+        if (!passed) {
+            printf("[%s] NMSE = %.9f > %.9f ", op_name.c_str(), err, err_max);
+        }
+
+        output_printer->print_test_result(test_result(ggml_backend_name(backend), op_name, vars(), "test", true, passed,
+                                                      passed ? "" : "test failed"));
+
+        return passed;
+    }
+};
+
+// the shapes use m % 8 == 0 so that the weights are repacked into the 8-row interleaved layouts,
+// and n covers the GEMV (n = 1), GEMM (multiples of 4) and GEMM + GEMV tail paths
+static std::vector<test_mul_mat_extra_buft> make_test_cases_extra_buft() {
+    std::vector<test_mul_mat_extra_buft> test_cases;
+
+    for (ggml_type type_a : { GGML_TYPE_Q4_0, GGML_TYPE_Q4_K, GGML_TYPE_Q2_K, GGML_TYPE_IQ4_NL,
+                              GGML_TYPE_Q8_0, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K, GGML_TYPE_IQ4_XS }) {
+        for (int64_t n : { 1, 4, 7, 32 }) {
+            test_cases.push_back({ type_a, 16, n, 512 });
+        }
+    }
+    test_cases.push_back({ GGML_TYPE_Q8_0, 64, 19, 1024 });
+
+    return test_cases;
+}
+
+// runs the extra buffer type tests for every extra buffer type of the device of a CPU backend
+static bool test_cpu_extra_bufts(ggml_backend_t backend, const char * op_names_filter, const char * params_filter, printer * output_printer) {
+    ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+    auto get_extra_bufts_fn = (ggml_backend_dev_get_extra_bufts_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_dev_get_extra_bufts");
+    if (!get_extra_bufts_fn) {
+        return true;
+    }
+
+    const auto test_cases = make_test_cases_extra_buft();
+
+    size_t n_ok    = 0;
+    size_t n_total = 0;
+
+    for (ggml_backend_buffer_type_t * buft = get_extra_bufts_fn(dev); buft && *buft; ++buft) {
+        for (const auto & test : test_cases) {
+            if (test.eval(backend, *buft, op_names_filter, params_filter, output_printer)) {
+                n_ok++;
+            }
+            n_total++;
+        }
+    }
+
+    output_printer->print_summary(test_summary_info(n_ok, n_total, false));
+
+    return n_ok == n_total;
+}
+
 static bool test_backend(ggml_backend_t backend, test_mode mode, const char * op_names_filter, const char * params_filter,
-                         printer * output_printer) {
+                         printer * output_printer, const std::vector<std::unique_ptr<test_graph_op>> & roofline_cases) {
     auto filter_test_cases = [](std::vector<std::unique_ptr<test_case>> & test_cases, const char * params_filter) {
         if (params_filter == nullptr) {
             return;
@@ -6487,6 +7440,54 @@ static bool test_backend(ggml_backend_t backend, test_mode mode, const char * op
 
         ggml_backend_free(backend_cpu);
 
+        bool ok_extra = true;
+        if (ggml_backend_dev_type(ggml_backend_get_device(backend)) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+            ok_extra = test_cpu_extra_bufts(backend, op_names_filter, params_filter, output_printer);
+        }
+
+        return n_ok == test_cases.size() && ok_extra;
+    }
+
+    if (mode == MODE_FUSION) {
+        // compare the graphs that can be fused with the same backend running the ops one by one
+        ggml_backend_dev_t dev = ggml_backend_get_device(backend);
+        ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(dev);
+
+        auto ggml_backend_set_fusion_fn = (ggml_backend_set_fusion_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_fusion");
+        if (!ggml_backend_set_fusion_fn) {
+            output_printer->print_summary(test_summary_info(0, 0, false));
+            return true;
+        }
+
+        ggml_backend_t backend_ref = ggml_backend_dev_init(dev, NULL);
+        GGML_ASSERT(backend_ref != NULL);
+
+        auto ggml_backend_set_n_threads_fn = (ggml_backend_set_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_n_threads");
+        if (ggml_backend_set_n_threads_fn) {
+            ggml_backend_set_n_threads_fn(backend_ref, std::thread::hardware_concurrency());
+        }
+
+        ggml_backend_set_fusion_fn(backend,     true);
+        ggml_backend_set_fusion_fn(backend_ref, false);
+
+        auto test_cases = make_test_cases_eval();
+        filter_test_cases(test_cases, params_filter);
+
+        // only the output is compared, the intermediate results of fused ops are not computed
+        test_cases.erase(std::remove_if(test_cases.begin(), test_cases.end(), [](const std::unique_ptr<test_case> & tc) {
+            return !tc->run_whole_graph();
+        }), test_cases.end());
+
+        size_t n_ok = 0;
+        for (auto & test : test_cases) {
+            if (test->eval(backend, backend_ref, op_names_filter, output_printer)) {
+                n_ok++;
+            }
+        }
+        output_printer->print_summary(test_summary_info(n_ok, test_cases.size(), false));
+
+        ggml_backend_free(backend_ref);
+
         return n_ok == test_cases.size();
     }
 
@@ -6522,19 +7523,85 @@ static bool test_backend(ggml_backend_t backend, test_mode mode, const char * op
         return true;
     }
 
+    if (mode == MODE_ROOFLINE) {
+        const roofline_peaks peaks = measure_roofline_peaks(backend);
+        output_printer->print_roofline_peaks(peaks);
+
+        std::unique_ptr<std::regex> params_filter_regex(params_filter ? new std::regex(params_filter) : nullptr);
+
+        std::vector<roofline_result> results;
+        for (const auto & test : roofline_cases) {
+            if (params_filter_regex && !std::regex_search(test->vars(), *params_filter_regex)) {
+                continue;
+            }
+
+            roofline_result res;
+            res.backend_name = ggml_backend_name(backend);
+            res.graph        = test->graph;
+            res.name         = test->name;
+            res.op_name      = ggml_op_name(test->op);
+            res.op_params    = test->vars();
+            res.count        = test->count;
+
+            uint64_t flops;
+            size_t   size;
+            if (!test->eval_roofline(backend, op_names_filter, 256u*1024*1024, res.supported, res.time_us, flops, size)) {
+                continue;
+            }
+
+            if (res.supported) {
+                const double bytes_s = size / (res.time_us / 1e6);
+
+                res.flops          = flops / (res.time_us / 1e6);
+                res.bandwidth_gb_s = bytes_s / 1024.0 / 1024.0 / 1024.0;
+                res.intensity      = (double) flops / size;
+
+                // the op is bound by the slower of compute and memory
+                const double t_roof = std::max(peaks.flops > 0 ? flops / peaks.flops : 0.0,
+                                               peaks.bandwidth_gb_s > 0 ? size / (peaks.bandwidth_gb_s * 1024.0 * 1024.0 * 1024.0) : 0.0);
+
+                res.roofline = t_roof / (res.time_us / 1e6);
+            }
+
+            results.push_back(res);
+        }
+
+        // share of each op in the time of its graph
+        std::unordered_map<std::string, double> graph_time;
+        for (const auto & res : results) {
+            graph_time[res.graph] += res.count * res.time_us;
+        }
+
+        for (auto & res : results) {
+            if (graph_time[res.graph] > 0) {
+                res.graph_share = res.count * res.time_us / graph_time[res.graph];
+            }
+            output_printer->print_roofline_result(res);
+        }
+
+        return true;
+    }
+
     GGML_ABORT("fatal error");
 }
 
 static void usage(char ** argv) {
-    printf("Usage: %s [mode] [-o <op,..>] [-b <backend>] [-p <params regex>] [--output <console|sql|csv>]\n", argv[0]);
+    printf("Usage: %s [mode] [-o <op,..>] [-b <backend>] [-p <params regex>] [--output <console|sql|csv|json>]\n", argv[0]);
+    printf("                  [--model <gguf>] [--n-tokens <n,..>] [--depth <n>]\n");
     printf("    valid modes:\n");
     printf("      - test (default, compare with CPU backend for correctness)\n");
     printf("      - grad (compare gradients from backpropagation with method of finite differences)\n");
     printf("      - perf (performance evaluation)\n");
     printf("      - support (probe backend operation support)\n");
+    printf("      - fusion (compare fused ops with the same backend running them one by one)\n");
+    printf("      - roofline (performance of the ops of a model against the measured peak bandwidth and FLOP/s)\n");
     printf("    op names for -o are as given by ggml_op_desc() (e.g. ADD, MUL_MAT, etc),\n");
     printf("        optionally including the full test case string (e.g. \"ADD(type=f16,ne=[1,1,8,1],nr=[1,1,1,1],nf=1)\")\n");
-    printf("    --output specifies output format (default: console, options: console, sql, csv)\n");
+    printf("    --output specifies output format (default: console, options: console, sql, csv, json)\n");
+    printf("    roofline mode options (console and json output only):\n");
+    printf("      --model    the model whose graphs provide the ops (required)\n");
+    printf("      --n-tokens batch sizes of the graphs (default: 1,16,128,512)\n");
+    printf("      --depth    tokens in the context before the batch (default: 0)\n");
 }
 
 int main(int argc, char ** argv) {
@@ -6543,6 +7610,9 @@ int main(int argc, char ** argv) {
     const char * op_names_filter = nullptr;
     const char * backend_filter = nullptr;
     const char * params_filter = nullptr;
+    const char * model_path = nullptr;
+    std::vector<int> n_tokens = { 1, 16, 128, 512 };
+    int n_depth = 0;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "test") == 0) {
@@ -6553,6 +7623,10 @@ int main(int argc, char ** argv) {
             mode = MODE_GRAD;
         } else if (strcmp(argv[i], "support") == 0) {
             mode = MODE_SUPPORT;
+        } else if (strcmp(argv[i], "fusion") == 0) {
+            mode = MODE_FUSION;
+        } else if (strcmp(argv[i], "roofline") == 0) {
+            mode = MODE_ROOFLINE;
         } else if (strcmp(argv[i], "-o") == 0) {
             if (i + 1 < argc) {
                 op_names_filter = argv[++i];
@@ -6574,6 +7648,40 @@ int main(int argc, char ** argv) {
                 usage(argv);
                 return 1;
             }
+        } else if (strcmp(argv[i], "--model") == 0) {
+            if (i + 1 < argc) {
+                model_path = argv[++i];
+            } else {
+                usage(argv);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--n-tokens") == 0) {
+            if (i + 1 < argc) {
+                n_tokens.clear();
+                for (const char * p = argv[++i]; *p; ) {
+                    char * end;
+                    n_tokens.push_back(strtol(p, &end, 10));
+                    if (end == p || n_tokens.back() <= 0) {
+                        usage(argv);
+                        return 1;
+                    }
+                    p = *end == ',' ? end + 1 : end;
+                }
+                if (n_tokens.empty()) {
+                    usage(argv);
+                    return 1;
+                }
+            } else {
+                usage(argv);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--depth") == 0) {
+            if (i + 1 < argc) {
+                n_depth = std::max(0, atoi(argv[++i]));
+            } else {
+                usage(argv);
+                return 1;
+            }
         } else if (strcmp(argv[i], "--output") == 0) {
             if (i + 1 < argc) {
                 if (!output_format_from_str(argv[++i], output_format)) {
@@ -6590,9 +7698,22 @@ int main(int argc, char ** argv) {
         }
     }
 
+    if (mode == MODE_ROOFLINE && (model_path == nullptr || output_format == SQL || output_format == CSV)) {
+        usage(argv);
+        return 1;
+    }
+
     // load and enumerate backends
     ggml_backend_load_all();
 
+    std::vector<std::unique_ptr<test_graph_op>> roofline_cases;
+    if (mode == MODE_ROOFLINE) {
+        roofline_cases = make_test_cases_roofline(model_path, n_tokens, n_depth);
+        if (roofline_cases.empty()) {
+            return 1;
+        }
+    }
+
     // Create printer for output format
     std::unique_ptr<printer> output_printer = create_printer(output_format);
     if (output_printer) {
@@ -6613,7 +7734,26 @@ int main(int argc, char ** argv) {
             continue;
         }
 
-        if (backend_filter == NULL && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU && mode != MODE_GRAD) {
+        if (backend_filter == NULL && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU && mode == MODE_TEST) {
+            // the CPU backend is the reference, only its extra buffer types (e.g. the repacked weights) are tested
+            ggml_backend_t backend = ggml_backend_dev_init(dev, NULL);
+            GGML_ASSERT(backend != NULL);
+
+            output_printer->print_backend_init(backend_init_info(
+                i, ggml_backend_dev_count(), ggml_backend_dev_name(dev), false, "", "extra buffer types only"));
+
+            const bool ok = test_cpu_extra_bufts(backend, op_names_filter, params_filter, output_printer.get());
+            if (ok) {
+                n_ok++;
+            }
+            output_printer->print_backend_status(
+                backend_status_info(ggml_backend_name(backend), ok ? test_status_t::OK : test_status_t::FAIL));
+
+            ggml_backend_free(backend);
+            continue;
+        }
+
+        if (backend_filter == NULL && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU && mode != MODE_GRAD && mode != MODE_FUSION && mode != MODE_ROOFLINE) {
             output_printer->print_backend_init(backend_init_info(
                 i, ggml_backend_dev_count(), ggml_backend_dev_name(dev), true, "Skipping CPU backend"));
             n_ok++;
@@ -6636,7 +7776,7 @@ int main(int argc, char ** argv) {
                                                              false, "", ggml_backend_dev_description(dev),
                                                              total / 1024 / 1024, free / 1024 / 1024, true));
 
-        bool ok = test_backend(backend, mode, op_names_filter, params_filter, output_printer.get());
+        bool ok = test_backend(backend, mode, op_names_filter, params_filter, output_printer.get(), roofline_cases);
 
         if (ok) {
             n_ok++;
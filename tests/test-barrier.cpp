@@ -3,92 +3,155 @@
 #include "ggml-backend.h"
 
 #include <chrono>
+#include <ctime>
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <functional>
+#include <thread>
 #include <vector>
 
 #define MAX_NARGS 2
 
-int main(int argc, char *argv[]) {
+// an independent graph and threadpool, several tenants computing at the same time oversubscribe the cores
+struct tenant {
+    struct ggml_context    * ctx        = nullptr;
+    struct ggml_cgraph     * gf         = nullptr;
+    struct ggml_threadpool * threadpool = nullptr;
+    struct ggml_cplan        cplan      = {};
 
-    int n_threads = 4;
-    int n_rounds  = 100;
+    std::vector<uint8_t> work_data;
 
-    if (argc > 1) {
-        n_threads = std::atoi(argv[1]);
-    }
-
-    if (argc > 2) {
-        n_rounds  = std::atoi(argv[2]);
-    }
+    int64_t usec = 0;
+};
 
+static void tenant_init(tenant & t, int n_threads) {
     struct ggml_init_params params = {
-        /* .mem_size   = */ 1024*1024*1024,
+        /* .mem_size   = */ 64*1024*1024,
         /* .mem_buffer = */ NULL,
         /* .no_alloc   = */ false,
     };
 
-    struct ggml_context * ctx = ggml_init(params);
+    t.ctx = ggml_init(params);
 
     // Create graph
-    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    t.gf = ggml_new_graph(t.ctx);
 
     // Lots of small, parallel ops where barriers in between will dominate
-    struct ggml_tensor * out = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,  64);
+    struct ggml_tensor * out = ggml_new_tensor_1d(t.ctx, GGML_TYPE_F32,  64);
     for (int i = 0; i < 1000; i++) {
-        struct ggml_tensor * a = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 64, 128);
-        out = ggml_mul_mat(ctx, a, out);
+        struct ggml_tensor * a = ggml_new_tensor_2d(t.ctx, GGML_TYPE_Q4_0, 64, 128);
+        out = ggml_mul_mat(t.ctx, a, out);
 
-        struct ggml_tensor * d = ggml_new_tensor_2d(ctx, GGML_TYPE_Q4_0, 128, 64);
-        out = ggml_mul_mat(ctx, d, out);
+        struct ggml_tensor * d = ggml_new_tensor_2d(t.ctx, GGML_TYPE_Q4_0, 128, 64);
+        out = ggml_mul_mat(t.ctx, d, out);
     }
 
-    ggml_build_forward_expand(gf, out);
-    int n_nodes = ggml_graph_n_nodes(gf);
+    ggml_build_forward_expand(t.gf, out);
 
     // Create threadpool
-    struct ggml_threadpool_params tpp  = ggml_threadpool_params_default(n_threads);
-    struct ggml_threadpool* threadpool = ggml_threadpool_new(&tpp);
-    if (!threadpool) {
+    struct ggml_threadpool_params tpp = ggml_threadpool_params_default(n_threads);
+    t.threadpool = ggml_threadpool_new(&tpp);
+    if (!t.threadpool) {
         fprintf(stderr, "threadpool create failed : n_threads %d\n", n_threads);
         exit(1);
     }
 
     // Create compute plan
-    struct ggml_cplan cplan = ggml_graph_plan(gf, n_threads, threadpool);
+    t.cplan = ggml_graph_plan(t.gf, n_threads, t.threadpool);
 
-    std::vector<uint8_t> work_data(cplan.work_size);
-    cplan.work_data = work_data.data();
+    t.work_data.resize(t.cplan.work_size);
+    t.cplan.work_data = t.work_data.data();
+}
+
+static void tenant_run(tenant & t, int n_rounds) {
+    // Warmup
+    ggml_graph_compute(t.gf, &t.cplan);
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < n_rounds; i++) {
+        ggml_graph_compute(t.gf, &t.cplan);
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    t.usec = std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count();
+}
+
+static void tenant_free(tenant & t) {
+    ggml_threadpool_free(t.threadpool);
+    ggml_free(t.ctx);
+}
+
+int main(int argc, char *argv[]) {
+
+    int n_threads = 4;
+    int n_rounds  = 100;
+    int n_tenants = 1;
+
+    if (argc > 1) {
+        n_threads = std::atoi(argv[1]);
+    }
+
+    if (argc > 2) {
+        n_rounds  = std::atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        n_tenants = std::atoi(argv[3]);
+    }
+
+    std::vector<tenant> tenants(n_tenants);
+    for (auto & t : tenants) {
+        tenant_init(t, n_threads);
+    }
+
+    int n_nodes = ggml_graph_n_nodes(tenants[0].gf);
 
     std::cerr << "graph-compute with"
               << "\n n_threads: " << n_threads
               << "\n   n_nodes: " << n_nodes
               << "\n  n_rounds: " << n_rounds
+              << "\n n_tenants: " << n_tenants
               << "\n";
     // ggml_graph_print(gf);
 
-    // Warmup
-    ggml_graph_compute(gf, &cplan);
-
+    const std::clock_t c0 = std::clock();
     auto t0 = std::chrono::high_resolution_clock::now();
 
-    for (int i=0; i < n_rounds; i++) {
-        ggml_graph_compute(gf, &cplan);
+    std::vector<std::thread> threads;
+    for (auto & t : tenants) {
+        threads.emplace_back(tenant_run, std::ref(t), n_rounds);
+    }
+    for (auto & th : threads) {
+        th.join();
     }
 
     auto t1 = std::chrono::high_resolution_clock::now();
+    const std::clock_t c1 = std::clock();
+
+    for (int i = 0; i < n_tenants; i++) {
+        const auto & t = tenants[i];
+
+        std::cerr << "tenant " << i << ": graph-compute took " << t.usec << " usec "
+                  << "\n " << (float) t.usec / n_rounds << " usec per-iter"
+                  << "\n " << (float) t.usec * 1000 / (n_rounds * n_nodes) << " nsec per-node"
+                  << "\n";
+    }
+
+    // the CPU time includes the warmup, it shows how much of the cores the waiting threads burn
+    const double wall = std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count() / 1e6;
+    const double cpu  = (double) (c1 - c0) / CLOCKS_PER_SEC;
 
-    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count();
-    auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(t1-t0).count();
-    std::cerr << "graph-compute took " << usec << " usec "
-              << "\n " << (float) usec / n_rounds << " usec per-iter"
-              << "\n " << (float) nsec / (n_rounds * n_nodes) << " nsec per-node"
+    std::cerr << "total: " << wall << " sec wall, " << cpu << " sec cpu"
+              << "\n " << (float) (wall * 1e9) / (n_tenants * n_rounds * n_nodes) << " nsec per-node (all tenants)"
               << "\n";
 
-    ggml_threadpool_free(threadpool);
-    ggml_free(ctx);
+    for (auto & t : tenants) {
+        tenant_free(t);
+    }
 
     return 0;
 }
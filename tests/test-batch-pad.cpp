@@ -0,0 +1,109 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "llama.h"
+
+#include "../src/llama-batch.h"
+#include "../src/llama-vocab.h"
+
+#include <cassert>
+#include <cstdio>
+#include <vector>
+
+// the padding tokens of llama_batch_allocr::ubatch_pad() repeat the last token of the ubatch,
+// and the real tokens keep their data and their place in front, so that their outputs come first
+static void test_pad(uint32_t n_pos_per_embd, bool output_last) {
+    const int32_t n_embd   = 4;
+    const int32_t n_tokens = 3;
+
+    llama_batch batch = llama_batch_init(n_tokens, n_embd, 2);
+
+    // with M-RoPE, each embedding has n_pos_per_embd positions, stored one after the other
+    std::vector<llama_pos> pos(n_tokens*n_pos_per_embd);
+    for (uint32_t k = 0; k < n_pos_per_embd; ++k) {
+        pos[k*n_tokens + 0] = 10*k + 0;
+        pos[k*n_tokens + 1] = 10*k + 0;
+        pos[k*n_tokens + 2] = 10*k + 1;
+    }
+
+    llama_pos * pos_init = batch.pos;
+    batch.pos = pos.data();
+
+    // tokens 0 and 2 belong to sequence 0, token 1 to sequence 1
+    for (int32_t i = 0; i < n_tokens; ++i) {
+        for (int32_t j = 0; j < n_embd; ++j) {
+            batch.embd[i*n_embd + j] = 100.0f*i + j;
+        }
+        batch.n_seq_id[i]  = 1;
+        batch.seq_id[i][0] = i == 1 ? 1 : 0;
+        batch.logits[i]    = i == 0 || (i == n_tokens - 1 && output_last);
+    }
+    batch.n_tokens = n_tokens;
+
+    llama_vocab vocab;
+
+    llama_batch_allocr balloc(n_pos_per_embd);
+
+    const bool ok = balloc.init(batch, vocab, nullptr, n_embd, 2, false);
+    assert(ok);
+
+    balloc.split_reset();
+
+    const llama_ubatch ubatch = balloc.split_simple(8);
+    assert(ubatch.n_tokens == (uint32_t) n_tokens);
+
+    const uint32_t n_pad = 8;
+
+    const llama_ubatch res = balloc.ubatch_pad(ubatch, n_pad);
+
+    assert(res.n_tokens     == n_pad);
+    assert(res.n_seq_tokens == 1);
+    assert(res.n_seqs       == n_pad);
+    assert(res.n_seqs_unq   == ubatch.n_seqs_unq);
+    assert(res.token        == nullptr);
+
+    uint32_t n_outputs = 0;
+
+    for (uint32_t i = 0; i < n_pad; ++i) {
+        const uint32_t j = i < ubatch.n_tokens ? i : ubatch.n_tokens - 1;
+
+        for (int32_t k = 0; k < n_embd; ++k) {
+            assert(res.embd[i*n_embd + k] == ubatch.embd[j*n_embd + k]);
+        }
+
+        for (uint32_t k = 0; k < n_pos_per_embd; ++k) {
+            assert(res.pos[k*n_pad + i] == ubatch.pos[k*ubatch.n_tokens + j]);
+        }
+
+        assert(res.n_seq_id[i]  == ubatch.n_seq_id[j]);
+        assert(res.seq_id[i][0] == ubatch.seq_id[j][0]);
+        assert(res.output[i]    == ubatch.output[j]);
+
+        n_outputs += res.output[i];
+    }
+
+    // the padding tokens produce outputs only if the last token does, after the outputs of the real tokens
+    assert(n_outputs == (output_last ? 2 + n_pad - n_tokens : 1));
+
+    for (uint32_t s = 0; s < res.n_seqs_unq; ++s) {
+        assert(res.seq_idx[res.seq_id_unq[s]] == (int32_t) s);
+    }
+
+    batch.pos = pos_init;
+    llama_batch_free(batch);
+}
+
+int main(void) {
+    llama_backend_init();
+
+    test_pad(1, true);
+    test_pad(1, false);
+    test_pad(4, true);
+
+    llama_backend_free();
+
+    printf("OK\n");
+
+    return 0;
+}
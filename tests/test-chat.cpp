@@ -6,6 +6,7 @@
 //    cmake -B build && cmake --build build --parallel && ./build/bin/test-chat ../minja/build/tests/*.jinja 2>/dev/null
 //
 #include "chat.h"
+#include "chat-parser.h"
 
 #include "log.h"
 
@@ -268,6 +269,35 @@ static delta_data init_delta(const struct common_chat_templates * tmpls, const s
     return { delta, params_full };
 }
 
+// Parses every prefix of the input with the state of the previous parses, the messages must match the parses from scratch
+static void test_parse_incremental(const std::string & input, const common_chat_syntax & syntax) {
+    common_chat_msg_parser_state state;
+
+    auto parse = [&](const std::string & prefix, bool is_partial, common_chat_msg_parser_state * state) -> common_chat_msg {
+        try {
+            return common_chat_parse(prefix, is_partial, syntax, state);
+        } catch (const std::exception & e) {
+            common_chat_msg msg;
+            msg.content = "error: " + std::string(e.what());
+            return msg;
+        }
+    };
+
+    for (size_t n = 1; n <= input.size(); n++) {
+        const auto prefix     = input.substr(0, n);
+        const bool is_partial = n < input.size();
+
+        const auto expected = parse(prefix, is_partial, nullptr);
+        const auto actual   = parse(prefix, is_partial, &state);
+        if (expected != actual) {
+            std::cerr << "Incremental parse of: " << prefix << std::endl;
+            std::cerr << "Expected: " << expected << std::endl;
+            std::cerr << "Actual: " << actual << std::endl;
+            throw std::runtime_error("Test failed");
+        }
+    }
+}
+
 /*
   Applies the template to 1 user message w/ add_generation_prompt=true, then w/ the test message w/ add_generation_prompt=false,
   gets the diff, removes any end tokens and parses the result w/ the grammar, checking that
@@ -296,6 +326,10 @@ static void test_templates(const struct common_chat_templates * tmpls, const std
             syntax.reasoning_format = reasoning_format;
             const auto msg = common_chat_parse(data.delta, /* is_partial= */ false, syntax);
             assert_msg_equals(test_message, msg);
+
+            if (tool_choice == COMMON_CHAT_TOOL_CHOICE_AUTO) {
+                test_parse_incremental(data.delta, syntax);
+            }
         }
 
         if (!test_message.tool_calls.empty()) {
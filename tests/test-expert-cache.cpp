@@ -0,0 +1,154 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#include "llama.h"
+
+#include "../src/llama-expert-cache.h"
+#include "../src/llama-mmap.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static void test_plan() {
+    // ranked by count: 3, 0, 2, 4, (1 and 5 are never selected)
+    const std::vector<float>  counts = { 5.0f,  0.0f,  3.0f,  9.0f,  1.0f,  0.0f };
+    const std::vector<size_t> sizes  = { 10,    10,    10,    10,    10,    10   };
+
+    {
+        const auto p = llama_expert_cache::make_plan(counts, sizes, 20);
+
+        assert((p.hot == std::vector<uint8_t>{ 1, 0, 0, 1, 0, 0 }));
+        assert((p.prefetch == std::vector<uint32_t>{ 2, 4 }));
+    }
+
+    // an expert that does not fit is skipped, the next smaller ones still get the room
+    {
+        const std::vector<size_t> sizes_mixed = { 15, 10, 10, 10, 5, 10 };
+        const auto p = llama_expert_cache::make_plan(counts, sizes_mixed, 20);
+
+        assert((p.hot == std::vector<uint8_t>{ 0, 0, 1, 1, 0, 0 }));
+        assert((p.prefetch == std::vector<uint32_t>{ 0, 4 }));
+    }
+
+    // experts without memory in host buffers are ignored
+    {
+        const std::vector<size_t> sizes_host = { 10, 10, 0, 0, 10, 10 };
+        const auto p = llama_expert_cache::make_plan(counts, sizes_host, 20);
+
+        assert((p.hot == std::vector<uint8_t>{ 1, 0, 0, 0, 1, 0 }));
+        assert(p.prefetch.empty());
+    }
+}
+
+static void test_stats() {
+    const uint32_t n_layer  = 1;
+    const uint32_t n_expert = 4;
+    const size_t   n_bytes  = 64*1024;
+
+    std::vector<void *> bufs;
+    std::vector<std::vector<llama_expert_cache::range>> ranges;
+    for (uint32_t e = 0; e < n_expert; ++e) {
+        bufs.push_back(aligned_alloc(n_bytes, n_bytes));
+        ranges.push_back({ { (const uint8_t *) bufs.back(), n_bytes } });
+    }
+
+    // locking can be unavailable (e.g. RLIMIT_MEMLOCK), the hits must then stay at 0
+    const bool can_lock = llama_mem_lock(bufs[0], n_bytes);
+    if (can_lock) {
+        llama_mem_unlock(bufs[0], n_bytes);
+    }
+
+    {
+        llama_expert_cache cache(n_layer, n_expert, ranges, 2*n_bytes);
+        assert(cache.enabled());
+
+        // route every token to experts 0 and 1 until a placement is made
+        const int32_t ids[4] = { 0, 1, 1, 0 };
+        for (uint32_t i = 0; i < llama_expert_cache::n_update_interval; ++i) {
+            cache.observe(0, ids, 2, 2);
+            cache.update();
+        }
+        cache.sync();
+
+        // nothing was resident while the routing was observed
+        assert(cache.get_n_total() == 4*llama_expert_cache::n_update_interval);
+        assert(cache.get_n_hits()  == 0);
+
+        assert(cache.get_n_locked() == (can_lock ? 2*n_bytes : 0));
+
+        const int32_t ids_all[4] = { 0, 1, 2, 3 };
+        cache.observe(0, ids_all, 1, 4);
+
+        assert(cache.get_n_total() == 4*llama_expert_cache::n_update_interval + 4);
+        assert(cache.get_n_hits()  == (can_lock ? 2u : 0u));
+
+        fprintf(stderr, "%s: locking %s, %llu hits out of %llu selections\n", __func__, can_lock ? "supported" : "not supported",
+                (unsigned long long) cache.get_n_hits(), (unsigned long long) cache.get_n_total());
+    }
+
+    for (void * buf : bufs) {
+        free(buf);
+    }
+}
+
+// a warm expert is prefetched once when it becomes warm, not again by every following placement
+static void test_prefetch() {
+    const uint32_t n_layer  = 1;
+    const uint32_t n_expert = 4;
+    const size_t   n_bytes  = 64*1024;
+
+    std::vector<void *> bufs;
+    std::vector<std::vector<llama_expert_cache::range>> ranges;
+    for (uint32_t e = 0; e < n_expert; ++e) {
+        bufs.push_back(aligned_alloc(n_bytes, n_bytes));
+        ranges.push_back({ { (const uint8_t *) bufs.back(), n_bytes } });
+    }
+
+    const bool can_lock = llama_mem_lock(bufs[0], n_bytes);
+    if (can_lock) {
+        llama_mem_unlock(bufs[0], n_bytes);
+    }
+
+    // without locking, the hot expert is prefetched once as well
+    const size_t n_hot = can_lock ? 0 : n_bytes;
+
+    {
+        llama_expert_cache cache(n_layer, n_expert, ranges, n_bytes);
+
+        const auto route = [&](const std::vector<int32_t> & ids, uint32_t n_intervals) {
+            for (uint32_t i = 0; i < n_intervals*llama_expert_cache::n_update_interval; ++i) {
+                cache.observe(0, ids.data(), ids.size(), 1);
+                cache.update();
+            }
+            cache.sync();
+        };
+
+        // expert 0 is hot and expert 1 is warm in every placement
+        route({ 0, 0, 1 }, 3);
+        assert(cache.get_n_prefetched() == n_hot + n_bytes);
+
+        // expert 2 replaces expert 1 as the warm one
+        route({ 0, 0, 0, 0, 0, 0, 2, 2, 2 }, 1);
+        assert(cache.get_n_prefetched() == n_hot + 2*n_bytes);
+
+        route({ 0, 0, 0, 0, 0, 0, 2, 2, 2 }, 2);
+        assert(cache.get_n_prefetched() == n_hot + 2*n_bytes);
+    }
+
+    for (void * buf : bufs) {
+        free(buf);
+    }
+}
+
+int main() {
+    test_plan();
+    test_stats();
+    test_prefetch();
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
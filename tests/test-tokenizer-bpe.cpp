@@ -0,0 +1,160 @@
+// tests of the BPE tokenizer internals that are not reachable through the public API
+
+#include "llama.h"
+#include "gguf.h"
+
+#include "../src/llama-vocab.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// a merges array with duplicates and entries without a space must load and tokenize like the original,
+// and merges whose parts contain a space must not be confused with other pairs
+static bool test_merges(const std::string & fname, const llama_vocab & vocab_ref, const std::string & text) {
+    const std::string fname_out = "test-tokenizer-bpe-merges.gguf.tmp";
+
+    size_t n_merges_orig = 0;
+    {
+        gguf_init_params params = { /*.no_alloc =*/ true, /*.ctx =*/ NULL };
+
+        gguf_context * ctx_src = gguf_init_from_file(fname.c_str(), params);
+        if (ctx_src == NULL) {
+            fprintf(stderr, "%s : error: failed to read %s\n", __func__, fname.c_str());
+            return false;
+        }
+
+        const int64_t kid = gguf_find_key(ctx_src, "tokenizer.ggml.merges");
+        if (kid < 0) {
+            fprintf(stderr, "%s : error: %s has no merges\n", __func__, fname.c_str());
+            gguf_free(ctx_src);
+            return false;
+        }
+
+        std::vector<std::string> merges;
+
+        n_merges_orig = gguf_get_arr_n(ctx_src, kid);
+        for (size_t i = 0; i < n_merges_orig; ++i) {
+            merges.push_back(gguf_get_arr_str(ctx_src, kid, i));
+        }
+
+        // duplicates of the highest priority merges, entries without a space and a merge with a space in
+        // its right part, which a plain "left right" key would confuse with the pair ("a b", "c")
+        for (size_t i = 0; i < std::min<size_t>(n_merges_orig, 64); ++i) {
+            merges.push_back(merges[i]);
+        }
+        merges.push_back("abc");
+        merges.push_back("xyz");
+        merges.push_back("a b c");
+
+        std::vector<const char *> data;
+        for (const auto & merge : merges) {
+            data.push_back(merge.c_str());
+        }
+
+        gguf_context * ctx_dst = gguf_init_empty();
+        gguf_set_kv(ctx_dst, ctx_src);
+        gguf_set_arr_str(ctx_dst, "tokenizer.ggml.merges", data.data(), data.size());
+
+        const bool ok = gguf_write_to_file(ctx_dst, fname_out.c_str(), /*only_meta =*/ true);
+
+        gguf_free(ctx_dst);
+        gguf_free(ctx_src);
+
+        if (!ok) {
+            fprintf(stderr, "%s : error: failed to write %s\n", __func__, fname_out.c_str());
+            return false;
+        }
+    }
+
+    auto mparams = llama_model_default_params();
+    mparams.vocab_only = true;
+
+    llama_model * model = llama_model_load_from_file(fname_out.c_str(), mparams);
+    std::remove(fname_out.c_str());
+
+    if (model == NULL) {
+        fprintf(stderr, "%s : error: failed to load the modified vocab\n", __func__);
+        return false;
+    }
+
+    const llama_vocab & vocab = *llama_model_get_vocab(model);
+
+    bool success = true;
+
+    if (vocab.tokenize(text, false) != vocab_ref.tokenize(text, false)) {
+        fprintf(stderr, "%s : failed: tokenization differs from the original vocab\n", __func__);
+        success = false;
+    }
+
+    // the original merges, the no-space entries collapsed into a single one and ("a", "b c")
+    const std::vector<std::string> merges = vocab.get_bpe_merges();
+    if (merges.size() != n_merges_orig + 2) {
+        fprintf(stderr, "%s : failed: %zu merges instead of %zu\n", __func__, merges.size(), n_merges_orig + 2);
+        success = false;
+    }
+
+    if (vocab.find_bpe_rank("a", "b c") != (int) (n_merges_orig + 64 + 2)) {
+        fprintf(stderr, "%s : failed: rank of (\"a\", \"b c\") is %d\n", __func__, vocab.find_bpe_rank("a", "b c"));
+        success = false;
+    }
+
+    if (vocab.find_bpe_rank("a b", "c") != -1) {
+        fprintf(stderr, "%s : failed: (\"a b\", \"c\") has rank %d\n", __func__, vocab.find_bpe_rank("a b", "c"));
+        success = false;
+    }
+
+    llama_model_free(model);
+
+    if (success) {
+        fprintf(stderr, "%s : OK\n", __func__);
+    }
+
+    return success;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <vocab-file>\n", argv[0]);
+        return 1;
+    }
+
+    const std::string fname = argv[1];
+
+    std::string text;
+    {
+        std::ifstream f(fname + ".inp");
+        if (!f) {
+            fprintf(stderr, "%s : error: could not open %s.inp\n", __func__, fname.c_str());
+            return 1;
+        }
+        std::stringstream ss;
+        ss << f.rdbuf();
+        text = ss.str();
+    }
+
+    llama_backend_init();
+
+    auto mparams = llama_model_default_params();
+    mparams.vocab_only = true;
+
+    llama_model * model = llama_model_load_from_file(fname.c_str(), mparams);
+    if (model == NULL) {
+        fprintf(stderr, "%s: error: failed to load vocab '%s'\n", __func__, fname.c_str());
+        return 1;
+    }
+
+    const llama_vocab & vocab = *llama_model_get_vocab(model);
+
+    bool success = true;
+
+    success = test_merges(fname, vocab, text) && success;
+
+    llama_model_free(model);
+    llama_backend_free();
+
+    return success ? 0 : 3;
+}
@@ -0,0 +1,162 @@
+//  Tests common_vector_index (quantized storage, SIMD scan and the on-disk format).
+
+#include "common.h"
+#include "vector-index.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+template <class T> static void assert_equals(const T & expected, const T & actual) {
+    if (expected != actual) {
+        std::cerr << "Expected: " << expected << std::endl;
+        std::cerr << "  Actual: " << actual << std::endl;
+        std::cerr << std::flush;
+        throw std::runtime_error("Test failed");
+    }
+}
+
+static std::vector<float> random_embd(std::mt19937 & rng, int n_embd) {
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+
+    std::vector<float> x(n_embd);
+    for (auto & v : x) {
+        v = dist(rng);
+    }
+
+    std::vector<float> res(n_embd);
+    common_embd_normalize(x.data(), res.data(), n_embd, 2);
+
+    return res;
+}
+
+static void test_search(common_vector_index_type type, int n_embd, int n_rows) {
+    std::cout << "# Testing " << common_vector_index_type_name(type) << ", n_embd = " << n_embd << ", n_rows = " << n_rows << std::endl;
+
+    std::mt19937 rng(42);
+
+    std::vector<std::vector<float>> embds;
+
+    common_vector_index index(n_embd, type);
+    for (int i = 0; i < n_rows; ++i) {
+        embds.push_back(random_embd(rng, n_embd));
+        assert_equals<int64_t>(i, index.add(embds.back().data()));
+    }
+    assert_equals<int64_t>(n_rows, index.size());
+
+    // every vector must find itself first
+    for (int i = 0; i < n_rows; i += 97) {
+        const auto res = index.search(embds[i].data(), 5, 4);
+
+        assert_equals<size_t>(5, res.size());
+        assert_equals<int64_t>(i, res[0].id);
+
+        // the score of a vector with itself is ~1 for all storage types
+        if (std::fabs(res[0].score - 1.0f) > 0.02f) {
+            throw std::runtime_error("unexpected self similarity");
+        }
+
+        for (size_t j = 1; j < res.size(); ++j) {
+            if (res[j].score > res[j - 1].score) {
+                throw std::runtime_error("results are not sorted");
+            }
+        }
+    }
+
+    // the approximate scores must track the exact cosine similarity
+    if (type == COMMON_VECTOR_INDEX_TYPE_I8) {
+        const auto q   = random_embd(rng, n_embd);
+        const auto res = index.search(q.data(), n_rows);
+
+        for (const auto & r : res) {
+            const float exact = common_embd_similarity_cos(q.data(), embds[r.id].data(), n_embd);
+            if (std::fabs(exact - r.score) > 0.02f) {
+                throw std::runtime_error("i8 score too far from the exact similarity");
+            }
+        }
+    }
+
+    // the file round trip must give the same results
+    {
+        const std::string fname = "test-vector-index-" + std::string(common_vector_index_type_name(type)) + ".tmp";
+
+        const std::vector<std::string> texts = { "a", "b c" };
+        index.set_hash(0x1234, common_vector_index_text_hash(texts));
+
+        if (!index.save(fname)) {
+            throw std::runtime_error("failed to save the index");
+        }
+
+        auto loaded = common_vector_index::load(fname);
+        if (!loaded) {
+            throw std::runtime_error("failed to load the index");
+        }
+
+        assert_equals<int64_t>(index.size(), loaded->size());
+        assert_equals<int32_t>(index.n_embd(), loaded->n_embd());
+        assert_equals<uint64_t>(0x1234, loaded->hash_model());
+        assert_equals<uint64_t>(common_vector_index_text_hash(texts), loaded->hash_text());
+
+        // the text hash is sensitive to the chunk boundaries
+        const std::vector<std::string> texts_joined = { "a b", "c" };
+        if (common_vector_index_text_hash(texts_joined) == loaded->hash_text()) {
+            throw std::runtime_error("text hash does not depend on the chunk boundaries");
+        }
+
+        const auto q  = random_embd(rng, n_embd);
+        const auto r0 = index.search(q.data(), 10);
+        const auto r1 = loaded->search(q.data(), 10, 3);
+
+        assert_equals(r0.size(), r1.size());
+        for (size_t j = 0; j < r0.size(); ++j) {
+            assert_equals(r0[j].id,    r1[j].id);
+            assert_equals(r0[j].score, r1[j].score);
+        }
+
+        loaded.reset();
+        std::remove(fname.c_str());
+    }
+}
+
+// a header with a row count that does not fit in the file must be rejected, including when the size overflows
+static void test_load_invalid() {
+    const std::string fname = "test-vector-index-invalid.tmp";
+
+    common_vector_index index(64, COMMON_VECTOR_INDEX_TYPE_F32);
+    const std::vector<float> embd(64, 0.125f);
+    for (int i = 0; i < 4; ++i) {
+        index.add(embd.data());
+    }
+
+    for (int64_t n_rows : { (int64_t) 5, (int64_t) 1 << 58, INT64_MAX }) {
+        if (!index.save(fname)) {
+            throw std::runtime_error("failed to save the index");
+        }
+
+        // n_rows is at offset 16 in the header
+        FILE * f = fopen(fname.c_str(), "r+b");
+        fseek(f, 16, SEEK_SET);
+        fwrite(&n_rows, sizeof(n_rows), 1, f);
+        fclose(f);
+
+        if (common_vector_index::load(fname)) {
+            throw std::runtime_error("loaded an index with an invalid row count");
+        }
+    }
+
+    std::remove(fname.c_str());
+}
+
+int main() {
+    for (auto type : { COMMON_VECTOR_INDEX_TYPE_F32, COMMON_VECTOR_INDEX_TYPE_I8, COMMON_VECTOR_INDEX_TYPE_BINARY }) {
+        test_search(type, 384, 2000);
+        test_search(type, 77,  3000); // not a multiple of any SIMD width
+    }
+
+    test_load_invalid();
+
+    std::cout << "All tests passed.\n";
+}
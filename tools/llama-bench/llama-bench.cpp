@@ -258,6 +258,7 @@ struct cmd_params {
     std::vector<std::vector<float>>  tensor_split;
     std::vector<std::vector<llama_model_tensor_buft_override>> tensor_buft_overrides;
     std::vector<bool>                use_mmap;
+    std::vector<bool>                use_hugepages;
     std::vector<bool>                embeddings;
     std::vector<bool>                no_op_offload;
     ggml_numa_strategy               numa;
@@ -267,6 +268,7 @@ struct cmd_params {
     bool                             verbose;
     bool                             progress;
     bool                             no_warmup;
+    std::string                      trace_file;
     output_formats                   output_format;
     output_formats                   output_format_stderr;
 };
@@ -294,6 +296,7 @@ static const cmd_params cmd_params_defaults = {
     /* tensor_split         */ { std::vector<float>(llama_max_devices(), 0.0f) },
     /* tensor_buft_overrides*/ { std::vector<llama_model_tensor_buft_override>{ { nullptr, nullptr } } },
     /* use_mmap             */ { true },
+    /* use_hugepages        */ { false },
     /* embeddings           */ { false },
     /* no_op_offload        */ { false },
     /* numa                 */ GGML_NUMA_STRATEGY_DISABLED,
@@ -303,6 +306,7 @@ static const cmd_params cmd_params_defaults = {
     /* verbose              */ false,
     /* progress             */ false,
     /* no_warmup            */ false,
+    /* trace_file           */ "",
     /* output_format        */ MARKDOWN,
     /* output_format_stderr */ NONE,
 };
@@ -326,6 +330,7 @@ static void print_usage(int /* argc */, char ** argv) {
     printf("  -v, --verbose                             verbose output\n");
     printf("  --progress                                print test progress indicators\n");
     printf("  --no-warmup                               skip warmup runs before benchmarking\n");
+    printf("  --trace <filename>                        write a Chrome trace of the graph execution to filename\n");
     printf("\n");
     printf("test parameters:\n");
     printf("  -m, --model <filename>                    (default: %s)\n", join(cmd_params_defaults.model, ",").c_str());
@@ -367,6 +372,8 @@ static void print_usage(int /* argc */, char ** argv) {
            join(cmd_params_defaults.flash_attn, ",").c_str());
     printf("  -mmp, --mmap <0|1>                        (default: %s)\n",
            join(cmd_params_defaults.use_mmap, ",").c_str());
+    printf("  -hp, --hugepages <0|1>                    (default: %s)\n",
+           join(cmd_params_defaults.use_hugepages, ",").c_str());
     printf("  -embd, --embeddings <0|1>                 (default: %s)\n",
            join(cmd_params_defaults.embeddings, ",").c_str());
     printf("  -ts, --tensor-split <ts0/ts1/..>          (default: 0)\n");
@@ -425,6 +432,7 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
     params.delay                = cmd_params_defaults.delay;
     params.progress             = cmd_params_defaults.progress;
     params.no_warmup            = cmd_params_defaults.no_warmup;
+    params.trace_file           = cmd_params_defaults.trace_file;
 
     for (int i = 1; i < argc; i++) {
         arg = argv[i];
@@ -639,6 +647,13 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
                 }
                 auto p = string_split<bool>(argv[i], split_delim);
                 params.use_mmap.insert(params.use_mmap.end(), p.begin(), p.end());
+            } else if (arg == "-hp" || arg == "--hugepages") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                auto p = string_split<bool>(argv[i], split_delim);
+                params.use_hugepages.insert(params.use_hugepages.end(), p.begin(), p.end());
             } else if (arg == "-embd" || arg == "--embeddings") {
                 if (++i >= argc) {
                     invalid_param = true;
@@ -793,6 +808,12 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
                 params.progress = true;
             } else if (arg == "--no-warmup") {
                 params.no_warmup = true;
+            } else if (arg == "--trace") {
+                if (++i >= argc) {
+                    invalid_param = true;
+                    break;
+                }
+                params.trace_file = argv[i];
             } else {
                 invalid_param = true;
                 break;
@@ -865,6 +886,9 @@ static cmd_params parse_cmd_params(int argc, char ** argv) {
     if (params.use_mmap.empty()) {
         params.use_mmap = cmd_params_defaults.use_mmap;
     }
+    if (params.use_hugepages.empty()) {
+        params.use_hugepages = cmd_params_defaults.use_hugepages;
+    }
     if (params.embeddings.empty()) {
         params.embeddings = cmd_params_defaults.embeddings;
     }
@@ -909,6 +933,7 @@ struct cmd_params_instance {
     std::vector<float> tensor_split;
     std::vector<llama_model_tensor_buft_override> tensor_buft_overrides;
     bool               use_mmap;
+    bool               use_hugepages;
     bool               embeddings;
     bool               no_op_offload;
 
@@ -967,6 +992,7 @@ struct cmd_params_instance {
         mparams.main_gpu     = main_gpu;
         mparams.tensor_split = tensor_split.data();
         mparams.use_mmap     = use_mmap;
+        mparams.use_hugepages = use_hugepages;
 
         if (tensor_buft_overrides.empty()) {
             mparams.tensor_buft_overrides = nullptr;
@@ -981,6 +1007,7 @@ struct cmd_params_instance {
     bool equal_mparams(const cmd_params_instance & other) const {
         return model == other.model && n_gpu_layers == other.n_gpu_layers && rpc_servers_str == other.rpc_servers_str &&
                split_mode == other.split_mode && main_gpu == other.main_gpu && use_mmap == other.use_mmap &&
+               use_hugepages == other.use_hugepages &&
                tensor_split == other.tensor_split && vec_tensor_buft_override_equal(tensor_buft_overrides, other.tensor_buft_overrides);
     }
 
@@ -1015,6 +1042,7 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
     for (const auto & ts : params.tensor_split)
     for (const auto & ot : params.tensor_buft_overrides)
     for (const auto & mmp : params.use_mmap)
+    for (const auto & hp : params.use_hugepages)
     for (const auto & embd : params.embeddings)
     for (const auto & nopo : params.no_op_offload)
     for (const auto & nb : params.n_batch)
@@ -1054,6 +1082,7 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
                 /* .tensor_split = */ ts,
                 /* .tensor_buft_overrides = */ ot,
                 /* .use_mmap     = */ mmp,
+                /* .use_hugepages= */ hp,
                 /* .embeddings   = */ embd,
                 /* .no_op_offload= */ nopo,
             };
@@ -1086,6 +1115,7 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
                 /* .tensor_split = */ ts,
                 /* .tensor_buft_overrides = */ ot,
                 /* .use_mmap     = */ mmp,
+                /* .use_hugepages= */ hp,
                 /* .embeddings   = */ embd,
                 /* .no_op_offload= */ nopo,
             };
@@ -1118,6 +1148,7 @@ static std::vector<cmd_params_instance> get_cmd_params_instances(const cmd_param
                 /* .tensor_split = */ ts,
                 /* .tensor_buft_overrides = */ ot,
                 /* .use_mmap     = */ mmp,
+                /* .use_hugepages= */ hp,
                 /* .embeddings   = */ embd,
                 /* .no_op_offload= */ nopo,
             };
@@ -1154,6 +1185,7 @@ struct test {
     std::vector<float>       tensor_split;
     std::vector<llama_model_tensor_buft_override> tensor_buft_overrides;
     bool                     use_mmap;
+    bool                     use_hugepages;
     bool                     embeddings;
     bool                     no_op_offload;
     int                      n_prompt;
@@ -1188,6 +1220,7 @@ struct test {
         tensor_split   = inst.tensor_split;
         tensor_buft_overrides = inst.tensor_buft_overrides;
         use_mmap       = inst.use_mmap;
+        use_hugepages  = inst.use_hugepages;
         embeddings     = inst.embeddings;
         no_op_offload  = inst.no_op_offload;
         n_prompt       = inst.n_prompt;
@@ -1235,7 +1268,8 @@ struct test {
             "model_type",   "model_size",   "model_n_params", "n_batch",    "n_ubatch",     "n_threads",
             "cpu_mask",     "cpu_strict",   "poll",           "type_k",     "type_v",       "n_gpu_layers",
             "split_mode",   "main_gpu",     "no_kv_offload",  "flash_attn", "tensor_split", "tensor_buft_overrides",
-            "use_mmap",     "embeddings",   "no_op_offload",   "n_prompt",       "n_gen",      "n_depth",      "test_time",
+            "use_mmap",     "use_hugepages", "embeddings",  "no_op_offload",   "n_prompt",   "n_gen",      "n_depth",
+            "test_time",
             "avg_ns",       "stddev_ns",    "avg_ts",         "stddev_ts",
         };
         return fields;
@@ -1251,7 +1285,7 @@ struct test {
             return INT;
         }
         if (field == "f16_kv" || field == "no_kv_offload" || field == "cpu_strict" || field == "flash_attn" ||
-            field == "use_mmap" || field == "embeddings") {
+            field == "use_mmap" || field == "use_hugepages" || field == "embeddings") {
             return BOOL;
         }
         if (field == "avg_ts" || field == "stddev_ts") {
@@ -1322,6 +1356,7 @@ struct test {
                                             tensor_split_str,
                                             tensor_buft_overrides_str,
                                             std::to_string(use_mmap),
+                                            std::to_string(use_hugepages),
                                             std::to_string(embeddings),
                                             std::to_string(no_op_offload),
                                             std::to_string(n_prompt),
@@ -1503,6 +1538,9 @@ struct markdown_printer : public printer {
         if (field == "use_mmap") {
             return 4;
         }
+        if (field == "use_hugepages") {
+            return 2;
+        }
         if (field == "test") {
             return 15;
         }
@@ -1537,6 +1575,9 @@ struct markdown_printer : public printer {
         if (field == "use_mmap") {
             return "mmap";
         }
+        if (field == "use_hugepages") {
+            return "hp";
+        }
         if (field == "embeddings") {
             return "embd";
         }
@@ -1608,6 +1649,9 @@ struct markdown_printer : public printer {
         if (params.use_mmap.size() > 1 || params.use_mmap != cmd_params_defaults.use_mmap) {
             fields.emplace_back("use_mmap");
         }
+        if (params.use_hugepages.size() > 1 || params.use_hugepages != cmd_params_defaults.use_hugepages) {
+            fields.emplace_back("use_hugepages");
+        }
         if (params.embeddings.size() > 1 || params.embeddings != cmd_params_defaults.embeddings) {
             fields.emplace_back("embeddings");
         }
@@ -1845,6 +1889,10 @@ int main(int argc, char ** argv) {
 
     set_process_priority(params.prio);
 
+    if (!params.trace_file.empty()) {
+        ggml_trace_start(params.trace_file.c_str());
+    }
+
     // initialize printer
     std::unique_ptr<printer> p     = create_printer(params.output_format);
     std::unique_ptr<printer> p_err = create_printer(params.output_format_stderr);
@@ -2014,6 +2062,8 @@ int main(int argc, char ** argv) {
         p_err->print_footer();
     }
 
+    ggml_trace_stop();
+
     llama_backend_free();
 
     return 0;
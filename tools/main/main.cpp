@@ -6,6 +6,7 @@
 #include "llama.h"
 #include "chat.h"
 
+#include <csignal>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
@@ -41,6 +42,9 @@ static std::vector<llama_token> * g_output_tokens;
 static bool is_interacting  = false;
 static bool need_insert_eot = false;
 
+// set by the Ctrl+C handler while tracing, so that the trace is written on the normal exit path
+static volatile sig_atomic_t is_interrupted = 0;
+
 static void print_usage(int argc, char ** argv) {
     (void) argc;
 
@@ -68,6 +72,10 @@ static void sigint_handler(int signo) {
         if (!is_interacting && g_params->interactive) {
             is_interacting  = true;
             need_insert_eot = true;
+        } else if (ggml_trace_enabled() && !is_interrupted) {
+            // ggml_trace_stop() is not async-signal-safe, stop the generation and exit normally instead
+            // a second Ctrl+C exits right away, without the trace
+            is_interrupted = 1;
         } else {
             console::cleanup();
             LOG("\n");
@@ -562,7 +570,7 @@ int main(int argc, char ** argv) {
         embd_inp.push_back(decoder_start_token_id);
     }
 
-    while ((n_remain != 0 && !is_antiprompt) || params.interactive) {
+    while (!is_interrupted && ((n_remain != 0 && !is_antiprompt) || params.interactive)) {
         // predict
         if (!embd.empty()) {
             // Note: (n_ctx - 4) here is to match the logic for commandline prompt handling via
@@ -973,6 +981,10 @@ int main(int argc, char ** argv) {
         }
     }
 
+    if (is_interrupted) {
+        LOG("\nInterrupted by user\n");
+    }
+
     if (!path_session.empty() && params.prompt_cache_all && !params.prompt_cache_ro) {
         LOG("\n%s: saving final output to session file '%s'\n", __func__, path_session.c_str());
         llama_state_save_file(ctx, path_session.c_str(), session_tokens.data(), session_tokens.size());
@@ -988,5 +1000,5 @@ int main(int argc, char ** argv) {
     ggml_threadpool_free_fn(threadpool);
     ggml_threadpool_free_fn(threadpool_batch);
 
-    return 0;
+    return is_interrupted ? 130 : 0;
 }
@@ -0,0 +1,914 @@
+// load generator for llama-server
+//
+// replays a synthetic or recorded workload against the /completion endpoint with streaming enabled and reports the
+// throughput, the time to first token (TTFT), the inter-token latency (ITL) and the goodput under latency SLOs
+//
+// the workload is generated from a seeded RNG and the requests use greedy sampling with ignore_eos, so that the same
+// parameters always send the same prompts and receive the same number of tokens
+
+#include "common.h"
+
+#include <cpp-httplib/httplib.h>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::ordered_json;
+
+using bench_clock = std::chrono::steady_clock;
+
+//
+// length distributions
+//
+
+struct length_dist {
+    enum dist_type {
+        FIXED,
+        UNIFORM,
+        NORMAL,
+        EXPONENTIAL,
+    };
+
+    dist_type type = FIXED;
+
+    double a = 0.0;
+    double b = 0.0;
+
+    int sample(std::mt19937 & rng) const {
+        double v = a;
+        switch (type) {
+            case FIXED:       v = a; break;
+            case UNIFORM:     v = std::uniform_int_distribution<int>((int) a, (int) b)(rng); break;
+            case NORMAL:      v = std::normal_distribution<double>(a, b)(rng); break;
+            case EXPONENTIAL: v = std::exponential_distribution<double>(1.0/a)(rng); break;
+        }
+        return std::max(1, (int) std::lround(v));
+    }
+
+    std::string str() const {
+        char buf[128];
+        switch (type) {
+            case FIXED:       snprintf(buf, sizeof(buf), "%d", (int) a); break;
+            case UNIFORM:     snprintf(buf, sizeof(buf), "uniform:%d:%d", (int) a, (int) b); break;
+            case NORMAL:      snprintf(buf, sizeof(buf), "normal:%g:%g", a, b); break;
+            case EXPONENTIAL: snprintf(buf, sizeof(buf), "exp:%g", a); break;
+        }
+        return buf;
+    }
+};
+
+// N, uniform:MIN:MAX, normal:MEAN:STDDEV or exp:MEAN
+static bool parse_length_dist(const std::string & s, length_dist & dist) {
+    const auto parts = string_split<std::string>(s, ':');
+
+    try {
+        if (parts.size() == 1) {
+            dist.type = length_dist::FIXED;
+            dist.a    = std::stoi(parts[0]);
+        } else if (parts.size() == 3 && parts[0] == "uniform") {
+            dist.type = length_dist::UNIFORM;
+            dist.a    = std::stoi(parts[1]);
+            dist.b    = std::stoi(parts[2]);
+            if (dist.b < dist.a) {
+                return false;
+            }
+        } else if (parts.size() == 3 && parts[0] == "normal") {
+            dist.type = length_dist::NORMAL;
+            dist.a    = std::stod(parts[1]);
+            dist.b    = std::stod(parts[2]);
+        } else if (parts.size() == 2 && parts[0] == "exp") {
+            dist.type = length_dist::EXPONENTIAL;
+            dist.a    = std::stod(parts[1]);
+        } else {
+            return false;
+        }
+    } catch (const std::exception &) {
+        return false;
+    }
+
+    return dist.a > 0 && dist.b >= 0;
+}
+
+//
+// parameters
+//
+
+enum output_formats { MARKDOWN, JSON };
+
+struct bench_params {
+    std::string host    = "127.0.0.1";
+    int         port    = 8080;
+    std::string api_key;
+    int         timeout = 600;
+
+    int    n_requests = 64;
+    int    n_clients  = 16;
+    double rate       = 0.0; // requests per second, 0 sends all requests at once
+    int    n_warmup   = 1;
+
+    length_dist prompt_len = { length_dist::FIXED, 128, 0 };
+    length_dist output_len = { length_dist::FIXED, 64,  0 };
+
+    int prefix_len = 0;
+    int n_prefixes = 1;
+
+    std::string replay_file;
+    double      replay_speed = 1.0;
+
+    bool cache_prompt = true;
+
+    double slo_ttft_ms = 0.0;
+    double slo_tpot_ms = 0.0;
+
+    uint32_t seed = 42;
+
+    output_formats output_format = MARKDOWN;
+    bool           verbose       = false;
+};
+
+static const bench_params bench_params_defaults;
+
+static void print_usage(int /* argc */, char ** argv) {
+    const auto & d = bench_params_defaults;
+
+    printf("usage: %s [options]\n", argv[0]);
+    printf("\n");
+    printf("server:\n");
+    printf("  -h, --help\n");
+    printf("  --host <host>                   server address (default: %s)\n", d.host.c_str());
+    printf("  --port <port>                   server port (default: %d)\n", d.port);
+    printf("  --api-key <key>                 API key sent as bearer token\n");
+    printf("  --timeout <s>                   read timeout of each request (default: %d)\n", d.timeout);
+    printf("\n");
+    printf("workload:\n");
+    printf("  -n, --n-requests <n>            number of requests (default: %d)\n", d.n_requests);
+    printf("  -c, --clients <n>               maximum number of requests in flight (default: %d)\n", d.n_clients);
+    printf("  -r, --rate <req/s>              Poisson arrival rate, 0 sends all requests at once (default: %g)\n", d.rate);
+    printf("  -p, --prompt-len <dist>         prompt length in tokens (default: %s)\n", d.prompt_len.str().c_str());
+    printf("  -g, --output-len <dist>         number of generated tokens (default: %s)\n", d.output_len.str().c_str());
+    printf("                                  <dist> is N, uniform:MIN:MAX, normal:MEAN:STDDEV or exp:MEAN\n");
+    printf("  --prefix-len <n>                tokens of shared prefix prepended to each prompt (default: %d)\n", d.prefix_len);
+    printf("  --n-prefixes <n>                number of distinct shared prefixes (default: %d)\n", d.n_prefixes);
+    printf("  --replay <file>                 replay the requests of a JSONL trace, see README.md\n");
+    printf("  --replay-speed <x>              divide the trace timestamps by x (default: %g)\n", d.replay_speed);
+    printf("  --no-cache-prompt               disable the prompt cache of the server\n");
+    printf("  --warmup <n>                    requests sent before the measurement (default: %d)\n", d.n_warmup);
+    printf("  -s, --seed <n>                  seed of the workload generator (default: %u)\n", d.seed);
+    printf("\n");
+    printf("report:\n");
+    printf("  --slo-ttft <ms>                 TTFT objective of the goodput (default: none)\n");
+    printf("  --slo-tpot <ms>                 time per output token objective of the goodput (default: none)\n");
+    printf("  -o, --output <md|json>          output format printed to stdout (default: %s)\n",
+            d.output_format == JSON ? "json" : "md");
+    printf("  -v, --verbose                   print each request as it completes\n");
+    printf("\n");
+}
+
+static bench_params parse_bench_params(int argc, char ** argv) {
+    bench_params params;
+
+    bool invalid_param = false;
+
+    std::string arg;
+    for (int i = 1; i < argc; i++) {
+        arg = argv[i];
+
+        try {
+            auto next = [&]() -> const char * {
+                if (++i >= argc) {
+                    throw std::invalid_argument("missing value");
+                }
+                return argv[i];
+            };
+
+            if (arg == "-h" || arg == "--help") {
+                print_usage(argc, argv);
+                exit(0);
+            } else if (arg == "--host") {
+                params.host = next();
+            } else if (arg == "--port") {
+                params.port = std::stoi(next());
+            } else if (arg == "--api-key") {
+                params.api_key = next();
+            } else if (arg == "--timeout") {
+                params.timeout = std::stoi(next());
+            } else if (arg == "-n" || arg == "--n-requests") {
+                params.n_requests = std::stoi(next());
+            } else if (arg == "-c" || arg == "--clients") {
+                params.n_clients = std::stoi(next());
+            } else if (arg == "-r" || arg == "--rate") {
+                params.rate = std::stod(next());
+            } else if (arg == "-p" || arg == "--prompt-len") {
+                invalid_param = !parse_length_dist(next(), params.prompt_len);
+            } else if (arg == "-g" || arg == "--output-len") {
+                invalid_param = !parse_length_dist(next(), params.output_len);
+            } else if (arg == "--prefix-len") {
+                params.prefix_len = std::stoi(next());
+            } else if (arg == "--n-prefixes") {
+                params.n_prefixes = std::stoi(next());
+            } else if (arg == "--replay") {
+                params.replay_file = next();
+            } else if (arg == "--replay-speed") {
+                params.replay_speed = std::stod(next());
+            } else if (arg == "--no-cache-prompt") {
+                params.cache_prompt = false;
+            } else if (arg == "--warmup") {
+                params.n_warmup = std::stoi(next());
+            } else if (arg == "-s" || arg == "--seed") {
+                params.seed = (uint32_t) std::stoul(next());
+            } else if (arg == "--slo-ttft") {
+                params.slo_ttft_ms = std::stod(next());
+            } else if (arg == "--slo-tpot") {
+                params.slo_tpot_ms = std::stod(next());
+            } else if (arg == "-o" || arg == "--output") {
+                const std::string fmt = next();
+                if (fmt == "md") {
+                    params.output_format = MARKDOWN;
+                } else if (fmt == "json") {
+                    params.output_format = JSON;
+                } else {
+                    invalid_param = true;
+                }
+            } else if (arg == "-v" || arg == "--verbose") {
+                params.verbose = true;
+            } else {
+                invalid_param = true;
+            }
+        } catch (const std::exception &) {
+            invalid_param = true;
+        }
+
+        if (invalid_param) {
+            break;
+        }
+    }
+
+    if (!invalid_param) {
+        invalid_param = params.n_requests < 1 || params.n_clients < 1 || params.rate < 0.0 || params.n_warmup < 0 ||
+                        params.prefix_len < 0 || params.n_prefixes < 1 || params.replay_speed <= 0.0;
+        if (invalid_param) {
+            arg = "(parameter values)";
+        }
+    }
+
+    if (invalid_param) {
+        fprintf(stderr, "error: invalid parameter for argument: %s\n", arg.c_str());
+        print_usage(argc, argv);
+        exit(1);
+    }
+
+    return params;
+}
+
+//
+// workload
+//
+
+struct bench_request {
+    double t_arrival = 0.0; // seconds after the start of the run
+
+    json prompt;            // text or token ids
+    int  n_prompt  = -1;    // -1 if the prompt is text
+    int  n_predict = 0;
+};
+
+static std::vector<llama_token> random_tokens(std::mt19937 & rng, int n_vocab, int n) {
+    // skip the first ids, these are often control tokens
+    std::uniform_int_distribution<int> dist(std::min(n_vocab - 1, 256), n_vocab - 1);
+
+    std::vector<llama_token> tokens(n);
+    for (auto & t : tokens) {
+        t = dist(rng);
+    }
+    return tokens;
+}
+
+static std::vector<bench_request> generate_requests(const bench_params & params, int n_vocab) {
+    std::mt19937 rng(params.seed);
+
+    std::vector<std::vector<llama_token>> prefixes(params.prefix_len > 0 ? params.n_prefixes : 0);
+    for (auto & prefix : prefixes) {
+        prefix = random_tokens(rng, n_vocab, params.prefix_len);
+    }
+
+    std::exponential_distribution<double> interval(params.rate > 0.0 ? params.rate : 1.0);
+    std::uniform_int_distribution<int>    pick_prefix(0, params.n_prefixes - 1);
+
+    std::vector<bench_request> requests(params.n_requests);
+
+    double t = 0.0;
+    for (auto & req : requests) {
+        std::vector<llama_token> prompt;
+        if (!prefixes.empty()) {
+            prompt = prefixes[pick_prefix(rng)];
+        }
+
+        const auto suffix = random_tokens(rng, n_vocab, params.prompt_len.sample(rng));
+        prompt.insert(prompt.end(), suffix.begin(), suffix.end());
+
+        req.t_arrival = t;
+        req.prompt    = prompt;
+        req.n_prompt  = (int) prompt.size();
+        req.n_predict = params.output_len.sample(rng);
+
+        if (params.rate > 0.0) {
+            t += interval(rng);
+        }
+    }
+
+    return requests;
+}
+
+// one request per line:
+//   {"timestamp": 0.5, "prompt": "text" | "prompt_len": 512, "prefix_id": 0, "output_len": 128}
+// the missing fields are generated as for a synthetic workload
+static bool load_replay(const bench_params & params, int n_vocab, std::vector<bench_request> & requests) {
+    std::ifstream file(params.replay_file);
+    if (!file) {
+        fprintf(stderr, "%s: failed to open %s\n", __func__, params.replay_file.c_str());
+        return false;
+    }
+
+    std::mt19937 rng(params.seed);
+
+    std::vector<std::vector<llama_token>> prefixes;
+
+    std::exponential_distribution<double> interval(params.rate > 0.0 ? params.rate : 1.0);
+
+    double t = 0.0;
+
+    std::string line;
+    for (int il = 1; std::getline(file, line); ++il) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+
+        bench_request req;
+
+        try {
+            const json entry = json::parse(line);
+
+            if (entry.contains("timestamp")) {
+                req.t_arrival = entry.at("timestamp").get<double>() / params.replay_speed;
+            } else {
+                req.t_arrival = t;
+                if (params.rate > 0.0) {
+                    t += interval(rng);
+                }
+            }
+
+            req.n_predict = entry.contains("output_len") ? entry.at("output_len").get<int>() : params.output_len.sample(rng);
+
+            if (entry.contains("prompt")) {
+                req.prompt = entry.at("prompt").get<std::string>();
+            } else {
+                std::vector<llama_token> prompt;
+
+                if (entry.contains("prefix_id")) {
+                    const int id = entry.at("prefix_id").get<int>();
+                    if (id < 0 || params.prefix_len <= 0) {
+                        throw std::invalid_argument("prefix_id requires --prefix-len");
+                    }
+                    while ((int) prefixes.size() <= id) {
+                        prefixes.push_back(random_tokens(rng, n_vocab, params.prefix_len));
+                    }
+                    prompt = prefixes[id];
+                }
+
+                const int n_suffix = entry.contains("prompt_len") ? entry.at("prompt_len").get<int>() : params.prompt_len.sample(rng);
+
+                const auto suffix = random_tokens(rng, n_vocab, n_suffix);
+                prompt.insert(prompt.end(), suffix.begin(), suffix.end());
+
+                req.prompt   = prompt;
+                req.n_prompt = (int) prompt.size();
+            }
+        } catch (const std::exception & e) {
+            fprintf(stderr, "%s: %s:%d: %s\n", __func__, params.replay_file.c_str(), il, e.what());
+            return false;
+        }
+
+        requests.push_back(std::move(req));
+    }
+
+    std::stable_sort(requests.begin(), requests.end(), [](const bench_request & a, const bench_request & b) {
+        return a.t_arrival < b.t_arrival;
+    });
+
+    if (!requests.empty()) {
+        const double t0 = requests.front().t_arrival;
+        for (auto & req : requests) {
+            req.t_arrival -= t0;
+        }
+    }
+
+    return !requests.empty();
+}
+
+//
+// client
+//
+
+struct bench_result {
+    bool        ok = false;
+    std::string error;
+
+    double t_lag_ms = 0.0; // delay between the scheduled arrival and the moment the request was sent
+    double ttft_ms  = 0.0; // from the scheduled arrival to the first token
+    double e2e_ms   = 0.0; // from the scheduled arrival to the last token
+
+    std::vector<double> itl_ms;
+
+    int n_prompt = 0;
+    int n_cached = 0;
+    int n_output = 0;
+
+    double t_end = 0.0;    // seconds after the start of the run
+
+    double tpot_ms() const {
+        return n_output > 1 ? (e2e_ms - ttft_ms) / (n_output - 1) : 0.0;
+    }
+};
+
+static double elapsed_ms(bench_clock::time_point t0, bench_clock::time_point t1) {
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+static httplib::Headers bench_headers(const bench_params & params) {
+    httplib::Headers headers;
+    if (!params.api_key.empty()) {
+        headers.emplace("Authorization", "Bearer " + params.api_key);
+    }
+    return headers;
+}
+
+static bench_result send_request(httplib::Client & cli, const bench_params & params, const bench_request & request,
+        bench_clock::time_point t_sched) {
+    bench_result result;
+
+    json body = {
+        {"prompt",       request.prompt},
+        {"n_predict",    request.n_predict},
+        {"stream",       true},
+        {"ignore_eos",   true},
+        {"cache_prompt", params.cache_prompt},
+        {"temperature",  0.0},
+        {"seed",         params.seed},
+    };
+
+    const auto t_send = bench_clock::now();
+    result.t_lag_ms = elapsed_ms(t_sched, t_send);
+
+    bool first = true;
+    bool done  = false;
+
+    auto t_last = t_send;
+
+    std::string pending;
+    std::string error;
+
+    int n_events = 0;
+
+    auto on_event = [&](const std::string & event) {
+        if (event.rfind("error: ", 0) == 0) {
+            error = event.substr(7);
+            return false;
+        }
+        if (event.rfind("data: ", 0) != 0) {
+            return true;
+        }
+
+        const json data = json::parse(event.substr(6), nullptr, false);
+        if (data.is_discarded()) {
+            error = "invalid event: " + event;
+            return false;
+        }
+
+        const auto t_now = bench_clock::now();
+
+        const bool has_token = (data.contains("content") && !data.at("content").get<std::string>().empty()) ||
+                               (data.contains("tokens") && !data.at("tokens").empty());
+        if (has_token) {
+            if (first) {
+                result.ttft_ms = elapsed_ms(t_sched, t_now);
+                first = false;
+            } else {
+                result.itl_ms.push_back(elapsed_ms(t_last, t_now));
+            }
+            t_last = t_now;
+            n_events++;
+        }
+
+        if (data.value("stop", false)) {
+            result.n_output = data.value("tokens_predicted", n_events);
+            result.n_prompt = data.value("tokens_evaluated", request.n_prompt);
+            if (data.contains("timings")) {
+                result.n_cached = result.n_prompt - data.at("timings").value("prompt_n", result.n_prompt);
+            }
+            done = true;
+        }
+
+        return true;
+    };
+
+    httplib::Request req;
+    req.method  = "POST";
+    req.path    = "/completion";
+    req.headers = bench_headers(params);
+    req.body    = body.dump();
+    req.set_header("Content-Type", "application/json");
+    req.content_receiver = [&](const char * data, size_t len, uint64_t /* offset */, uint64_t /* total */) {
+        pending.append(data, len);
+
+        size_t pos;
+        while ((pos = pending.find("\n\n")) != std::string::npos) {
+            const std::string event = pending.substr(0, pos);
+            pending.erase(0, pos + 2);
+            if (!on_event(event)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    httplib::Response res;
+    httplib::Error    err = httplib::Error::Success;
+
+    const bool sent = cli.send(req, res, err);
+
+    const auto t_end = bench_clock::now();
+
+    if (!error.empty()) {
+        result.error = error;
+    } else if (!sent) {
+        result.error = httplib::to_string(err);
+    } else if (res.status != 200) {
+        result.error = "HTTP " + std::to_string(res.status) + ": " + pending;
+    } else if (!done) {
+        result.error = "stream ended before the final event";
+    } else if (first) {
+        result.error = "no tokens received";
+    } else {
+        result.ok     = true;
+        result.e2e_ms = elapsed_ms(t_sched, t_last);
+    }
+
+    if (!result.ok) {
+        result.e2e_ms = elapsed_ms(t_sched, t_end);
+    }
+
+    return result;
+}
+
+static httplib::Client make_client(const bench_params & params) {
+    httplib::Client cli(params.host, params.port);
+    cli.set_keep_alive(true);
+    cli.set_read_timeout(params.timeout, 0);
+    cli.set_write_timeout(params.timeout, 0);
+    return cli;
+}
+
+static int get_n_vocab(const bench_params & params) {
+    auto cli = make_client(params);
+
+    auto res = cli.Get("/v1/models", bench_headers(params));
+    if (!res || res->status != 200) {
+        fprintf(stderr, "%s: failed to query http://%s:%d/v1/models: %s\n", __func__, params.host.c_str(), params.port,
+                res ? ("HTTP " + std::to_string(res->status)).c_str() : httplib::to_string(res.error()).c_str());
+        return -1;
+    }
+
+    const json data = json::parse(res->body, nullptr, false);
+    try {
+        return data.at("data").at(0).at("meta").at("n_vocab").get<int>();
+    } catch (const std::exception &) {
+        fprintf(stderr, "%s: the server did not report the vocabulary size\n", __func__);
+        return -1;
+    }
+}
+
+//
+// report
+//
+
+struct bench_stats {
+    size_t n    = 0;
+    double mean = 0.0;
+    double p50  = 0.0;
+    double p90  = 0.0;
+    double p99  = 0.0;
+    double max  = 0.0;
+};
+
+static double percentile(const std::vector<double> & sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    const double pos = p/100.0 * (sorted.size() - 1);
+    const size_t i0  = (size_t) pos;
+    const size_t i1  = std::min(i0 + 1, sorted.size() - 1);
+    return sorted[i0] + (pos - i0) * (sorted[i1] - sorted[i0]);
+}
+
+static bench_stats compute_stats(std::vector<double> v) {
+    bench_stats s;
+    if (v.empty()) {
+        return s;
+    }
+
+    std::sort(v.begin(), v.end());
+
+    double sum = 0.0;
+    for (double x : v) {
+        sum += x;
+    }
+
+    s.n    = v.size();
+    s.mean = sum / v.size();
+    s.p50  = percentile(v, 50);
+    s.p90  = percentile(v, 90);
+    s.p99  = percentile(v, 99);
+    s.max  = v.back();
+
+    return s;
+}
+
+static json stats_to_json(const bench_stats & s) {
+    return json {
+        {"mean", s.mean},
+        {"p50",  s.p50},
+        {"p90",  s.p90},
+        {"p99",  s.p99},
+        {"max",  s.max},
+    };
+}
+
+static bool meets_slo(const bench_params & params, const bench_result & r) {
+    if (!r.ok) {
+        return false;
+    }
+    if (params.slo_ttft_ms > 0.0 && r.ttft_ms > params.slo_ttft_ms) {
+        return false;
+    }
+    if (params.slo_tpot_ms > 0.0 && r.tpot_ms() > params.slo_tpot_ms) {
+        return false;
+    }
+    return true;
+}
+
+static void print_report(const bench_params & params, const std::vector<bench_request> & requests,
+        const std::vector<bench_result> & results, double t_total) {
+    int n_ok     = 0;
+    int n_good   = 0;
+    int n_prompt = 0;
+    int n_cached = 0;
+    int n_output = 0;
+    int n_good_output = 0;
+
+    std::vector<double> ttft;
+    std::vector<double> itl;
+    std::vector<double> tpot;
+    std::vector<double> e2e;
+    std::vector<double> lag;
+
+    for (const auto & r : results) {
+        lag.push_back(r.t_lag_ms);
+        if (!r.ok) {
+            continue;
+        }
+
+        n_ok++;
+        n_prompt += r.n_prompt;
+        n_cached += r.n_cached;
+        n_output += r.n_output;
+
+        if (meets_slo(params, r)) {
+            n_good++;
+            n_good_output += r.n_output;
+        }
+
+        ttft.push_back(r.ttft_ms);
+        e2e.push_back(r.e2e_ms);
+        if (r.n_output > 1) {
+            tpot.push_back(r.tpot_ms());
+        }
+        itl.insert(itl.end(), r.itl_ms.begin(), r.itl_ms.end());
+    }
+
+    const int n_failed = (int) results.size() - n_ok;
+
+    const bench_stats s_ttft = compute_stats(ttft);
+    const bench_stats s_itl  = compute_stats(itl);
+    const bench_stats s_tpot = compute_stats(tpot);
+    const bench_stats s_e2e  = compute_stats(e2e);
+    const bench_stats s_lag  = compute_stats(lag);
+
+    const double req_per_s      = n_ok / t_total;
+    const double prompt_per_s   = (n_prompt - n_cached) / t_total;
+    const double output_per_s   = n_output / t_total;
+    const double goodput        = n_good / t_total;
+    const double goodput_tokens = n_good_output / t_total;
+
+    const std::string workload = params.replay_file.empty() ?
+        "prompt " + params.prompt_len.str() + ", output " + params.output_len.str() :
+        "replay " + params.replay_file;
+
+    if (params.output_format == JSON) {
+        json slo = json::object();
+        if (params.slo_ttft_ms > 0.0) {
+            slo["ttft_ms"] = params.slo_ttft_ms;
+        }
+        if (params.slo_tpot_ms > 0.0) {
+            slo["tpot_ms"] = params.slo_tpot_ms;
+        }
+
+        const json report = {
+            {"workload",           workload},
+            {"n_requests",         requests.size()},
+            {"n_clients",          params.n_clients},
+            {"rate",               params.rate},
+            {"prefix_len",         params.prefix_len},
+            {"n_prefixes",         params.n_prefixes},
+            {"seed",               params.seed},
+            {"duration_s",         t_total},
+            {"n_completed",        n_ok},
+            {"n_failed",           n_failed},
+            {"n_prompt_tokens",    n_prompt},
+            {"n_cached_tokens",    n_cached},
+            {"n_output_tokens",    n_output},
+            {"requests_per_s",     req_per_s},
+            {"prompt_tokens_per_s", prompt_per_s},
+            {"output_tokens_per_s", output_per_s},
+            {"slo",                slo},
+            {"n_good",             n_good},
+            {"goodput_requests_per_s", goodput},
+            {"goodput_tokens_per_s",   goodput_tokens},
+            {"ttft_ms",            stats_to_json(s_ttft)},
+            {"itl_ms",             stats_to_json(s_itl)},
+            {"tpot_ms",            stats_to_json(s_tpot)},
+            {"e2e_ms",             stats_to_json(s_e2e)},
+            {"send_lag_ms",        stats_to_json(s_lag)},
+        };
+
+        printf("%s\n", report.dump(4).c_str());
+        return;
+    }
+
+    printf("\n");
+    printf("workload:          %s, %zu requests, %d clients, ", workload.c_str(), requests.size(), params.n_clients);
+    if (!params.replay_file.empty()) {
+        printf("speed %.2fx\n", params.replay_speed);
+    } else if (params.rate > 0.0) {
+        printf("%.2f req/s\n", params.rate);
+    } else {
+        printf("all at once\n");
+    }
+    if (params.prefix_len > 0 && params.replay_file.empty()) {
+        printf("shared prefixes:   %d x %d tokens\n", params.n_prefixes, params.prefix_len);
+    }
+    printf("duration:          %.3f s\n", t_total);
+    printf("requests:          %d completed, %d failed\n", n_ok, n_failed);
+    printf("prompt tokens:     %d (%d cached, %.1f%%)\n", n_prompt, n_cached, n_prompt > 0 ? 100.0*n_cached/n_prompt : 0.0);
+    printf("output tokens:     %d\n", n_output);
+    printf("throughput:        %.2f req/s, %.2f prompt t/s, %.2f output t/s\n", req_per_s, prompt_per_s, output_per_s);
+    if (params.slo_ttft_ms > 0.0 || params.slo_tpot_ms > 0.0) {
+        printf("goodput:           %.2f req/s, %.2f output t/s, %d/%zu requests within TTFT <= %s ms, TPOT <= %s ms\n",
+                goodput, goodput_tokens, n_good, results.size(),
+                params.slo_ttft_ms > 0.0 ? std::to_string((int) params.slo_ttft_ms).c_str() : "inf",
+                params.slo_tpot_ms > 0.0 ? std::to_string((int) params.slo_tpot_ms).c_str() : "inf");
+    }
+    printf("\n");
+
+    printf("| %-12s | %9s | %9s | %9s | %9s | %9s |\n", "metric (ms)", "mean", "p50", "p90", "p99", "max");
+    printf("| %-12s | %9s | %9s | %9s | %9s | %9s |\n", "------------", "--------:", "--------:", "--------:", "--------:", "--------:");
+
+    auto print_row = [](const char * name, const bench_stats & s) {
+        printf("| %-12s | %9.2f | %9.2f | %9.2f | %9.2f | %9.2f |\n", name, s.mean, s.p50, s.p90, s.p99, s.max);
+    };
+
+    print_row("TTFT",     s_ttft);
+    print_row("ITL",      s_itl);
+    print_row("TPOT",     s_tpot);
+    print_row("E2E",      s_e2e);
+    print_row("send lag", s_lag);
+    printf("\n");
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].ok) {
+            fprintf(stderr, "request %zu failed: %s\n", i, results[i].error.c_str());
+            break;
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+    const bench_params params = parse_bench_params(argc, argv);
+
+    const int n_vocab = get_n_vocab(params);
+    if (n_vocab <= 0) {
+        return 1;
+    }
+
+    std::vector<bench_request> requests;
+    if (params.replay_file.empty()) {
+        requests = generate_requests(params, n_vocab);
+    } else if (!load_replay(params, n_vocab, requests)) {
+        return 1;
+    }
+
+    // warm up with a request that does not share anything with the workload
+    if (params.n_warmup > 0) {
+        fprintf(stderr, "%s: warming up with %d requests\n", __func__, params.n_warmup);
+
+        std::mt19937 rng(params.seed ^ 0x5eed);
+
+        auto cli = make_client(params);
+        for (int i = 0; i < params.n_warmup; ++i) {
+            bench_request req;
+            req.prompt    = random_tokens(rng, n_vocab, 16);
+            req.n_prompt  = 16;
+            req.n_predict = 4;
+
+            const auto r = send_request(cli, params, req, bench_clock::now());
+            if (!r.ok) {
+                fprintf(stderr, "%s: warmup request failed: %s\n", __func__, r.error.c_str());
+                return 1;
+            }
+        }
+    }
+
+    fprintf(stderr, "%s: sending %zu requests to http://%s:%d with %d clients\n", __func__, requests.size(),
+            params.host.c_str(), params.port, params.n_clients);
+
+    std::vector<bench_result> results(requests.size());
+
+    std::atomic<size_t> next{0};
+    std::atomic<int>    n_done{0};
+    std::mutex          log_mutex;
+
+    const auto t_start = bench_clock::now();
+
+    // the requests are taken in arrival order, a client that is late sends its request immediately and the lag is
+    // included in the TTFT, so that a saturated client pool does not hide the queueing delay
+    auto worker = [&]() {
+        auto cli = make_client(params);
+
+        while (true) {
+            const size_t i = next.fetch_add(1);
+            if (i >= requests.size()) {
+                break;
+            }
+
+            const auto t_sched = t_start + std::chrono::duration_cast<bench_clock::duration>(
+                    std::chrono::duration<double>(requests[i].t_arrival));
+            std::this_thread::sleep_until(t_sched);
+
+            results[i] = send_request(cli, params, requests[i], t_sched);
+            results[i].t_end = std::chrono::duration<double>(bench_clock::now() - t_start).count();
+
+            const int n = ++n_done;
+
+            if (params.verbose) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                const auto & r = results[i];
+                if (r.ok) {
+                    fprintf(stderr, "[%4d/%4zu] request %4zu: prompt %5d (cached %5d), output %4d, TTFT %8.2f ms, TPOT %7.2f ms, E2E %9.2f ms\n",
+                            n, requests.size(), i, r.n_prompt, r.n_cached, r.n_output, r.ttft_ms, r.tpot_ms(), r.e2e_ms);
+                } else {
+                    fprintf(stderr, "[%4d/%4zu] request %4zu: failed: %s\n", n, requests.size(), i, r.error.c_str());
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::min<int>(params.n_clients, (int) requests.size()); ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    double t_total = 0.0;
+    for (const auto & r : results) {
+        t_total = std::max(t_total, r.t_end);
+    }
+
+    print_report(params, requests, results, t_total);
+
+    const bool all_ok = std::all_of(results.begin(), results.end(), [](const bench_result & r) { return r.ok; });
+
+    return all_ok ? 0 : 1;
+}
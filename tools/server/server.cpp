@@ -10,6 +10,7 @@
 #include "speculative.h"
 #include "mtmd.h"
 #include "mtmd-helper.h"
+#include "vector-index.h"
 
 // mime type for sending response
 #define MIMETYPE_JSON "application/json; charset=utf-8"
@@ -24,8 +25,10 @@
 #include <cstddef>
 #include <cinttypes>
 #include <deque>
+#include <fstream>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <signal.h>
 #include <thread>
 #include <unordered_map>
@@ -77,6 +80,13 @@ enum oaicompat_type {
     OAICOMPAT_TYPE_EMBEDDING,
 };
 
+enum embd_encoding_type {
+    EMBD_ENCODING_TYPE_FLOAT,
+    EMBD_ENCODING_TYPE_BASE64, // raw float32 bytes, base64 encoded
+    EMBD_ENCODING_TYPE_INT8,   // scaled per vector to [-127, 127]
+    EMBD_ENCODING_TYPE_BINARY, // packed sign bits
+};
+
 // https://community.openai.com/t/openai-chat-list-of-error-codes-and-types/357791/11
 enum error_type {
     ERROR_TYPE_INVALID_REQUEST,
@@ -141,6 +151,8 @@ struct slot_params {
     // Embeddings
     int32_t embd_normalize = 2; // (-1=none, 0=max absolute int16, 1=taxicab, 2=Euclidean/L2, >2=p-norm)
 
+    embd_encoding_type embd_encoding = EMBD_ENCODING_TYPE_FLOAT;
+
     json to_json() const {
         std::vector<std::string> samplers;
         samplers.reserve(sampling.samplers.size());
@@ -237,6 +249,9 @@ struct server_task {
     // used by SERVER_TASK_TYPE_METRICS
     bool metrics_reset_bucket = false;
 
+    // time the task was posted to the queue, for the queue wait time
+    int64_t t_queued = 0;
+
     // used by SERVER_TASK_TYPE_SET_LORA
     std::vector<common_adapter_lora_info> set_lora;
 
@@ -612,6 +627,11 @@ struct server_task_result {
         return -1;
     }
     virtual json to_json() = 0;
+    // appends the SSE events of the result to out without building the JSON, returns false if the result must be
+    // sent through to_json() instead
+    virtual bool to_sse(std::string & /* out */) {
+        return false;
+    }
     virtual ~server_task_result() = default;
 };
 
@@ -942,6 +962,48 @@ struct server_task_result_cmpl_final : server_task_result {
     }
 };
 
+// pre-serialized SSE events of the partial results of a streamed request
+// the content, the token, the number of decoded tokens and the creation time are written between the parts:
+//   OAICOMPAT_TYPE_NONE:       parts[0] content parts[1] token parts[2] n_decoded parts[3]
+//   OAICOMPAT_TYPE_COMPLETION: parts[0] content parts[1] created parts[2]
+//   OAICOMPAT_TYPE_CHAT:       parts[0] content parts[1] created parts[2]
+// the output must stay identical to server_sent_event() of server_task_result_cmpl_partial::to_json()
+struct server_sse_template {
+    oaicompat_type oaicompat;
+
+    std::string parts[4];
+
+    server_sse_template(oaicompat_type oaicompat, int index, int id_slot, int n_prompt_tokens, const std::string & model, const std::string & cmpl_id)
+        : oaicompat(oaicompat) {
+        const auto dump = [](const std::string & str) {
+            return json(str).dump(-1, ' ', false, json::error_handler_t::replace);
+        };
+
+        switch (oaicompat) {
+            case OAICOMPAT_TYPE_NONE:
+                parts[0] = "data: {\"index\":" + std::to_string(index) + ",\"content\":\"";
+                parts[1] = "\",\"tokens\":[";
+                parts[2] = "],\"stop\":false,\"id_slot\":" + std::to_string(id_slot) + ",\"tokens_predicted\":";
+                parts[3] = ",\"tokens_evaluated\":" + std::to_string(n_prompt_tokens) + "}\n\n";
+                break;
+            case OAICOMPAT_TYPE_COMPLETION:
+                parts[0] = "data: {\"choices\":[{\"text\":\"";
+                parts[1] = "\",\"index\":" + std::to_string(index) + ",\"logprobs\":null,\"finish_reason\":null}],\"created\":";
+                parts[2] = ",\"model\":" + dump(model) + ",\"system_fingerprint\":" + dump(build_info) +
+                           ",\"object\":\"text_completion\",\"id\":" + dump(cmpl_id) + "}\n\n";
+                break;
+            case OAICOMPAT_TYPE_CHAT:
+                parts[0] = "data: {\"choices\":[{\"finish_reason\":null,\"index\":0,\"delta\":{\"content\":\"";
+                parts[1] = "\"}}],\"created\":";
+                parts[2] = ",\"id\":" + dump(cmpl_id) + ",\"model\":" + dump(model) + ",\"system_fingerprint\":" + dump(build_info) +
+                           ",\"object\":\"chat.completion.chunk\"}\n\n";
+                break;
+            default:
+                break; // to_sse() falls back to to_json()
+        }
+    }
+};
+
 struct server_task_result_cmpl_partial : server_task_result {
     int index = 0;
 
@@ -962,6 +1024,8 @@ struct server_task_result_cmpl_partial : server_task_result {
     std::string     oaicompat_cmpl_id;
     std::vector<common_chat_msg_diff> oaicompat_msg_diffs;
 
+    std::shared_ptr<const server_sse_template> sse;
+
     virtual int get_index() override {
         return index;
     }
@@ -970,6 +1034,80 @@ struct server_task_result_cmpl_partial : server_task_result {
         return false; // in stream mode, partial responses are not considered stop
     }
 
+    // only the plain text tokens use the templates, the first chat chunk, the probabilities, the timings and the
+    // reasoning and tool call deltas go through to_json()
+    virtual bool to_sse(std::string & out) override {
+        if (!sse || !prob_output.probs.empty()) {
+            return false;
+        }
+
+        const size_t n_out = out.size();
+
+        switch (oaicompat) {
+            case OAICOMPAT_TYPE_NONE:
+                {
+                    if (timings.prompt_n > 0 || tokens.size() != 1) {
+                        return false;
+                    }
+
+                    out += sse->parts[0];
+                    if (!json_escape_append(out, content)) {
+                        out.resize(n_out);
+                        return false;
+                    }
+                    out += sse->parts[1];
+                    out += std::to_string(tokens[0]);
+                    out += sse->parts[2];
+                    out += std::to_string(n_decoded);
+                    out += sse->parts[3];
+                } break;
+            case OAICOMPAT_TYPE_COMPLETION:
+                {
+                    if (timings.prompt_n >= 0 || verbose) {
+                        return false;
+                    }
+
+                    out += sse->parts[0];
+                    if (!json_escape_append(out, content)) {
+                        out.resize(n_out);
+                        return false;
+                    }
+                    out += sse->parts[1];
+                    out += std::to_string(std::time(0));
+                    out += sse->parts[2];
+                } break;
+            case OAICOMPAT_TYPE_CHAT:
+                {
+                    if (timings.prompt_n >= 0 || n_decoded == 1) {
+                        return false;
+                    }
+
+                    for (const auto & diff : oaicompat_msg_diffs) {
+                        if (diff.content_delta.empty() || !diff.reasoning_content_delta.empty() || diff.tool_call_index != std::string::npos) {
+                            return false;
+                        }
+                    }
+
+                    const std::string created = std::to_string(std::time(0));
+
+                    for (const auto & diff : oaicompat_msg_diffs) {
+                        out += sse->parts[0];
+                        if (!json_escape_append(out, diff.content_delta)) {
+                            out.resize(n_out);
+                            return false;
+                        }
+                        out += sse->parts[1];
+                        out += created;
+                        out += sse->parts[2];
+                    }
+                } break;
+            default:
+                return false;
+        }
+
+        return true;
+    }
+
     virtual json to_json() override {
         switch (oaicompat) {
             case OAICOMPAT_TYPE_NONE:
@@ -1097,6 +1235,8 @@ struct server_task_result_embd : server_task_result {
 
     int32_t n_tokens;
 
+    embd_encoding_type encoding = EMBD_ENCODING_TYPE_FLOAT;
+
     // OAI-compat fields
     oaicompat_type oaicompat = OAICOMPAT_TYPE_NONE;
 
@@ -1111,19 +1251,38 @@ struct server_task_result_embd : server_task_result {
     }
 
     json to_json_non_oaicompat() {
+        json embd = json::array();
+        for (const auto & e : embedding) {
+            embd.push_back(encode(e));
+        }
+
         return json {
             {"index",     index},
-            {"embedding", embedding},
+            {"embedding", embd},
         };
     }
 
     json to_json_oaicompat() {
         return json {
             {"index",            index},
-            {"embedding",        embedding[0]},
+            {"embedding",        encode(embedding[0])},
             {"tokens_evaluated", n_tokens},
         };
     }
+
+    // the vectors are encoded here, so that the HTTP thread does not have to convert them again
+    json encode(const std::vector<float> & embd) const {
+        switch (encoding) {
+            case EMBD_ENCODING_TYPE_BASE64:
+                return base64::encode(reinterpret_cast<const char *>(embd.data()), embd.size()*sizeof(float));
+            case EMBD_ENCODING_TYPE_INT8:
+                return embd_quantize_i8(embd);
+            case EMBD_ENCODING_TYPE_BINARY:
+                return embd_quantize_binary(embd);
+            default:
+                return embd;
+        }
+    }
 };
 
 struct server_task_result_rerank : server_task_result {
@@ -1223,6 +1382,18 @@ struct server_task_result_metrics : server_task_result {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    uint64_t n_prompt_tokens_total        = 0;
+    uint64_t n_prompt_tokens_cached_total = 0;
+
+    // per slot: KV cache usage and the prompt tokens of the last task that were reused from the cache
+    struct slot_usage {
+        int32_t n_ctx;
+        int32_t n_past;
+        int32_t n_prompt_tokens;
+        int32_t n_prompt_tokens_cached;
+    };
+    std::vector<slot_usage> slots_usage;
+
     // while we can also use std::vector<server_slot> this requires copying the slot object which can be quite messy
     // therefore, we use json to temporarily store the slot.to_json() result
     json slots_data = json::array();
@@ -1249,6 +1420,9 @@ struct server_task_result_metrics : server_task_result {
             { "n_decode_total",                  n_decode_total },
             { "n_busy_slots_total",              n_busy_slots_total },
 
+            { "n_prompt_tokens_total",           n_prompt_tokens_total },
+            { "n_prompt_tokens_cached_total",    n_prompt_tokens_cached_total },
+
             { "slots",                           slots_data },
         };
     }
@@ -1352,10 +1526,18 @@ struct server_slot {
 
     std::string  generated_text;
     llama_tokens generated_tokens;
-    common_chat_msg chat_msg;
+
+    // parses generated_text incrementally, created on the first update of the chat message
+    std::unique_ptr<common_chat_msg_stream_parser> chat_parser;
+
+    // pre-serialized stream events, created with the first partial result
+    std::shared_ptr<const server_sse_template> sse_template;
 
     server_tokens cache_tokens;
 
+    // number of cache_tokens with computed KV cells, updated before building each batch
+    int32_t n_cache_computed = 0;
+
     std::vector<completion_token_output> generated_token_probs;
 
     std::vector<swa_checkpoint> swa_checkpoints;
@@ -1375,17 +1557,20 @@ struct server_slot {
     llama_token sampled;
 
     common_chat_format chat_format = COMMON_CHAT_FORMAT_CONTENT_ONLY;
-    std::vector<std::string> generated_tool_call_ids;
 
     // stats
     size_t n_sent_text        = 0; // number of sent text character
 
+    int64_t t_queued;     // time the task was posted
+    int64_t t_last_token; // time the last token was sampled
     int64_t t_start_process_prompt;
     int64_t t_start_generation;
 
     double t_prompt_processing; // ms
     double t_token_generation;  // ms
 
+    int32_t n_prompt_tokens_cached = 0; // prompt tokens reused from the cache
+
     std::function<void(int)> callback_on_release;
 
     // Speculative decoding stats
@@ -1409,9 +1594,9 @@ struct server_slot {
 
         generated_tokens.clear();
         generated_token_probs.clear();
-        chat_msg = {};
+        chat_parser.reset();
+        sse_template.reset();
         json_schema = json();
-        generated_tool_call_ids.clear();
 
         // clear speculative decoding stats
         n_draft_total = 0;
@@ -1428,10 +1613,11 @@ struct server_slot {
 
     // if the context does not have a memory module then all embeddings have to be computed within a single ubatch
     // also we cannot split if the pooling would require any past tokens
+    // note: models with a memory module are causal, so rank pooling uses the last token, same as last pooling
     bool can_split() const {
         return
             !need_embd() ||
-            (llama_get_memory(ctx) && llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_LAST);
+            (llama_get_memory(ctx) && (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_LAST || llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_RANK));
     }
 
     bool can_batch_with(server_slot & other_slot) const {
@@ -1503,18 +1689,14 @@ struct server_slot {
     }
 
     const common_chat_msg & update_chat_msg(std::vector<common_chat_msg_diff> & diffs) {
-        auto previous_msg = chat_msg;
+        if (!chat_parser) {
+            chat_parser = std::make_unique<common_chat_msg_stream_parser>(params.oaicompat_chat_syntax, gen_tool_call_id);
+        }
         SRV_DBG("Parsing chat message: %s\n", generated_text.c_str());
-        auto new_msg = common_chat_parse(
+        diffs = chat_parser->update(
             generated_text,
-            /* is_partial= */ stop != STOP_TYPE_EOS,
-            params.oaicompat_chat_syntax);
-        if (!new_msg.empty()) {
-            new_msg.ensure_tool_call_ids_set(generated_tool_call_ids, gen_tool_call_id);
-            chat_msg = new_msg;
-            diffs = common_chat_msg_diff::compute_diffs(previous_msg, new_msg.empty() ? previous_msg : new_msg);
-        }
-        return chat_msg;
+            /* is_partial= */ stop != STOP_TYPE_EOS);
+        return chat_parser->msg();
     }
 
     size_t find_stopping_strings(const std::string & text, const size_t last_token_size, bool is_full_stop) {
@@ -1594,6 +1776,57 @@ struct server_slot {
     }
 };
 
+// index of the calling thread, used to spread the updates of the histograms over their shards
+static int server_thread_index() {
+    static std::atomic<int> n_threads = 0;
+    thread_local const int index = n_threads.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+// latency histogram, exported in the Prometheus format with the bounds of the buckets in seconds
+// the threads record their observations without locking, each one in its own shard, and the shards are merged on scrape
+struct server_histogram {
+    static constexpr double bounds[] = {
+        0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0,
+    };
+    static constexpr int n_bounds = sizeof(bounds)/sizeof(bounds[0]);
+    static constexpr int n_shards = 16;
+
+    struct alignas(64) shard {
+        std::atomic<uint64_t> count[n_bounds + 1] = {}; // the last one is +Inf
+        std::atomic<uint64_t> sum_us = 0;
+    };
+
+    shard shards[n_shards];
+
+    void observe_us(int64_t t_us) {
+        t_us = std::max<int64_t>(t_us, 0);
+
+        const int i = std::lower_bound(bounds, bounds + n_bounds, t_us/1e6) - bounds;
+
+        shard & cur = shards[server_thread_index() % n_shards];
+        cur.count[i].fetch_add(1,    std::memory_order_relaxed);
+        cur.sum_us  .fetch_add(t_us, std::memory_order_relaxed);
+    }
+
+    // the cumulative bucket counts, the last one is the total count
+    std::vector<uint64_t> collect(double & sum) const {
+        std::vector<uint64_t> res(n_bounds + 1, 0);
+        uint64_t sum_us = 0;
+        for (const auto & cur : shards) {
+            for (int i = 0; i <= n_bounds; ++i) {
+                res[i] += cur.count[i].load(std::memory_order_relaxed);
+            }
+            sum_us += cur.sum_us.load(std::memory_order_relaxed);
+        }
+        for (int i = 1; i <= n_bounds; ++i) {
+            res[i] += res[i - 1];
+        }
+        sum = sum_us/1e6;
+        return res;
+    }
+};
+
 struct server_metrics {
     int64_t t_start = 0;
 
@@ -1613,11 +1846,28 @@ struct server_metrics {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    uint64_t n_prompt_tokens_total        = 0;
+    uint64_t n_prompt_tokens_cached_total = 0; // prompt tokens reused from the slot cache
+
+    // latencies, these are updated by the HTTP threads too
+    server_histogram queue_wait;    // from posting the task to launching it in a slot
+    server_histogram ttft;          // from posting the task to the first sampled token
+    server_histogram inter_token;   // between consecutive tokens of a slot
+    server_histogram tokenize;      // tokenization of the prompts of a request
+    server_histogram prefill_batch; // llama_decode() of a batch with prompt tokens
+    server_histogram decode_batch;  // llama_decode() of a batch with generated tokens only
+    server_histogram sampling;      // sampling of a token
+    server_histogram detokenize;    // conversion of a token to text, stop strings and partial response
+    server_histogram serialize;     // conversion of a result to JSON and writing it to the HTTP connection
+
     void init() {
         t_start = ggml_time_us();
     }
 
     void on_prompt_eval(const server_slot & slot) {
+        n_prompt_tokens_total        += slot.n_prompt_tokens;
+        n_prompt_tokens_cached_total += slot.n_prompt_tokens_cached;
+
         n_prompt_tokens_processed_total += slot.n_prompt_tokens_processed;
         n_prompt_tokens_processed       += slot.n_prompt_tokens_processed;
         t_prompt_processing             += slot.t_prompt_processing;
@@ -1679,6 +1929,9 @@ struct server_queue {
             cleanup_pending_task(task.id_target);
         }
         const int task_id = task.id;
+        if (task.t_queued == 0) {
+            task.t_queued = ggml_time_us();
+        }
         QUE_DBG("new task, id = %d, front = %d\n", task_id, front);
         if (front) {
             queue_tasks.push_front(std::move(task));
@@ -1700,6 +1953,9 @@ struct server_queue {
             if (task.type == SERVER_TASK_TYPE_CANCEL) {
                 cleanup_pending_task(task.id_target);
             }
+            if (task.t_queued == 0) {
+                task.t_queued = ggml_time_us();
+            }
             QUE_DBG("new task, id = %d/%d, front = %d\n", task.id, (int) tasks.size(), front);
             if (front) {
                 queue_tasks.push_front(std::move(task));
@@ -1820,107 +2076,178 @@ private:
     }
 };
 
-struct server_response {
-    bool running = true;
+// unbounded single producer, single consumer queue
+template <typename T>
+struct spsc_queue {
+    struct node {
+        T value;
+        std::atomic<node *> next{nullptr};
+    };
+
+    node * head; // owned by the consumer, the value of head is already consumed
+    node * tail; // owned by the producer
+
+    spsc_queue() {
+        head = tail = new node();
+    }
+
+    ~spsc_queue() {
+        while (head) {
+            node * next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+        }
+    }
+
+    spsc_queue(const spsc_queue &) = delete;
+    spsc_queue & operator=(const spsc_queue &) = delete;
+
+    void push(T && value) {
+        node * n = new node();
+        n->value = std::move(value);
+        tail->next.store(n, std::memory_order_release);
+        tail = n;
+    }
+
+    bool pop(T & value) {
+        node * next = head->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        value = std::move(next->value);
+        delete head;
+        head = next;
+        return true;
+    }
+
+    bool empty() const {
+        return head->next.load(std::memory_order_acquire) == nullptr;
+    }
+};
+
+// results of the tasks of one request
+// the server thread is the only producer and the HTTP thread of the request the only consumer, so that the results
+// of a request do not go through a lock shared with the other requests and only wake up their own HTTP thread
+struct server_result_channel {
+    spsc_queue<server_task_result_ptr> queue;
+
+    // the consumer waits on the condition variable only when the queue is empty
+    std::atomic<bool> waiting{false};
 
-    // for keeping track of all tasks waiting for the result
-    std::unordered_set<int> waiting_task_ids;
+    std::mutex              mutex;
+    std::condition_variable cv;
+};
+
+struct server_response {
+    std::atomic<bool> running{true};
 
-    // the main result queue (using ptr for polymorphism)
-    std::vector<server_task_result_ptr> queue_results;
+    // the channel of each task waiting for a result, the tasks of a request share the same channel
+    std::unordered_map<int, std::shared_ptr<server_result_channel>> channels;
 
+    // protects channels, the results themselves are passed through the channel queues
     std::mutex mutex_results;
-    std::condition_variable condition_results;
 
     // add the id_task to the list of tasks waiting for response
     void add_waiting_task_id(int id_task) {
-        SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", id_task, (int) waiting_task_ids.size());
+        SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", id_task, (int) channels.size());
 
         std::unique_lock<std::mutex> lock(mutex_results);
-        waiting_task_ids.insert(id_task);
+        channels[id_task] = std::make_shared<server_result_channel>();
     }
 
     void add_waiting_tasks(const std::vector<server_task> & tasks) {
+        auto channel = std::make_shared<server_result_channel>();
+
         std::unique_lock<std::mutex> lock(mutex_results);
 
         for (const auto & task : tasks) {
-            SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", task.id, (int) waiting_task_ids.size());
-            waiting_task_ids.insert(task.id);
+            SRV_DBG("add task %d to waiting list. current waiting = %d (before add)\n", task.id, (int) channels.size());
+            channels[task.id] = channel;
         }
     }
 
     // when the request is finished, we can remove task associated with it
+    // the pending results are released with the channel
     void remove_waiting_task_id(int id_task) {
-        SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_task_ids.size());
+        SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) channels.size());
 
         std::unique_lock<std::mutex> lock(mutex_results);
-        waiting_task_ids.erase(id_task);
-        // make sure to clean up all pending results
-        queue_results.erase(
-            std::remove_if(queue_results.begin(), queue_results.end(), [id_task](const server_task_result_ptr & res) {
-                return res->id == id_task;
-            }),
-            queue_results.end());
+        channels.erase(id_task);
     }
 
     void remove_waiting_task_ids(const std::unordered_set<int> & id_tasks) {
         std::unique_lock<std::mutex> lock(mutex_results);
 
         for (const auto & id_task : id_tasks) {
-            SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) waiting_task_ids.size());
-            waiting_task_ids.erase(id_task);
+            SRV_DBG("remove task %d from waiting list. current waiting = %d (before remove)\n", id_task, (int) channels.size());
+            channels.erase(id_task);
         }
     }
 
-    // This function blocks the thread until there is a response for one of the id_tasks
-    server_task_result_ptr recv(const std::unordered_set<int> & id_tasks) {
-        while (true) {
-            std::unique_lock<std::mutex> lock(mutex_results);
-            condition_results.wait(lock, [&]{
-                if (!running) {
-                    SRV_DBG("%s : queue result stop\n", __func__);
-                    std::terminate(); // we cannot return here since the caller is HTTP code
-                }
-                return !queue_results.empty();
-            });
+    // wait at most timeout for a response for one of the id_tasks
+    // if timeout is reached, nullptr is returned
+    server_task_result_ptr recv_for(const std::unordered_set<int> & id_tasks, std::chrono::microseconds timeout) {
+        const auto t_end = std::chrono::steady_clock::now() + timeout;
 
-            for (size_t i = 0; i < queue_results.size(); i++) {
-                if (id_tasks.find(queue_results[i]->id) != id_tasks.end()) {
-                    server_task_result_ptr res = std::move(queue_results[i]);
-                    queue_results.erase(queue_results.begin() + i);
-                    return res;
+        std::shared_ptr<server_result_channel> channel;
+        {
+            std::unique_lock<std::mutex> lock(mutex_results);
+            for (const auto & id_task : id_tasks) {
+                auto it = channels.find(id_task);
+                if (it != channels.end()) {
+                    channel = it->second;
+                    break;
                 }
             }
         }
 
-        // should never reach here
-    }
+        if (!channel) {
+            // none of the tasks is waiting, no result can arrive
+            std::this_thread::sleep_until(t_end);
+            return nullptr;
+        }
 
-    // same as recv(), but have timeout in seconds
-    // if timeout is reached, nullptr is returned
-    server_task_result_ptr recv_with_timeout(const std::unordered_set<int> & id_tasks, int timeout) {
+        server_task_result_ptr res;
         while (true) {
-            std::unique_lock<std::mutex> lock(mutex_results);
-
-            for (int i = 0; i < (int) queue_results.size(); i++) {
-                if (id_tasks.find(queue_results[i]->id) != id_tasks.end()) {
-                    server_task_result_ptr res = std::move(queue_results[i]);
-                    queue_results.erase(queue_results.begin() + i);
+            while (channel->queue.pop(res)) {
+                if (id_tasks.find(res->id) != id_tasks.end()) {
                     return res;
                 }
             }
 
-            std::cv_status cr_res = condition_results.wait_for(lock, std::chrono::seconds(timeout));
             if (!running) {
                 SRV_DBG("%s : queue result stop\n", __func__);
                 std::terminate(); // we cannot return here since the caller is HTTP code
             }
-            if (cr_res == std::cv_status::timeout) {
+
+            if (std::chrono::steady_clock::now() >= t_end) {
                 return nullptr;
             }
+
+            std::unique_lock<std::mutex> lock(channel->mutex);
+            channel->waiting.store(true);
+            // pairs with the fence in send(): either the producer sees waiting or we see the new result
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (channel->queue.empty() && running) {
+                channel->cv.wait_until(lock, t_end);
+            }
+            channel->waiting.store(false, std::memory_order_relaxed);
         }
+    }
+
+    // same as recv_for(), but have timeout in seconds
+    server_task_result_ptr recv_with_timeout(const std::unordered_set<int> & id_tasks, int timeout) {
+        return recv_for(id_tasks, std::chrono::seconds(timeout));
+    }
 
-        // should never reach here
+    // This function blocks the thread until there is a response for one of the id_tasks
+    server_task_result_ptr recv(const std::unordered_set<int> & id_tasks) {
+        while (true) {
+            server_task_result_ptr res = recv_with_timeout(id_tasks, HTTP_POLLING_SECONDS);
+            if (res) {
+                return res;
+            }
+        }
     }
 
     // single-task version of recv()
@@ -1930,25 +2257,41 @@ struct server_response {
     }
 
     // Send a new result to a waiting id_task
+    // must only be called from the server thread
     void send(server_task_result_ptr && result) {
         SRV_DBG("sending result for task id = %d\n", result->id);
 
-        std::unique_lock<std::mutex> lock(mutex_results);
-        for (const auto & id_task : waiting_task_ids) {
-            if (result->id == id_task) {
-                SRV_DBG("task id = %d pushed to result queue\n", result->id);
-
-                queue_results.emplace_back(std::move(result));
-                condition_results.notify_all();
+        std::shared_ptr<server_result_channel> channel;
+        {
+            std::unique_lock<std::mutex> lock(mutex_results);
+            auto it = channels.find(result->id);
+            if (it == channels.end()) {
                 return;
             }
+            channel = it->second;
+        }
+
+        SRV_DBG("task id = %d pushed to result queue\n", result->id);
+
+        channel->queue.push(std::move(result));
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (channel->waiting.load(std::memory_order_relaxed)) {
+            // taking the mutex ensures that the consumer is either before its check of the queue or already waiting
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            channel->cv.notify_one();
         }
     }
 
     // terminate the waiting loop
     void terminate() {
         running = false;
-        condition_results.notify_all();
+
+        std::unique_lock<std::mutex> lock(mutex_results);
+        for (auto & it : channels) {
+            std::lock_guard<std::mutex> lock_channel(it.second->mutex);
+            it.second->cv.notify_all();
+        }
     }
 };
 
@@ -1994,7 +2337,20 @@ struct server_context {
     common_chat_templates_ptr chat_templates;
     oaicompat_parser_options  oai_parser_opt;
 
+    // vector index for the /index endpoints
+    std::unique_ptr<common_vector_index> vindex;
+    std::shared_mutex vindex_mutex;
+    bool vindex_dirty = false; // vectors were added since the index was loaded
+
     ~server_context() {
+        if (vindex && vindex_dirty && !params_base.index_file.empty()) {
+            if (vindex->save(params_base.index_file)) {
+                SRV_INF("saved vector index to '%s'\n", params_base.index_file.c_str());
+            } else {
+                SRV_ERR("failed to save vector index to '%s'\n", params_base.index_file.c_str());
+            }
+        }
+
         mtmd_free(mctx);
 
         // Clear any sampling context
@@ -2126,6 +2482,52 @@ struct server_context {
             }
         }
 
+        if (params_base.embedding && llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_NONE && llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_RANK) {
+            if (!load_vector_index()) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool load_vector_index() {
+        const int32_t n_embd = llama_model_n_embd(model);
+
+        const std::string & fname = params_base.index_file;
+        if (!fname.empty() && std::ifstream(fname).good()) {
+            // a loaded index is memory-mapped and cannot be extended
+            vindex = common_vector_index::load(fname);
+            if (!vindex) {
+                SRV_ERR("failed to load vector index, '%s'\n", fname.c_str());
+                return false;
+            }
+            if (vindex->n_embd() != n_embd) {
+                SRV_ERR("vector index '%s' has n_embd = %d, but the model has n_embd = %d\n", fname.c_str(), vindex->n_embd(), n_embd);
+                return false;
+            }
+            if (vindex->hash_model() != common_vector_index_model_hash(ctx)) {
+                SRV_ERR("vector index '%s' was built with a different model or pooling type\n", fname.c_str());
+                return false;
+            }
+            if (params_base.index_type != common_vector_index_type_name(vindex->type())) {
+                SRV_WRN("vector index '%s' is stored as %s, --index-type %s is ignored\n", fname.c_str(),
+                        common_vector_index_type_name(vindex->type()), params_base.index_type.c_str());
+            }
+            SRV_INF("loaded %s vector index with %" PRId64 " vectors, '%s'\n", common_vector_index_type_name(vindex->type()), vindex->size(), fname.c_str());
+            return true;
+        }
+
+        common_vector_index_type type;
+        if (!common_vector_index_type_from_name(params_base.index_type, type)) {
+            SRV_ERR("invalid vector index type '%s'\n", params_base.index_type.c_str());
+            return false;
+        }
+
+        // a new index is saved to index_file (if set) on shutdown
+        vindex = std::make_unique<common_vector_index>(n_embd, type);
+        vindex->set_hash(common_vector_index_model_hash(ctx), 0);
+
         return true;
     }
 
@@ -2275,7 +2677,11 @@ struct server_context {
 
     bool launch_slot_with_task(server_slot & slot, server_task && task) {
         slot.reset();
+        slot.t_queued      = task.t_queued;
         slot.id_task       = task.id;
+
+        metrics.queue_wait.observe_us(ggml_time_us() - task.t_queued);
+
         slot.index         = task.index;
         slot.task_type     = task.type;
         slot.params        = std::move(task.params);
@@ -2325,6 +2731,81 @@ struct server_context {
         return true;
     }
 
+    // with a unified KV cache, a slot can reuse the KV cells of a prompt prefix computed by another slot
+    // (e.g. the query shared by all documents of a rerank request) - the cells are shared, no data is copied
+    // disabled when KV cells can be shifted, since that would move the positions for all slots sharing them
+    // only embedding and rerank slots share their cells, completions keep their own KV
+    bool can_share_prefix() const {
+        return
+            params_base.kv_unified &&
+            !params_base.ctx_shift &&
+            params_base.n_cache_reuse == 0 &&
+            mctx == nullptr &&
+            llama_get_memory(ctx) &&
+            llama_memory_can_shift(llama_get_memory(ctx)) && // not recurrent
+            llama_model_n_swa(model) == 0;
+    }
+
+    // length of the prefix of the slot prompt that another slot can provide
+    // n_computed is the part with computed KV, n_pending includes the tokens in the batch that is being built
+    server_slot * find_prefix_slot(const server_slot & slot, int32_t & n_computed, int32_t & n_pending) {
+        server_slot * res = nullptr;
+
+        n_computed = 0;
+        n_pending  = 0;
+
+        for (auto & other : slots) {
+            if (other.id == slot.id || !other.need_embd()) {
+                continue;
+            }
+
+            const int32_t n_common = (int32_t) other.cache_tokens.get_common_prefix(slot.prompt_tokens);
+
+            n_pending = std::max(n_pending, n_common);
+
+            if (std::min(n_common, other.n_cache_computed) > n_computed) {
+                n_computed = std::min(n_common, other.n_cache_computed);
+                res = &other;
+            }
+        }
+
+        return res;
+    }
+
+    void share_prefix(server_slot & slot) {
+        int32_t n_computed;
+        int32_t n_pending;
+
+        server_slot * src = find_prefix_slot(slot, n_computed, n_pending);
+
+        // keep at least one token to evaluate
+        n_computed = std::min(n_computed, slot.n_prompt_tokens - 1);
+
+        if (src == nullptr || n_computed <= slot.n_past) {
+            return;
+        }
+
+        llama_memory_t mem = llama_get_memory(ctx);
+
+        if (llama_memory_seq_pos_max(mem, src->id) < n_computed - 1) {
+            SLT_WRN(slot, "slot %d does not have the KV cells for its cached tokens, pos_max = %d\n", src->id, llama_memory_seq_pos_max(mem, src->id));
+            return;
+        }
+
+        llama_memory_seq_rm(mem, slot.id, -1, -1);
+        llama_memory_seq_cp(mem, src->id, slot.id, 0, n_computed);
+
+        const llama_tokens & prompt = slot.prompt_tokens.get_text_tokens();
+
+        slot.cache_tokens.clear();
+        slot.cache_tokens.insert(llama_tokens(prompt.begin(), prompt.begin() + n_computed));
+        slot.n_cache_computed = n_computed;
+
+        SLT_INF(slot, "sharing %d prompt tokens with slot %d\n", n_computed, src->id);
+
+        slot.n_past = n_computed;
+    }
+
     void kv_cache_clear() {
         SRV_DBG("%s", "clearing KV cache\n");
 
@@ -2581,6 +3062,12 @@ struct server_context {
 
         slot.update_chat_msg(res->oaicompat_msg_diffs);
 
+        if (!slot.sse_template) {
+            slot.sse_template = std::make_shared<server_sse_template>(
+                    res->oaicompat, res->index, res->id_slot, res->n_prompt_tokens, res->oaicompat_model, res->oaicompat_cmpl_id);
+        }
+        res->sse = slot.sse_template;
+
         // populate res.probs_output
         if (slot.params.sampling.n_probs > 0) {
             res->prob_output = tkn; // copy the token probs
@@ -2648,23 +3135,36 @@ struct server_context {
         res->id        = slot.id_task;
         res->index     = slot.index;
         res->n_tokens  = slot.n_prompt_tokens;
+        res->encoding  = slot.params.embd_encoding;
         res->oaicompat = slot.params.oaicompat;
 
         const int n_embd = llama_model_n_embd(model);
 
-        std::vector<float> embd_res(n_embd, 0.0f);
+        // pooled embeddings are stored per sequence - no need to look for the slot tokens in the batch
+        if (llama_pooling_type(slot.ctx) != LLAMA_POOLING_TYPE_NONE) {
+            std::vector<float> embd_res(n_embd, 0.0f);
+
+            const float * embd = llama_get_embeddings_seq(ctx, slot.id);
+            if (embd == nullptr) {
+                SLT_ERR(slot, "failed to get embeddings, seq_id = %d\n", slot.id);
+            } else {
+                common_embd_normalize(embd, embd_res.data(), n_embd, slot.params.embd_normalize);
+            }
+
+            res->embedding.push_back(std::move(embd_res));
+
+            SLT_DBG(slot, "%s", "sending embeddings\n");
+
+            queue_results.send(std::move(res));
+            return;
+        }
 
         for (int i = 0; i < batch.n_tokens; ++i) {
             if (!batch.logits[i] || batch.seq_id[i][0] != slot.id) {
                 continue;
             }
 
-            const float * embd = nullptr;
-            if (llama_pooling_type(slot.ctx) == LLAMA_POOLING_TYPE_NONE) {
-                embd = llama_get_embeddings_ith(ctx, i);
-            } else {
-                embd = llama_get_embeddings_seq(ctx, batch.seq_id[i][0]);
-            }
+            const float * embd = llama_get_embeddings_ith(ctx, i);
 
             if (embd == nullptr) {
                 SLT_ERR(slot, "failed to get embeddings, token = %d, seq_id = %d\n", batch.token[i], batch.seq_id[i][0]);
@@ -2673,14 +3173,8 @@ struct server_context {
                 continue;
             }
 
-            // normalize only when there is pooling
-            if (llama_pooling_type(slot.ctx) != LLAMA_POOLING_TYPE_NONE) {
-                common_embd_normalize(embd, embd_res.data(), n_embd, slot.params.embd_normalize);
-                res->embedding.push_back(embd_res);
-                break;
-            } else {
-                res->embedding.emplace_back(embd, embd + n_embd);
-            }
+            // no normalization without pooling
+            res->embedding.emplace_back(embd, embd + n_embd);
         }
 
         SLT_DBG(slot, "%s", "sending embeddings\n");
@@ -2777,18 +3271,45 @@ struct server_context {
     }
 
     // receive the results from task(s), in stream mode
+    // the results that are already available, or that arrive within --stream-flush-ms of the previous flush, are passed
+    // to result_handler before calling flush once for all of them
     void receive_cmpl_results_stream(
             const std::unordered_set<int> & id_tasks,
             const std::function<bool(server_task_result_ptr&)> & result_handler,
             const std::function<void(json)> & error_handler,
-            const std::function<bool()> & is_connection_closed) {
+            const std::function<bool()> & is_connection_closed,
+            const std::function<bool()> & flush) {
+        const int64_t t_flush_interval_us = 1000ll*params_base.stream_flush_ms;
+
+        int64_t t_last_flush = ggml_time_us();
+        bool    pending      = false;
+
         size_t n_finished = 0;
         while (true) {
-            server_task_result_ptr result = queue_results.recv_with_timeout(id_tasks, HTTP_POLLING_SECONDS);
+            server_task_result_ptr result;
 
-            if (is_connection_closed()) {
-                cancel_tasks(id_tasks);
-                return;
+            if (pending) {
+                const int64_t t_wait_us = std::max<int64_t>(0, t_last_flush + t_flush_interval_us - ggml_time_us());
+
+                result = queue_results.recv_for(id_tasks, std::chrono::microseconds(t_wait_us));
+                if (result == nullptr) {
+                    // a failed write means that the connection is closed
+                    if (!flush()) {
+                        cancel_tasks(id_tasks);
+                        return;
+                    }
+                    pending      = false;
+                    t_last_flush = ggml_time_us();
+                    continue;
+                }
+            } else {
+                result = queue_results.recv_with_timeout(id_tasks, HTTP_POLLING_SECONDS);
+
+                // polling the connection costs a system call, it is only needed while no result is written
+                if (result == nullptr && is_connection_closed()) {
+                    cancel_tasks(id_tasks);
+                    return;
+                }
             }
 
             if (result == nullptr) {
@@ -2809,6 +3330,7 @@ struct server_context {
                 cancel_tasks(id_tasks);
                 break;
             }
+            pending = true;
 
             if (result->is_stop()) {
                 if (++n_finished == id_tasks.size()) {
@@ -2873,9 +3395,13 @@ struct server_context {
                     int n_idle_slots       = 0;
                     int n_processing_slots = 0;
 
+                    std::vector<server_task_result_metrics::slot_usage> slots_usage;
+
                     for (server_slot & slot : slots) {
                         json slot_data = slot.to_json();
 
+                        slots_usage.push_back({ slot.n_ctx, slot.n_past, slot.n_prompt_tokens, slot.n_prompt_tokens_cached });
+
                         if (slot.is_processing()) {
                             n_processing_slots++;
                         } else {
@@ -2909,6 +3435,11 @@ struct server_context {
                     res->n_decode_total          = metrics.n_decode_total;
                     res->n_busy_slots_total      = metrics.n_busy_slots_total;
 
+                    res->n_prompt_tokens_total        = metrics.n_prompt_tokens_total;
+                    res->n_prompt_tokens_cached_total = metrics.n_prompt_tokens_cached_total;
+
+                    res->slots_usage = std::move(slots_usage);
+
                     if (task.metrics_reset_bucket) {
                         metrics.reset_bucket();
                     }
@@ -3119,6 +3650,10 @@ struct server_context {
         // start populating the batch for this iteration
         common_batch_clear(batch);
 
+        for (auto & slot : slots) {
+            slot.n_cache_computed = slot.cache_tokens.size();
+        }
+
         // track if given slot can be batched with slots already in the batch
         server_slot * slot_batched = nullptr;
 
@@ -3150,6 +3685,9 @@ struct server_context {
                     slot.n_ctx, slot.n_past, (int) slot.cache_tokens.size(), slot.truncated);
         }
 
+        // the sampled tokens come first in the batch, the prompt tokens after them
+        const int32_t n_tokens_gen = batch.n_tokens;
+
         // process in chunks of params.n_batch
         int32_t n_batch  = llama_n_batch(ctx);
         int32_t n_ubatch = llama_n_ubatch(ctx);
@@ -3170,6 +3708,18 @@ struct server_context {
                 if (slot.state == SLOT_STATE_PROCESSING_PROMPT || slot.state == SLOT_STATE_STARTED) {
                     auto & prompt_tokens = slot.prompt_tokens;
 
+                    // embeddings and reranking are throughput bound - if another slot is about to compute a prefix of this prompt
+                    // in the current batch, wait for it instead of computing the prefix twice
+                    if (slot.state == SLOT_STATE_STARTED && slot.need_embd() && slot.params.cache_prompt && can_share_prefix()) {
+                        int32_t n_computed;
+                        int32_t n_pending;
+                        find_prefix_slot(slot, n_computed, n_pending);
+
+                        if (n_pending > n_computed && n_pending > (int32_t) slot.cache_tokens.get_common_prefix(prompt_tokens)) {
+                            continue;
+                        }
+                    }
+
                     // TODO: maybe move branch to outside of this loop in the future
                     if (slot.state == SLOT_STATE_STARTED) {
                         slot.t_start_process_prompt = ggml_time_us();
@@ -3323,6 +3873,10 @@ struct server_context {
 
                                     SLT_DBG(slot, "after context reuse, new slot.n_past = %d\n", slot.n_past);
                                 }
+
+                                if (slot.need_embd() && can_share_prefix()) {
+                                    share_prefix(slot);
+                                }
                             } else {
                                 // if we don't cache the prompt, we have to remove the entire KV cache
                                 slot.n_past = 0;
@@ -3400,6 +3954,7 @@ struct server_context {
                         }
 
                         slot.n_prompt_tokens_processed = 0;
+                        slot.n_prompt_tokens_cached    = slot.n_past;
                     }
 
                     if (!slot.can_split()) {
@@ -3420,8 +3975,11 @@ struct server_context {
 
                     SLT_INF(slot, "kv cache rm [%d, end)\n", slot.n_past);
 
+                    slot.n_prompt_tokens_cached = std::min(slot.n_prompt_tokens_cached, slot.n_past);
+
                     // remove the non-common part from the cache
                     slot.cache_tokens.keep_first(slot.n_past);
+                    slot.n_cache_computed = std::min<int32_t>(slot.n_cache_computed, slot.n_past);
 
                     // check if we should process the image
                     if (slot.n_past < slot.n_prompt_tokens && slot.prompt_tokens[slot.n_past] == LLAMA_TOKEN_NULL) {
@@ -3532,8 +4090,16 @@ struct server_context {
                 batch.logits   + i,
             };
 
+            const int64_t t_decode_start = ggml_time_us();
+
             const int ret = llama_decode(ctx, batch_view);
 
+            if (i + n_tokens > n_tokens_gen) {
+                metrics.prefill_batch.observe_us(ggml_time_us() - t_decode_start);
+            } else {
+                metrics.decode_batch.observe_us(ggml_time_us() - t_decode_start);
+            }
+
             metrics.on_decoded(slots);
 
             if (ret != 0) {
@@ -3641,6 +4207,8 @@ struct server_context {
 
                 const int tok_idx = slot.i_batch - i;
 
+                const int64_t t_sample_start = ggml_time_us();
+
                 llama_token id = common_sampler_sample(slot.smpl, ctx, tok_idx);
 
                 slot.i_batch = -1;
@@ -3651,12 +4219,18 @@ struct server_context {
 
                 const int64_t t_current = ggml_time_us();
 
+                metrics.sampling.observe_us(t_current - t_sample_start);
+
                 if (slot.n_decoded == 1) {
                     slot.t_start_generation = t_current;
                     slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
                     metrics.on_prompt_eval(slot);
+                    metrics.ttft.observe_us(t_current - slot.t_queued);
+                } else {
+                    metrics.inter_token.observe_us(t_current - slot.t_last_token);
                 }
 
+                slot.t_last_token = t_current;
                 slot.t_token_generation = (t_current - slot.t_start_generation) / 1e3;
 
                 completion_token_output result;
@@ -3668,7 +4242,11 @@ struct server_context {
                     populate_token_probs(slot, result, slot.params.post_sampling_probs, params_base.special, tok_idx);
                 }
 
-                if (!process_token(result, slot)) {
+                const bool has_next = process_token(result, slot);
+
+                metrics.detokenize.observe_us(ggml_time_us() - t_current);
+
+                if (!has_next) {
                     // release slot because of stop condition
                     slot.release();
                     slot.print_timings();
@@ -3742,11 +4320,28 @@ struct server_context {
 
                 SLT_DBG(slot, "decoding speculative batch, size = %d\n", slot.batch_spec.n_tokens);
 
+                const int64_t t_decode_start = ggml_time_us();
+
                 llama_decode(ctx, slot.batch_spec);
 
+                const int64_t t_sample_start = ggml_time_us();
+
+                metrics.decode_batch.observe_us(t_sample_start - t_decode_start);
+
                 // the accepted tokens from the speculation
                 const auto ids = common_sampler_sample_and_accept_n(slot.smpl, ctx, draft);
 
+                const int64_t t_current = ggml_time_us();
+
+                metrics.sampling.observe_us(t_current - t_sample_start);
+
+                // the accepted tokens arrive together, the first one after the whole step
+                for (size_t i = 0; i < ids.size(); ++i) {
+                    metrics.inter_token.observe_us(i == 0 ? t_current - slot.t_last_token : 0);
+                }
+
+                slot.t_last_token = t_current;
+
                 slot.n_past    += ids.size();
                 slot.n_decoded += ids.size();
 
@@ -4111,6 +4706,10 @@ int main(int argc, char ** argv) {
                     {"name",  "n_busy_slots_per_decode"},
                     {"help",  "Average number of busy slots per llama_decode() call"},
                     {"value",  (float) res_metrics->n_busy_slots_total / std::max((float) res_metrics->n_decode_total, 1.f)}
+            }, {
+                    {"name",  "prompt_tokens_cached_total"},
+                    {"help",  "Number of prompt tokens reused from the slot caches."},
+                    {"value",  res_metrics->n_prompt_tokens_cached_total}
             }}},
             {"gauge", {{
                     {"name",  "prompt_tokens_seconds"},
@@ -4128,6 +4727,10 @@ int main(int argc, char ** argv) {
                     {"name",  "requests_deferred"},
                     {"help",  "Number of requests deferred."},
                     {"value",  (uint64_t) res_metrics->n_tasks_deferred}
+            },{
+                    {"name",  "prompt_cache_hit_ratio"},
+                    {"help",  "Fraction of the prompt tokens reused from the slot caches."},
+                    {"value",  res_metrics->n_prompt_tokens_total ? (double) res_metrics->n_prompt_tokens_cached_total / res_metrics->n_prompt_tokens_total : 0.}
             }}}
         };
 
@@ -4148,6 +4751,63 @@ int main(int argc, char ** argv) {
             }
         }
 
+        // per-slot gauges
+        {
+            const auto & slots_usage = res_metrics->slots_usage;
+
+            const auto add_slot_gauge = [&](const char * name, const char * help, const std::function<double(const server_task_result_metrics::slot_usage &)> & value) {
+                prometheus << "# HELP llamacpp:" << name << " " << help << "\n"
+                           << "# TYPE llamacpp:" << name << " gauge\n";
+                for (size_t i = 0; i < slots_usage.size(); ++i) {
+                    prometheus << "llamacpp:" << name << "{slot=\"" << i << "\"} " << value(slots_usage[i]) << "\n";
+                }
+            };
+
+            add_slot_gauge("slot_kv_tokens", "Number of tokens in the KV cache of the slot.",
+                    [](const auto & u) { return (double) u.n_past; });
+            add_slot_gauge("slot_kv_usage_ratio", "Fraction of the context of the slot in use.",
+                    [](const auto & u) { return u.n_ctx > 0 ? (double) u.n_past / u.n_ctx : 0.; });
+            add_slot_gauge("slot_prompt_cache_hit_ratio", "Fraction of the last prompt of the slot reused from its cache.",
+                    [](const auto & u) { return u.n_prompt_tokens > 0 ? (double) u.n_prompt_tokens_cached / u.n_prompt_tokens : 0.; });
+        }
+
+        // latency histograms, read directly from the shards without going through the task queue
+        {
+            const auto & metrics = ctx_server.metrics;
+
+            struct histogram_def {
+                const char * name;
+                const char * help;
+                const server_histogram & hist;
+            };
+
+            const histogram_def histograms[] = {
+                { "queue_wait_seconds",          "Time from receiving a request to starting it in a slot.",            metrics.queue_wait    },
+                { "time_to_first_token_seconds", "Time from receiving a request to its first generated token.",        metrics.ttft          },
+                { "inter_token_seconds",         "Time between consecutive generated tokens of a request.",            metrics.inter_token   },
+                { "tokenize_seconds",            "Time to tokenize the prompts of a request.",                         metrics.tokenize      },
+                { "prefill_batch_seconds",       "Duration of the llama_decode() calls with prompt tokens.",           metrics.prefill_batch },
+                { "decode_batch_seconds",        "Duration of the llama_decode() calls with generated tokens only.",   metrics.decode_batch  },
+                { "sampling_seconds",            "Time to sample a token.",                                            metrics.sampling      },
+                { "detokenize_seconds",          "Time to convert a token to text and queue the partial response.",    metrics.detokenize    },
+                { "serialize_seconds",           "Time to convert a result to JSON and send it.",                      metrics.serialize     },
+            };
+
+            for (const auto & def : histograms) {
+                double sum = 0.0;
+                const std::vector<uint64_t> counts = def.hist.collect(sum);
+
+                prometheus << "# HELP llamacpp:" << def.name << " " << def.help << "\n"
+                           << "# TYPE llamacpp:" << def.name << " histogram\n";
+                for (int i = 0; i < server_histogram::n_bounds; ++i) {
+                    prometheus << "llamacpp:" << def.name << "_bucket{le=\"" << server_histogram::bounds[i] << "\"} " << counts[i] << "\n";
+                }
+                prometheus << "llamacpp:" << def.name << "_bucket{le=\"+Inf\"} " << counts.back() << "\n"
+                           << "llamacpp:" << def.name << "_sum "   << sum           << "\n"
+                           << "llamacpp:" << def.name << "_count " << counts.back() << "\n";
+            }
+        }
+
         res.set_header("Process-Start-Time-Unix", std::to_string(res_metrics->t_start));
 
         res.set_content(prometheus.str(), "text/plain; version=0.0.4");
@@ -4360,6 +5020,8 @@ int main(int argc, char ** argv) {
             // process prompt
             std::vector<server_tokens> inputs;
 
+            const int64_t t_tokenize_start = ggml_time_us();
+
             if (oaicompat && ctx_server.mctx != nullptr) {
                 // This is the case used by OAI compatible chat path with MTMD. TODO It can be moved to the path below.
                 inputs.push_back(process_mtmd_prompt(ctx_server.mctx, prompt.get<std::string>(), files));
@@ -4368,6 +5030,8 @@ int main(int argc, char ** argv) {
                 inputs = tokenize_input_prompts(ctx_server.vocab, ctx_server.mctx, prompt, true, true);
             }
 
+            ctx_server.metrics.tokenize.observe_us(ggml_time_us() - t_tokenize_start);
+
             tasks.reserve(inputs.size());
             for (size_t i = 0; i < inputs.size(); i++) {
                 server_task task = server_task(type);
@@ -4402,6 +5066,8 @@ int main(int argc, char ** argv) {
 
         if (!stream) {
             ctx_server.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
+                const int64_t t_serialize_start = ggml_time_us();
+
                 if (results.size() == 1) {
                     // single result
                     res_ok(res, results[0]->to_json());
@@ -4413,6 +5079,8 @@ int main(int argc, char ** argv) {
                     }
                     res_ok(res, arr);
                 }
+
+                ctx_server.metrics.serialize.observe_us(ggml_time_us() - t_serialize_start);
             }, [&](const json & error_data) {
                 res_error(res, error_data);
             }, is_connection_closed);
@@ -4420,31 +5088,51 @@ int main(int argc, char ** argv) {
             ctx_server.queue_results.remove_waiting_task_ids(task_ids);
         } else {
             const auto chunked_content_provider = [task_ids, &ctx_server, oaicompat](size_t, httplib::DataSink & sink) {
+                // the events are serialized into this buffer and written to the sink together
+                std::string buf;
+
+                const auto flush = [&]() {
+                    if (buf.empty()) {
+                        return true;
+                    }
+
+                    LOG_DBG("data stream, to_send: %s", buf.c_str());
+
+                    const bool ok = sink.write(buf.data(), buf.size());
+                    buf.clear();
+                    return ok;
+                };
+
                 ctx_server.receive_cmpl_results_stream(task_ids, [&](server_task_result_ptr & result) -> bool {
-                    json res_json = result->to_json();
-                    if (res_json.is_array()) {
-                        for (const auto & res : res_json) {
-                            if (!server_sent_event(sink, "data", res)) {
-                                // sending failed (HTTP connection closed), cancel the generation
-                                return false;
+                    const int64_t t_serialize_start = ggml_time_us();
+
+                    if (!result->to_sse(buf)) {
+                        json res_json = result->to_json();
+                        if (res_json.is_array()) {
+                            for (const auto & res : res_json) {
+                                server_sent_event(buf, "data", res);
                             }
+                        } else {
+                            server_sent_event(buf, "data", res_json);
                         }
-                        return true;
-                    } else {
-                        return server_sent_event(sink, "data", res_json);
                     }
+
+                    ctx_server.metrics.serialize.observe_us(ggml_time_us() - t_serialize_start);
+
+                    return true;
                 }, [&](const json & error_data) {
-                    server_sent_event(sink, "error", error_data);
+                    server_sent_event(buf, "error", error_data);
                 }, [&sink]() {
                     // note: do not use req.is_connection_closed here because req is already destroyed
                     return !sink.is_writable();
-                });
+                }, flush);
                 if (oaicompat != OAICOMPAT_TYPE_NONE) {
-                    static const std::string ev_done = "data: [DONE]\n\n";
-                    sink.write(ev_done.data(), ev_done.size());
+                    buf += "data: [DONE]\n\n";
                 }
+                flush();
                 sink.done();
-                return false;
+                // the response is complete, the connection can be reused
+                return true;
             };
 
             auto on_complete = [task_ids, &ctx_server] (bool) {
@@ -4712,18 +5400,28 @@ int main(int argc, char ** argv) {
             return;
         }
 
-        bool use_base64 = false;
-        if (body.count("encoding_format") != 0) {
-            const std::string& format = body.at("encoding_format");
-            if (format == "base64") {
-                use_base64 = true;
-            } else if (format != "float") {
-                res_error(res, format_error_response("The format to return the embeddings in. Can be either float or base64", ERROR_TYPE_INVALID_REQUEST));
-                return;
-            }
+        const std::string encoding_format = json_value(body, "encoding_format", std::string("float"));
+
+        embd_encoding_type embd_encoding;
+        if (encoding_format == "float") {
+            embd_encoding = EMBD_ENCODING_TYPE_FLOAT;
+        } else if (encoding_format == "base64") {
+            embd_encoding = EMBD_ENCODING_TYPE_BASE64;
+        } else if (encoding_format == "int8") {
+            embd_encoding = EMBD_ENCODING_TYPE_INT8;
+        } else if (encoding_format == "binary") {
+            embd_encoding = EMBD_ENCODING_TYPE_BINARY;
+        } else {
+            res_error(res, format_error_response("The format to return the embeddings in. Can be one of float, base64, int8 or binary", ERROR_TYPE_INVALID_REQUEST));
+            return;
         }
 
+        const int64_t t_tokenize_start = ggml_time_us();
+
         auto tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, ctx_server.mctx, prompt, true, true);
+
+        ctx_server.metrics.tokenize.observe_us(ggml_time_us() - t_tokenize_start);
+
         for (const auto & tokens : tokenized_prompts) {
             // this check is necessary for models that do not add BOS token to the input
             if (tokens.empty()) {
@@ -4756,6 +5454,7 @@ int main(int argc, char ** argv) {
                 // OAI-compat
                 task.params.oaicompat = oaicompat;
                 task.params.embd_normalize = embd_normalize;
+                task.params.embd_encoding  = embd_encoding;
 
                 tasks.push_back(std::move(task));
             }
@@ -4784,7 +5483,7 @@ int main(int argc, char ** argv) {
 
         // write JSON response
         json root = oaicompat == OAICOMPAT_TYPE_EMBEDDING
-            ? format_embeddings_response_oaicompat(body, responses, use_base64)
+            ? format_embeddings_response_oaicompat(body, responses, encoding_format)
             : json(responses);
         res_ok(res, root);
     };
@@ -4797,6 +5496,133 @@ int main(int argc, char ** argv) {
         handle_embeddings_impl(req, res, OAICOMPAT_TYPE_EMBEDDING);
     };
 
+    // embed the prompts with L2 normalization, as expected by the vector index
+    // returns false if an error response was sent
+    const auto embed_for_index = [&ctx_server, &res_error](const httplib::Request & req, httplib::Response & res, const json & prompt, std::vector<std::vector<float>> & embds) {
+        auto tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, ctx_server.mctx, prompt, true, true);
+        for (const auto & tokens : tokenized_prompts) {
+            if (tokens.empty()) {
+                res_error(res, format_error_response("Input content cannot be empty", ERROR_TYPE_INVALID_REQUEST));
+                return false;
+            }
+        }
+
+        bool error = false;
+        std::unordered_set<int> task_ids;
+        {
+            std::vector<server_task> tasks;
+            for (size_t i = 0; i < tokenized_prompts.size(); i++) {
+                server_task task = server_task(SERVER_TASK_TYPE_EMBEDDING);
+
+                task.id            = ctx_server.queue_tasks.get_new_id();
+                task.index         = i;
+                task.prompt_tokens = std::move(tokenized_prompts[i]);
+
+                task.params.embd_normalize = 2;
+
+                tasks.push_back(std::move(task));
+            }
+
+            task_ids = server_task::get_list_id(tasks);
+            ctx_server.queue_results.add_waiting_tasks(tasks);
+            ctx_server.queue_tasks.post(std::move(tasks));
+        }
+
+        embds.clear();
+        embds.resize(task_ids.size());
+
+        ctx_server.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
+            for (auto & res : results) {
+                auto * res_embd = dynamic_cast<server_task_result_embd*>(res.get());
+                GGML_ASSERT(res_embd != nullptr && res_embd->embedding.size() == 1);
+                embds[res_embd->index] = std::move(res_embd->embedding[0]);
+            }
+        }, [&](const json & error_data) {
+            res_error(res, error_data);
+            error = true;
+        }, req.is_connection_closed);
+
+        ctx_server.queue_results.remove_waiting_task_ids(task_ids);
+
+        return !error;
+    };
+
+    const auto handle_index_add = [&ctx_server, &embed_for_index, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res) {
+        if (!ctx_server.vindex) {
+            res_error(res, format_error_response("This server does not support the vector index. Start it with `--embeddings` and a pooling type other than `none` or `rank`", ERROR_TYPE_NOT_SUPPORTED));
+            return;
+        }
+
+        const json body = json::parse(req.body);
+        if (!body.contains("input")) {
+            res_error(res, format_error_response("\"input\" must be provided", ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        std::vector<std::vector<float>> embds;
+        if (!embed_for_index(req, res, body.at("input"), embds)) {
+            return;
+        }
+
+        json ids = json::array();
+        {
+            std::unique_lock<std::shared_mutex> lock(ctx_server.vindex_mutex);
+
+            for (const auto & embd : embds) {
+                const int64_t id = ctx_server.vindex->add(embd.data());
+                if (id < 0) {
+                    res_error(res, format_error_response("The vector index was loaded from a file and is read-only", ERROR_TYPE_NOT_SUPPORTED));
+                    return;
+                }
+                ids.push_back(id);
+            }
+
+            ctx_server.vindex_dirty = true;
+        }
+
+        res_ok(res, json {{"ids", ids}});
+    };
+
+    const auto handle_index_search = [&ctx_server, &embed_for_index, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res) {
+        if (!ctx_server.vindex) {
+            res_error(res, format_error_response("This server does not support the vector index. Start it with `--embeddings` and a pooling type other than `none` or `rank`", ERROR_TYPE_NOT_SUPPORTED));
+            return;
+        }
+
+        const json body = json::parse(req.body);
+        if (!body.contains("input") || !body.at("input").is_string()) {
+            res_error(res, format_error_response("\"input\" must be a string", ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        const int32_t top_k = json_value(body, "top_k", 10);
+        if (top_k <= 0) {
+            res_error(res, format_error_response("\"top_k\" must be positive", ERROR_TYPE_INVALID_REQUEST));
+            return;
+        }
+
+        std::vector<std::vector<float>> embds;
+        if (!embed_for_index(req, res, body.at("input"), embds)) {
+            return;
+        }
+
+        std::vector<common_vector_index_result> results;
+        {
+            std::shared_lock<std::shared_mutex> lock(ctx_server.vindex_mutex);
+            results = ctx_server.vindex->search(embds[0].data(), top_k, ctx_server.params_base.cpuparams.n_threads);
+        }
+
+        json data = json::array();
+        for (const auto & r : results) {
+            data.push_back(json {
+                {"id",    r.id},
+                {"score", r.score},
+            });
+        }
+
+        res_ok(res, json {{"results", data}});
+    };
+
     const auto handle_rerank = [&ctx_server, &res_error, &res_ok](const httplib::Request & req, httplib::Response & res) {
         if (!ctx_server.params_base.embedding || ctx_server.params_base.pooling_type != LLAMA_POOLING_TYPE_RANK) {
             res_error(res, format_error_response("This server does not support reranking. Start it with `--reranking`", ERROR_TYPE_NOT_SUPPORTED));
@@ -4984,6 +5810,8 @@ int main(int argc, char ** argv) {
     svr->Post(params.api_prefix + "/embedding",           handle_embeddings); // legacy
     svr->Post(params.api_prefix + "/embeddings",          handle_embeddings);
     svr->Post(params.api_prefix + "/v1/embeddings",       handle_embeddings_oai);
+    svr->Post(params.api_prefix + "/index/add",           handle_index_add);
+    svr->Post(params.api_prefix + "/index/search",        handle_index_search);
     svr->Post(params.api_prefix + "/rerank",              handle_rerank);
     svr->Post(params.api_prefix + "/reranking",           handle_rerank);
     svr->Post(params.api_prefix + "/v1/rerank",           handle_rerank);
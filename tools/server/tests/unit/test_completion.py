@@ -165,6 +165,39 @@ def test_consistent_result_same_seed(n_slots: int):
         last_res = res
 
 
+def test_kv_unified_shared_prefix_same_result():
+    # a prompt whose prefix is cached by another slot must complete the same with --kv-unified
+    global server
+    prompts = [
+        "I believe the meaning of life is to be happy",
+        "I believe the meaning of life is to find a friend",
+    ]
+
+    def run():
+        contents = []
+        for i, prompt in enumerate(prompts):
+            res = server.make_request("POST", "/completion", data={
+                "prompt": prompt,
+                "id_slot": i,
+                "n_predict": 16,
+                "temperature": 0.0,
+            })
+            assert res.status_code == 200
+            contents.append(res.body["content"])
+        return contents
+
+    server.n_slots = 2
+    server.start()
+    ref = run()
+    server.stop()
+
+    server = ServerPreset.tinyllama2()
+    server.n_slots = 2
+    server.kv_unified = True
+    server.start()
+    assert run() == ref
+
+
 @pytest.mark.parametrize("n_slots", [1, 2])
 def test_different_result_different_seed(n_slots: int):
     global server
@@ -255,3 +255,83 @@ def test_embedding_openai_library_base64():
     # make sure the decoded data is the same as the original
     for x, y in zip(floats, vec0):
         assert abs(x - y) < EPSILON
+
+
+@pytest.mark.parametrize("encoding_format", ["int8", "binary"])
+def test_embedding_quantized_encoding(encoding_format: str):
+    global server
+    server.start()
+    test_input = "Test quantized embedding output"
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input,
+    })
+    assert res.status_code == 200
+    vec0 = res.body["data"][0]["embedding"]
+
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": test_input,
+        "encoding_format": encoding_format,
+    })
+    assert res.status_code == 200
+    embedding_data = res.body["data"][0]
+    assert embedding_data["encoding_format"] == encoding_format
+    vec = embedding_data["embedding"]
+
+    if encoding_format == "int8":
+        assert len(vec) == len(vec0)
+        assert all(-127 <= x <= 127 for x in vec)
+        assert max(abs(x) for x in vec) == 127
+        amax = max(abs(x) for x in vec0)
+        for x, y in zip(vec, vec0):
+            assert abs(x - round(y * 127 / amax)) <= 1
+    else:
+        assert len(vec) == (len(vec0) + 7) // 8
+        for i, y in enumerate(vec0):
+            bit = (vec[i // 8] >> (7 - i % 8)) & 1
+            assert bit == (1 if y > 0 else 0)
+
+
+def test_embedding_invalid_encoding():
+    global server
+    server.start()
+    res = server.make_request("POST", "/v1/embeddings", data={
+        "input": "I believe the meaning of life is",
+        "encoding_format": "float16",
+    })
+    assert res.status_code == 400
+
+
+def test_embedding_kv_unified_shared_prefix():
+    # with a causal model and --kv-unified, inputs with a common prefix share its KV cells
+    # the embeddings must match the ones computed separately
+    global server
+    prefix = "The quick brown fox jumps over the lazy dog. " * 4
+    inputs = [prefix + suffix for suffix in ["Once upon a time", "there was a cat", "and a little girl", "who liked to play"]]
+
+    server = ServerPreset.tinyllama2()
+    server.server_embeddings = True
+    server.pooling = 'last'
+    server.n_slots = 1
+    server.start()
+    ref = []
+    for inp in inputs:
+        res = server.make_request("POST", "/v1/embeddings", data={"input": inp})
+        assert res.status_code == 200
+        ref.append(res.body['data'][0]['embedding'])
+    server.stop()
+
+    server = ServerPreset.tinyllama2()
+    server.server_embeddings = True
+    server.pooling = 'last'
+    server.n_slots = 4
+    server.kv_unified = True
+    server.start()
+    res = server.make_request("POST", "/v1/embeddings", data={"input": inputs})
+    assert res.status_code == 200
+    assert len(res.body['data']) == len(inputs)
+    for d in res.body['data']:
+        emb = d['embedding']
+        assert len(emb) == len(ref[d['index']])
+        for a, b in zip(emb, ref[d['index']]):
+            assert abs(a - b) < EPSILON
@@ -102,3 +102,31 @@ def test_rerank_usage(query, doc1, doc2, n_tokens):
     assert res.status_code == 200
     assert res.body['usage']['prompt_tokens'] == res.body['usage']['total_tokens']
     assert res.body['usage']['prompt_tokens'] == n_tokens
+
+
+def test_rerank_kv_unified_same_scores():
+    # with --kv-unified the slots may share the KV cells of the query prefix, the scores must not change
+    global server
+    server.n_slots = 4
+    server.start()
+    res = server.make_request("POST", "/rerank", data={
+        "query": "Machine learning is",
+        "documents": TEST_DOCUMENTS,
+    })
+    assert res.status_code == 200
+    ref = {doc["index"]: doc["relevance_score"] for doc in res.body["results"]}
+    server.stop()
+
+    server = ServerPreset.jina_reranker_tiny()
+    server.n_slots = 4
+    server.kv_unified = True
+    server.start()
+    for _ in range(2):
+        res = server.make_request("POST", "/rerank", data={
+            "query": "Machine learning is",
+            "documents": TEST_DOCUMENTS,
+        })
+        assert res.status_code == 200
+        assert len(res.body["results"]) == len(TEST_DOCUMENTS)
+        for doc in res.body["results"]:
+            assert abs(doc["relevance_score"] - ref[doc["index"]]) < 1e-3
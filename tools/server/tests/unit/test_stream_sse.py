@@ -0,0 +1,73 @@
+import pytest
+import json
+from utils import *
+
+server = ServerPreset.tinyllama2()
+
+# the partial results of a stream are written from pre-serialized templates instead of to_json(), the events must stay
+# byte for byte identical to the compact dump of their JSON, which is what the JSON path writes
+
+# quotes, backslashes and control characters, produced one byte token at a time
+GRAMMAR_ESCAPES = r'root ::= "He said \"hi\",\tthen \x01\x1f\\ \"bye\"\n"'
+CONTENT_ESCAPES = 'He said "hi",\tthen \x01\x1f\\ "bye"\n'
+
+# byte token <0x80> is a lone continuation byte, so the content is invalid UTF-8 and is replaced with U+FFFD
+# note: the first 3 tokens of the vocab are <unk>, <s> and </s>, followed by the 256 byte tokens
+LOGIT_BIAS_INVALID_UTF8 = [[3 + 0x80, 100]]
+
+
+@pytest.fixture(autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.tinyllama2()
+    server.stream_flush_ms = 0
+
+
+def check_event(raw: bytes) -> dict:
+    data = json.loads(raw.decode("utf-8"))
+    assert raw.decode("utf-8") == json.dumps(data, ensure_ascii=False, separators=(",", ":"))
+    return data
+
+
+def get_stream_content(path: str, body: dict) -> str:
+    content = ""
+    n_events = 0
+    for raw in server.make_raw_stream_request("POST", path, data={**body, "stream": True}):
+        if b'"timings"' in raw:
+            # the last event goes through to_json() and holds floats, whose formatting is not compared
+            data = json.loads(raw.decode("utf-8"))
+        else:
+            data = check_event(raw)
+            n_events += 1
+        if path == "/completion":
+            content += data["content"]
+        elif path == "/v1/completions":
+            content += data["choices"][0]["text"] if data["choices"] else ""
+        else:
+            content += (data["choices"][0]["delta"].get("content") or "") if data["choices"] else ""
+    assert n_events > 1
+    return content
+
+
+@pytest.mark.parametrize("path", ["/completion", "/v1/completions", "/v1/chat/completions"])
+@pytest.mark.parametrize("body,expected_content", [
+    ({"grammar": GRAMMAR_ESCAPES}, CONTENT_ESCAPES),
+    ({"logit_bias": LOGIT_BIAS_INVALID_UTF8, "n_predict": 8}, "�" * 8),
+])
+def test_stream_events_match_json(path: str, body: dict, expected_content: str):
+    global server
+    server.start()
+    if path == "/v1/chat/completions":
+        body = {**body, "messages": [{"role": "user", "content": "Say something"}]}
+    else:
+        body = {**body, "prompt": "Say something"}
+    res = server.make_request("POST", path, data={**body, "stream": False})
+    assert res.status_code == 200
+    if path == "/completion":
+        content = res.body["content"]
+    elif path == "/v1/completions":
+        content = res.body["choices"][0]["text"]
+    else:
+        content = res.body["choices"][0]["message"]["content"]
+    assert content == expected_content
+    assert get_stream_content(path, body) == content
@@ -0,0 +1,112 @@
+import pytest
+from utils import *
+
+server = ServerPreset.bert_bge_small()
+
+
+@pytest.fixture(autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.bert_bge_small()
+
+
+TEST_DOCUMENTS = [
+    "A machine is a physical system that uses power to apply forces and control movement to perform an action.",
+    "Learning is the process of acquiring new understanding, knowledge, behaviors, skills, values, attitudes, and preferences.",
+    "Machine learning is a field of study in artificial intelligence concerned with statistical algorithms that learn from data.",
+    "Paris, capitale de la France, est une grande ville européenne et un centre mondial de l'art.",
+]
+
+
+@pytest.mark.parametrize("index_type,min_score", [
+    ("f32",    0.99),
+    ("i8",     0.97),
+    ("binary", 0.90),
+])
+def test_index_add_search(index_type: str, min_score: float):
+    global server
+    server.pooling = "mean"
+    server.index_type = index_type
+    server.start()
+
+    res = server.make_request("POST", "/index/add", data={
+        "input": TEST_DOCUMENTS[:2],
+    })
+    assert res.status_code == 200
+    assert res.body["ids"] == [0, 1]
+
+    res = server.make_request("POST", "/index/add", data={
+        "input": TEST_DOCUMENTS[2:],
+    })
+    assert res.status_code == 200
+    assert res.body["ids"] == [2, 3]
+
+    # a document is its own nearest neighbour
+    for i, doc in enumerate(TEST_DOCUMENTS):
+        res = server.make_request("POST", "/index/search", data={
+            "input": doc,
+            "top_k": 2,
+        })
+        assert res.status_code == 200
+        assert len(res.body["results"]) == 2
+        assert res.body["results"][0]["id"] == i
+        assert res.body["results"][0]["score"] > min_score
+        assert res.body["results"][0]["score"] >= res.body["results"][1]["score"]
+
+
+def test_index_search_top_k():
+    global server
+    server.pooling = "mean"
+    server.start()
+
+    res = server.make_request("POST", "/index/add", data={
+        "input": TEST_DOCUMENTS,
+    })
+    assert res.status_code == 200
+
+    res = server.make_request("POST", "/index/search", data={
+        "input": "What is machine learning?",
+        "top_k": 10,
+    })
+    assert res.status_code == 200
+    # top_k is clamped to the size of the index
+    assert len(res.body["results"]) == len(TEST_DOCUMENTS)
+    assert res.body["results"][0]["id"] == 2
+    scores = [r["score"] for r in res.body["results"]]
+    assert scores == sorted(scores, reverse=True)
+
+
+def test_index_search_empty():
+    global server
+    server.pooling = "mean"
+    server.start()
+    res = server.make_request("POST", "/index/search", data={
+        "input": "What is machine learning?",
+    })
+    assert res.status_code == 200
+    assert res.body["results"] == []
+
+
+@pytest.mark.parametrize("data", [
+    {},
+    {"input": ["a", "b"]},
+    {"input": "a", "top_k": 0},
+])
+def test_index_search_invalid(data):
+    global server
+    server.pooling = "mean"
+    server.start()
+    res = server.make_request("POST", "/index/search", data=data)
+    assert res.status_code != 200
+    assert "error" in res.body
+
+
+def test_index_not_supported():
+    global server
+    server.pooling = "none"
+    server.start()
+    res = server.make_request("POST", "/index/add", data={
+        "input": TEST_DOCUMENTS,
+    })
+    assert res.status_code != 200
+    assert "error" in res.body
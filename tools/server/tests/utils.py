@@ -70,12 +70,16 @@ class ServerProcess:
     ctk: str | None = None
     ctv: str | None = None
     fa: bool | None = None
+    kv_unified: bool | None = None
+    stream_flush_ms: int | None = None
     server_continuous_batching: bool | None = False
     server_embeddings: bool | None = False
     server_reranking: bool | None = False
     server_metrics: bool | None = False
     server_slots: bool | None = False
     pooling: str | None = None
+    index_type: str | None = None
+    index_file: str | None = None
     draft: int | None = None
     api_key: str | None = None
     lora_files: List[str] | None = None
@@ -153,6 +157,10 @@ class ServerProcess:
             server_args.append("--slots")
         if self.pooling:
             server_args.extend(["--pooling", self.pooling])
+        if self.index_type:
+            server_args.extend(["--index-type", self.index_type])
+        if self.index_file:
+            server_args.extend(["--index-file", self.index_file])
         if self.model_alias:
             server_args.extend(["--alias", self.model_alias])
         if self.n_ctx:
@@ -165,8 +173,12 @@ class ServerProcess:
             server_args.extend(["-ctv", self.ctv])
         if self.fa is not None:
             server_args.append("-fa")
+        if self.kv_unified:
+            server_args.append("--kv-unified")
         if self.n_predict:
             server_args.extend(["--n-predict", self.n_predict])
+        if self.stream_flush_ms is not None:
+            server_args.extend(["--stream-flush-ms", self.stream_flush_ms])
         if self.slot_save_path:
             server_args.extend(["--slot-save-path", self.slot_save_path])
         if self.n_ga:
@@ -297,6 +309,24 @@ class ServerProcess:
                 print("Partial response from server", json.dumps(data, indent=2))
                 yield data
 
+    def make_raw_stream_request(
+        self,
+        method: str,
+        path: str,
+        data: dict | None = None,
+        headers: dict | None = None,
+    ) -> Iterator[bytes]:
+        url = f"http://{self.server_host}:{self.server_port}{path}"
+        if method == "POST":
+            response = requests.post(url, headers=headers, json=data, stream=True)
+        else:
+            raise ValueError(f"Unimplemented method: {method}")
+        for line_bytes in response.iter_lines():
+            if b'[DONE]' in line_bytes:
+                break
+            elif line_bytes.startswith(b'data: '):
+                yield line_bytes[6:]
+
     def make_any_request(
         self,
         method: str,
@@ -336,6 +336,40 @@ static llama_tokens format_infill(
     return embd_inp;
 }
 
+//
+// embedding encoding utils
+//
+
+// scale the vector so that its largest magnitude maps to 127
+// cosine similarities are preserved, absolute dot products are not
+static std::vector<int8_t> embd_quantize_i8(const std::vector<float> & embd) {
+    float amax = 0.0f;
+    for (const float v : embd) {
+        amax = std::max(amax, std::fabs(v));
+    }
+
+    const float id = amax > 0.0f ? 127.0f/amax : 0.0f;
+
+    std::vector<int8_t> res(embd.size());
+    for (size_t i = 0; i < embd.size(); ++i) {
+        res[i] = (int8_t) std::lround(embd[i]*id);
+    }
+
+    return res;
+}
+
+// one bit per dimension (set when positive), most significant bit first - same layout as numpy.packbits
+static std::vector<uint8_t> embd_quantize_binary(const std::vector<float> & embd) {
+    std::vector<uint8_t> res((embd.size() + 7)/8, 0);
+    for (size_t i = 0; i < embd.size(); ++i) {
+        if (embd[i] > 0.0f) {
+            res[i/8] |= 0x80 >> (i%8);
+        }
+    }
+
+    return res;
+}
+
 //
 // base64 utils (TODO: move to common in the future)
 //
@@ -459,15 +493,100 @@ static std::string tokens_to_output_formatted_string(const llama_context * ctx,
     return out;
 }
 
-static bool server_sent_event(httplib::DataSink & sink, const char * event, const json & data) {
-    const std::string str =
-        std::string(event) + ": " +
-        data.dump(-1, ' ', false, json::error_handler_t::replace) +
-        "\n\n"; // required by RFC 8895 - A message is terminated by a blank line (two line terminators in a row).
+// appends the event to a buffer that is written to the sink once the pending events are serialized
+static void server_sent_event(std::string & buf, const char * event, const json & data) {
+    buf += event;
+    buf += ": ";
+    buf += data.dump(-1, ' ', false, json::error_handler_t::replace);
+    buf += "\n\n"; // required by RFC 8895 - A message is terminated by a blank line (two line terminators in a row).
+}
+
+// appends str escaped as the content of a JSON string, with the same output as json::dump()
+// returns false if str is not valid UTF-8, the caller must then discard the output and use json::dump(), which
+// replaces the invalid bytes
+static bool json_escape_append(std::string & out, const std::string & str) {
+    static const char hex[] = "0123456789abcdef";
+
+    const size_t n = str.size();
+
+    size_t i = 0;
+    while (i < n) {
+        // copy the runs of characters that do not need escaping at once
+        size_t j = i;
+        while (j < n) {
+            const unsigned char c = str[j];
+            if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\') {
+                break;
+            }
+            j++;
+        }
+        out.append(str, i, j - i);
+        i = j;
 
-    LOG_DBG("data stream, to_send: %s", str.c_str());
+        if (i == n) {
+            break;
+        }
 
-    return sink.write(str.c_str(), str.size());
+        const unsigned char c = str[i];
+
+        if (c < 0x80) {
+            switch (c) {
+                case '"':  out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\b': out += "\\b";  break;
+                case '\f': out += "\\f";  break;
+                case '\n': out += "\\n";  break;
+                case '\r': out += "\\r";  break;
+                case '\t': out += "\\t";  break;
+                default:
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 0xf];
+                    break;
+            }
+            i++;
+            continue;
+        }
+
+        // multi-byte sequences are copied as they are once validated
+        size_t   len;
+        uint32_t cp;
+        if ((c & 0xe0) == 0xc0) {
+            len = 2;
+            cp  = c & 0x1f;
+        } else if ((c & 0xf0) == 0xe0) {
+            len = 3;
+            cp  = c & 0x0f;
+        } else if ((c & 0xf8) == 0xf0) {
+            len = 4;
+            cp  = c & 0x07;
+        } else {
+            return false;
+        }
+
+        if (i + len > n) {
+            return false;
+        }
+
+        for (size_t k = 1; k < len; ++k) {
+            const unsigned char cc = str[i + k];
+            if ((cc & 0xc0) != 0x80) {
+                return false;
+            }
+            cp = (cp << 6) | (cc & 0x3f);
+        }
+
+        // reject overlong encodings, surrogates and code points above U+10FFFF
+        static const uint32_t cp_min[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (cp < cp_min[len] || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+            return false;
+        }
+
+        out.append(str, i, len);
+        i += len;
+    }
+
+    return true;
 }
 
 //
@@ -793,31 +912,21 @@ static json oaicompat_chat_params_parse(
     return llama_params;
 }
 
-static json format_embeddings_response_oaicompat(const json & request, const json & embeddings, bool use_base64 = false) {
+static json format_embeddings_response_oaicompat(const json & request, const json & embeddings, const std::string & encoding_format = "float") {
     json data = json::array();
     int32_t n_tokens = 0;
     int i = 0;
     for (const auto & elem : embeddings) {
-        json embedding_obj;
-
-        if (use_base64) {
-            const auto& vec = json_value(elem, "embedding", json::array()).get<std::vector<float>>();
-            const char* data_ptr = reinterpret_cast<const char*>(vec.data());
-            size_t data_size = vec.size() * sizeof(float);
-            embedding_obj = {
-                {"embedding", base64::encode(data_ptr, data_size)},
-                {"index", i++},
-                {"object", "embedding"},
-                {"encoding_format", "base64"}
-            };
-        } else {
-            embedding_obj = {
-                {"embedding", json_value(elem, "embedding", json::array())},
-                {"index", i++},
-                {"object", "embedding"}
-            };
+        // the embeddings are already encoded in the requested format
+        json embedding_obj = {
+            {"embedding", json_value(elem, "embedding", json::array())},
+            {"index", i++},
+            {"object", "embedding"}
+        };
+        if (encoding_format != "float") {
+            embedding_obj["encoding_format"] = encoding_format;
         }
-        data.push_back(embedding_obj);
+        data.push_back(std::move(embedding_obj));
 
         n_tokens += json_value(elem, "tokens_evaluated", 0);
     }